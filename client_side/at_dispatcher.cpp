@@ -0,0 +1,150 @@
+// AT line dispatcher for the NB-IoT example application
+
+#include "stdint.h"
+#include "stddef.h"
+#include "string.h"
+#include "at_dispatcher.h"
+
+// ----------------------------------------------------------------
+// CLASSES/METHODS
+// ----------------------------------------------------------------
+
+// Constructor.
+AtDispatcher::AtDispatcher()
+{
+    memset (gNodes, 0, sizeof (gNodes));
+    gNodes[0].handler = -1;
+    gNumNodes = 1;
+    gNumHandlers = 0;
+    gDefault.handler = NULL;
+    gDefault.pContext = NULL;
+    gCommandOpen = false;
+    gpResponsePrefix = NULL;
+}
+
+// Find a child node.
+uint32_t AtDispatcher::findChild(uint32_t parent, char c)
+{
+    uint32_t child = gNodes[parent].firstChild;
+
+    while ((child != 0) && (gNodes[child].character != c))
+    {
+        child = gNodes[child].nextSibling;
+    }
+
+    return child;
+}
+
+// Check for an exact match.
+bool AtDispatcher::isExactly(const char * pLine, uint32_t len, const char * pString)
+{
+    return (len == strlen (pString)) && (memcmp (pLine, pString, len) == 0);
+}
+
+// Register a URC handler.
+bool AtDispatcher::addUrcHandler(const char * pPrefix, AtLineHandler handler, void * pContext)
+{
+    bool success = false;
+    uint32_t node = 0;
+    uint32_t child;
+    uint32_t len = strlen (pPrefix);
+
+    // Check there is room for the worst case of every character
+    // needing a new node
+    if ((gNumHandlers < AT_DISPATCHER_MAX_HANDLERS) && (gNumNodes + len <= AT_DISPATCHER_MAX_NODES) && (len > 0))
+    {
+        for (uint32_t x = 0; x < len; x++)
+        {
+            child = findChild (node, pPrefix[x]);
+            if (child == 0)
+            {
+                child = gNumNodes;
+                gNumNodes++;
+                gNodes[child].character = pPrefix[x];
+                gNodes[child].firstChild = 0;
+                gNodes[child].nextSibling = gNodes[node].firstChild;
+                gNodes[child].handler = -1;
+                gNodes[node].firstChild = (uint8_t) child;
+            }
+            node = child;
+        }
+
+        gHandlers[gNumHandlers].handler = handler;
+        gHandlers[gNumHandlers].pContext = pContext;
+        gNodes[node].handler = (int8_t) gNumHandlers;
+        gNumHandlers++;
+        success = true;
+    }
+
+    return success;
+}
+
+// Set the default handler.
+void AtDispatcher::setDefaultHandler(AtLineHandler handler, void * pContext)
+{
+    gDefault.handler = handler;
+    gDefault.pContext = pContext;
+}
+
+// Mark a command as outstanding.
+void AtDispatcher::openCommand(const char * pResponsePrefix)
+{
+    gpResponsePrefix = pResponsePrefix;
+    gCommandOpen = true;
+}
+
+// Mark the outstanding command as complete.
+void AtDispatcher::closeCommand()
+{
+    gCommandOpen = false;
+    gpResponsePrefix = NULL;
+}
+
+// Route a line.
+AtDispatcher::Destination AtDispatcher::dispatch(const char * pLine, uint32_t len)
+{
+    Destination destination = DISPATCH_DEFAULT;
+    // Read in the opposite order to which openCommand() writes
+    bool commandOpen = gCommandOpen;
+    const char * pPrefix = gpResponsePrefix;
+    uint32_t node = 0;
+    int32_t handler = -1;
+
+    if (commandOpen &&
+        (isExactly (pLine, len, AT_OK) || isExactly (pLine, len, AT_ERROR) ||
+         ((pPrefix != NULL) && (len >= strlen (pPrefix)) && (memcmp (pLine, pPrefix, strlen (pPrefix)) == 0))))
+    {
+        destination = DISPATCH_COMMAND;
+    }
+    else
+    {
+        // Walk the trie as far as the line allows, remembering the
+        // deepest node that has a handler
+        for (uint32_t x = 0; x < len; x++)
+        {
+            node = findChild (node, pLine[x]);
+            if (node == 0)
+            {
+                break;
+            }
+            if (gNodes[node].handler >= 0)
+            {
+                handler = gNodes[node].handler;
+            }
+        }
+
+        if (handler >= 0)
+        {
+            destination = DISPATCH_URC;
+            gHandlers[handler].handler(gHandlers[handler].pContext, pLine, len);
+        }
+        else if (gDefault.handler != NULL)
+        {
+            gDefault.handler(gDefault.pContext, pLine, len);
+        }
+    }
+
+    return destination;
+}
+
+// End Of File
@@ -0,0 +1,132 @@
+// AT line dispatcher for the NB-IoT example application
+
+#ifndef _AT_DISPATCHER_H_
+#define _AT_DISPATCHER_H_
+
+#include <atomic>
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// At the end of all AT strings there is a...
+#define AT_TERMINATOR "\r\n"
+
+// OK
+#define AT_OK "OK\r\n"
+
+// ERROR
+#define AT_ERROR "ERROR\r\n"
+
+// The maximum number of unsolicited result code handlers
+#define AT_DISPATCHER_MAX_HANDLERS 8
+
+// The maximum number of nodes in the prefix trie, one per distinct
+// character position across all the registered prefixes
+#define AT_DISPATCHER_MAX_NODES 64
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// A handler for lines from the modem, called with the pContext given
+// when it was registered and the line, len characters long including
+// the AT terminator.  The line is not NULL terminated.
+typedef void (*AtLineHandler) (void * pContext, const char * pLine, uint32_t len);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// Routes each line received from the modem to one place: the AT command
+// currently outstanding, if the line is a response to it, else the handler
+// registered for the longest matching unsolicited result code (URC) prefix,
+// else the default handler.  No line is dropped on the floor.
+class AtDispatcher
+{
+public:
+    // Where dispatch() sent a line.
+    typedef enum
+    {
+        DISPATCH_COMMAND,
+        DISPATCH_URC,
+        DISPATCH_DEFAULT
+    } Destination;
+
+    AtDispatcher ();
+
+    // Register handler to be called, with pContext, for lines beginning
+    // with pPrefix (which must be a NULL terminated string that remains
+    // valid).  Where prefixes overlap the longest match wins.  Handlers
+    // must all be registered before dispatch() is first called.  Returns
+    // true on success, false if there is no more room.
+    bool addUrcHandler (const char * pPrefix, AtLineHandler handler, void * pContext);
+
+    // Set the handler for lines that are neither a response to the
+    // outstanding command nor a known URC.
+    void setDefaultHandler (AtLineHandler handler, void * pContext);
+
+    // Mark a command as outstanding; from now on "OK", "ERROR" and lines
+    // beginning with pResponsePrefix (which may be NULL) are responses to
+    // it.  pResponsePrefix must remain valid until closeCommand().  This
+    // must be called before the command is written to the modem.
+    void openCommand (const char * pResponsePrefix);
+
+    // Mark the outstanding command as complete.
+    void closeCommand ();
+
+    // Route the line at pLine, len characters long including the AT
+    // terminator.  URC and default handlers are called from here;
+    // for a response to the outstanding command nothing is called and
+    // it is up to the caller to pass the line on.
+    Destination dispatch (const char * pLine, uint32_t len);
+
+protected:
+    // A node of the prefix trie; node 0 is the root and, as it can
+    // never be anyone's child or sibling, 0 also means "none".
+    typedef struct
+    {
+        char character;
+        uint8_t firstChild;
+        uint8_t nextSibling;
+        int8_t handler;
+    } TrieNode;
+
+    // A registered handler.
+    typedef struct
+    {
+        AtLineHandler handler;
+        void * pContext;
+    } HandlerEntry;
+
+    // The prefix trie.
+    TrieNode gNodes[AT_DISPATCHER_MAX_NODES];
+
+    // The number of nodes used in gNodes.
+    uint32_t gNumNodes;
+
+    // The URC handlers, indexed from TrieNode.handler.
+    HandlerEntry gHandlers[AT_DISPATCHER_MAX_HANDLERS];
+
+    // The number of entries used in gHandlers.
+    uint32_t gNumHandlers;
+
+    // The default handler.
+    HandlerEntry gDefault;
+
+    // True while a command is outstanding.
+    std::atomic<bool> gCommandOpen;
+
+    // Response prefix of the outstanding command, NULL if none.
+    std::atomic<const char *> gpResponsePrefix;
+
+    // Find the child of node parent holding character c, 0 if none.
+    uint32_t findChild (uint32_t parent, char c);
+
+    // Return true if the line at pLine, length len, is exactly pString.
+    static bool isExactly (const char * pLine, uint32_t len, const char * pString);
+};
+
+#endif
+
+// End Of File
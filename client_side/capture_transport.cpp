@@ -0,0 +1,244 @@
+// Wire capture transport for NB-IoT example application
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "utilities.h"
+#include "transport.h"
+#include "capture_transport.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The most bytes an unsigned LEB128 of 64 bits takes
+#define LEB128_MAX_SIZE 10
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Write value to pBuf as unsigned LEB128, returning the number of
+// bytes written.
+static uint32_t putLeb128(char * pBuf, uint64_t value)
+{
+    uint32_t len = 0;
+
+    while (value >= 0x80)
+    {
+        pBuf[len] = (char) ((value & 0x7F) | 0x80);
+        value >>= 7;
+        len++;
+    }
+    pBuf[len] = (char) value;
+
+    return len + 1;
+}
+
+// Read an unsigned LEB128 at *pOffset in the len bytes at pBuf into
+// pValue, moving *pOffset on.  Returns false if it runs off the end or
+// is too long.
+static bool getLeb128(const char * pBuf, uint32_t len, uint32_t * pOffset, uint64_t * pValue)
+{
+    uint64_t value = 0;
+    uint32_t shift = 0;
+    bool done = false;
+    bool success = true;
+
+    while (!done && success)
+    {
+        if ((*pOffset < len) && (shift < LEB128_MAX_SIZE * 7))
+        {
+            value |= (uint64_t) ((uint8_t) pBuf[*pOffset] & 0x7F) << shift;
+            done = (((uint8_t) pBuf[*pOffset] & 0x80) == 0);
+            shift += 7;
+            (*pOffset)++;
+        }
+        else
+        {
+            success = false;
+        }
+    }
+    *pValue = value;
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// PROTECTED FUNCTIONS
+// ----------------------------------------------------------------
+
+// Write a record to the capture file.
+void CaptureTransport::record(CaptureDirection direction, const TxSegment * pSegments, uint32_t numSegments)
+{
+    char header[LEB128_MAX_SIZE * 2];
+    uint32_t lenHeader;
+    uint64_t len = 0;
+    int64_t timeUs;
+
+    for (uint32_t x = 0; x < numSegments; x++)
+    {
+        len += pSegments[x].len;
+    }
+
+    std::lock_guard<std::mutex> lock(gMutex);
+
+    if (gpFile != NULL)
+    {
+        // Taken with the lock held so that times only go forwards
+        timeUs = getTimeUs();
+        lenHeader = putLeb128(header, (uint64_t) (timeUs - gLastUs));
+        lenHeader += putLeb128(header + lenHeader, (len << 1) | direction);
+        gLastUs = timeUs;
+        if (fwrite(header, 1, lenHeader, gpFile) != lenHeader)
+        {
+            gFailed = true;
+        }
+        for (uint32_t x = 0; x < numSegments; x++)
+        {
+            if (fwrite(pSegments[x].pBuf, 1, pSegments[x].len, gpFile) != pSegments[x].len)
+            {
+                gFailed = true;
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor.
+CaptureTransport::CaptureTransport(Transport * pTransport)
+{
+    gpTransport = pTransport;
+    gpFile = NULL;
+    gpFileBuf = NULL;
+    gLastUs = 0;
+    gFailed = false;
+}
+
+// Destructor.
+CaptureTransport::~CaptureTransport()
+{
+    close();
+}
+
+// Start capturing.
+bool CaptureTransport::open(const char * pFileName)
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(gMutex);
+
+    gpFile = fopen(pFileName, "wb");
+    if (gpFile != NULL)
+    {
+        gpFileBuf = new char[CAPTURE_FILE_BUFFER_SIZE];
+        setvbuf(gpFile, gpFileBuf, _IOFBF, CAPTURE_FILE_BUFFER_SIZE);
+        gFailed = (fwrite(CAPTURE_FILE_MAGIC, 1, strlen(CAPTURE_FILE_MAGIC), gpFile) != strlen(CAPTURE_FILE_MAGIC));
+        gLastUs = getTimeUs();
+    }
+
+    return (gpFile != NULL) && !gFailed;
+}
+
+// Stop capturing.
+bool CaptureTransport::close()
+{
+    bool success = true;
+
+    std::lock_guard<std::mutex> lock(gMutex);
+
+    if (gpFile != NULL)
+    {
+        success = (fclose(gpFile) == 0) && !gFailed;
+        gpFile = NULL;
+        delete[] gpFileBuf;
+        gpFileBuf = NULL;
+    }
+
+    return success;
+}
+
+// Transmit, capturing what was sent.
+bool CaptureTransport::transmitVector(const TxSegment * pSegments, uint32_t numSegments)
+{
+    // Recorded first: the answer may be read, by another thread, before
+    // the write returns, and must not appear in the capture before it
+    record(CAPTURE_DIRECTION_TX, pSegments, numSegments);
+
+    return gpTransport->transmitVector(pSegments, numSegments);
+}
+
+// Receive, capturing what arrived.
+uint32_t CaptureTransport::receiveBuffer(char * pBuf, uint32_t lenBuf)
+{
+    uint32_t len = gpTransport->receiveBuffer(pBuf, lenBuf);
+    TxSegment segment = {pBuf, len};
+
+    if (len > 0)
+    {
+        record(CAPTURE_DIRECTION_RX, &segment, 1);
+    }
+
+    return len;
+}
+
+// Wait for characters to arrive.
+bool CaptureTransport::waitReadable(uint32_t timeoutMs)
+{
+    return gpTransport->waitReadable(timeoutMs);
+}
+
+// Whether the transport underneath is connected.
+bool CaptureTransport::isConnected()
+{
+    return gpTransport->isConnected();
+}
+
+#ifndef _WIN32
+// The file descriptor underneath.
+int CaptureTransport::getFd()
+{
+    return gpTransport->getFd();
+}
+#endif
+
+// Find the first record of a capture.
+uint32_t captureStart(const char * pCapture, uint32_t len)
+{
+    uint32_t offset = 0;
+
+    if ((len >= strlen(CAPTURE_FILE_MAGIC)) && (memcmp(pCapture, CAPTURE_FILE_MAGIC, strlen(CAPTURE_FILE_MAGIC)) == 0))
+    {
+        offset = strlen(CAPTURE_FILE_MAGIC);
+    }
+
+    return offset;
+}
+
+// Decode the next record of a capture.
+bool captureNext(const char * pCapture, uint32_t len, uint32_t * pOffset, CaptureRecord * pRecord)
+{
+    uint32_t offset = *pOffset;
+    uint64_t deltaUs;
+    uint64_t lenAndDirection;
+    bool success = false;
+
+    if (getLeb128(pCapture, len, &offset, &deltaUs) && getLeb128(pCapture, len, &offset, &lenAndDirection) &&
+        ((lenAndDirection >> 1) <= len - offset))
+    {
+        pRecord->timeUs += (int64_t) deltaUs;
+        pRecord->direction = (CaptureDirection) (lenAndDirection & 1);
+        pRecord->pData = pCapture + offset;
+        pRecord->len = (uint32_t) (lenAndDirection >> 1);
+        *pOffset = offset + pRecord->len;
+        success = true;
+    }
+
+    return success;
+}
+
+// End Of File
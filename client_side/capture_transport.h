@@ -0,0 +1,130 @@
+// Wire capture transport for NB-IoT example application
+
+#ifndef _CAPTURE_TRANSPORT_H_
+#define _CAPTURE_TRANSPORT_H_
+
+#include <mutex>
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The first bytes of a capture file
+#define CAPTURE_FILE_MAGIC "NBCAPT01"
+
+// The size of the buffer the capture file is written through
+#ifndef CAPTURE_FILE_BUFFER_SIZE
+# define CAPTURE_FILE_BUFFER_SIZE 65536
+#endif
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// Which way the bytes of a record went.
+typedef enum
+{
+    CAPTURE_DIRECTION_TX, // Written to the module
+    CAPTURE_DIRECTION_RX  // Read from the module
+} CaptureDirection;
+
+// A record of a capture, as decoded by captureNext().
+typedef struct
+{
+    int64_t timeUs;             // Since the capture was opened, from getTimeUs()
+    CaptureDirection direction;
+    const char * pData;         // Points into the capture
+    uint32_t len;
+} CaptureRecord;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// A Transport that passes everything through to another and records
+// every byte written and read, with the time it went, in a capture
+// file, so that a session with a real module can be replayed later
+// without one (see the at_replay tool).  The file is CAPTURE_FILE_MAGIC
+// followed by a record for each transmitVector() (the segments
+// together) and each receiveBuffer() that returned anything: the
+// microseconds since the record before, or since the file was opened,
+// then the length times two plus the CaptureDirection, both as
+// unsigned LEB128, then the bytes.  Most records thus carry two or
+// three bytes on top of the data.  Records are written whole from
+// whichever thread transmits or receives; until close() some may still
+// be in the file buffer.
+class CaptureTransport : public Transport {
+public:
+    // Constructor: pass everything through to pTransport, which must
+    // outlive this object, capturing nothing until open().
+    CaptureTransport(Transport * pTransport);
+
+    // Destructor: closes the capture file.
+    ~CaptureTransport();
+
+    // Start capturing to the file pFileName, replacing anything in it.
+    // Returns TRUE on success, otherwise FALSE.
+    bool open(const char * pFileName);
+
+    // Stop capturing and close the file.
+    // Returns FALSE if any of the capture could not be written.
+    bool close();
+
+    // Transmit on the transport underneath, capturing what is sent
+    // (whether or not the transmission then succeeds).
+    bool transmitVector(const TxSegment * pSegments, uint32_t numSegments);
+
+    // Receive from the transport underneath, capturing what arrived.
+    uint32_t receiveBuffer(char * pBuf, uint32_t lenBuf);
+
+    // Wait on the transport underneath.
+    bool waitReadable(uint32_t timeoutMs);
+
+    // Whether the transport underneath is connected.
+    bool isConnected();
+
+#ifndef _WIN32
+    // The file descriptor of the transport underneath.
+    int getFd();
+#endif
+
+protected:
+    // The transport underneath.
+    Transport * gpTransport;
+
+    // The capture file, NULL when not capturing, and its buffer.
+    FILE * gpFile;
+    char * gpFileBuf;
+
+    // When the last record was made, or the capture opened.
+    int64_t gLastUs;
+
+    // Set if a write to the file has failed.
+    bool gFailed;
+
+    // Keeps records whole when made from more than one thread.
+    std::mutex gMutex;
+
+    // Write a record of the numSegments segments at pSegments, which
+    // went in direction, to the capture file, if there is one.
+    void record(CaptureDirection direction, const TxSegment * pSegments, uint32_t numSegments);
+};
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+// Return the offset of the first record in the capture of len bytes at
+// pCapture, the whole of a capture file, or zero if it is not one.
+uint32_t captureStart(const char * pCapture, uint32_t len);
+
+// Decode the record at *pOffset in the capture of len bytes at
+// pCapture into pRecord, moving *pOffset on to the next.  The time of
+// the record is that of the record before, which is in pRecord->timeUs
+// on entry (zero for the first), plus its own.  Returns FALSE at the
+// end of the capture, or at a record cut short.
+bool captureNext(const char * pCapture, uint32_t len, uint32_t * pOffset, CaptureRecord * pRecord);
+
+#endif
+
+// End Of File
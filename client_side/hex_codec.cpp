@@ -0,0 +1,432 @@
+// Hex codec kernels for NB-IoT example application
+
+#include "stdint.h"
+#include "hex_codec.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+# define HEX_CODEC_X86
+# include <immintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// GCC and Clang will only generate SSE2/AVX2 instructions inside
+// functions marked for it, which lets this file be built without
+// -mavx2 and still run on processors that lack it; MSVC always
+// allows the intrinsics
+#if defined(HEX_CODEC_X86) && (defined(__GNUC__) || defined(__clang__))
+# define HEX_CODEC_TARGET(x) __attribute__((target(x)))
+#else
+# define HEX_CODEC_TARGET(x)
+#endif
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+static const char hexTable[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Decode up to lenInBuf hex characters into pOutBuf, starting at
+// byte *pY and stopping when lenOutBuf is reached, skipping non-hex
+// characters.  *pOdd is true when a high nibble has been written to
+// pOutBuf[*pY] and the low nibble is awaited; it and *pY are updated.
+// Returns the number of characters consumed.
+static uint32_t decodeRun (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf, uint32_t * pY, bool * pOdd)
+{
+    uint32_t x;
+    uint32_t y = *pY;
+    bool odd = *pOdd;
+    int32_t z;
+
+    for (x = 0; (x < lenInBuf) && (y < lenOutBuf); x++)
+    {
+        z = *(pInBuf + x);
+        if ((z >= '0') && (z <= '9'))
+        {
+            z = z - '0';
+        }
+        else
+        {
+            z &= ~0x20;
+            if ((z >= 'A') && (z <= 'F'))
+            {
+                z = z - 'A' + 10;
+            }
+            else
+            {
+                z = -1;
+            }
+        }
+
+        if (z >= 0)
+        {
+            if (!odd)
+            {
+                *(pOutBuf + y) = (z << 4) & 0xF0;
+            }
+            else
+            {
+                *(pOutBuf + y) += z;
+                y++;
+            }
+            odd = !odd;
+        }
+    }
+
+    *pY = y;
+    *pOdd = odd;
+
+    return x;
+}
+
+// Encode input bytes from *pX into hex characters from *pY,
+// stopping at size or lenOutBuf; *pX and *pY are updated.
+static void encodeRun (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf, uint32_t * pX, uint32_t * pY)
+{
+    uint32_t x = *pX;
+    uint32_t y = *pY;
+
+    for (; (x < size) && (y < lenOutBuf); x++)
+    {
+        pOutBuf[y] = hexTable[(pInBuf[x] >> 4) & 0x0f]; // upper nibble
+        y++;
+        if (y < lenOutBuf)
+        {
+            pOutBuf[y] = hexTable[pInBuf[x] & 0x0f]; // lower nibble
+            y++;
+        }
+    }
+
+    *pX = x;
+    *pY = y;
+}
+
+#ifdef HEX_CODEC_X86
+
+// Return the number of trailing zero bits in a non-zero value.
+static inline uint32_t countTrailingZeros (uint32_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+
+    _BitScanForward(&index, value);
+
+    return index;
+#else
+    return __builtin_ctz(value);
+#endif
+}
+
+// Turn 16 nibble values (0 to 15) into lower case hex characters.
+HEX_CODEC_TARGET("sse2")
+static inline __m128i nibblesToHexSse2 (__m128i nibbles)
+{
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+// Encode 16 bytes at pInBuf into 32 hex characters at pOutBuf.
+HEX_CODEC_TARGET("sse2")
+static inline void encodeBlockSse2 (const char * pInBuf, char * pOutBuf)
+{
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i bytes = _mm_loadu_si128((const __m128i *) pInBuf);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    __m128i low = _mm_and_si128(bytes, mask);
+
+    _mm_storeu_si128((__m128i *) pOutBuf, nibblesToHexSse2(_mm_unpacklo_epi8(high, low)));
+    _mm_storeu_si128((__m128i *) (pOutBuf + 16), nibblesToHexSse2(_mm_unpackhi_epi8(high, low)));
+}
+
+// If the 16 characters at pInBuf are all hex, decode them into 8
+// bytes at pOutBuf and return 0, otherwise write nothing and return
+// the number of characters up to and including the first non-hex one.
+HEX_CODEC_TARGET("sse2")
+static inline uint32_t decodeBlockSse2 (const char * pInBuf, char * pOutBuf)
+{
+    uint32_t validMask;
+    __m128i chars = _mm_loadu_si128((const __m128i *) pInBuf);
+    __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    __m128i nibbles;
+    __m128i bytes;
+
+    validMask = _mm_movemask_epi8(_mm_or_si128(digit, letter));
+    if (validMask == 0xFFFF)
+    {
+        nibbles = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+                               _mm_and_si128(letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+        // Each 16-bit lane holds the high nibble in its first byte and
+        // the low nibble in its second
+        bytes = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(nibbles, 4), _mm_set1_epi16(0x00F0)), _mm_srli_epi16(nibbles, 8));
+        _mm_storel_epi64((__m128i *) pOutBuf, _mm_packus_epi16(bytes, bytes));
+    }
+
+    return (validMask == 0xFFFF) ? 0 : countTrailingZeros(~validMask) + 1;
+}
+
+// Turn 32 nibble values (0 to 15) into lower case hex characters.
+HEX_CODEC_TARGET("avx2")
+static inline __m256i nibblesToHexAvx2 (__m256i nibbles)
+{
+    __m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+
+    return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+}
+
+// Encode 32 bytes at pInBuf into 64 hex characters at pOutBuf.
+HEX_CODEC_TARGET("avx2")
+static inline void encodeBlockAvx2 (const char * pInBuf, char * pOutBuf)
+{
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i bytes = _mm256_loadu_si256((const __m256i *) pInBuf);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), mask);
+    __m256i low = _mm256_and_si256(bytes, mask);
+    // Unpacking works within each 128-bit half, so these hold bytes
+    // 0-7 and 16-23, then 8-15 and 24-31
+    __m256i first = nibblesToHexAvx2(_mm256_unpacklo_epi8(high, low));
+    __m256i second = nibblesToHexAvx2(_mm256_unpackhi_epi8(high, low));
+
+    _mm256_storeu_si256((__m256i *) pOutBuf, _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i *) (pOutBuf + 32), _mm256_permute2x128_si256(first, second, 0x31));
+}
+
+// If the 32 characters at pInBuf are all hex, decode them into 16
+// bytes at pOutBuf and return 0, otherwise write nothing and return
+// the number of characters up to and including the first non-hex one.
+HEX_CODEC_TARGET("avx2")
+static inline uint32_t decodeBlockAvx2 (const char * pInBuf, char * pOutBuf)
+{
+    uint32_t validMask;
+    __m256i chars = _mm256_loadu_si256((const __m256i *) pInBuf);
+    __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+    __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    __m256i nibbles;
+    __m256i bytes;
+
+    validMask = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(digit, letter));
+    if (validMask == 0xFFFFFFFF)
+    {
+        nibbles = _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(chars, _mm256_set1_epi8('0'))),
+                                  _mm256_and_si256(letter, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+        bytes = _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(nibbles, 4), _mm256_set1_epi16(0x00F0)), _mm256_srli_epi16(nibbles, 8));
+        // Packing also works within each 128-bit half, so gather the
+        // two halves' 8 bytes into the bottom 128 bits
+        bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(bytes, bytes), 0x08);
+        _mm_storeu_si128((__m128i *) pOutBuf, _mm256_castsi256_si128(bytes));
+    }
+
+    return (validMask == 0xFFFFFFFF) ? 0 : countTrailingZeros(~validMask) + 1;
+}
+
+#endif
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Convert a sequence of bytes into a hex string, one byte at a time,
+// returning the number of characters written. The hex string is NOT
+// null terminated.
+uint32_t bytesToHexStringScalar (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf)
+{
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+    encodeRun (pInBuf, size, pOutBuf, lenOutBuf, &x, &y);
+
+    return y;
+}
+
+// Convert a sequence of bytes into a hex string, 16 bytes at a time
+// with SSE2, returning the number of characters written. The hex
+// string is NOT null terminated.
+HEX_CODEC_TARGET("sse2")
+uint32_t bytesToHexStringSse2 (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf)
+{
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+#ifdef HEX_CODEC_X86
+    for (; (x + 16 <= size) && (y + 32 <= lenOutBuf); x += 16, y += 32)
+    {
+        encodeBlockSse2 (pInBuf + x, pOutBuf + y);
+    }
+#endif
+    encodeRun (pInBuf, size, pOutBuf, lenOutBuf, &x, &y);
+
+    return y;
+}
+
+// Convert a sequence of bytes into a hex string, 32 bytes at a time
+// with AVX2, returning the number of characters written. The hex
+// string is NOT null terminated.
+HEX_CODEC_TARGET("avx2")
+uint32_t bytesToHexStringAvx2 (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf)
+{
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+#ifdef HEX_CODEC_X86
+    for (; (x + 32 <= size) && (y + 64 <= lenOutBuf); x += 32, y += 64)
+    {
+        encodeBlockAvx2 (pInBuf + x, pOutBuf + y);
+    }
+#endif
+    encodeRun (pInBuf, size, pOutBuf, lenOutBuf, &x, &y);
+
+    return y;
+}
+
+// Convert a hex string of a given length into a sequence of bytes, one
+// character at a time, returning the number of bytes written.
+uint32_t hexStringToBytesScalar (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf)
+{
+    uint32_t y = 0;
+    bool odd = false;
+
+    decodeRun (pInBuf, lenInBuf, pOutBuf, lenOutBuf, &y, &odd);
+
+    return y;
+}
+
+// Convert a hex string of a given length into a sequence of bytes, 16
+// characters at a time with SSE2, returning the number of bytes written.
+// Blocks containing non-hex characters are handled by the scalar code.
+HEX_CODEC_TARGET("sse2")
+uint32_t hexStringToBytesSse2 (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf)
+{
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t lenScalar;
+    bool odd = false;
+
+#ifdef HEX_CODEC_X86
+    while ((x + 16 <= lenInBuf) && (y + 8 <= lenOutBuf))
+    {
+        if (odd)
+        {
+            // Get back in step after an odd number of hex characters
+            x += decodeRun (pInBuf + x, 1, pOutBuf, lenOutBuf, &y, &odd);
+        }
+        else
+        {
+            lenScalar = decodeBlockSse2 (pInBuf + x, pOutBuf + y);
+            if (lenScalar == 0)
+            {
+                x += 16;
+                y += 8;
+            }
+            else
+            {
+                x += decodeRun (pInBuf + x, lenScalar, pOutBuf, lenOutBuf, &y, &odd);
+            }
+        }
+    }
+#endif
+    decodeRun (pInBuf + x, lenInBuf - x, pOutBuf, lenOutBuf, &y, &odd);
+
+    return y;
+}
+
+// Convert a hex string of a given length into a sequence of bytes, 32
+// characters at a time with AVX2, returning the number of bytes written.
+// Blocks containing non-hex characters are handled by the scalar code.
+HEX_CODEC_TARGET("avx2")
+uint32_t hexStringToBytesAvx2 (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf)
+{
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t lenScalar;
+    bool odd = false;
+
+#ifdef HEX_CODEC_X86
+    while ((x + 32 <= lenInBuf) && (y + 16 <= lenOutBuf))
+    {
+        if (odd)
+        {
+            // Get back in step after an odd number of hex characters
+            x += decodeRun (pInBuf + x, 1, pOutBuf, lenOutBuf, &y, &odd);
+        }
+        else
+        {
+            lenScalar = decodeBlockAvx2 (pInBuf + x, pOutBuf + y);
+            if (lenScalar == 0)
+            {
+                x += 32;
+                y += 16;
+            }
+            else
+            {
+                x += decodeRun (pInBuf + x, lenScalar, pOutBuf, lenOutBuf, &y, &odd);
+            }
+        }
+    }
+#endif
+    decodeRun (pInBuf + x, lenInBuf - x, pOutBuf, lenOutBuf, &y, &odd);
+
+    return y;
+}
+
+// Return true if the processor supports SSE2.
+bool hexCodecSse2Supported (void)
+{
+    bool supported = false;
+
+#if defined(_M_X64) || defined(__x86_64__)
+    // Part of the x86-64 baseline
+    supported = true;
+#elif defined(HEX_CODEC_X86) && defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 1);
+    supported = (info[3] & (1 << 26)) != 0;
+#elif defined(HEX_CODEC_X86)
+    __builtin_cpu_init();
+    supported = __builtin_cpu_supports("sse2");
+#endif
+
+    return supported;
+}
+
+// Return true if the processor, and the operating system, support AVX2.
+bool hexCodecAvx2Supported (void)
+{
+    bool supported = false;
+
+#if defined(HEX_CODEC_X86) && defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] >= 7)
+    {
+        // AVX and OSXSAVE, then that the OS saves the YMM registers
+        __cpuid(info, 1);
+        if (((info[2] & (1 << 28)) != 0) && ((info[2] & (1 << 27)) != 0) &&
+            ((_xgetbv(0) & 0x06) == 0x06))
+        {
+            __cpuidex(info, 7, 0);
+            supported = (info[1] & (1 << 5)) != 0;
+        }
+    }
+#elif defined(HEX_CODEC_X86)
+    __builtin_cpu_init();
+    supported = __builtin_cpu_supports("avx2");
+#endif
+
+    return supported;
+}
+
+// End Of File
@@ -0,0 +1,31 @@
+// Hex codec kernels for NB-IoT example application
+
+#ifndef _HEX_CODEC_H_
+#define _HEX_CODEC_H_
+
+// These are the implementations behind bytesToHexString() and
+// hexStringToBytes() in utilities.h, which pick the fastest one the
+// processor supports at run-time.  All variants behave identically:
+// encoding writes lower case hex, never more than lenOutBuf characters,
+// and decoding skips any non-hex characters and writes no more than
+// lenOutBuf bytes.  The SSE2 and AVX2 variants fall back to the scalar
+// code on processors other than x86, so they are always safe to call
+// but only fast where hexCodecSse2Supported()/hexCodecAvx2Supported()
+// return true.
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+uint32_t bytesToHexStringScalar (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf);
+uint32_t bytesToHexStringSse2 (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf);
+uint32_t bytesToHexStringAvx2 (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf);
+uint32_t hexStringToBytesScalar (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf);
+uint32_t hexStringToBytesSse2 (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf);
+uint32_t hexStringToBytesAvx2 (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf);
+bool hexCodecSse2Supported (void);
+bool hexCodecAvx2Supported (void);
+
+#endif
+
+// End Of File
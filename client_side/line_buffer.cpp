@@ -0,0 +1,113 @@
+// Line assembler for the AT interface of the NB-IoT example application
+
+#include "stdint.h"
+#include "string.h"
+#include "line_buffer.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The AT terminator is "\r\n": lines are found by searching for the
+// last character and then checking the one before it
+#define LINE_TERMINATOR_FIRST '\r'
+#define LINE_TERMINATOR_LAST  '\n'
+
+// ----------------------------------------------------------------
+// CLASSES/METHODS
+// ----------------------------------------------------------------
+
+// Constructor.
+LineBuffer::LineBuffer(char * pStorage, uint32_t size)
+{
+    gpStorage = pStorage;
+    gSize = size;
+    gStart = 0;
+    gEnd = 0;
+    gScanned = 0;
+}
+
+// Get a pointer to the free space at the end of the buffer.
+char * LineBuffer::getWritePointer(uint32_t * pSpace)
+{
+    // Lines are handed out as contiguous views so, rather than
+    // wrapping, move any partial line down to the start of the
+    // storage to make room; this only ever copies the unfinished tail
+    if (gStart > 0)
+    {
+        memmove (gpStorage, gpStorage + gStart, gEnd - gStart);
+        gEnd -= gStart;
+        gScanned -= gStart;
+        gStart = 0;
+    }
+
+    *pSpace = gSize - gEnd;
+
+    return gpStorage + gEnd;
+}
+
+// Note that characters have been written into the buffer.
+void LineBuffer::commit(uint32_t len)
+{
+    if (len > gSize - gEnd)
+    {
+        len = gSize - gEnd;
+    }
+
+    gEnd += len;
+}
+
+// Get the next line from the buffer.
+uint32_t LineBuffer::getLine(const char ** ppLine)
+{
+    uint32_t returnLen = 0;
+    const char * pFound;
+
+    while ((returnLen == 0) && (gScanned < gEnd))
+    {
+        pFound = (const char *) memchr (gpStorage + gScanned, LINE_TERMINATOR_LAST, gEnd - gScanned);
+        if (pFound != NULL)
+        {
+            gScanned = (uint32_t) (pFound - gpStorage) + 1;
+            if ((pFound > gpStorage + gStart) && (*(pFound - 1) == LINE_TERMINATOR_FIRST))
+            {
+                returnLen = gScanned - gStart;
+            }
+        }
+        else
+        {
+            gScanned = gEnd;
+        }
+    }
+
+    if ((returnLen == 0) && (gStart == 0) && (gEnd == gSize))
+    {
+        // No terminator and no more room: hand back what there is
+        returnLen = gSize;
+        gScanned = gSize;
+    }
+
+    if (returnLen > 0)
+    {
+        *ppLine = gpStorage + gStart;
+        gStart += returnLen;
+    }
+
+    return returnLen;
+}
+
+// Return the number of characters buffered.
+uint32_t LineBuffer::getLength()
+{
+    return gEnd - gStart;
+}
+
+// Discard everything in the buffer.
+void LineBuffer::clear()
+{
+    gStart = 0;
+    gEnd = 0;
+    gScanned = 0;
+}
+
+// End Of File
@@ -0,0 +1,67 @@
+// Line assembler for the AT interface of the NB-IoT example application
+
+#ifndef _LINE_BUFFER_H_
+#define _LINE_BUFFER_H_
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// Assembles the characters received from the AT interface into lines
+// ending with the AT terminator "\r\n".  Characters are written in bulk
+// straight into the buffer (e.g. by SerialPort::receiveBuffer()) and
+// complete lines are handed back as views into the buffer, so nothing
+// is copied on the way through.
+class LineBuffer
+{
+public:
+    // Constructor.  pStorage is the memory to use, size bytes of it,
+    // which must remain valid for the lifetime of this object.  No line
+    // longer than size characters can be returned in one piece.
+    LineBuffer (char * pStorage, uint32_t size);
+
+    // Get a pointer to the free space at the end of the buffer, setting
+    // pSpace to the number of characters that may be written there.
+    // Calling this may move the buffered characters and so invalidates
+    // any line previously returned by getLine().
+    char * getWritePointer (uint32_t * pSpace);
+
+    // Tell the buffer that len characters have been written at the
+    // location returned by getWritePointer().
+    void commit (uint32_t len);
+
+    // Get the next line from the buffer.  If an AT terminator is found,
+    // or the buffer is full, ppLine is set to point at the start of the
+    // line and the number of characters in it (including the terminator)
+    // is returned, otherwise 0 is returned.  No NULL terminator is added.
+    // The line remains valid until the next call to getWritePointer().
+    uint32_t getLine (const char ** ppLine);
+
+    // Return the number of characters buffered but not yet returned
+    // by getLine().
+    uint32_t getLength ();
+
+    // Discard everything in the buffer.
+    void clear ();
+
+protected:
+    // The storage for the buffer.
+    char * gpStorage;
+
+    // The size of gpStorage.
+    uint32_t gSize;
+
+    // Offset of the first character not yet returned by getLine().
+    uint32_t gStart;
+
+    // Offset of the end of the characters written into the buffer.
+    uint32_t gEnd;
+
+    // Offset from which the next search for a terminator starts, so
+    // that no character is searched more than once.
+    uint32_t gScanned;
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,51 @@
+// Logging for the NB-IoT example application
+
+#ifndef _LOGGING_H_
+#define _LOGGING_H_
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The levels of log message, most important first
+#define LOG_LEVEL_NONE    0
+#define LOG_LEVEL_ERROR   1 // Something has failed ("!!! ...")
+#define LOG_LEVEL_WARNING 2 // Something odd that was coped with ("WARNING: ...")
+#define LOG_LEVEL_INFO    3 // Progress: connecting, connected, etc.
+#define LOG_LEVEL_DEBUG   4 // Every AT line written and read
+
+// The level of log message compiled in; messages below it are
+// compiled out entirely, arguments and all.  Set it with, for
+// instance, -DLOG_LEVEL=LOG_LEVEL_DEBUG to see the AT traffic.
+#ifndef LOG_LEVEL
+# define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// printf()-style log macros, one per level
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+# define LOG_ERROR(...) printf(__VA_ARGS__)
+#else
+# define LOG_ERROR(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARNING
+# define LOG_WARNING(...) printf(__VA_ARGS__)
+#else
+# define LOG_WARNING(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+# define LOG_INFO(...) printf(__VA_ARGS__)
+#else
+# define LOG_INFO(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+# define LOG_DEBUG(...) printf(__VA_ARGS__)
+#else
+# define LOG_DEBUG(...)
+#endif
+
+#endif
+
+// End Of File
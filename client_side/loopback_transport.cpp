@@ -0,0 +1,205 @@
+// In-memory transport for NB-IoT example application
+
+#include <stdint.h>
+#include <string.h>
+#include "platform.h"
+#include "transport.h"
+#include "loopback_transport.h"
+
+// ----------------------------------------------------------------
+// PROTECTED FUNCTIONS
+// ----------------------------------------------------------------
+
+// Put characters into a ring.
+uint32_t LoopbackTransport::put(Ring * pRing, const char * pBuf, uint32_t len)
+{
+    uint32_t space = LOOPBACK_BUFFER_SIZE - (pRing->head - pRing->tail);
+    uint32_t offset;
+    uint32_t chunk;
+
+    if (len > space)
+    {
+        len = space;
+    }
+
+    // Copy in at most two pieces, either side of the wrap
+    offset = pRing->head & (LOOPBACK_BUFFER_SIZE - 1);
+    chunk = LOOPBACK_BUFFER_SIZE - offset;
+    if (chunk > len)
+    {
+        chunk = len;
+    }
+    memcpy(pRing->buf + offset, pBuf, chunk);
+    memcpy(pRing->buf, pBuf + chunk, len - chunk);
+    pRing->head += len;
+
+    return len;
+}
+
+// Take characters out of a ring.
+uint32_t LoopbackTransport::take(Ring * pRing, char * pBuf, uint32_t len)
+{
+    uint32_t count = pRing->head - pRing->tail;
+    uint32_t offset;
+    uint32_t chunk;
+
+    if (len > count)
+    {
+        len = count;
+    }
+
+    offset = pRing->tail & (LOOPBACK_BUFFER_SIZE - 1);
+    chunk = LOOPBACK_BUFFER_SIZE - offset;
+    if (chunk > len)
+    {
+        chunk = len;
+    }
+    memcpy(pBuf, pRing->buf + offset, chunk);
+    memcpy(pBuf + chunk, pRing->buf, len - chunk);
+    pRing->tail += len;
+
+    return len;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor.
+LoopbackTransport::LoopbackTransport()
+{
+    gRx.head = 0;
+    gRx.tail = 0;
+    gTx.head = 0;
+    gTx.tail = 0;
+    gpWriteHandler = NULL;
+    gpWriteContext = NULL;
+}
+
+// Destructor.
+LoopbackTransport::~LoopbackTransport()
+{
+}
+
+// Set the write handler.
+void LoopbackTransport::setWriteHandler(LoopbackWriteHandler pHandler, void * pContext)
+{
+    std::lock_guard<std::mutex> lock(gMutex);
+
+    gpWriteHandler = pHandler;
+    gpWriteContext = pContext;
+}
+
+// Make characters available to be received.
+uint32_t LoopbackTransport::inject(const char * pBuf, uint32_t lenBuf)
+{
+    uint32_t len;
+
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        len = put(&gRx, pBuf, lenBuf);
+    }
+    if (len > 0)
+    {
+        gSignal.notify_all();
+    }
+
+    return len;
+}
+
+// Take the characters transmitted.
+uint32_t LoopbackTransport::collect(char * pBuf, uint32_t lenBuf)
+{
+    uint32_t len;
+
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        len = take(&gTx, pBuf, lenBuf);
+    }
+    if (len > 0)
+    {
+        // There may be a transmitter waiting for the space
+        gSignal.notify_all();
+    }
+
+    return len;
+}
+
+// Wait for up to timeoutMs for characters to be transmitted.
+bool LoopbackTransport::waitCollect(uint32_t timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(gMutex);
+
+    return gSignal.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                            [this] {return gTx.head != gTx.tail;});
+}
+
+// Transmit a number of segments.
+bool LoopbackTransport::transmitVector(const TxSegment * pSegments, uint32_t numSegments)
+{
+    LoopbackWriteHandler pHandler;
+    void * pContext;
+    const char * pBuf;
+    uint32_t len;
+    uint32_t done;
+
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        pHandler = gpWriteHandler;
+        pContext = gpWriteContext;
+    }
+
+    for (uint32_t x = 0; x < numSegments; x++)
+    {
+        if (pHandler != NULL)
+        {
+            // Called without the lock held so that it may inject()
+            pHandler(pContext, pSegments[x].pBuf, pSegments[x].len);
+        }
+        else
+        {
+            pBuf = pSegments[x].pBuf;
+            len = pSegments[x].len;
+            while (len > 0)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(gMutex);
+                    gSignal.wait(lock, [this] {return gTx.head - gTx.tail < LOOPBACK_BUFFER_SIZE;});
+                    done = put(&gTx, pBuf, len);
+                }
+                gSignal.notify_all();
+                pBuf += done;
+                len -= done;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Receive the characters injected.
+uint32_t LoopbackTransport::receiveBuffer(char * pBuf, uint32_t lenBuf)
+{
+    std::lock_guard<std::mutex> lock(gMutex);
+
+    return take(&gRx, pBuf, lenBuf);
+}
+
+// Wait for up to timeoutMs for characters to be injected.
+bool LoopbackTransport::waitReadable(uint32_t timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(gMutex);
+
+    return gSignal.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                            [this] {return gRx.head != gRx.tail;});
+}
+
+#ifndef _WIN32
+// There is no file descriptor.
+int LoopbackTransport::getFd()
+{
+    return -1;
+}
+#endif
+
+// End Of File
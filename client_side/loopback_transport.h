@@ -0,0 +1,116 @@
+// In-memory transport for NB-IoT example application
+
+#ifndef _LOOPBACK_TRANSPORT_H_
+#define _LOOPBACK_TRANSPORT_H_
+
+#include <condition_variable>
+#include <mutex>
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The size of each direction's buffer; must be a power of two
+#ifndef LOOPBACK_BUFFER_SIZE
+# define LOOPBACK_BUFFER_SIZE 4096
+#endif
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// Called with each segment that Nbiot transmits, from the thread
+// transmitting it; pBuf is only valid for the duration of the call.
+typedef void (*LoopbackWriteHandler) (void * pContext, const char * pBuf, uint32_t len);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// A Transport entirely in memory, with no device or system call in the
+// way, for running Nbiot against a model of a module at memory speed
+// (for benchmarking and fuzzing the AT engine).  The model plays the far
+// end: it feeds characters to Nbiot with inject() and sees what Nbiot
+// transmits either as it is written, through a write handler, or by
+// reading it back with collect().  inject() and collect() may be called
+// from any thread.
+class LoopbackTransport : public Transport {
+public:
+    LoopbackTransport();
+    ~LoopbackTransport();
+
+    // Far end: set a handler to be called with everything transmitted
+    // from now on, instead of it being buffered for collect().  The
+    // handler may call inject() to answer.  NULL removes the handler.
+    void setWriteHandler(LoopbackWriteHandler pHandler, void * pContext);
+
+    // Far end: make lenBuf characters from pBuf available to be received.
+    // Returns the number of characters taken, less than lenBuf if the
+    // buffer is full.
+    uint32_t inject(const char * pBuf, uint32_t lenBuf);
+
+    // Far end: take up to lenBuf of the characters transmitted into pBuf.
+    // Returns the number of characters taken.
+    uint32_t collect(char * pBuf, uint32_t lenBuf);
+
+    // Far end: block for up to timeoutMs milliseconds waiting for
+    // transmitted characters to collect().
+    // Returns TRUE if characters are waiting, otherwise FALSE.
+    bool waitCollect(uint32_t timeoutMs);
+
+    // Transmit the numSegments segments at pSegments, to the write
+    // handler or, if there is none, to the buffer read by collect(),
+    // blocking while that is full.
+    // Returns TRUE on success, otherwise FALSE.
+    bool transmitVector(const TxSegment * pSegments, uint32_t numSegments);
+
+    // Receive up to lenBuf of the characters injected into pBuf.
+    // Returns the number of characters received.
+    uint32_t receiveBuffer(char * pBuf, uint32_t lenBuf);
+
+    // Block for up to timeoutMs milliseconds waiting for characters to
+    // be injected, without consuming them.
+    // Returns TRUE if characters are waiting, otherwise FALSE.
+    bool waitReadable(uint32_t timeoutMs);
+
+#ifndef _WIN32
+    // There is no file descriptor: returns -1.
+    int getFd();
+#endif
+
+protected:
+    // A buffer of characters in one direction; head and tail run
+    // freely, their difference being the number of characters held.
+    typedef struct
+    {
+        char buf[LOOPBACK_BUFFER_SIZE];
+        uint32_t head;
+        uint32_t tail;
+    } Ring;
+
+    // The characters injected, waiting to be received.
+    Ring gRx;
+
+    // The characters transmitted, waiting to be collected.
+    Ring gTx;
+
+    // The write handler and its context.
+    LoopbackWriteHandler gpWriteHandler;
+    void * gpWriteContext;
+
+    // Protects the buffers and signals any change to them.
+    std::mutex gMutex;
+    std::condition_variable gSignal;
+
+    // Put up to len characters from pBuf into pRing, returning the
+    // number put; call with gMutex locked.
+    static uint32_t put(Ring * pRing, const char * pBuf, uint32_t len);
+
+    // Take up to len characters from pRing into pBuf, returning the
+    // number taken; call with gMutex locked.
+    static uint32_t take(Ring * pRing, char * pBuf, uint32_t len);
+};
+
+#endif
+
+// End Of File
@@ -8,10 +8,23 @@
 #include "stdint.h"
 #include "string.h"
 #include "stdio.h"
-#include "windows.h"
+#include "time.h"
+#include "platform.h"
 #include "utilities.h"
+#include "trace.h"
+#include "transport.h"
 #include "serial_driver.h"
+#include "tcp_transport.h"
+#include "capture_transport.h"
+#include "line_buffer.h"
+#include "spsc_queue.h"
+#include "at_dispatcher.h"
+#include "metrics.h"
+#include "timer_wheel.h"
 #include "modem_driver.h"
+#include "uplink_journal.h"
+#include "payload_codec.h"
+#include "uplink_aggregator.h"
 
 // ----------------------------------------------------------------
 // COMPILE-TIME CONSTANTS
@@ -20,16 +33,99 @@
 #define DIR_SEPARATORS "\\/"
 #define EXT_SEPARATOR "."
 
+// The prefix of a port name that is the host:port of a terminal server
+#define TCP_PORT_PREFIX "tcp:"
+
+// The most downlink datagrams collected in one go when polling
+#define DOWNLINK_BATCH 8
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// What sendUplink() needs, for the aggregator to call it with.
+typedef struct
+{
+    Nbiot * pModem;
+    UplinkJournal * pJournal;
+    bool compress;
+} UplinkContext;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Send size bytes from pData on the uplink, encoded with a header, which
+// marks them as an aggregate of records if aggregate is true, and
+// compressed where that helps if compress is true, by way of pJournal if
+// it is not NULL.  Returns true if the datagram was sent or is waiting
+// in the journal to be sent.
+static bool sendUplink (Nbiot * pModem, UplinkJournal * pJournal, bool compress, bool aggregate,
+                        const char * pData, uint32_t size)
+{
+    bool success = false;
+    char encoded[MAX_LEN_SEND_STRING];
+
+    // Zero if it does not fit with the header
+    size = payloadEncode (pData, size, encoded, sizeof (encoded), compress, aggregate);
+    if (size > 0)
+    {
+        if ((pJournal != NULL) && pJournal->append (encoded, size))
+        {
+            pJournal->forward (pModem);
+            success = true;
+        }
+        else
+        {
+            success = pModem->send (encoded, size);
+        }
+    }
+
+    return success;
+}
+
+// Send an aggregate datagram with sendUplink().
+static bool sendAggregate (void * pContext, const char * pDatagram, uint32_t size)
+{
+    UplinkContext * pUplink = (UplinkContext *) pContext;
+
+    return sendUplink (pUplink->pModem, pUplink->pJournal, pUplink->compress, true, pDatagram, size);
+}
+
 // ----------------------------------------------------------------
 // MAIN
 // ----------------------------------------------------------------
 
-// Main accepts two command-line arguments:
+// Main accepts six command-line arguments:
 //
 // -s: if this is present then it is assumed that SoftRadio is
 // in use, otherwise a real NB-IoT module is assumed.
 //
-// string: specifies the port name to use, e.g. COM8
+// -z: if this is present then uplink datagrams are compressed where
+// that makes them smaller.  With or without it, each uplink datagram
+// starts with a one-byte header saying how it is encoded, which the
+// server side decodes.
+//
+// -a: if this is present then the lines typed in are sent as records
+// packed together into as few datagrams as possible, each datagram
+// going when it is full, on an empty line or when its first record has
+// waited AGGREGATE_DEFAULT_MAX_DELAY_MS; that wait is only checked when
+// the next line is entered, so records sit for as long as nothing is
+// typed.  The server side splits them apart again.
+//
+// -c <file>: if this is present then every byte written to and read
+// from the module is captured, with the time it went, in file, for
+// replaying later with the at_replay tool.
+//
+// -j <file>: if this is present then uplink datagrams are kept in a
+// journal in file until the module reports them sent, so that any that
+// fail (e.g. while out of coverage) are sent again, in order, including
+// the next time the program is started with the same file.  Without it
+// uplink datagrams are sent directly and those that fail are lost.
+//
+// string: specifies the port name to use, e.g. COM8 on Windows or
+// /dev/ttyUSB0 on Linux, or "tcp:" followed by the host:port
+// of a terminal server that the module is on, e.g. tcp:192.168.1.20:4001
 //
 // The parameters may be provided in any order
 int main(int argc, char* argv[])
@@ -37,14 +133,35 @@ int main(int argc, char* argv[])
     bool success = true;
     bool usingSoftRadio = false;
     bool gotPortString = false;
-    char portString[8];
-    char winPortString[16] = "\\\\.\\";   // Windows format for port management
-    char datagram[256] = "Hello World!";
+    bool asyncReceive = false;
+    bool compressUplinks = false;
+    bool aggregateUplinks = false;
+    char portString[MAX_PATH] = "";
+#ifdef _WIN32
+    char osPortString[MAX_PATH] = "\\\\.\\";   // Windows format for port management
+#else
+    char osPortString[MAX_PATH] = "";         // POSIX uses the device path as-is
+#endif
+    char datagram[MAX_LEN_SEND_STRING] = "Hello World!";
+    char downlinkArena[MAX_LEN_SEND_STRING * DOWNLINK_BATCH];
+    Nbiot::DatagramSpan downlinks[DOWNLINK_BATCH];
+    uint32_t numDownlinks;
     Nbiot * pModem = NULL;
+    TcpTransport * pTcpTransport = NULL;
+    SerialPort * pSerialPort = NULL;
+    CaptureTransport * pCaptureTransport = NULL;
+    Transport * pTransport = NULL;
+    const char * pCaptureFile = NULL;
+    const char * pJournalFile = NULL;
+    TCHAR tcharPortString[MAX_PATH];
+    UplinkJournal journal;
+    bool journalOpen = false;
+    UplinkContext uplinkContext;
+    UplinkAggregator * pAggregator = NULL;
     uint32_t datagramLen = strlen (datagram);
     char * pUserInput;
     char * pChar;
-    char * pExeName;
+    char * pExeName = NULL;
 
     // Find the exe name in the first argument
     pChar = strtok (argv[0], DIR_SEPARATORS);
@@ -70,11 +187,29 @@ int main(int argc, char* argv[])
         {
             usingSoftRadio = true;
         }
+        else if (!compressUplinks && (strcmp (argv[x], "-z") == 0))
+        {
+            compressUplinks = true;
+        }
+        else if (!aggregateUplinks && (strcmp (argv[x], "-a") == 0))
+        {
+            aggregateUplinks = true;
+        }
+        else if ((pCaptureFile == NULL) && (strcmp (argv[x], "-c") == 0) && (x + 1 < argc))
+        {
+            x++;
+            pCaptureFile = argv[x];
+        }
+        else if ((pJournalFile == NULL) && (strcmp (argv[x], "-j") == 0) && (x + 1 < argc))
+        {
+            x++;
+            pJournalFile = argv[x];
+        }
         else if (!gotPortString)
         {
             gotPortString = true;
-            strncpy(portString, argv[x], sizeof (portString));
-            strcat(winPortString, argv[x]);
+            strncpy(portString, argv[x], sizeof (portString) - 1);
+            strncat(osPortString, argv[x], sizeof (osPortString) - strlen (osPortString) - 1);
         }
         else
         {
@@ -86,47 +221,187 @@ int main(int argc, char* argv[])
     if (success && gotPortString)
     {
         // Initialise the module and register with the network
-        pModem = new Nbiot(winPortString);
+        if (strncmp (portString, TCP_PORT_PREFIX, strlen (TCP_PORT_PREFIX)) == 0)
+        {
+            pTcpTransport = new TcpTransport();
+            if (pTcpTransport->connect(portString + strlen (TCP_PORT_PREFIX)))
+            {
+                pTransport = pTcpTransport;
+            }
+        }
+        else if (pCaptureFile != NULL)
+        {
+            // Open the port here rather than in Nbiot, so that the
+            // capture can sit between the two
+#ifdef _MSC_VER
+            memset (tcharPortString, 0, sizeof (tcharPortString));
+            MultiByteToWideChar(CP_UTF8, 0, osPortString, (int) strlen (osPortString), tcharPortString, MAX_PATH - 1);
+#else
+            memcpy (tcharPortString, osPortString, sizeof (tcharPortString));
+#endif
+            pSerialPort = new SerialPort();
+            if (pSerialPort->connect(tcharPortString))
+            {
+                pTransport = pSerialPort;
+            }
+        }
+        else
+        {
+            pModem = new Nbiot(osPortString);
+        }
+
+        if ((pTransport != NULL) && (pCaptureFile != NULL))
+        {
+            pCaptureTransport = new CaptureTransport(pTransport);
+            if (pCaptureTransport->open(pCaptureFile))
+            {
+                printf ("Capturing to %s.\n", pCaptureFile);
+            }
+            else
+            {
+                printf ("WARNING: unable to open %s, nothing will be captured.\n", pCaptureFile);
+            }
+            pTransport = pCaptureTransport;
+        }
+        if (pTransport != NULL)
+        {
+            pModem = new Nbiot(pTransport);
+        }
         
         if (pModem)
         {
             printf ("Initialising module...\n");
             success = pModem->connect(usingSoftRadio);
 
+            if (success && (pJournalFile != NULL))
+            {
+                // Keep uplink datagrams on disk until they are sent, so that
+                // none are lost while out of coverage or across a restart;
+                // anything left from last time goes first
+                journalOpen = journal.open (pJournalFile);
+                if (journalOpen)
+                {
+                    printf ("Journalling uplink datagrams in %s.\n", pJournalFile);
+                }
+                else
+                {
+                    printf ("WARNING: unable to open %s, uplink datagrams that fail to send will be lost.\n", pJournalFile);
+                }
+            }
+
             if (success)
             {
+
                 // Send the initial "hello" that is in the buffer at start of day
                 printf ("Sending initial datagram \"%*s\".\n", datagramLen, datagram);
-                success = pModem->send (datagram, datagramLen);
+                success = sendUplink (pModem, journalOpen ? &journal : NULL, compressUplinks, false, datagram, datagramLen);
 
                 if (success)
                 {
+                    if (aggregateUplinks)
+                    {
+                        // Leave room for the header that sendUplink() adds
+                        uplinkContext.pModem = pModem;
+                        uplinkContext.pJournal = journalOpen ? &journal : NULL;
+                        uplinkContext.compress = compressUplinks;
+                        pAggregator = new UplinkAggregator (sendAggregate, &uplinkContext,
+                                                            pModem->getMaxDatagramSize() - 1);
+                    }
+
+                    // Have downlink datagrams delivered by the modem as they
+                    // arrive if possible, otherwise poll for them with AT+MGR
+                    asyncReceive = pModem->startAsyncReceive();
+
                     while (true)
                     {
                         // Get user input
                         printf ("Type in a datagram to send to the network and press <enter>, or just press <enter> to check the downlink.\n");
                         printf ("> ");
                         pUserInput = fgets (datagram, sizeof (datagram), stdin);                    
-                        if (pUserInput && (strlen(datagram) > 1))
+                        if (pUserInput == NULL)
+                        {
+                            // End of input
+                            break;
+                        }
+                        if (strlen(datagram) > 1)
                         {
                             // If there was user input, send it on the uplink,
                             // omitting the newline character from the end
-                            if (!pModem->send (datagram, strlen(datagram) - 1))
+                            if (pAggregator != NULL)
+                            {
+                                if (!pAggregator->add (datagram, strlen(datagram) - 1))
+                                {
+                                    printf ("!!! Failed to send uplink datagram.\n");
+                                }
+                            }
+                            else if (!sendUplink (pModem, journalOpen ? &journal : NULL, compressUplinks, false, datagram, strlen(datagram) - 1))
                             {
                                 printf ("!!! Failed to send uplink datagram.\n");
                             }
                         }
+                        else
+                        {
+                            if ((pAggregator != NULL) && !pAggregator->flush())
+                            {
+                                printf ("!!! Failed to send uplink datagram.\n");
+                            }
+                            if (journalOpen)
+                            {
+                                // Try again with anything that failed to go before
+                                journal.forward (pModem);
+                            }
+                        }
+
+                        if (pAggregator != NULL)
+                        {
+                            // The deadline may have passed while waiting for
+                            // input, which is the only time it is checked
+                            if (!pAggregator->poll())
+                            {
+                                printf ("!!! Failed to send uplink datagram.\n");
+                            }
+                            if (pAggregator->getRecordCount() > 0)
+                            {
+                                printf ("%d record(s) waiting to be sent together, press <enter> to send them now.\n", pAggregator->getRecordCount());
+                            }
+                        }
+
+                        if (journalOpen && (journal.getPendingCount() > 0))
+                        {
+                            printf ("%d uplink datagram(s) waiting to be sent, press <enter> to try again.\n", journal.getPendingCount());
+                        }
                         
-                        // Check for any downlink data
-                        // Set datagramLen to the maximum size we can receive
-                        datagramLen = sizeof (datagram);
-                        datagramLen = pModem->receive (datagram, datagramLen);
-                        
-                        if (datagramLen > 0)
+                        if (asyncReceive)
                         {
-                            printf ("Datagam received from network: \"%.*s\".\n", datagramLen, datagram);
+                            // Collect all the downlink data that has arrived,
+                            // reading the modem first in case there is no
+                            // reader thread to have done so
+                            pModem->serviceSends();
+                            while ((datagramLen = pModem->getDownlink (datagram, sizeof (datagram))) > 0)
+                            {
+                                printf ("Datagam received from network: \"%.*s\".\n", datagramLen, datagram);
+                            }
+                        }
+                        else
+                        {
+                            // Collect all the downlink data that the module is holding,
+                            // a batch at a time
+                            do
+                            {
+                                numDownlinks = pModem->receiveBatch (downlinkArena, sizeof (downlinkArena),
+                                                                     downlinks, DOWNLINK_BATCH);
+                                for (uint32_t x = 0; x < numDownlinks; x++)
+                                {
+                                    printf ("Datagam received from network: \"%.*s\".\n", (int) downlinks[x].size, downlinks[x].pData);
+                                }
+                            } while (numDownlinks == DOWNLINK_BATCH);
                         }
                     }
+                    if ((pAggregator != NULL) && !pAggregator->flush())
+                    {
+                        printf ("!!! Failed to send uplink datagram.\n");
+                    }
+                    delete pAggregator;
                     printf ("Exitting.\n");
                 }
                 else
@@ -138,18 +413,47 @@ int main(int argc, char* argv[])
             {
                 printf ("!!! Failed to connect to the network.\n");
             }
+
+            delete pModem;
+            if ((pCaptureTransport != NULL) && !pCaptureTransport->close())
+            {
+                printf ("!!! Unable to write all of the capture to %s.\n", pCaptureFile);
+            }
+            delete pCaptureTransport;
+            delete pSerialPort;
+            delete pTcpTransport;
+#if TRACE_ENABLED
+            if (traceDump(TRACE_FILE_NAME))
+            {
+                printf ("Trace written to %s.\n", TRACE_FILE_NAME);
+            }
+            else
+            {
+                printf ("!!! Unable to write trace to %s.\n", TRACE_FILE_NAME);
+            }
+#endif
         }
         else
         {
-            printf ("!!! Unable to connect serial port '%s'.\n", portString);
+            printf ("!!! Unable to connect to port '%s'.\n", portString);
+            delete pSerialPort;
+            delete pTcpTransport;
         }
     }
     else
     {
         printf("Usage:\n");
-        printf("%s [-s] <port>\n", pExeName);
+        printf("%s [-s] [-z] [-a] [-c capture_file] [-j journal_file] <port>\n", pExeName);
         printf("...where -s is used to indicate that Soft Radio is being used and <port> is\n");
-        printf("the serial port where the AT interface of the NBIoT modem can be found.\n");
+        printf("the serial port where the AT interface of the NBIoT modem can be found or\n");
+        printf("%s<host>:<port> for a terminal server that it is on.  -z compresses and -a\n", TCP_PORT_PREFIX);
+        printf("aggregates uplink datagrams; -c captures everything to and from the module\n");
+        printf("in capture_file, for the at_replay tool; -j keeps uplink datagrams in\n");
+        printf("journal_file until they are sent, so that those that fail are sent again.\n");
+#ifdef _WIN32
         printf("For example: %s -s COM1\n\n", pExeName);
+#else
+        printf("For example: %s -s /dev/ttyUSB0\n\n", pExeName);
+#endif
     }
 }
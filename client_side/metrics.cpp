@@ -0,0 +1,299 @@
+// Metrics for the NB-IoT example application
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+#include "metrics.h"
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+// The names of the types of AT command, in MetricsCommand order.
+static const char * const gCommandNames[METRICS_NUM_COMMANDS] = {"NAS", "RAS", "SMI", "NMI", "MGS", "MGR", "MQS", "other"};
+
+// The names of the outcomes, in MetricsOutcome order.
+static const char * const gOutcomeNames[METRICS_NUM_OUTCOMES] = {"ok", "error", "timeout"};
+
+// The percentiles exported by exportText().
+static const double gExportPercentiles[] = {50, 90, 99, 99.9};
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Return the position of the most significant set bit of a non-zero value.
+static inline uint32_t mostSignificantBit(uint32_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+
+    _BitScanReverse(&index, value);
+
+    return index;
+#else
+    return 31 - __builtin_clz(value);
+#endif
+}
+
+// Append printf-style output to pBuf, of lenBuf characters, at *pLen,
+// moving *pLen on; output that doesn't fit is dropped.
+static void appendText(char * pBuf, uint32_t lenBuf, uint32_t * pLen, const char * pFormat, ...)
+{
+    va_list args;
+    int written;
+
+    if (*pLen + 1 < lenBuf)
+    {
+        va_start(args, pFormat);
+        written = vsnprintf(pBuf + *pLen, lenBuf - *pLen, pFormat, args);
+        va_end(args);
+        if (written > 0)
+        {
+            *pLen += ((uint32_t) written < lenBuf - *pLen) ? (uint32_t) written : lenBuf - *pLen - 1;
+        }
+    }
+}
+
+// ----------------------------------------------------------------
+// PROTECTED FUNCTIONS
+// ----------------------------------------------------------------
+
+// Return the histogram bucket for a latency: values below
+// METRICS_SUB_BUCKETS have a bucket each, above that each power of
+// two is split into METRICS_SUB_BUCKETS by the bits below the top one.
+uint32_t Metrics::getBucket(uint32_t latencyUs)
+{
+    uint32_t bucket = latencyUs;
+    uint32_t msb;
+
+    if (latencyUs >= METRICS_SUB_BUCKETS)
+    {
+        msb = mostSignificantBit(latencyUs);
+        bucket = (msb - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS +
+                 (latencyUs >> (msb - METRICS_SUB_BUCKET_BITS)) - METRICS_SUB_BUCKETS;
+    }
+
+    return bucket;
+}
+
+// Return the highest latency that falls in a histogram bucket.
+uint32_t Metrics::getBucketMaxUs(uint32_t bucket)
+{
+    uint32_t next = bucket + 1;
+    uint32_t group = next / METRICS_SUB_BUCKETS;
+    uint32_t maxUs = 0xFFFFFFFF;
+
+    if (next < METRICS_HISTOGRAM_BUCKETS)
+    {
+        // One less than the lowest latency in the next bucket
+        if (group == 0)
+        {
+            maxUs = next - 1;
+        }
+        else
+        {
+            maxUs = ((METRICS_SUB_BUCKETS + (next % METRICS_SUB_BUCKETS)) << (group - 1)) - 1;
+        }
+    }
+
+    return maxUs;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor
+Metrics::Metrics()
+{
+    reset();
+}
+
+// Record an AT command
+void Metrics::recordCommand(MetricsCommand command, MetricsOutcome outcome, uint32_t latencyUs)
+{
+    CommandMetrics * pCommand = &gCommands[command];
+    uint32_t maxUs = pCommand->maxUs.load(std::memory_order_relaxed);
+
+    pCommand->count[outcome].fetch_add(1, std::memory_order_relaxed);
+    pCommand->totalUs.fetch_add(latencyUs, std::memory_order_relaxed);
+    pCommand->buckets[getBucket(latencyUs)].fetch_add(1, std::memory_order_relaxed);
+    while ((latencyUs > maxUs) &&
+           !pCommand->maxUs.compare_exchange_weak(maxUs, latencyUs, std::memory_order_relaxed)) {}
+}
+
+// Count bytes read
+void Metrics::addBytesIn(uint32_t bytes)
+{
+    gBytesIn.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// Count bytes written
+void Metrics::addBytesOut(uint32_t bytes)
+{
+    gBytesOut.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// Take a copy of everything
+void Metrics::snapshot(MetricsSnapshot * pSnapshot)
+{
+    for (uint32_t c = 0; c < METRICS_NUM_COMMANDS; c++)
+    {
+        for (uint32_t o = 0; o < METRICS_NUM_OUTCOMES; o++)
+        {
+            pSnapshot->commands[c].count[o] = gCommands[c].count[o].load(std::memory_order_relaxed);
+        }
+        pSnapshot->commands[c].totalUs = gCommands[c].totalUs.load(std::memory_order_relaxed);
+        pSnapshot->commands[c].maxUs = gCommands[c].maxUs.load(std::memory_order_relaxed);
+        for (uint32_t b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++)
+        {
+            pSnapshot->commands[c].buckets[b] = gCommands[c].buckets[b].load(std::memory_order_relaxed);
+        }
+    }
+    pSnapshot->bytesIn = gBytesIn.load(std::memory_order_relaxed);
+    pSnapshot->bytesOut = gBytesOut.load(std::memory_order_relaxed);
+}
+
+// Zero everything
+void Metrics::reset()
+{
+    for (uint32_t c = 0; c < METRICS_NUM_COMMANDS; c++)
+    {
+        for (uint32_t o = 0; o < METRICS_NUM_OUTCOMES; o++)
+        {
+            gCommands[c].count[o] = 0;
+        }
+        gCommands[c].totalUs = 0;
+        gCommands[c].maxUs = 0;
+        for (uint32_t b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++)
+        {
+            gCommands[c].buckets[b] = 0;
+        }
+    }
+    gBytesIn = 0;
+    gBytesOut = 0;
+}
+
+// Work out the type of an AT command from its response prefix
+MetricsCommand Metrics::commandFromResponsePrefix(const char * pResponsePrefix)
+{
+    MetricsCommand command = METRICS_COMMAND_OTHER;
+
+    if ((pResponsePrefix != NULL) && (pResponsePrefix[0] == '+'))
+    {
+        for (uint32_t x = 0; x < METRICS_COMMAND_OTHER; x++)
+        {
+            if (strncmp(pResponsePrefix + 1, gCommandNames[x], 3) == 0)
+            {
+                command = (MetricsCommand) x;
+            }
+        }
+    }
+
+    return command;
+}
+
+// Return the name of a type of AT command
+const char * Metrics::getCommandName(MetricsCommand command)
+{
+    const char * pName = NULL;
+
+    if (command < METRICS_NUM_COMMANDS)
+    {
+        pName = gCommandNames[command];
+    }
+
+    return pName;
+}
+
+// Work out a percentile from a histogram
+uint32_t Metrics::getPercentileUs(const MetricsCommandSnapshot * pCommand, double percentile)
+{
+    uint64_t total = 0;
+    uint64_t target;
+    uint64_t count = 0;
+    uint32_t latencyUs = 0;
+    bool found = false;
+
+    for (uint32_t b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++)
+    {
+        total += pCommand->buckets[b];
+    }
+
+    if (total > 0)
+    {
+        // The position of the value wanted, counting from one
+        target = (uint64_t) (total * percentile / 100 + 0.999999);
+        if (target < 1)
+        {
+            target = 1;
+        }
+        for (uint32_t b = 0; (b < METRICS_HISTOGRAM_BUCKETS) && !found; b++)
+        {
+            count += pCommand->buckets[b];
+            if (count >= target)
+            {
+                latencyUs = getBucketMaxUs(b);
+                found = true;
+            }
+        }
+        if (latencyUs > pCommand->maxUs)
+        {
+            latencyUs = pCommand->maxUs;
+        }
+    }
+
+    return latencyUs;
+}
+
+// Write a snapshot out as text
+uint32_t Metrics::exportText(const MetricsSnapshot * pSnapshot, char * pBuf, uint32_t lenBuf)
+{
+    uint32_t len = 0;
+    const MetricsCommandSnapshot * pCommand;
+    uint32_t count;
+
+    if (lenBuf > 0)
+    {
+        pBuf[0] = 0;
+        for (uint32_t c = 0; c < METRICS_NUM_COMMANDS; c++)
+        {
+            pCommand = &pSnapshot->commands[c];
+            count = 0;
+            for (uint32_t o = 0; o < METRICS_NUM_OUTCOMES; o++)
+            {
+                count += pCommand->count[o];
+            }
+            if (count > 0)
+            {
+                for (uint32_t o = 0; o < METRICS_NUM_OUTCOMES; o++)
+                {
+                    appendText(pBuf, lenBuf, &len, "nbiot_at_commands_total{command=\"%s\",outcome=\"%s\"} %u\n",
+                               gCommandNames[c], gOutcomeNames[o], pCommand->count[o]);
+                }
+                for (uint32_t p = 0; p < sizeof (gExportPercentiles) / sizeof (gExportPercentiles[0]); p++)
+                {
+                    appendText(pBuf, lenBuf, &len, "nbiot_at_command_latency_us{command=\"%s\",quantile=\"%g\"} %u\n",
+                               gCommandNames[c], gExportPercentiles[p] / 100, getPercentileUs(pCommand, gExportPercentiles[p]));
+                }
+                appendText(pBuf, lenBuf, &len, "nbiot_at_command_latency_us_sum{command=\"%s\"} %llu\n",
+                           gCommandNames[c], (unsigned long long) pCommand->totalUs);
+                appendText(pBuf, lenBuf, &len, "nbiot_at_command_latency_us_count{command=\"%s\"} %u\n",
+                           gCommandNames[c], count);
+                appendText(pBuf, lenBuf, &len, "nbiot_at_command_latency_max_us{command=\"%s\"} %u\n",
+                           gCommandNames[c], pCommand->maxUs);
+            }
+        }
+        appendText(pBuf, lenBuf, &len, "nbiot_bytes_in_total %llu\n", (unsigned long long) pSnapshot->bytesIn);
+        appendText(pBuf, lenBuf, &len, "nbiot_bytes_out_total %llu\n", (unsigned long long) pSnapshot->bytesOut);
+    }
+
+    return len;
+}
+
+// End Of File
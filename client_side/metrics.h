@@ -0,0 +1,146 @@
+// Metrics for the NB-IoT example application
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// Each power of two of latency is split into 2 ^ METRICS_SUB_BUCKET_BITS
+// buckets, so a latency is known to within 1 part in that many
+#define METRICS_SUB_BUCKET_BITS 4
+
+// The number of buckets in each power of two
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+
+// The number of buckets in a latency histogram, enough to cover
+// every uint32_t number of microseconds
+#define METRICS_HISTOGRAM_BUCKETS ((32 - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS)
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// The types of AT command that are measured.
+typedef enum
+{
+    METRICS_COMMAND_NAS,
+    METRICS_COMMAND_RAS,
+    METRICS_COMMAND_SMI,
+    METRICS_COMMAND_NMI,
+    METRICS_COMMAND_MGS,
+    METRICS_COMMAND_MGR,
+    METRICS_COMMAND_MQS,
+    METRICS_COMMAND_OTHER,
+    METRICS_NUM_COMMANDS
+} MetricsCommand;
+
+// How an AT command ended.
+typedef enum
+{
+    METRICS_OUTCOME_OK,      // The final response was "OK" or the one expected
+    METRICS_OUTCOME_ERROR,   // The final response was "ERROR"
+    METRICS_OUTCOME_TIMEOUT, // It was abandoned without a final response
+    METRICS_NUM_OUTCOMES
+} MetricsOutcome;
+
+// A copy of the measurements of one type of AT command.
+typedef struct
+{
+    uint32_t count[METRICS_NUM_OUTCOMES];
+    uint64_t totalUs;
+    uint32_t maxUs;
+    uint32_t buckets[METRICS_HISTOGRAM_BUCKETS];
+} MetricsCommandSnapshot;
+
+// A copy of all the measurements, from Metrics::snapshot().
+typedef struct
+{
+    MetricsCommandSnapshot commands[METRICS_NUM_COMMANDS];
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+} MetricsSnapshot;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// Counters and latency histograms for the AT commands sent to a modem,
+// from the command being written to its final response, plus the bytes
+// written to and read from the modem.  The histograms are log-linear
+// (as HdrHistogram): 2 ^ METRICS_SUB_BUCKET_BITS buckets per power of two
+// microseconds.  Every update is a relaxed atomic increment, so any thread
+// may record and any thread may take a snapshot, without locking; a
+// snapshot taken while updates are going on may be a count or two out
+// between its fields but is never torn within one.
+class Metrics
+{
+public:
+    // Constructor.
+    Metrics ();
+
+    // Record that an AT command of the given type ended with outcome,
+    // latencyUs after it was written.
+    void recordCommand (MetricsCommand command, MetricsOutcome outcome, uint32_t latencyUs);
+
+    // Count bytes read from the modem.
+    void addBytesIn (uint32_t bytes);
+
+    // Count bytes written to the modem.
+    void addBytesOut (uint32_t bytes);
+
+    // Copy everything measured so far into pSnapshot.
+    void snapshot (MetricsSnapshot * pSnapshot);
+
+    // Zero everything.
+    void reset ();
+
+    // Return the type of the AT command whose responses begin with
+    // pResponsePrefix, e.g. METRICS_COMMAND_MGS for "+MGS:".
+    static MetricsCommand commandFromResponsePrefix (const char * pResponsePrefix);
+
+    // Return the name of a type of AT command, e.g. "MGS".
+    static const char * getCommandName (MetricsCommand command);
+
+    // Return the latency in microseconds below which the given
+    // percentage (0 to 100) of the commands in pCommand completed,
+    // to the resolution of the histogram.
+    static uint32_t getPercentileUs (const MetricsCommandSnapshot * pCommand, double percentile);
+
+    // Write pSnapshot into pBuf, up to lenBuf characters including a
+    // null terminator, one "name{labels} value" line per measurement (the
+    // Prometheus text format), returning the number of characters written
+    // not counting the terminator.  Only commands that have been sent
+    // appear.
+    static uint32_t exportText (const MetricsSnapshot * pSnapshot, char * pBuf, uint32_t lenBuf);
+
+protected:
+    // The measurements of one type of AT command.
+    typedef struct
+    {
+        std::atomic<uint32_t> count[METRICS_NUM_OUTCOMES];
+        std::atomic<uint64_t> totalUs;
+        std::atomic<uint32_t> maxUs;
+        std::atomic<uint32_t> buckets[METRICS_HISTOGRAM_BUCKETS];
+    } CommandMetrics;
+
+    // The measurements of each type of AT command.
+    CommandMetrics gCommands[METRICS_NUM_COMMANDS];
+
+    // Bytes read from and written to the modem.
+    std::atomic<uint64_t> gBytesIn;
+    std::atomic<uint64_t> gBytesOut;
+
+    // Return the histogram bucket for a latency.
+    static uint32_t getBucket (uint32_t latencyUs);
+
+    // Return the highest latency that falls in a histogram bucket.
+    static uint32_t getBucketMaxUs (uint32_t bucket);
+};
+
+#endif
+
+// End Of File
@@ -2,385 +2,1674 @@
 
 #include <stdint.h>
 #include <stdio.h>
-#include <time.h>
-#include <windows.h>
+#include <string.h>
+#include "platform.h"
 #include "utilities.h"
+#include "logging.h"
+#include "trace.h"
+#include "transport.h"
 #include "serial_driver.h"
+#include "line_buffer.h"
+#include "spsc_queue.h"
+#include "at_dispatcher.h"
+#include "metrics.h"
+#include "timer_wheel.h"
 #include "modem_driver.h"
 
 // ----------------------------------------------------------------
 // COMPILE-TIME CONSTANTS
 // ----------------------------------------------------------------
 
-// At the end of all AT strings there is a...
-#define AT_TERMINATOR "\r\n"
-
-// Wait between polling the NB-IoT module AT interface
+// The longest time to block waiting for characters from the NB-IoT
+// module AT interface before re-checking for a timeout; the wait
+// ends as soon as characters arrive
 #define AT_RX_POLL_TIMER_MS 100
 
-// OK
-#define AT_OK "OK\r\n"
+// The start of a +NMI notification carrying a datagram
+#define AT_NMI_PREFIX "+NMI:"
+
+// The notification that an uplink datagram has been sent
+#define AT_SMI_SENT "+SMI:SENT\r\n"
+
+// The start of the AT command that sends a datagram
+#define AT_MGS_COMMAND "AT+MGS="
+
+// What separates the size from the hex data in AT+MGS
+#define AT_MGS_SEPARATOR ", "
+
+// The command that collects a downlink datagram
+#define AT_MGR_COMMAND "AT+MGR" AT_TERMINATOR
+
+// The start of the answer to AT+MGR
+#define AT_MGR_PREFIX "+MGR:"
+
+// The line that ends the answer to AT+MGR
+#define AT_MGR_OK "+MGR:OK\r\n"
+
+// The start of the answer to AT+MQS, up to the number buffered
+#define AT_MQS_BUFFERED "+MQS:BUFFERED="
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Read the decimal number at *pOffset in the len characters at pBuf into
+// pValue, moving *pOffset past it.  Returns false if there is no digit
+// there.
+static bool parseDecimal(const char * pBuf, uint32_t len, uint32_t * pOffset, uint32_t * pValue)
+{
+    uint32_t start = *pOffset;
+    uint32_t value = 0;
+
+    while ((*pOffset < len) && (pBuf[*pOffset] >= '0') && (pBuf[*pOffset] <= '9'))
+    {
+        value = value * 10 + pBuf[*pOffset] - '0';
+        (*pOffset)++;
+    }
+    *pValue = value;
 
-// ERROR
-#define AT_ERROR "ERROR\r\n"
+    return (*pOffset > start);
+}
 
 // ----------------------------------------------------------------
 // PROTECTED FUNCTIONS
 // ----------------------------------------------------------------
 
-// Send a string, printf()-wise, to the NB-IoT module
-uint32_t Nbiot::sendPrintf(const char * pFormat, ...)
+// Send a string to the NB-IoT module
+bool Nbiot::sendString(const char * pString)
 {
-    va_list args;
     bool success = false;
-    uint32_t len = 0;
 
     if (gInitialised)
     {
-        va_start(args, pFormat);
-        len = vsnprintf(gTxBuf, sizeof(gTxBuf), pFormat, args);
-        va_end(args);
-
-        printf("Sending to module %s", gTxBuf);
-        success = gpSerialPort->transmitBuffer((const char *) gTxBuf, len);
+        LOG_DEBUG ("Sending to module %s", pString);
+        success = gpTransport->transmitBuffer(pString, strlen (pString));
+        if (success)
+        {
+            TRACE(TRACE_EVENT_TX, pString, strlen (pString));
+#if METRICS_ENABLED
+            gMetrics.addBytesOut(strlen (pString));
+#endif
+        }
     }
 
     return success;
 }
 
-// Get characters (up to lenBuf of them) from the NB-IoT module into pBuf.
-// If an AT terminator is found, or lenBuf characters have been read,
-// return a count of the number of characters (including the AT terminator),
-// otherwise return 0.
-uint32_t Nbiot::getLine(char * pBuf, uint32_t lenBuf)
+// Get a line from the NB-IoT module, pulling in whatever characters
+// are available from the transport in a single read.  If an AT
+// terminator is found, or the receive buffer is full, point ppLine
+// at the line and return a count of the number of characters
+// (including the AT terminator), otherwise return 0.
+uint32_t Nbiot::getLine(const char ** ppLine)
 {
-    int32_t x;
     uint32_t returnLen = 0;
+    uint32_t space;
+    uint32_t len;
+    char * pWrite;
 
     if (gInitialised)
     {
-        if (gLenRx < lenBuf)
+        returnLen = gRxLineBuffer.getLine(ppLine);
+        if (returnLen == 0)
         {
-            do
+            // Nothing complete buffered, read what has arrived
+            pWrite = gRxLineBuffer.getWritePointer(&space);
+            len = gpTransport->receiveBuffer(pWrite, space);
+            if (len > 0)
             {
-                x = gpSerialPort->receiveChar();
-
-                // If something was received, add it to the buffer
-                // and check if a terminator has landed
-                if (x >= 0)
-                {
-                    *(pBuf + gLenRx) = (char) x;
-                    gLenRx++;
-                    
-                    if (x == AT_TERMINATOR[gMatched])
-                    {
-                        gMatched++;
-                    }
-                    else
-                    {
-                        gMatched = 0;
-                    }
-                }
-            } while ((x >= 0) && (gLenRx < lenBuf) && (gMatched < sizeof(AT_TERMINATOR) - 1));        
+#if METRICS_ENABLED
+                gMetrics.addBytesIn(len);
+#endif
+                gRxLineBuffer.commit(len);
+                returnLen = gRxLineBuffer.getLine(ppLine);
+            }
         }
-        
-        if ((gMatched == sizeof(AT_TERMINATOR) - 1) || (gLenRx == lenBuf)) // -1 to omit 0 of string
-        {
-            // A terminator has been found, or we've hit a buffer limit, so let the caller know to
-            // handle the line and reset the tracking variables for next time
-            returnLen = gLenRx;
-            gLenRx = 0;
-            gMatched = 0;
-        }    
     }
     
     return returnLen;
 }
 
 // Callback to handle AT stuff received from the NBIoT module
-void Nbiot::rxTick()
+bool Nbiot::rxTick()
 {
-    uint32_t len = getLine (gRxBuf, sizeof (gRxBuf));
+    const char * pLine = NULL;
+    uint32_t len = 0;
+    bool isResponse = false;
+    const uint32_t * pRecord;
 
-    if (len > sizeof(AT_TERMINATOR) - 1) // -1 to omit NULL terminator
+    if (gAsyncReceive)
+    {
+        // The reader thread owns the modem and has already dispatched
+        // everything; note how far it had got and take any response
+        // to the outstanding command that it has passed over
+        gRxEventsSeen = gRxEvents;
+        pRecord = (const uint32_t *) gRxLineQueue.getReadRecord();
+        if (pRecord != NULL)
+        {
+            len = *pRecord;
+            memcpy (gpRxLineCopy, pRecord + 1, len);
+            gRxLineQueue.pop();
+            pLine = gpRxLineCopy;
+            isResponse = true;
+        }
+    }
+    else
+    {
+        len = getLine (&pLine);
+        isResponse = (len > sizeof(AT_TERMINATOR) - 1) && // -1 to omit NULL terminator
+                     (gDispatcher.dispatch (pLine, len) == AtDispatcher::DISPATCH_COMMAND);
+    }
+
+    if (isResponse)
     {
-        printf ("RxTick received %d characters from module: \"%.*s\".\r\n", (int) (len - (sizeof(AT_TERMINATOR) - 1)), (int) (len - (sizeof(AT_TERMINATOR) - 1)), gRxBuf);
+        TRACE(TRACE_EVENT_RX_RESPONSE, pLine, len);
+        LOG_DEBUG ("RxTick received %d characters from module: \"%.*s\".\r\n", (int) (len - (sizeof(AT_TERMINATOR) - 1)), (int) (len - (sizeof(AT_TERMINATOR) - 1)), pLine);
         if (gpResponse == NULL)
         {
            gLenResponse = len;
-           gpResponse = gRxBuf;
+           gpResponse = pLine;
         }
     }
+
+    return (len > 0);
 }
 
-// Wait for an AT response.  If pExpected is not NULL and the
-// AT response string begins with this string then say so, else
-// wait for the standard "OK" or "ERROR" responses for a little
-// while, else time out. The response string is copied into
-// gpResponse if it is non-NULL (and a null terminator is added).
-Nbiot::AtResponse Nbiot::waitResponse(const char * pExpected, time_t timeoutSeconds, char * pResponseBuf, uint32_t responseBufLen)
+// Wait for something to arrive from the NB-IoT module: straight from
+// the transport or, when receiving asynchronously, from the reader
+// thread.
+void Nbiot::waitRx(uint32_t timeoutMs)
 {
-    AtResponse response = AT_RESPONSE_NONE;
-    time_t startTime = time(NULL);
+#if READER_THREAD_ENABLED
+    if (gAsyncReceive)
+    {
+        std::unique_lock<std::mutex> lock(gRxLineMutex);
+        gRxLineSignal.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                               [this] {return (gRxLineQueue.getCount() > 0) || (gRxEvents != gRxEventsSeen);});
+    }
+    else
+#endif
+    if (gpTransport != NULL)
+    {
+        gpTransport->waitReadable(timeoutMs);
+    }
+    else
+    {
+        sleepMs(timeoutMs);
+    }
+}
 
-    if (gpResponse != NULL)
+// Handle a line that the dispatcher has not matched to the outstanding
+// command or to a URC.
+void Nbiot::unsolicitedHandler(void * pContext, const char * pLine, uint32_t len)
+{
+    (void) pContext;
+
+    if (len > sizeof(AT_TERMINATOR) - 1) // -1 to omit NULL terminator
     {
-        printf ("ERROR: response from module not cleared from last time.\n");
-        gpResponse = NULL;
+        TRACE(TRACE_EVENT_RX_URC, pLine, len);
+        LOG_DEBUG ("Unsolicited %d characters from module: \"%.*s\".\r\n", (int) (len - (sizeof(AT_TERMINATOR) - 1)), (int) (len - (sizeof(AT_TERMINATOR) - 1)), pLine);
     }
+}
 
-    do {
-        rxTick();
+// URC handler for +NMI.
+void Nbiot::nmiHandler(void * pContext, const char * pLine, uint32_t len)
+{
+    if (!((Nbiot *) pContext)->handleNmi(pLine, len))
+    {
+        unsolicitedHandler(pContext, pLine, len);
+    }
+}
 
-        if (gpResponse != NULL)
+// URC handler for +SMI:SENT.
+void Nbiot::sentHandler(void * pContext, const char * pLine, uint32_t len)
+{
+    Nbiot * pThis = (Nbiot *) pContext;
+
+    if ((len == sizeof(AT_SMI_SENT) - 1) && (memcmp (pLine, AT_SMI_SENT, len) == 0)) // -1 to omit 0 of string
+    {
+        LOG_DEBUG ("Modem reports datagram SENT.\r\n");
+        pThis->gSentCount++;
+    }
+    else
+    {
+        unsolicitedHandler(pContext, pLine, len);
+    }
+}
+
+// URC handler for unsolicited registration reports, e.g. +CEREG.
+void Nbiot::registrationHandler(void * pContext, const char * pLine, uint32_t len)
+{
+    // Any change is a reason to check again straight away
+    ((Nbiot *) pContext)->gRegistrationEvents++;
+    unsolicitedHandler(pContext, pLine, len);
+}
+
+// Timer callback: the module has not answered AT+MGS.
+void Nbiot::submitTimeout(void * pContext, uint32_t param)
+{
+    Nbiot * pThis = (Nbiot *) pContext;
+
+    (void) param;
+
+    if (pThis->gSubmitState != SUBMIT_IDLE)
+    {
+        pThis->submitDone(false);
+    }
+}
+
+// Timer callback: a datagram the module accepted has not been
+// reported SENT.  Should the notification turn up after all it will
+// be matched to the next datagram: the module gives no way of
+// telling which datagram a notification is for.
+void Nbiot::sentTimeout(void * pContext, uint32_t param)
+{
+    Nbiot * pThis = (Nbiot *) pContext;
+    SendSlot * pSlot = &pThis->gpSendSlots[param & (pThis->gSendQueueLength - 1)];
+
+    if ((pSlot->ticket == param) && (pSlot->status == SEND_STATUS_SUBMITTED))
+    {
+        pSlot->status = SEND_STATUS_FAILED;
+        TRACE_VALUE(TRACE_EVENT_SEND_FAILED, param);
+        LOG_ERROR ("!!! No SENT indication for datagram %d.\r\n", (int) param);
+    }
+}
+
+// Timer callback: a connect command has gone unanswered or, in
+// backoff, the registration check is due.
+void Nbiot::connectStepTimeout(void * pContext, uint32_t param)
+{
+    (void) param;
+    ((Nbiot *) pContext)->gConnectStepDue = true;
+}
+
+// Timer callback: startConnect() has run out of time.
+void Nbiot::connectDeadlineTimeout(void * pContext, uint32_t param)
+{
+    (void) param;
+    ((Nbiot *) pContext)->gConnectDeadlinePassed = true;
+}
+
+// Check for a +NMI notification, "+NMI:<length>,<hex data>", and
+// if it is one queue the datagram it carries.
+bool Nbiot::handleNmi(const char * pLine, uint32_t len)
+{
+    bool isNmi = false;
+    uint32_t x = sizeof (AT_NMI_PREFIX) - 1; // -1 to omit 0 of string
+    uint32_t reportedSize = 0;
+    uint32_t * pRecord;
+
+    // Only a prefix followed by a length is a datagram, "+NMI:OK" is not
+    if ((len > x) && (memcmp (pLine, AT_NMI_PREFIX, x) == 0) && parseDecimal (pLine, len, &x, &reportedSize))
+    {
+        if ((x < len) && (pLine[x] == ','))
         {
-            // Got a line, process it
-            if ((strncmp(gpResponse, AT_OK, gLenResponse) == 0) && (gLenResponse == (sizeof (AT_OK) - 1))) // -1 to omit 0 of string
-            {
-                response = AT_RESPONSE_OK;
-            }
-            else if ((strncmp(gpResponse, AT_ERROR, gLenResponse) == 0) && (gLenResponse == (sizeof (AT_ERROR) - 1))) // -1 to omit 0 of string
+            isNmi = true;
+            x++;
+            // A line too long for the buffer is handed over without
+            // its terminator
+            if ((len - x >= sizeof (AT_TERMINATOR) - 1) &&
+                (memcmp (pLine + len - (sizeof (AT_TERMINATOR) - 1), AT_TERMINATOR, sizeof (AT_TERMINATOR) - 1) == 0)) // -1 to omit 0 of string
             {
-                response = AT_RESPONSE_ERROR;
+                len -= sizeof (AT_TERMINATOR) - 1;
             }
-            else if ((pExpected != NULL) && (gLenResponse >= strlen (pExpected)) && (strcmp(gpResponse, pExpected) >= 0))
+            pRecord = (uint32_t *) gDownlinkQueue.getWriteRecord();
+            if (pRecord != NULL)
             {
-                response = AT_RESPONSE_STARTS_AS_EXPECTED;
-                if (pResponseBuf != NULL)
+                *pRecord = hexStringToBytes (pLine + x, len - x, (char *) (pRecord + 1), gMaxDatagram);
+                if (*pRecord != reportedSize)
                 {
-                    // Copy the response string into pResponseBuf, with a terminator
-                    if (gLenResponse > responseBufLen - 1)
-                    {
-                        gLenResponse = responseBufLen - 1;
-                    }
-                    memcpy (pResponseBuf, gpResponse, gLenResponse);
-                    pResponseBuf[gLenResponse] = 0;
+                    LOG_WARNING ("WARNING: +NMI reported %d byte(s) but carried %d.\n", (int) reportedSize, (int) *pRecord);
                 }
+                TRACE(TRACE_EVENT_DOWNLINK, (char *) (pRecord + 1), *pRecord);
+                gDownlinkQueue.push();
             }
             else
             {
-                if (pExpected != NULL)
+                gDownlinkDropped++;
+                LOG_WARNING ("WARNING: downlink queue full, datagram of %d byte(s) lost.\n", (int) reportedSize);
+            }
+        }
+    }
+
+    return isNmi;
+}
+
+#if READER_THREAD_ENABLED
+// The reader thread: reads everything from the modem and dispatches
+// it, so URCs (e.g. datagrams in +NMI notifications) are handled here
+// and responses to the outstanding command are passed over to the
+// command side.  It stops if the transport goes away.
+void Nbiot::readerThread()
+{
+    const char * pLine;
+    uint32_t len;
+    uint32_t * pRecord;
+
+    while (gReaderRunning && gpTransport->isConnected())
+    {
+        len = getLine (&pLine);
+        if (len == 0)
+        {
+            gpTransport->waitReadable(AT_RX_POLL_TIMER_MS);
+        }
+        else if (len > sizeof(AT_TERMINATOR) - 1) // -1 to omit NULL terminator
+        {
+            if (gDispatcher.dispatch (pLine, len) == AtDispatcher::DISPATCH_COMMAND)
+            {
+                pRecord = (uint32_t *) gRxLineQueue.getWriteRecord();
+                if (pRecord != NULL)
+                {
+                    *pRecord = len;
+                    memcpy (pRecord + 1, pLine, len);
+                    gRxLineQueue.push();
+                }
+                else
                 {
-                    printf ("WARNING: unexpected response from module.\n");
-                    printf ("Expected: %s... Received: %.*s\r\n", pExpected, (int) gLenResponse, gpResponse);
+                    LOG_WARNING ("WARNING: AT line queue full, \"%.*s\" lost.\n", (int) (len - (sizeof(AT_TERMINATOR) - 1)), pLine);
                 }
-                // Reset response pointer
-                gpResponse = NULL;
             }
+
+            // Wake the command side: either there is a response for it
+            // or a URC handler may have done something it is waiting for
+            gRxEvents++;
+            {
+                std::lock_guard<std::mutex> lock(gRxLineMutex);
+            }
+            gRxLineSignal.notify_one();
         }
+    }
 
-        if (gpResponse == NULL)
+    if (gReaderRunning)
+    {
+        LOG_ERROR ("!!! Lost the module, nothing more will be received from it.\n");
+    }
+}
+#endif
+
+// Get ready to send an AT command whose responses begin with
+// pResponsePrefix (or are "OK" or "ERROR").
+void Nbiot::beginCommand(const char * pResponsePrefix)
+{
+    const char * pLine;
+    uint32_t len;
+
+    // Finish handing over any datagram in progress first
+    while (gSubmitState != SUBMIT_IDLE)
+    {
+        progressSubmit();
+        if (gSubmitState != SUBMIT_IDLE)
         {
-            Sleep(AT_RX_POLL_TIMER_MS);
+            waitRx(AT_RX_POLL_TIMER_MS);
         }
+    }
 
-    } while ((response == AT_RESPONSE_NONE) && ((timeoutSeconds == 0) || (startTime + timeoutSeconds > time(NULL))));
+    if (gAsyncReceive)
+    {
+        // Anything still queued is left over from a command that
+        // has been and gone
+        while (rxTick())
+        {
+            LOG_WARNING ("WARNING: discarding late response from module \"%.*s\".\r\n", (int) gLenResponse, gpResponse);
+            gpResponse = NULL;
+        }
+    }
+    else
+    {
+        // Pass anything already received to the URC/default handlers
+        // now, while no command is outstanding, without waiting
+        while ((len = getLine (&pLine)) > 0)
+        {
+            if (len > sizeof(AT_TERMINATOR) - 1) // -1 to omit NULL terminator
+            {
+                gDispatcher.dispatch (pLine, len);
+            }
+        }
+    }
 
-    // Reset response pointer for next time
-    gpResponse = NULL;
+    gDispatcher.openCommand(pResponsePrefix);
 
-    return response;
+    // The command is written straight after this, so time it from here
+    gCommandOpen = true;
+    gCommandType = Metrics::commandFromResponsePrefix(pResponsePrefix);
+    gCommandOutcome = METRICS_OUTCOME_TIMEOUT;
+    gCommandStartUs = getTimeUs();
 }
 
-static void charToTchar(const char *pIn, TCHAR *pOut, uint32_t size)
+// Finish with the outstanding AT command.
+void Nbiot::endCommand()
 {
-    memset (pOut, 0, size);
-#ifdef _MSC_VER
-    uint32_t size_needed = MultiByteToWideChar(CP_UTF8, 0, pIn, (int)strlen(pIn), NULL, 0);
-    if (size_needed > size)
+    uint32_t latencyUs;
+
+    gDispatcher.closeCommand();
+
+    if (gCommandOpen)
     {
-        size_needed = size;
-    }
-    MultiByteToWideChar(CP_UTF8, 0, pIn, (int)strlen(pIn), pOut, size_needed);
-#else
-    strncpy(pOut, pIn, size);
+        latencyUs = (uint32_t) (getTimeUs() - gCommandStartUs);
+#if METRICS_ENABLED
+        gMetrics.recordCommand(gCommandType, gCommandOutcome, latencyUs);
 #endif
+#if TRACE_ENABLED
+        uint32_t values[] = {gCommandType, gCommandOutcome, latencyUs};
+        TRACE(TRACE_EVENT_COMMAND_END, (const char *) values, sizeof (values));
+#endif
+        (void) latencyUs;
+        gCommandOpen = false;
+    }
 }
 
-// ----------------------------------------------------------------
-// PUBLIC FUNCTIONS
-// ----------------------------------------------------------------
-
-
-// Constructor
-Nbiot::Nbiot(const char * pPortname)
+// Check the response at gpResponse.  If pExpected is not NULL and the
+// AT response string begins with this string then say so, else check
+// for the standard "OK" or "ERROR" responses.  If nothing matches, a
+// warning is printed, gpResponse is reset and AT_RESPONSE_NONE is
+// returned.
+Nbiot::AtResponse Nbiot::matchResponse(const char * pExpected)
 {
-    gpResponse   = NULL;
-    gpSerialPort = NULL;
-    gLenResponse = 0;
-    gMatched = 0;
-    gLenRx = 0;
-    gInitialised = false;
-    gpSerialPort = new SerialPort();
-    TCHAR tcharPortname[MAX_PATH];
-
-    charToTchar(pPortname, tcharPortname, sizeof (tcharPortname));
+    AtResponse response = AT_RESPONSE_NONE;
 
-    if (gpSerialPort)
+    if ((strncmp(gpResponse, AT_OK, gLenResponse) == 0) && (gLenResponse == (sizeof (AT_OK) - 1))) // -1 to omit 0 of string
     {
-        if (gpSerialPort->connect(tcharPortname))
-        {
-            printf ("Connected to port %s.\n", pPortname);
-            gInitialised = true;
-            // Flush out any initialisation messages from the modem
-            waitResponse(NULL, DEFAULT_FLUSH_TIMEOUT_SECONDS);
-        }
-        else
+        response = AT_RESPONSE_OK;
+        gCommandOutcome = METRICS_OUTCOME_OK;
+    }
+    else if ((strncmp(gpResponse, AT_ERROR, gLenResponse) == 0) && (gLenResponse == (sizeof (AT_ERROR) - 1))) // -1 to omit 0 of string
+    {
+        response = AT_RESPONSE_ERROR;
+        gCommandOutcome = METRICS_OUTCOME_ERROR;
+    }
+    else if ((pExpected != NULL) && (gLenResponse >= strlen (pExpected)) && (memcmp(gpResponse, pExpected, strlen (pExpected)) == 0))
+    {
+        response = AT_RESPONSE_STARTS_AS_EXPECTED;
+        gCommandOutcome = METRICS_OUTCOME_OK;
+    }
+    else
+    {
+        if (pExpected != NULL)
         {
-            delete gpSerialPort;
-            printf ("Unable to connect to port %s.\n", pPortname);
+            LOG_WARNING ("WARNING: unexpected response from module.\n");
+            LOG_WARNING ("Expected: %s... Received: %.*s\r\n", pExpected, (int) gLenResponse, gpResponse);
         }
+        // Reset response pointer
+        gpResponse = NULL;
     }
+
+    return response;
 }
 
-// Connect to the network
-bool Nbiot::connect(bool usingSoftRadio, time_t timeoutSeconds)
+// Wait for an AT response.  If pExpected is not NULL and the
+// AT response string begins with this string then say so, pointing
+// ppLine at it if that is not NULL, else wait for the standard "OK"
+// or "ERROR" responses for a little while, else time out; give up
+// early if the transport goes away.
+Nbiot::AtResponse Nbiot::waitResponse(const char * pExpected, uint32_t timeoutMs, const char ** ppLine, uint32_t * pLen)
 {
-    bool success = false;
-    AtResponse response;
-    time_t startTime = time(NULL);
+    AtResponse response = AT_RESPONSE_NONE;
+    int64_t deadlineMs = getTimeMs() + timeoutMs;
+    int64_t waitMs;
+    bool gotLine;
 
-    if (gInitialised)
+    if (gpResponse != NULL)
     {
-        if (timeoutSeconds > 0)
-        {
-            printf ("Checking for connection to network for up to %d seconds...\r\n", (int) timeoutSeconds);
-        }
-        else
-        {
-            printf ("Checking for connection to network...\r\n");
-        }
+        LOG_ERROR ("ERROR: response from module not cleared from last time.\n");
+        gpResponse = NULL;
+    }
 
-        do {
+    do {
+        gotLine = rxTick();
 
-            if (usingSoftRadio)
+        if (gpResponse != NULL)
+        {
+            // Got a line, process it
+            response = matchResponse(pExpected);
+            if ((response == AT_RESPONSE_STARTS_AS_EXPECTED) && (ppLine != NULL))
             {
-                // Check for service at radio level (as SoftRadio
-                // does not support AT+NAS)
-                sendPrintf("AT+RAS%s", AT_TERMINATOR);
-                response = waitResponse("+RAS:CONNECTED\r\n");
+                // Left where it was received, for the caller to parse
+                *ppLine = gpResponse;
+                *pLen = gLenResponse;
             }
-            else
+        }
+
+        if (!gotLine)
+        {
+            // Nothing buffered, sleep until the module sends something
+            waitMs = AT_RX_POLL_TIMER_MS;
+            if ((timeoutMs != 0) && (deadlineMs - getTimeMs() < waitMs))
             {
-                // First check for service using +NAS.
-                sendPrintf("AT+NAS%s", AT_TERMINATOR);
-                response = waitResponse("+NAS: Connected (activated)\r\n");
+                waitMs = deadlineMs - getTimeMs();
             }
-
-            if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
+            if (waitMs > 0)
             {
-                // It worked, but need to also wait for the "OK"
-                waitResponse();
-
-                printf ("Connected to network, setting AT+SMI to 1.\r\n");
+                waitRx((uint32_t) waitMs);
+            }
+        }
 
-                // Set AT+SMI to be 1
-                sendPrintf("AT+SMI=1%s", AT_TERMINATOR);
-                response = waitResponse("+SMI:OK\r\n");
-                if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
-                {
-                    // Absorb the trailing OK.
-                    waitResponse();
+    } while ((response == AT_RESPONSE_NONE) && (gotLine || (gpTransport == NULL) || gpTransport->isConnected()) &&
+             ((timeoutMs == 0) || (getTimeMs() < deadlineMs)));
 
-                    // All done
-                    success = true;
-                    printf ("AT+SMI set to 1.\r\n");
-                }
+    // Reset response pointer for next time
+    gpResponse = NULL;
 
-                // Here we could set up AT+NMI to be 2 and receive
-                // datagrams asynchronously based on +NMI notifications
-                // from the module but this simple example is kept 
-                // deliberately kept single-threaded and so it instead
-                // polls the modem with AT+MGR for downlink messages between
-                // uplink message transmissions.
-            }
-            else
-            {
-                // Didn't work, wait before re-trying
-                Sleep((timeoutSeconds * 1000) / 10);
-            }
-        } while ((!success) && ((timeoutSeconds == 0) || (startTime + timeoutSeconds > time(NULL))));
-    }
-    
-    return success;
+    return response;
 }
 
-// Send a message to the network
-bool Nbiot::send (char * pMsg, uint32_t msgSize, time_t timeoutSeconds)
+// Finish handing a datagram to the module, successfully or otherwise.
+void Nbiot::submitDone(bool success)
 {
-    bool success = false;
-    AtResponse response;
-    uint32_t charCount = 0;
+    SendSlot * pSlot = &gpSendSlots[gSubmitTicket & (gSendQueueLength - 1)];
 
-    // Check that the incoming message, when hex coded (so * 2) is not too big
-    if ((msgSize * 2) <= sizeof(gHexBuf))
+    endCommand();
+    gSubmitState = SUBMIT_IDLE;
+    gTimers.stop(&gSubmitTimer);
+    if (success)
     {
-        charCount = bytesToHexString (pMsg, msgSize, gHexBuf, sizeof(gHexBuf));
-        printf("Sending datagram to network, %d characters: %.*s\r\n", msgSize, (int) msgSize, pMsg);
-        sendPrintf("AT+MGS=%d, %.*s%s", msgSize, charCount, gHexBuf, AT_TERMINATOR);
-
-        // Wait for confirmation
-        response = waitResponse("+MGS:OK\r\n");
-
-        if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
+        pSlot->status = SEND_STATUS_SUBMITTED;
+        if (pSlot->timeoutMs != 0)
         {
-            // It worked, wait for the "OK"
-            waitResponse();
-
-            // Now wait for the SENT indication
-            response = waitResponse("+SMI:SENT\r\n", timeoutSeconds);
-
-            if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
-            {
-                // All done
-                success = true;
-                printf ("Modem reports datagram SENT.\r\n");
-            }
+            gTimers.start(&pSlot->sentTimer, pSlot->timeoutMs);
         }
     }
     else
     {
-        printf ("!!! Datagram is too long (%d characters when only %d bytes can be sent).\r\n", msgSize, (int) (sizeof (gHexBuf) / 2));
+        pSlot->status = SEND_STATUS_FAILED;
+        TRACE_VALUE(TRACE_EVENT_SEND_FAILED, gSubmitTicket);
+        LOG_ERROR ("!!! Module did not accept datagram %d.\r\n", (int) gSubmitTicket);
     }
-
-    return success;
 }
 
-// Receive a message from the network
-uint32_t Nbiot::receive (char * pMsg, uint32_t msgSize, time_t timeoutSeconds)
+// Check a "+MGR:<n>,<hex>" line, decoding up to msgSize bytes of the
+// datagram it carries into pMsg.  The length of the line is known, so
+// the hex is found without searching and decoded where it lies.
+int32_t Nbiot::parseMgr(const char * pLine, uint32_t len, char * pMsg, uint32_t msgSize)
 {
-    int bytesReceived = 0;
-    AtResponse response;
-    char * pHexStart = NULL;
-    char * pHexEnd = NULL;
+    int32_t bytesReceived = -1;
+    uint32_t x = sizeof (AT_MGR_PREFIX) - 1; // -1 to omit 0 of string
+    uint32_t reportedSize;
+    uint32_t carried;
+    uint32_t written;
+    bool whole = true;
 
-    printf("Receiving a datagram of up to %d byte(s) from the network...\r\n", msgSize);
-    sendPrintf("AT+MGR%s", AT_TERMINATOR);
-
-    response = waitResponse("+MGR:", timeoutSeconds, gHexBuf, sizeof (gHexBuf));
+    // A line too long for the buffer is handed over without its terminator
+    if ((len >= sizeof (AT_TERMINATOR) - 1) &&
+        (memcmp (pLine + len - (sizeof (AT_TERMINATOR) - 1), AT_TERMINATOR, sizeof (AT_TERMINATOR) - 1) == 0)) // -1 to omit 0 of string
+    {
+        len -= sizeof (AT_TERMINATOR) - 1;
+    }
 
-    if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
+    if ((len > x) && (memcmp (pLine, AT_MGR_PREFIX, x) == 0) && parseDecimal (pLine, len, &x, &reportedSize) &&
+        (x < len) && (pLine[x] == ','))
     {
-        if (sscanf(gHexBuf, " +MGR:%d,", &bytesReceived) == 1) // The space in the string is significant,
-                                                               // it allows any whitespace characters in the input string
+        x++;
+        carried = (len - x) / 2;
+        if (pMsg != NULL)
         {
-            pHexStart = strchr (gHexBuf, ',');
-            if (pHexStart != NULL)
-            {
-                pHexStart++;
-                pHexEnd = strstr (pHexStart, AT_TERMINATOR);
-                if ((pHexEnd != NULL) && (pMsg != NULL))
-                {
-                    hexStringToBytes (pHexStart, pHexEnd - pHexStart, pMsg, msgSize);
-                }
-            }
-
-            // Wait for the OK at the end
-            response = waitResponse("+MGR:OK\r\n");
+            // hexStringToBytes() skips anything other than hex rather than
+            // stopping at it, so a line with stray characters in it decodes
+            // to fewer bytes than its length says it carries: that shortfall
+            // is what gives it away
+            written = hexStringToBytes (pLine + x, len - x, pMsg, msgSize);
+            whole = (written == ((carried < msgSize) ? carried : msgSize));
         }
+        // A datagram that is cut short, or is not what the module said
+        // it would be, can't be vouched for, so none of it is handed over
+        if (whole && ((len - x) % 2 == 0) && (carried == reportedSize))
+        {
+            bytesReceived = (int32_t) carried;
+        }
+        else
+        {
+            LOG_WARNING ("WARNING: +MGR reported %u byte(s) but carried %u or was not all hex, datagram dropped.\n",
+                         reportedSize, carried);
+        }
+    }
+
+    return bytesReceived;
+}
+
+// Collect a datagram from the module with AT+MGR.
+int32_t Nbiot::readDatagram(char * pMsg, uint32_t msgSize, uint32_t timeoutMs)
+{
+    int32_t bytesReceived = -1;
+    const char * pLine;
+    uint32_t len;
+
+    beginCommand(AT_MGR_PREFIX);
+    sendString(AT_MGR_COMMAND);
+
+    if (waitResponse(AT_MGR_PREFIX, timeoutMs, &pLine, &len) == AT_RESPONSE_STARTS_AS_EXPECTED)
+    {
+        bytesReceived = parseMgr(pLine, len, pMsg, msgSize);
+        // Wait for the OK at the end, which follows a dropped datagram too
+        waitResponse(AT_MGR_OK);
+    }
+    endCommand();
+
+    return bytesReceived;
+}
+
+// Collect several datagrams from the module, writing the AT+MGR
+// commands for them in one go and then reading the answers.
+int32_t Nbiot::readDatagrams(char * pArena, DatagramSpan * pSpans, uint32_t count, uint32_t timeoutMs, bool * pEmpty,
+                             uint32_t * pDropped)
+{
+    char commands[(sizeof (AT_MGR_COMMAND) - 1) * MAX_RECEIVE_PIPELINE_DEPTH + 1];
+    int32_t numDatagrams = 0;
+    int32_t bytesReceived;
+    uint32_t answered = 0;
+    uint32_t used = 0;
+    const char * pLine;
+    uint32_t len;
+    AtResponse response = AT_RESPONSE_OK;
+
+    if (count > gReceivePipelineDepth)
+    {
+        count = gReceivePipelineDepth;
+    }
+    for (uint32_t x = 0; x < count; x++)
+    {
+        memcpy (commands + x * (sizeof (AT_MGR_COMMAND) - 1), AT_MGR_COMMAND, sizeof (AT_MGR_COMMAND) - 1);
+    }
+    commands[count * (sizeof (AT_MGR_COMMAND) - 1)] = 0;
+
+    // The commands are answered in order, so one open command covers
+    // them all and the batch is measured as one
+    beginCommand(AT_MGR_PREFIX);
+    if (!sendString(commands))
+    {
+        response = AT_RESPONSE_NONE;
+    }
+
+    while ((answered < count) && (response != AT_RESPONSE_NONE))
+    {
+        response = waitResponse(AT_MGR_PREFIX, timeoutMs, &pLine, &len);
+        if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
+        {
+            if ((len == sizeof (AT_MGR_OK) - 1) && (memcmp (pLine, AT_MGR_OK, len) == 0)) // -1 to omit 0 of string
+            {
+                answered++;
+            }
+            else if ((uint32_t) numDatagrams < count)
+            {
+                bytesReceived = parseMgr(pLine, len, pArena + used, gMaxDatagram);
+                if (bytesReceived > 0)
+                {
+                    if ((uint32_t) bytesReceived > gMaxDatagram)
+                    {
+                        bytesReceived = (int32_t) gMaxDatagram;
+                    }
+                    pSpans[numDatagrams].pData = pArena + used;
+                    pSpans[numDatagrams].size = (uint32_t) bytesReceived;
+                    used += (uint32_t) bytesReceived;
+                    numDatagrams++;
+                }
+                else if (bytesReceived == 0)
+                {
+                    *pEmpty = true;
+                }
+                else
+                {
+                    (*pDropped)++;
+                }
+            }
+            else
+            {
+                // There is room in pArena and pSpans for count only
+                LOG_WARNING ("WARNING: more datagrams than the %d asked for, one lost.\n", (int) count);
+            }
+        }
+        else if (response != AT_RESPONSE_NONE)
+        {
+            // A plain OK or an ERROR also ends an answer
+            answered++;
+        }
+    }
+    endCommand();
+
+    if ((response == AT_RESPONSE_NONE) && (numDatagrams == 0))
+    {
+        numDatagrams = -1;
+    }
+
+    return numDatagrams;
+}
+
+// Ask the module how many datagrams it is holding, from the
+// "+MQS:BUFFERED=<n>,RECEIVED=<n>,DROPPED=<n>" response to AT+MQS.
+int32_t Nbiot::queryBuffered(uint32_t timeoutMs)
+{
+    int32_t buffered = -1;
+    const char * pLine;
+    uint32_t len;
+    uint32_t x = sizeof (AT_MQS_BUFFERED) - 1; // -1 to omit 0 of string
+    uint32_t value;
+
+    beginCommand("+MQS:");
+    sendString("AT+MQS" AT_TERMINATOR);
+
+    if (waitResponse("+MQS:", timeoutMs, &pLine, &len) == AT_RESPONSE_STARTS_AS_EXPECTED)
+    {
+        if ((len > x) && (memcmp (pLine, AT_MQS_BUFFERED, x) == 0) && parseDecimal (pLine, len, &x, &value))
+        {
+            buffered = (int32_t) value;
+        }
+
+        // Absorb the trailing OK
+        waitResponse();
+    }
+    endCommand();
+
+    return buffered;
+}
+
+// Deal with a response while handing a datagram to the module.
+void Nbiot::submitResponse()
+{
+    AtResponse response;
+
+    if (gSubmitState == SUBMIT_WAIT_MGS_OK)
+    {
+        response = matchResponse("+MGS:OK\r\n");
+        if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
+        {
+            // It worked, wait for the "OK"
+            gSubmitState = SUBMIT_WAIT_OK;
+        }
+        else if (response != AT_RESPONSE_NONE)
+        {
+            submitDone(false);
+        }
+    }
+    else if (gSubmitState == SUBMIT_WAIT_OK)
+    {
+        response = matchResponse(NULL);
+        if (response != AT_RESPONSE_NONE)
+        {
+            submitDone(response == AT_RESPONSE_OK);
+        }
+    }
+}
+
+// Deal with everything that has arrived from the module, without
+// blocking, handing responses to whichever of the connect and
+// submit state machines has a command open.
+void Nbiot::pumpResponses()
+{
+    while (rxTick())
+    {
+        if (gpResponse != NULL)
+        {
+            if (connectBusy())
+            {
+                connectResponse();
+            }
+            else if (gSubmitState != SUBMIT_IDLE)
+            {
+                submitResponse();
+            }
+            gpResponse = NULL;
+        }
+    }
+
+    gTimers.advance(getTimeMs());
+}
+
+// Move along the datagram currently being handed to the module, if
+// there is one, without blocking; gSubmitTimer gives up on it if the
+// module does not answer.
+void Nbiot::progressSubmit()
+{
+    pumpResponses();
+}
+
+// Return true while the connect state machine has a command open.
+bool Nbiot::connectBusy()
+{
+    return (gConnectState != CONNECT_STATE_IDLE) && (gConnectState != CONNECT_STATE_BACKOFF) &&
+           (gConnectState < CONNECT_STATE_CONNECTED);
+}
+
+// Move the connect state machine to a new state.
+void Nbiot::setConnectState(ConnectState newState)
+{
+    gConnectState = newState;
+    if ((newState == CONNECT_STATE_IDLE) || (newState >= CONNECT_STATE_CONNECTED))
+    {
+        gTimers.stop(&gConnectStepTimer);
+        gTimers.stop(&gConnectDeadlineTimer);
+    }
+    TRACE_VALUE(TRACE_EVENT_CONNECT_STATE, newState);
+}
+
+// Send the next command on the way to connecting.
+void Nbiot::connectCommand(ConnectState newState)
+{
+    bool success = false;
+
+    // Any response that led here has been dealt with
+    gpResponse = NULL;
+
+    switch (newState)
+    {
+        case CONNECT_STATE_WAIT_REGISTRATION:
+            // Anything reported from now on is a reason to ask again
+            gRegistrationEventsSeen = gRegistrationEvents;
+            if (gConnectSoftRadio)
+            {
+                // Check for service at radio level (as SoftRadio
+                // does not support AT+NAS)
+                beginCommand("+RAS:");
+                success = sendString("AT+RAS" AT_TERMINATOR);
+            }
+            else
+            {
+                beginCommand("+NAS:");
+                success = sendString("AT+NAS" AT_TERMINATOR);
+            }
+        break;
+        case CONNECT_STATE_WAIT_SMI:
+            // Only +SMI:OK is a response, +SMI:SENT is a URC
+            LOG_INFO ("Connected to network, setting AT+SMI to 1.\r\n");
+            beginCommand("+SMI:OK");
+            success = sendString("AT+SMI=1" AT_TERMINATOR);
+        break;
+        case CONNECT_STATE_WAIT_NMI:
+            // As for AT+SMI, only +NMI:OK is a response, other +NMI
+            // lines are URCs carrying datagrams
+            LOG_INFO ("Setting AT+NMI to 2.\r\n");
+            beginCommand("+NMI:OK");
+            success = sendString("AT+NMI=2" AT_TERMINATOR);
+        break;
+        default:
+        break;
+    }
+
+    setConnectState(newState);
+    gConnectStepDue = false;
+    gTimers.start(&gConnectStepTimer, DEFAULT_RESPONSE_TIMEOUT_MS);
+    if (!success)
+    {
+        endCommand();
+        connectBackoff();
+    }
+}
+
+// Wait before checking registration again.
+void Nbiot::connectBackoff()
+{
+    setConnectState(CONNECT_STATE_BACKOFF);
+    gConnectStepDue = false;
+    gTimers.start(&gConnectStepTimer, gConnectBackoffMs);
+    gConnectBackoffMs *= 2;
+    if (gConnectBackoffMs > gConnectBackoffMaxMs)
+    {
+        gConnectBackoffMs = gConnectBackoffMaxMs;
+    }
+}
+
+// Deal with a response while connecting.
+void Nbiot::connectResponse()
+{
+    AtResponse response;
+
+    switch (gConnectState)
+    {
+        case CONNECT_STATE_WAIT_REGISTRATION:
+            response = matchResponse(gConnectSoftRadio ? "+RAS:CONNECTED\r\n" : "+NAS: Connected (activated)\r\n");
+            if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
+            {
+                // It worked, but need to also wait for the "OK"
+                setConnectState(CONNECT_STATE_WAIT_REGISTRATION_OK);
+            }
+            else if (response != AT_RESPONSE_NONE)
+            {
+                // Finished without saying it is registered
+                endCommand();
+                connectBackoff();
+            }
+        break;
+        case CONNECT_STATE_WAIT_REGISTRATION_OK:
+            if (matchResponse(NULL) != AT_RESPONSE_NONE)
+            {
+                endCommand();
+                connectCommand(CONNECT_STATE_WAIT_SMI);
+            }
+        break;
+        case CONNECT_STATE_WAIT_SMI:
+        case CONNECT_STATE_WAIT_NMI:
+            response = matchResponse((gConnectState == CONNECT_STATE_WAIT_SMI) ? "+SMI:OK\r\n" : "+NMI:OK\r\n");
+            if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
+            {
+                // Absorb the trailing OK
+                setConnectState((ConnectState) (gConnectState + 1));
+            }
+            else if (response != AT_RESPONSE_NONE)
+            {
+                // Refused, start again from the registration check
+                endCommand();
+                connectBackoff();
+            }
+        break;
+        case CONNECT_STATE_WAIT_SMI_OK:
+            if (matchResponse(NULL) != AT_RESPONSE_NONE)
+            {
+                endCommand();
+                LOG_INFO ("AT+SMI set to 1.\r\n");
+                if (gConnectNmi && !gNmiEnabled)
+                {
+                    connectCommand(CONNECT_STATE_WAIT_NMI);
+                }
+                else
+                {
+                    // All done.  Downlink datagrams are collected by polling
+                    // the modem with AT+MGR, see receive(), unless
+                    // startAsyncReceive() is called to have them delivered
+                    // in +NMI notifications.
+                    setConnectState(CONNECT_STATE_CONNECTED);
+                }
+            }
+        break;
+        case CONNECT_STATE_WAIT_NMI_OK:
+            if (matchResponse(NULL) != AT_RESPONSE_NONE)
+            {
+                endCommand();
+                gNmiEnabled = true;
+                setConnectState(CONNECT_STATE_CONNECTED);
+                LOG_INFO ("AT+NMI set to 2, receiving asynchronously.\r\n");
+            }
+        break;
+        default:
+        break;
+    }
+}
+
+static void charToTchar(const char *pIn, TCHAR *pOut, uint32_t size)
+{
+    memset (pOut, 0, size);
+#ifdef _MSC_VER
+    uint32_t size_needed = MultiByteToWideChar(CP_UTF8, 0, pIn, (int)strlen(pIn), NULL, 0);
+    if (size_needed > size)
+    {
+        size_needed = size;
+    }
+    MultiByteToWideChar(CP_UTF8, 0, pIn, (int)strlen(pIn), pOut, size_needed);
+#else
+    strncpy(pOut, pIn, size - 1);
+#endif
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+
+// Constructor, on a transport owned by the caller, in memory provided
+// by a subclass
+Nbiot::Nbiot(Transport * pTransport, const Memory & memory) :
+    gRxLineBuffer(memory.pRxBuf, memory.rxCapacity),
+    gDownlinkQueue(memory.pDownlinkRecords, NBIOT_RECORD_WORDS(memory.maxDatagram) * sizeof (uint32_t), memory.downlinkQueueLength),
+    gRxLineQueue(memory.pRxLineRecords, NBIOT_RECORD_WORDS(memory.rxCapacity) * sizeof (uint32_t), memory.rxLineQueueLength),
+    gTimers(memory.ppTimerSlots, memory.timerSlots)
+{
+    gpDefaultBuffers = NULL;
+    gMaxDatagram = memory.maxDatagram;
+    gpRxLineCopy = memory.pRxLineCopy;
+    gpSendSlots = memory.pSendSlots;
+    gSendQueueLength = memory.sendQueueLength;
+    gpResponse   = NULL;
+    gpTransport  = pTransport;
+    gOwnTransport = false;
+    gLenResponse = 0;
+    gInitialised = false;
+    gDownlinkDropped = 0;
+#if READER_THREAD_ENABLED
+    gReaderRunning = false;
+#endif
+    gAsyncReceive = false;
+    gNmiEnabled = false;
+    gSentCount = 0;
+    gSentMatched = 0;
+    gNextTicket = 1;
+    gNextSubmit = 1;
+    gNextConfirm = 1;
+    gSubmitTicket = 0;
+    gSubmitState = SUBMIT_IDLE;
+    memset (gpSendSlots, 0, sizeof (SendSlot) * gSendQueueLength);
+    for (uint32_t x = 0; x < gSendQueueLength; x++)
+    {
+        gpSendSlots[x].pHex = memory.pSendHex + x * gMaxDatagram * 2;
+        TimerWheel::init(&gpSendSlots[x].sentTimer, sentTimeout, this);
     }
+    TimerWheel::init(&gSubmitTimer, submitTimeout, this);
+    TimerWheel::init(&gConnectStepTimer, connectStepTimeout, this);
+    TimerWheel::init(&gConnectDeadlineTimer, connectDeadlineTimeout, this);
+    setConnectState(CONNECT_STATE_IDLE);
+    gConnectSoftRadio = false;
+    gConnectNmi = false;
+    gConnectDeadlinePassed = false;
+    gConnectStepDue = false;
+    gConnectBackoffMinMs = DEFAULT_CONNECT_BACKOFF_MIN_MS;
+    gConnectBackoffMaxMs = DEFAULT_CONNECT_BACKOFF_MAX_MS;
+    gConnectBackoffMs = gConnectBackoffMinMs;
+    gReceivePipelineDepth = DEFAULT_RECEIVE_PIPELINE_DEPTH;
+    gRegistrationEvents = 0;
+    gRegistrationEventsSeen = 0;
+    gRxEvents = 0;
+    gRxEventsSeen = 0;
+    gCommandOpen = false;
+    gCommandType = METRICS_COMMAND_OTHER;
+    gCommandStartUs = 0;
+    gCommandOutcome = METRICS_OUTCOME_TIMEOUT;
+    gDispatcher.addUrcHandler(AT_NMI_PREFIX, nmiHandler, this);
+    gDispatcher.addUrcHandler("+SMI:", sentHandler, this);
+    gDispatcher.addUrcHandler("+NAS:", registrationHandler, this);
+    gDispatcher.addUrcHandler("+RAS:", registrationHandler, this);
+    gDispatcher.addUrcHandler("+CEREG:", registrationHandler, this);
+    gDispatcher.setDefaultHandler(unsolicitedHandler, this);
 
-    return (uint32_t) bytesReceived;
+    // Any initialisation messages from the modem will simply
+    // be passed to the default handler when they are read
+    gInitialised = (gpTransport != NULL);
 }
 
+// Constructor, on a transport owned by the caller, in memory of its own
+Nbiot::Nbiot(Transport * pTransport, DefaultBuffers * pBuffers) : Nbiot(pTransport, pBuffers->getMemory())
+{
+    gpDefaultBuffers = pBuffers;
+}
+
+// Constructor, on a transport owned by the caller
+Nbiot::Nbiot(Transport * pTransport) : Nbiot(pTransport, new DefaultBuffers)
+{
+}
+
+// Constructor, on a serial port
+Nbiot::Nbiot(const char * pPortname) : Nbiot((Transport *) NULL)
+{
+    SerialPort * pSerialPort = new SerialPort();
+    TCHAR tcharPortname[MAX_PATH];
+
+    charToTchar(pPortname, tcharPortname, sizeof (tcharPortname));
+
+    if (pSerialPort)
+    {
+        if (pSerialPort->connect(tcharPortname))
+        {
+            LOG_INFO ("Connected to port %s.\n", pPortname);
+            gpTransport = pSerialPort;
+            gOwnTransport = true;
+            gInitialised = true;
+        }
+        else
+        {
+            delete pSerialPort;
+            LOG_ERROR ("Unable to connect to port %s.\n", pPortname);
+        }
+    }
+}
+
+// Destructor
+Nbiot::~Nbiot()
+{
+    stopAsyncReceive();
+    if (gOwnTransport)
+    {
+        delete gpTransport;
+    }
+    delete gpDefaultBuffers;
+}
+
+// Connect to the network
+bool Nbiot::connect(bool usingSoftRadio, uint32_t timeoutMs)
+{
+    uint32_t waitMs;
+
+    if (startConnect(usingSoftRadio, timeoutMs))
+    {
+        while (serviceConnect() < CONNECT_STATE_CONNECTED)
+        {
+            // Sleep until the module sends something or the next
+            // timer is due
+            waitMs = gTimers.getWaitMs(AT_RX_POLL_TIMER_MS);
+            if (waitMs > 0)
+            {
+                waitRx(waitMs);
+            }
+        }
+    }
+
+    return (gConnectState == CONNECT_STATE_CONNECTED);
+}
+
+// Start connecting to the network
+bool Nbiot::startConnect(bool usingSoftRadio, uint32_t timeoutMs, bool enableNmi)
+{
+    if (connectBusy())
+    {
+        endCommand();
+    }
+
+    setConnectState(CONNECT_STATE_FAILED);
+    if (gInitialised)
+    {
+        gConnectDeadlinePassed = false;
+        if (timeoutMs > 0)
+        {
+            LOG_INFO ("Checking for connection to network for up to %u ms...\r\n", (unsigned int) timeoutMs);
+            gTimers.start(&gConnectDeadlineTimer, timeoutMs);
+        }
+        else
+        {
+            LOG_INFO ("Checking for connection to network...\r\n");
+        }
+
+        gConnectSoftRadio = usingSoftRadio;
+        gConnectNmi = enableNmi;
+        gConnectBackoffMs = gConnectBackoffMinMs;
+        connectCommand(CONNECT_STATE_WAIT_REGISTRATION);
+    }
+
+    return gInitialised;
+}
+
+// Move the connection along
+Nbiot::ConnectState Nbiot::serviceConnect()
+{
+    if ((gConnectState != CONNECT_STATE_IDLE) && (gConnectState < CONNECT_STATE_CONNECTED))
+    {
+        // This runs the timers, which only set flags: acting on them
+        // here keeps commands from being sent from inside a callback
+        pumpResponses();
+
+        if (gConnectState == CONNECT_STATE_BACKOFF)
+        {
+            // Ask again when the wait is over, or straight away if the
+            // module has reported a change in registration, once any
+            // datagram being handed over has gone, so that beginCommand()
+            // does not block waiting for it
+            if ((gConnectStepDue || (gRegistrationEvents != gRegistrationEventsSeen)) &&
+                (gSubmitState == SUBMIT_IDLE))
+            {
+                connectCommand(CONNECT_STATE_WAIT_REGISTRATION);
+            }
+        }
+        else if (connectBusy() && gConnectStepDue)
+        {
+            LOG_WARNING ("WARNING: no response from module while connecting.\r\n");
+            endCommand();
+            connectBackoff();
+        }
+
+        // Once registered, setting the module up is allowed to finish
+        if (((gConnectState == CONNECT_STATE_BACKOFF) || (gConnectState == CONNECT_STATE_WAIT_REGISTRATION)) &&
+            gConnectDeadlinePassed)
+        {
+            if (connectBusy())
+            {
+                endCommand();
+            }
+            setConnectState(CONNECT_STATE_FAILED);
+        }
+    }
+
+    return gConnectState;
+}
+
+// Return the state of the connection
+Nbiot::ConnectState Nbiot::getConnectState()
+{
+    return gConnectState;
+}
+
+// Set the waits between registration checks
+void Nbiot::setConnectBackoff(uint32_t minMs, uint32_t maxMs)
+{
+    gConnectBackoffMinMs = minMs;
+    gConnectBackoffMaxMs = (maxMs > minMs) ? maxMs : minMs;
+}
+
+// Set how many AT+MGR commands receiveBatch() writes in one go
+void Nbiot::setReceivePipelineDepth(uint32_t depth)
+{
+    gReceivePipelineDepth = depth;
+    if (gReceivePipelineDepth < 1)
+    {
+        gReceivePipelineDepth = 1;
+    }
+    if (gReceivePipelineDepth > MAX_RECEIVE_PIPELINE_DEPTH)
+    {
+        gReceivePipelineDepth = MAX_RECEIVE_PIPELINE_DEPTH;
+    }
+}
+
+// Send a message to the network
+bool Nbiot::send (char * pMsg, uint32_t msgSize, uint32_t timeoutMs)
+{
+    uint32_t ticket = 0;
+
+    // Check that the incoming message, when hex coded (so * 2) is not too big
+    if (!gInitialised)
+    {
+        LOG_ERROR ("!!! Not connected to the module.\r\n");
+    }
+    else if (msgSize <= gMaxDatagram)
+    {
+        // Wait for room in the queue if necessary
+        while ((ticket = sendAsync(pMsg, msgSize, timeoutMs)) == 0)
+        {
+            serviceSends();
+            waitRx(gTimers.getWaitMs(AT_RX_POLL_TIMER_MS));
+        }
+    }
+    else
+    {
+        LOG_ERROR ("!!! Datagram is too long (%d characters when only %d bytes can be sent).\r\n", msgSize, gMaxDatagram);
+    }
+
+    // The datagram's own timeout bounds the wait
+    return (ticket != 0) && (waitSend(ticket, 0) == SEND_STATUS_SENT);
+}
+
+// Queue a message to be sent to the network
+uint32_t Nbiot::sendAsync (const char * pMsg, uint32_t msgSize, uint32_t timeoutMs)
+{
+    uint32_t ticket = 0;
+    SendSlot * pSlot;
+
+    // Check that the incoming message is not too big
+    if (!gInitialised)
+    {
+        // Otherwise it would wait in the queue for ever
+        LOG_ERROR ("!!! Not connected to the module.\r\n");
+    }
+    else if (msgSize <= gMaxDatagram)
+    {
+        if (gNextTicket - gNextConfirm < gSendQueueLength)
+        {
+            ticket = gNextTicket;
+            pSlot = &gpSendSlots[ticket & (gSendQueueLength - 1)];
+            pSlot->ticket = ticket;
+            pSlot->status = SEND_STATUS_QUEUED;
+            pSlot->timeoutMs = timeoutMs;
+            gTimers.stop(&pSlot->sentTimer);
+            pSlot->sentTimer.param = ticket;
+            pSlot->size = msgSize;
+
+            // Build the AT+MGS command in the slot now, hex encoding
+            // straight from the caller's buffer, so that submitting it
+            // later is just a write
+            memcpy (pSlot->prefix, AT_MGS_COMMAND, sizeof (AT_MGS_COMMAND) - 1);
+            pSlot->lenPrefix = sizeof (AT_MGS_COMMAND) - 1;
+            pSlot->lenPrefix += uintToDecString (msgSize, pSlot->prefix + pSlot->lenPrefix, sizeof (pSlot->prefix) - pSlot->lenPrefix);
+            memcpy (pSlot->prefix + pSlot->lenPrefix, AT_MGS_SEPARATOR, sizeof (AT_MGS_SEPARATOR) - 1);
+            pSlot->lenPrefix += sizeof (AT_MGS_SEPARATOR) - 1;
+            bytesToHexString (pMsg, msgSize, pSlot->pHex, gMaxDatagram * 2);
+            gNextTicket++;
+
+            // Get it moving
+            serviceSends();
+        }
+    }
+    else
+    {
+        LOG_ERROR ("!!! Datagram is too long (%d characters when only %d bytes can be sent).\r\n", msgSize, gMaxDatagram);
+    }
+
+    return ticket;
+}
+
+// Move the uplink pipeline along
+void Nbiot::serviceSends ()
+{
+    SendSlot * pSlot;
+    TxSegment segments[3];
+    bool stop = false;
+
+    progressSubmit();
+
+    // Match +SMI:SENT notifications to the datagrams the module has
+    // accepted, in the order it accepted them, skipping failures
+    while ((gNextConfirm != gNextSubmit) && !stop)
+    {
+        pSlot = &gpSendSlots[gNextConfirm & (gSendQueueLength - 1)];
+        if (pSlot->status == SEND_STATUS_SUBMITTED)
+        {
+            if (gSentMatched != gSentCount)
+            {
+                pSlot->status = SEND_STATUS_SENT;
+                gTimers.stop(&pSlot->sentTimer);
+                gSentMatched++;
+                TRACE_VALUE(TRACE_EVENT_SENT, gNextConfirm);
+            }
+        }
+
+        if ((pSlot->status == SEND_STATUS_SENT) || (pSlot->status == SEND_STATUS_FAILED))
+        {
+            gNextConfirm++;
+        }
+        else
+        {
+            stop = true;
+        }
+    }
+
+    if (gNextConfirm == gNextSubmit)
+    {
+        // Nothing is with the module so any notifications are stray
+        gSentMatched = gSentCount;
+    }
+
+    // Hand the next datagram to the module if it has room for it, but not
+    // while startConnect() is under way, as its next command would have
+    // to wait for the hand-over to finish
+    if (gInitialised && (gSubmitState == SUBMIT_IDLE) &&
+        ((gConnectState == CONNECT_STATE_IDLE) || (gConnectState >= CONNECT_STATE_CONNECTED)) &&
+        (gNextSubmit != gNextTicket) &&
+        (gNextSubmit - gNextConfirm < DEFAULT_SEND_PIPELINE_DEPTH))
+    {
+        gSubmitTicket = gNextSubmit;
+        pSlot = &gpSendSlots[gSubmitTicket & (gSendQueueLength - 1)];
+        gNextSubmit++;
+
+        segments[0].pBuf = pSlot->prefix;
+        segments[0].len = pSlot->lenPrefix;
+        segments[1].pBuf = pSlot->pHex;
+        segments[1].len = pSlot->size * 2;
+        segments[2].pBuf = AT_TERMINATOR;
+        segments[2].len = sizeof (AT_TERMINATOR) - 1;
+
+        beginCommand("+MGS:");
+        pSlot->status = SEND_STATUS_SUBMITTING;
+        gSubmitState = SUBMIT_WAIT_MGS_OK;
+        gTimers.start(&gSubmitTimer, DEFAULT_RESPONSE_TIMEOUT_MS);
+        TRACE_VALUE(TRACE_EVENT_SUBMIT, gSubmitTicket);
+        if (gpTransport->transmitVector(segments, sizeof (segments) / sizeof (segments[0])))
+        {
+            TRACE(TRACE_EVENT_TX, pSlot->prefix, pSlot->lenPrefix);
+#if METRICS_ENABLED
+            gMetrics.addBytesOut(segments[0].len + segments[1].len + segments[2].len);
+#endif
+        }
+        else
+        {
+            submitDone(false);
+        }
+    }
+}
+
+// Get the status of a datagram
+Nbiot::SendStatus Nbiot::getSendStatus (uint32_t ticket)
+{
+    SendStatus status = SEND_STATUS_UNKNOWN;
+    SendSlot * pSlot = &gpSendSlots[ticket & (gSendQueueLength - 1)];
+
+    if ((ticket != 0) && (pSlot->ticket == ticket))
+    {
+        status = pSlot->status;
+    }
+
+    return status;
+}
+
+// Wait for a datagram to be sent
+Nbiot::SendStatus Nbiot::waitSend (uint32_t ticket, uint32_t timeoutMs)
+{
+    int64_t deadlineMs = getTimeMs() + timeoutMs;
+    int64_t waitMs;
+    SendStatus status;
+
+    serviceSends();
+    status = getSendStatus(ticket);
+    while (((status == SEND_STATUS_QUEUED) || (status == SEND_STATUS_SUBMITTING) || (status == SEND_STATUS_SUBMITTED)) &&
+           ((timeoutMs == 0) || (getTimeMs() < deadlineMs)))
+    {
+        // Sleep until the module sends something, the next timer is
+        // due or the wait is over
+        waitMs = gTimers.getWaitMs(AT_RX_POLL_TIMER_MS);
+        if ((timeoutMs != 0) && (deadlineMs - getTimeMs() < waitMs))
+        {
+            waitMs = deadlineMs - getTimeMs();
+        }
+        if (waitMs > 0)
+        {
+            waitRx((uint32_t) waitMs);
+        }
+        serviceSends();
+        status = getSendStatus(ticket);
+    }
+
+    return status;
+}
+
+// Receive a message from the network
+uint32_t Nbiot::receive (char * pMsg, uint32_t msgSize, uint32_t timeoutMs)
+{
+    int32_t bytesReceived;
+
+    LOG_DEBUG ("Receiving a datagram of up to %d byte(s) from the network...\r\n", msgSize);
+    bytesReceived = readDatagram(pMsg, msgSize, timeoutMs);
+
+    return (bytesReceived > 0) ? (uint32_t) bytesReceived : 0;
+}
+
+// Receive the messages the module is holding
+uint32_t Nbiot::receiveBatch (char * pArena, uint32_t arenaSize, DatagramSpan * pSpans, uint32_t maxDatagrams,
+                              uint32_t timeoutMs)
+{
+    uint32_t numDatagrams = 0;
+    uint32_t used = 0;
+    uint32_t count;
+    int64_t deadlineMs = getTimeMs() + timeoutMs;
+    int64_t waitMs;
+    int32_t buffered;
+    int32_t received;
+    uint32_t dropped;
+    bool empty = false;
+    bool done = false;
+
+    LOG_DEBUG ("Receiving up to %d datagram(s) from the network...\r\n", maxDatagrams);
+
+    // If the module can't say how many it has, keep going until it
+    // has none
+    buffered = queryBuffered(timeoutMs);
+
+    while (!done && (numDatagrams < maxDatagrams) && (buffered != 0) && (arenaSize - used >= gMaxDatagram))
+    {
+        // Each round gets whatever is left of the time
+        waitMs = 0;
+        if (timeoutMs != 0)
+        {
+            waitMs = deadlineMs - getTimeMs();
+            done = (waitMs <= 0);
+        }
+        if (!done)
+        {
+            // Ask for as many as the module has, as far as there is room
+            count = maxDatagrams - numDatagrams;
+            if ((buffered > 0) && ((uint32_t) buffered < count))
+            {
+                count = (uint32_t) buffered;
+            }
+            if ((arenaSize - used) / gMaxDatagram < count)
+            {
+                count = (arenaSize - used) / gMaxDatagram;
+            }
+
+            dropped = 0;
+            received = readDatagrams(pArena + used, pSpans + numDatagrams, count, (uint32_t) waitMs, &empty, &dropped);
+            for (int32_t x = 0; x < received; x++)
+            {
+                used += pSpans[numDatagrams].size;
+                numDatagrams++;
+                if (buffered > 0)
+                {
+                    buffered--;
+                }
+            }
+            // Dropped datagrams were taken from the module all the same
+            for (uint32_t x = 0; (x < dropped) && (buffered > 0); x++)
+            {
+                buffered--;
+            }
+            // A round that collects nothing, e.g. because the module
+            // answers ERROR, would only be repeated until the timeout
+            done = ((received <= 0) && (dropped == 0)) || empty;
+        }
+    }
+
+    return numDatagrams;
+}
+
+// Start receiving datagrams asynchronously
+bool Nbiot::startAsyncReceive(bool useReaderThread)
+{
+    AtResponse response;
+
+    if (gInitialised && !gNmiEnabled)
+    {
+        LOG_INFO ("Setting AT+NMI to 2.\r\n");
+
+        // As for AT+SMI, only +NMI:OK is a response, other +NMI
+        // lines are URCs carrying datagrams
+        beginCommand("+NMI:OK");
+        sendString("AT+NMI=2" AT_TERMINATOR);
+        response = waitResponse("+NMI:OK\r\n");
+        if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
+        {
+            // Absorb the trailing OK.
+            waitResponse();
+            gNmiEnabled = true;
+            LOG_INFO ("AT+NMI set to 2, receiving asynchronously.\r\n");
+        }
+        endCommand();
+    }
+
+#if READER_THREAD_ENABLED
+    if (gNmiEnabled && useReaderThread && !gAsyncReceive)
+    {
+        // Hand the modem over to the reader thread
+        gReaderRunning = true;
+        gAsyncReceive = true;
+        gReaderThread = std::thread(&Nbiot::readerThread, this);
+    }
+
+    return useReaderThread ? gAsyncReceive : gNmiEnabled;
+#else
+    // No thread to hand the modem to, so the caller goes on reading it
+    (void) useReaderThread;
+
+    return gNmiEnabled;
+#endif
+}
+
+// Stop receiving datagrams asynchronously
+void Nbiot::stopAsyncReceive()
+{
+#if READER_THREAD_ENABLED
+    if (gAsyncReceive)
+    {
+        gReaderRunning = false;
+        gReaderThread.join();
+        gAsyncReceive = false;
+    }
+#endif
+}
+
+// Collect a datagram received asynchronously
+uint32_t Nbiot::getDownlink(char * pMsg, uint32_t msgSize)
+{
+    uint32_t size = 0;
+    const uint32_t * pRecord = (const uint32_t *) gDownlinkQueue.getReadRecord();
+
+    if (pRecord != NULL)
+    {
+        size = *pRecord;
+        if (msgSize > size)
+        {
+            msgSize = size;
+        }
+        if (pMsg != NULL)
+        {
+            memcpy (pMsg, pRecord + 1, msgSize);
+        }
+        gDownlinkQueue.pop();
+    }
+
+    return size;
+}
+
+// Return the number of datagrams waiting
+uint32_t Nbiot::getDownlinkCount()
+{
+    return gDownlinkQueue.getCount();
+}
+
+// Return the number of datagrams lost
+uint32_t Nbiot::getDownlinkDropped()
+{
+    return gDownlinkDropped;
+}
+
+// Wait for the modem to send something
+bool Nbiot::waitReadable(uint32_t timeoutMs)
+{
+    bool readable = false;
+
+    if (gpTransport != NULL)
+    {
+        readable = gpTransport->waitReadable(timeoutMs);
+    }
+
+    return readable;
+}
+
+// Return the largest datagram
+uint32_t Nbiot::getMaxDatagramSize()
+{
+    return gMaxDatagram;
+}
+
+// Return the length of the send queue
+uint32_t Nbiot::getSendQueueLength()
+{
+    return gSendQueueLength;
+}
+
+// Return when the next timeout is due
+int64_t Nbiot::getNextTimeoutMs()
+{
+    return gTimers.getNextExpiryMs();
+}
+
+// Take a copy of the measurements
+void Nbiot::getMetrics(MetricsSnapshot * pSnapshot)
+{
+#if METRICS_ENABLED
+    gMetrics.snapshot(pSnapshot);
+#else
+    memset (pSnapshot, 0, sizeof (*pSnapshot));
+#endif
+}
+
+// Zero the measurements
+void Nbiot::resetMetrics()
+{
+#if METRICS_ENABLED
+    gMetrics.reset();
+#endif
+}
+
+#ifndef _WIN32
+// Return the file descriptor of the transport
+int Nbiot::getFd()
+{
+    int fd = -1;
+
+    if (gpTransport != NULL)
+    {
+        fd = gpTransport->getFd();
+    }
+
+    return fd;
+}
+#endif
+
 // End Of File
@@ -3,27 +3,112 @@
 #ifndef _MODEM_DRIVER_H_
 #define _MODEM_DRIVER_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 // ----------------------------------------------------------------
 // COMPILE-TIME CONSTANTS
 // ----------------------------------------------------------------
 
-// The default interrupt buffer for received data
-#define DEFAULT_RX_INT_STORAGE 256
+// Maximum length of a datagram that can be sent or received; this
+// may be overridden at build time (e.g. -DMAX_LEN_SEND_STRING=512)
+// to suit the payload limit of the network
+#ifndef MAX_LEN_SEND_STRING
+# define MAX_LEN_SEND_STRING 256
+#endif
+
+// Margin on the hex version of a datagram to allow for the AT command
+// itself, count value, terminator, etc.
+#define AT_STRING_MARGIN 32
+
+// The default buffer for received data; this must be large enough
+// to hold the longest line from the modem, which is a +MGR line
+// carrying a hex encoded datagram of MAX_LEN_SEND_STRING bytes
+#ifndef DEFAULT_RX_INT_STORAGE
+# define DEFAULT_RX_INT_STORAGE (MAX_LEN_SEND_STRING * 2 + AT_STRING_MARGIN)
+#endif
+
+// The number of 32-bit words taken by each record in the queues of
+// datagrams and AT lines: the length, then up to capacity characters
+#define NBIOT_RECORD_WORDS(capacity) (1 + ((capacity) + sizeof (uint32_t) - 1) / sizeof (uint32_t))
+
+// Default timeout when connecting to the network, in milliseconds
+#define DEFAULT_CONNECT_TIMEOUT_MS 30000
+
+// The shortest and longest waits between asking the modem whether it
+// has registered with the network while connecting; the wait doubles
+// from the shortest to the longest with each attempt, but a registration
+// change reported by the modem ends it at once
+#define DEFAULT_CONNECT_BACKOFF_MIN_MS 250
+#define DEFAULT_CONNECT_BACKOFF_MAX_MS 3000
+
+// Default timeout when sending a message to the network, in milliseconds
+#define DEFAULT_SEND_TIMEOUT_MS 5000
 
-// Default timeout when connecting to the network
-#define DEFAULT_CONNECT_TIMEOUT_SECONDS 30
+// Default timeout when receiving a message from the network, in milliseconds
+#define DEFAULT_RECEIVE_TIMEOUT_MS 5000
 
-// Default timeout when sending a message to the network
-#define DEFAULT_SEND_TIMEOUT_SECONDS 5
+// Default timeout when waiting for a response from the CIoT modem, in
+// milliseconds
+#define DEFAULT_RESPONSE_TIMEOUT_MS 5000
+
+// The number of received datagrams that can be queued, waiting for
+// collection with getDownlink(), when receiving asynchronously;
+// must be a power of two
+#define DEFAULT_DOWNLINK_QUEUE_LENGTH 16
+
+// The number of AT lines that can be queued between the reader thread
+// and the command side when receiving asynchronously; must be a power
+// of two
+#define DEFAULT_RX_LINE_QUEUE_LENGTH 8
+
+// The number of uplink datagrams that can be queued with sendAsync();
+// must be a power of two
+#define DEFAULT_SEND_QUEUE_LENGTH 16
+
+// The number of uplink datagrams that may be with the modem at any one
+// time, accepted by it but not yet reported as SENT
+#define DEFAULT_SEND_PIPELINE_DEPTH 4
+
+// The number of AT+MGR commands that receiveBatch() writes to the modem
+// in one go before reading the answers, unless setReceivePipelineDepth()
+// says otherwise: one, since not every modem can take a command until it
+// has answered the last, and the next AT+MGR then goes as soon as the OK
+// for the last arrives
+#ifndef DEFAULT_RECEIVE_PIPELINE_DEPTH
+# define DEFAULT_RECEIVE_PIPELINE_DEPTH 1
+#endif
+
+// The most AT+MGR commands that setReceivePipelineDepth() allows
+#ifndef MAX_RECEIVE_PIPELINE_DEPTH
+# define MAX_RECEIVE_PIPELINE_DEPTH 4
+#endif
 
-// Default timeout when receiving a message from the network
-#define DEFAULT_RECEIVE_TIMEOUT_SECONDS 5
+// The number of slots in the timer wheel of a BasicNbiot unless it says
+// otherwise; it runs one timer per send queue entry and three more, so
+// a wheel far smaller than TIMER_WHEEL_SLOTS loses nothing; must be a
+// power of two
+#ifndef DEFAULT_BASIC_TIMER_SLOTS
+# define DEFAULT_BASIC_TIMER_SLOTS 16
+#endif
 
-// Default timeout when waiting for a response from the CIoT modem
-#define DEFAULT_RESPONSE_TIMEOUT_SECONDS 5
+// Set to 0, e.g. with -DMETRICS_ENABLED=0 for the whole build, to compile
+// out the counters and latency histograms of getMetrics() (which then
+// returns zeroes), leaving the memory they take, some 15 kbytes, out of
+// every instance
+#ifndef METRICS_ENABLED
+# define METRICS_ENABLED 1
+#endif
 
-// Default timeout when flushing the modem at the outset
-#define DEFAULT_FLUSH_TIMEOUT_SECONDS 1
+// Set to 0, e.g. with -DREADER_THREAD_ENABLED=0 for the whole build, to
+// compile out the reader thread of startAsyncReceive() and the thread,
+// mutex and condition variable that go with it, for an application that
+// only reads the modem from its own thread
+#ifndef READER_THREAD_ENABLED
+# define READER_THREAD_ENABLED 1
+#endif
 
 // ----------------------------------------------------------------
 // CLASSES
@@ -33,8 +118,39 @@
 class Nbiot
 {
 public:
-    // Maximum length of a string to be sent with the send() function
-#   define MAX_LEN_SEND_STRING 256
+    // The states of a datagram queued with sendAsync().
+    typedef enum
+    {
+        SEND_STATUS_UNKNOWN,    // Not a ticket, or so old it is forgotten
+        SEND_STATUS_QUEUED,     // Waiting to be handed to the modem
+        SEND_STATUS_SUBMITTING, // Being handed to the modem
+        SEND_STATUS_SUBMITTED,  // Accepted by the modem, waiting for +SMI:SENT
+        SEND_STATUS_SENT,       // The modem reported it SENT
+        SEND_STATUS_FAILED      // Refused by the modem or not reported SENT in time
+    } SendStatus;
+
+    // The states of connecting to the network with startConnect().
+    typedef enum
+    {
+        CONNECT_STATE_IDLE,                 // startConnect() has not been called
+        CONNECT_STATE_WAIT_REGISTRATION,    // Asked with AT+NAS (or AT+RAS), waiting for the answer
+        CONNECT_STATE_WAIT_REGISTRATION_OK, // Registered, waiting for the OK
+        CONNECT_STATE_BACKOFF,              // Not registered, waiting to ask again
+        CONNECT_STATE_WAIT_SMI,             // Set AT+SMI=1, waiting for +SMI:OK
+        CONNECT_STATE_WAIT_SMI_OK,          // Waiting for the OK after +SMI:OK
+        CONNECT_STATE_WAIT_NMI,             // Set AT+NMI=2, waiting for +NMI:OK
+        CONNECT_STATE_WAIT_NMI_OK,          // Waiting for the OK after +NMI:OK
+        CONNECT_STATE_CONNECTED,            // Done
+        CONNECT_STATE_FAILED                // Not registered within the timeout
+    } ConnectState;
+
+    // A datagram collected by receiveBatch(): where it was put and how
+    // long it is.
+    typedef struct
+    {
+        char * pData;
+        uint32_t size;
+    } DatagramSpan;
 
     // Constructor.  pPortname is a string that defines the serial port where the
     // NB-IoT modem is connected.  On Windows the form of a properly escaped string
@@ -47,31 +163,176 @@ public:
     //
     // "\\\\.\\COM17"    
     Nbiot (const char * pPortname);
+
+    // Constructor.  Talk to the NB-IoT modem over pTransport, e.g. a
+    // TcpTransport to a terminal server or a LoopbackTransport in memory,
+    // which must outlive this instance and is not deleted by it.  Buffers
+    // are sized from MAX_LEN_SEND_STRING and the DEFAULT_*_LENGTH values
+    // and allocated from the heap; see BasicNbiot for an instance that
+    // allocates nothing.
+    Nbiot (Transport * pTransport);
+
+    // Destructor: virtual, as BasicNbiot adds to this class and may be
+    // deleted through a pointer to it (e.g. by ModemPool).
+    virtual ~Nbiot ();
     
-    // Connect to the NB-IoT network with optional timeoutSeconds.  If usingSoftRadio
+    // Connect to the NB-IoT network with optional timeoutMs.  If usingSoftRadio
     // is true then the connect behaviour is matched to that of SoftRadio, otherwise
-    // it is matched to that of a real radio.  If timeoutSeconds is zero this function
-    // will block indefinitely until a connection has been achieved.
-    bool connect (bool usingSoftRadio = false, time_t timeoutSeconds = DEFAULT_CONNECT_TIMEOUT_SECONDS);
+    // it is matched to that of a real radio.  If timeoutMs is zero this function
+    // will block indefinitely until a connection has been achieved.  This is
+    // startConnect() followed by calls to serviceConnect() until it is done.
+    // All the timeouts of this class are in milliseconds, measured with the
+    // monotonic clock of getTimeMs(), so changes to the time of day do not
+    // affect them.
+    bool connect (bool usingSoftRadio = false, uint32_t timeoutMs = DEFAULT_CONNECT_TIMEOUT_MS);
+
+    // Start connecting to the NB-IoT network, as connect() but without blocking:
+    // the connection is moved along by calling serviceConnect(), e.g. from an
+    // event loop whenever the modem has sent something (see getFd()) and when
+    // getNextTimeoutMs() says a timer is due.  If enableNmi is true the modem
+    // is also set to deliver datagrams in +NMI notifications, as
+    // startAsyncReceive(false).
+    // Returns false if there is no modem.
+    bool startConnect (bool usingSoftRadio = false, uint32_t timeoutMs = DEFAULT_CONNECT_TIMEOUT_MS,
+                       bool enableNmi = false);
+
+    // Move the connection started with startConnect() along without blocking,
+    // returning its state.  The registration check is repeated with a backoff
+    // (see setConnectBackoff()) until the modem reports that it is registered,
+    // or until the modem sends an unsolicited registration report, whichever
+    // is sooner.
+    ConnectState serviceConnect ();
+
+    // Return the state of the connection started with startConnect().
+    ConnectState getConnectState ();
+
+    // Set the shortest and longest waits, in milliseconds, between registration
+    // checks while connecting; the wait doubles from one to the other.
+    void setConnectBackoff (uint32_t minMs, uint32_t maxMs);
     
     // Send the contents of the buffer pMsg, length msgSize, to the NB-IoT network with
-    // optional timeoutSeconds, waiting for confirmation that the message has been sent.
-    // If timeoutSeconds is zero this function will block indefinitely until the message
+    // optional timeoutMs, waiting for confirmation that the message has been sent.
+    // If timeoutMs is zero this function will block indefinitely until the message
     // has been sent.
-    bool send (char * pMsg, uint32_t msgSize, time_t timeoutSeconds = DEFAULT_SEND_TIMEOUT_SECONDS);
+    bool send (char * pMsg, uint32_t msgSize, uint32_t timeoutMs = DEFAULT_SEND_TIMEOUT_MS);
+    
+    // Queue the contents of the buffer pMsg, length msgSize, to be sent to the NB-IoT
+    // network and return straight away with a non-zero ticket for it, or zero if the
+    // queue is full, the datagram is too long or there is no connection to the
+    // module.  Up to DEFAULT_SEND_PIPELINE_DEPTH datagrams are handed to the modem
+    // without waiting for each to be SENT, and +SMI:SENT notifications are matched
+    // back to them in order.  The datagram fails if it is not reported SENT within
+    // timeoutMs of the modem accepting it (zero meaning no limit).  The queue moves
+    // along whenever sendAsync(), serviceSends(), waitSend() or send() is called.
+    // The send functions must all be called from one thread.
+    uint32_t sendAsync (const char * pMsg, uint32_t msgSize, uint32_t timeoutMs = DEFAULT_SEND_TIMEOUT_MS);
     
-    // Poll the NB-IoT modem for received data with optional timeoutSeconds.  If data
+    // Move the queue of datagrams from sendAsync() along without blocking: check
+    // responses and SENT notifications and hand the next datagram to the modem,
+    // unless startConnect() is still under way.
+    void serviceSends ();
+    
+    // Return the state of the datagram with the given ticket.
+    SendStatus getSendStatus (uint32_t ticket);
+    
+    // Wait for up to timeoutMs (zero meaning forever) for the datagram with the
+    // given ticket to be SENT or to fail, returning its state.
+    SendStatus waitSend (uint32_t ticket, uint32_t timeoutMs = 0);
+    
+    // Poll the NB-IoT modem for received data with optional timeoutMs.  If data
     // has been received the return value will be non-zero, representing the number of
     // bytes received.  Up to msgSize bytes of returned data will be stored at pMsg; any
-    // data beyond that will be lost.  If timeoutSeconds is zero this function will block
-    // indefinitely until a message has been received.
-    uint32_t receive (char * pMsg, uint32_t msgSize, time_t timeoutSeconds = DEFAULT_RECEIVE_TIMEOUT_SECONDS);
+    // data beyond that will be lost.  A datagram that does not arrive whole is
+    // dropped, with a warning, and zero returned.  If timeoutMs is zero this
+    // function will block indefinitely until a message has been received.
+    uint32_t receive (char * pMsg, uint32_t msgSize, uint32_t timeoutMs = DEFAULT_RECEIVE_TIMEOUT_MS);
 
-protected:
-    // Margin on the send string to allow for the actual AT command itself,
-    // count value, terminator, etc.
-#   define AT_STRING_MARGIN 32
+    // Collect up to maxDatagrams datagrams that the NB-IoT modem is holding, e.g.
+    // a backlog built up while out of coverage, within timeoutMs overall (zero
+    // meaning no limit).  The modem is asked how many it has (AT+MQS) and then
+    // AT+MGR is issued back to back, each as soon as the last is answered or,
+    // with setReceivePipelineDepth(), several written at a time, until that many
+    // have been collected, so draining a backlog takes a fraction of the time of
+    // calling receive() for each.  The
+    // datagrams are stored one after another in pArena, arenaSize bytes long,
+    // and described by pSpans, which must have room for maxDatagrams entries;
+    // collection also stops when fewer than getMaxDatagramSize() bytes of pArena
+    // are left, so that no datagram is cut short.  A datagram that does not arrive
+    // whole is dropped, with a warning, and collection goes on.  Returns the number
+    // of entries of pSpans filled in.
+    uint32_t receiveBatch (char * pArena, uint32_t arenaSize, DatagramSpan * pSpans, uint32_t maxDatagrams,
+                           uint32_t timeoutMs = DEFAULT_RECEIVE_TIMEOUT_MS);
+
+    // Set the number of AT+MGR commands that receiveBatch() writes to the modem
+    // in one go, from 1 (DEFAULT_RECEIVE_PIPELINE_DEPTH) to
+    // MAX_RECEIVE_PIPELINE_DEPTH.  More than one saves a round trip per
+    // datagram but is only for a modem known to take a command before it has
+    // answered the last.
+    void setReceivePipelineDepth (uint32_t depth);
+
+    // Set the NB-IoT modem to deliver received datagrams in +NMI notifications
+    // (AT+NMI=2) and start a thread which, from then on, does all the reading
+    // of the modem, placing each received datagram in a queue for collection
+    // with getDownlink().  If useReaderThread is false, or READER_THREAD_ENABLED
+    // is 0, no thread is started and datagrams are queued as the calling thread
+    // reads the modem, e.g. in serviceSends(), which suits an event loop driving
+    // many modems.  Returns true on success.
+    bool startAsyncReceive (bool useReaderThread = true);
+
+    // Stop the thread started by startAsyncReceive(); the modem is read by
+    // the calling thread once more.
+    void stopAsyncReceive ();
+
+    // Collect a datagram received asynchronously.  If there is one the return
+    // value will be non-zero, representing the number of bytes received.  Up to
+    // msgSize bytes of returned data will be stored at pMsg; any data beyond
+    // that will be lost.  This function does not block; it returns zero if no
+    // datagram is waiting.  It must only be called from one thread.
+    uint32_t getDownlink (char * pMsg, uint32_t msgSize);
+
+    // Return the number of datagrams waiting to be collected with getDownlink().
+    uint32_t getDownlinkCount ();
+
+    // Return the number of received datagrams that have been lost because the
+    // queue was full when they arrived.
+    uint32_t getDownlinkDropped ();
+
+    // Block for up to timeoutMs milliseconds waiting for the modem to send
+    // something, without reading it.  Returns true if there is something
+    // for serviceSends() to read.
+    bool waitReadable (uint32_t timeoutMs);
+
+    // Return the time, from getTimeMs(), at which the next of this instance's
+    // timeouts falls due, or -1 if none is running.  An event loop driving the
+    // modem should call serviceConnect() or serviceSends() by then, even if
+    // the modem has sent nothing.
+    int64_t getNextTimeoutMs ();
+
+    // Copy the counts and latency histograms of the AT commands sent to the
+    // modem, and of the bytes written to and read from it, into pSnapshot;
+    // see Metrics::exportText() for a way to write them out.  May be called
+    // from any thread.  All zero if METRICS_ENABLED is 0.
+    void getMetrics (MetricsSnapshot * pSnapshot);
+
+    // Zero the measurements returned by getMetrics().
+    void resetMetrics ();
+
+    // Return the largest datagram, in bytes, that this instance can send
+    // or receive (MAX_LEN_SEND_STRING unless it is a BasicNbiot).
+    uint32_t getMaxDatagramSize ();
+
+    // Return the number of datagrams that can be queued with sendAsync()
+    // (DEFAULT_SEND_QUEUE_LENGTH unless it is a BasicNbiot).
+    uint32_t getSendQueueLength ();
+
+#ifndef _WIN32
+    // Return the file descriptor of the transport the modem is on, for
+    // adding to an event loop, or -1 if there is none.  It
+    // becomes readable when there is something for serviceSends() to read.
+    int getFd ();
+#endif
 
+protected:
     // The possible types of AT response, returned by waitResponse().
     typedef enum
     {
@@ -82,59 +343,414 @@ protected:
         AT_RESPONSE_OTHER
     } AtResponse;
 
-    // Intermediate buffer used during hex string converstion.
-    char gHexBuf[MAX_LEN_SEND_STRING * 2];
-    
-    // Intermediate buffer for storing the hex version of AT strings
-    // to be transmitted.
-    char gTxBuf[MAX_LEN_SEND_STRING * 2 + AT_STRING_MARGIN];
-    
-    // Intermediate buffer for storing the hex version of AT strings
-    // received.
-    char gRxBuf[DEFAULT_RX_INT_STORAGE];
-    
-    // Length of the data stored in rxBuf
-    uint32_t gLenRx;
+    // A datagram queued with sendAsync(), held as the AT+MGS command
+    // that will carry it: the "AT+MGS=<size>, " prefix and the hex
+    // encoded datagram, ready to be written out with the terminator
+    // as a single gathered write.
+    typedef struct
+    {
+        uint32_t ticket;
+        SendStatus status;
+        uint32_t timeoutMs;
+        WheelTimer sentTimer;   // Runs from acceptance by the modem until SENT
+        uint32_t size;
+        uint32_t lenPrefix;
+        char prefix[AT_STRING_MARGIN];
+        char * pHex;            // gMaxDatagram * 2 characters
+    } SendSlot;
+
+    // The memory an instance works in and its dimensions, passed to the
+    // constructor: where the buffers are sized by the largest datagram,
+    // maxDatagram, or the longest line from the modem, rxCapacity, and
+    // how long the queues are (each a power of two).
+    typedef struct
+    {
+        uint32_t maxDatagram;
+        uint32_t rxCapacity;
+        uint32_t sendQueueLength;
+        uint32_t downlinkQueueLength;
+        uint32_t rxLineQueueLength;
+        uint32_t timerSlots;
+        char * pRxBuf;              // rxCapacity
+        char * pRxLineCopy;         // rxCapacity
+        SendSlot * pSendSlots;      // sendQueueLength
+        char * pSendHex;            // sendQueueLength * maxDatagram * 2
+        uint32_t * pDownlinkRecords; // downlinkQueueLength * NBIOT_RECORD_WORDS(maxDatagram)
+        uint32_t * pRxLineRecords;  // rxLineQueueLength * NBIOT_RECORD_WORDS(rxCapacity)
+        WheelTimer ** ppTimerSlots; // timerSlots
+    } Memory;
+
+    // The memory of an instance with its dimensions fixed at compile time.
+    template <uint32_t MaxDatagram, uint32_t RxCapacity, uint32_t SendQueueLength,
+              uint32_t DownlinkQueueLength, uint32_t RxLineQueueLength, uint32_t TimerSlots>
+    struct Buffers
+    {
+        char rxBuf[RxCapacity];
+        char rxLineCopy[RxCapacity];
+        SendSlot sendSlots[SendQueueLength];
+        char sendHex[SendQueueLength][MaxDatagram * 2];
+        uint32_t downlinkRecords[DownlinkQueueLength][NBIOT_RECORD_WORDS(MaxDatagram)];
+        uint32_t rxLineRecords[RxLineQueueLength][NBIOT_RECORD_WORDS(RxCapacity)];
+        WheelTimer * timerSlots[TimerSlots];
+
+        // Describe this memory to the constructor.
+        Memory getMemory ()
+        {
+            Memory memory = {MaxDatagram, RxCapacity, SendQueueLength, DownlinkQueueLength, RxLineQueueLength,
+                             TimerSlots, rxBuf, rxLineCopy, sendSlots, sendHex[0],
+                             downlinkRecords[0], rxLineRecords[0], timerSlots};
+
+            return memory;
+        }
+    };
+
+    // The memory of an instance created with the public constructors.
+    typedef Buffers<MAX_LEN_SEND_STRING, DEFAULT_RX_INT_STORAGE, DEFAULT_SEND_QUEUE_LENGTH,
+                    DEFAULT_DOWNLINK_QUEUE_LENGTH, DEFAULT_RX_LINE_QUEUE_LENGTH, TIMER_WHEEL_SLOTS> DefaultBuffers;
+
+    // Constructor for a subclass that provides the memory, which must
+    // outlive this instance.
+    Nbiot (Transport * pTransport, const Memory & memory);
+
+    // Constructor that takes ownership of pBuffers.
+    Nbiot (Transport * pTransport, DefaultBuffers * pBuffers);
+
+    // The memory allocated by the public constructors, NULL otherwise.
+    DefaultBuffers * gpDefaultBuffers;
+
+    // The largest datagram that this instance can deal with.
+    uint32_t gMaxDatagram;
+
+    // Assembles the characters received from the modem, read in bulk,
+    // into AT lines.
+    LineBuffer gRxLineBuffer;
     
     // Pointer to a response string from the modem, used during
-    // transmit operations.
+    // transmit operations; this is a view into the receive buffer.
     const char * gpResponse;
     
     // Length of the string pointed to by pResponse.
     uint32_t gLenResponse;
     
-    // Index into matching progress for the AT string terminator.
-    uint8_t gMatched;
+    // Datagrams received in +NMI notifications, waiting for getDownlink(),
+    // each record a length followed by the datagram.
+    SpscQueue gDownlinkQueue;
+    
+    // Count of datagrams lost because gDownlinkQueue was full.
+    std::atomic<uint32_t> gDownlinkDropped;
+    
+    // Lines from the modem that are not +NMI notifications, passed from
+    // the reader thread to waitResponse() when receiving asynchronously,
+    // each record a length followed by the line.
+    SpscQueue gRxLineQueue;
+    
+    // The line most recently taken from gRxLineQueue, of gRxCapacity
+    // characters; gpResponse points here when receiving asynchronously.
+    char * gpRxLineCopy;
+    
+#if READER_THREAD_ENABLED
+    // Used to wake the command side when the reader thread has queued a line.
+    std::mutex gRxLineMutex;
+    std::condition_variable gRxLineSignal;
+    
+    // The thread reading the modem when receiving asynchronously.
+    std::thread gReaderThread;
+    
+    // Set to false to ask gReaderThread to exit.
+    std::atomic<bool> gReaderRunning;
+#endif
+    
+    // True while gReaderThread owns the reading of the modem.
+    bool gAsyncReceive;
+    
+    // Flag to indicate that the modem has been set to deliver datagrams in
+    // +NMI notifications.
+    bool gNmiEnabled;
+    
+    // Routes each line from the modem to the outstanding command or to
+    // the handler for the URC it carries.
+    AtDispatcher gDispatcher;
+
+#if METRICS_ENABLED
+    // Measurements of the AT commands sent and the bytes in and out.
+    Metrics gMetrics;
+#endif
+
+    // The AT command opened by beginCommand(): its type, when it was
+    // written, from getTimeUs(), and how it has ended so far.
+    bool gCommandOpen;
+    MetricsCommand gCommandType;
+    int64_t gCommandStartUs;
+    MetricsOutcome gCommandOutcome;
+    
+    // Count of +SMI:SENT notifications received.
+    std::atomic<uint32_t> gSentCount;
+    
+    // Count of lines dispatched by gReaderThread.
+    std::atomic<uint32_t> gRxEvents;
+    
+    // The value of gRxEvents when the command side last looked.
+    uint32_t gRxEventsSeen;
+    
+    // The progress of handing a datagram to the modem.
+    typedef enum
+    {
+        SUBMIT_IDLE,
+        SUBMIT_WAIT_MGS_OK,
+        SUBMIT_WAIT_OK
+    } SubmitState;
+    
+    // The queue of datagrams from sendAsync(), indexed by ticket, and
+    // its length.
+    SendSlot * gpSendSlots;
+    uint32_t gSendQueueLength;
+    
+    // The ticket that will be given to the next datagram queued.
+    uint32_t gNextTicket;
+    
+    // The ticket of the next datagram to hand to the modem.
+    uint32_t gNextSubmit;
+    
+    // The ticket of the oldest datagram handed to the modem and not
+    // yet SENT or failed.
+    uint32_t gNextConfirm;
+    
+    // The ticket of the datagram being handed to the modem.
+    uint32_t gSubmitTicket;
+    
+    // The progress of handing gSubmitTicket to the modem.
+    SubmitState gSubmitState;
+    
+    // Fails gSubmitTicket if the modem does not answer in time.
+    WheelTimer gSubmitTimer;
+    
+    // The number of +SMI:SENT notifications matched to datagrams.
+    uint32_t gSentMatched;
+    
+    // The progress of startConnect().
+    ConnectState gConnectState;
+    
+    // The options passed to startConnect().
+    bool gConnectSoftRadio;
+    bool gConnectNmi;
+    
+    // Runs until startConnect() gives up; gConnectDeadlinePassed is set
+    // when it expires.
+    WheelTimer gConnectDeadlineTimer;
+    bool gConnectDeadlinePassed;
+    
+    // Runs until the outstanding connect command times out or, in backoff,
+    // until the registration check is next due; gConnectStepDue is set when
+    // it expires.
+    WheelTimer gConnectStepTimer;
+    bool gConnectStepDue;
+    
+    // The current and limiting waits between registration checks.
+    uint32_t gConnectBackoffMs;
+    uint32_t gConnectBackoffMinMs;
+    uint32_t gConnectBackoffMaxMs;
+
+    // The number of AT+MGR commands receiveBatch() writes in one go.
+    uint32_t gReceivePipelineDepth;
     
-    // Pointer to serial port instance.
-    SerialPort * gpSerialPort;
+    // Count of unsolicited registration reports from the modem.
+    std::atomic<uint32_t> gRegistrationEvents;
+    
+    // The value of gRegistrationEvents at the last registration check.
+    uint32_t gRegistrationEventsSeen;
+    
+    // The timers of the connect and send state machines, moved along by
+    // pumpResponses(); one wheel serves however many commands and
+    // datagrams are outstanding.
+    TimerWheel gTimers;
+    
+    // Pointer to the transport instance and whether it was created,
+    // and so is to be deleted, by this instance.
+    Transport * gpTransport;
+    bool gOwnTransport;
     
     // Flag to indicate that this driver has been succesfully initialised.
     bool gInitialised;
 
-    // Send a string, printf()-style to the serial port
-    uint32_t sendPrintf (const char * pFormat, ...);
+    // Send a null-terminated AT command string to the serial port.
+    bool sendString (const char * pString);
     
-    // Check the modem interface for received characters, copying each one into
-    // pBuf.  If an AT_TERMINATOR is found, or lenBuf characters have been
-    // received, return the number of characters (including the AT_TERMINATOR),
-    // otherwise return 0.  No NULL terminator is added to pBuf.
-    uint32_t getLine (char * pBuf, uint32_t lenBuf);
+    // Check the modem interface for received characters, reading whatever is
+    // available in one go.  If an AT_TERMINATOR is found, or the receive
+    // buffer is full, set ppLine to point to the line and return the number of
+    // characters (including the AT_TERMINATOR), otherwise return 0.  No NULL
+    // terminator is added; the line remains valid until getLine() is next called.
+    uint32_t getLine (const char ** ppLine);
     
     // Tick along the process of receiving characters from the modem AT interface.
-    void rxTick();
+    // Returns true if a line was received, false if there was nothing complete.
+    bool rxTick();
+    
+    // Wait for up to timeoutMs for something to be received from the modem.
+    void waitRx (uint32_t timeoutMs);
+    
+    // Open a command with the dispatcher, first passing anything already
+    // received to the URC handlers.  pResponsePrefix is the start of the
+    // information responses to the command (see AtDispatcher::openCommand()).
+    // Must be called before the command is sent.
+    void beginCommand (const char * pResponsePrefix);
+    
+    // Close the command opened with beginCommand().
+    void endCommand ();
+    
+    // Read everything that has arrived from the modem, passing responses to
+    // the connect or submit state machine that has the command open, then
+    // run the callbacks of any timers that have expired.
+    void pumpResponses ();
+    
+    // Move along the handing of gSubmitTicket to the modem, without blocking.
+    void progressSubmit ();
+    
+    // Deal with the response at gpResponse while handing over gSubmitTicket.
+    void submitResponse ();
+    
+    // Return true while startConnect() has a command open with the modem.
+    bool connectBusy ();
+    
+    // Move the connect state machine to newState.
+    void setConnectState (ConnectState newState);
+    
+    // Send the next AT command on the way to connecting: the registration
+    // check (AT+NAS or AT+RAS), AT+SMI=1 or AT+NMI=2, moving to newState.
+    void connectCommand (ConnectState newState);
+    
+    // Registration check failed: wait, for a little longer each time.
+    void connectBackoff ();
+    
+    // Deal with the response at gpResponse while connecting.
+    void connectResponse ();
+    
+    // Finish handing gSubmitTicket to the modem, success or otherwise.
+    void submitDone (bool success);
+    
+    // If the line at pLine, length len, is "+MGR:<n>,<hex>" decode up to
+    // msgSize bytes of the datagram it carries straight into pMsg, in one
+    // pass over the line where it was received, and return n, otherwise
+    // return -1.  A line that does not carry n bytes of hex, e.g. because
+    // it was cut short, also gets -1 (with a warning), as what it does
+    // carry can't be trusted.
+    static int32_t parseMgr (const char * pLine, uint32_t len, char * pMsg, uint32_t msgSize);
+    
+    // Collect one datagram with AT+MGR, storing up to msgSize bytes of it at
+    // pMsg.  Returns its size, zero if the modem had none or -1 if the modem
+    // did not answer or the datagram was not whole, when it is dropped.
+    int32_t readDatagram (char * pMsg, uint32_t msgSize, uint32_t timeoutMs);
     
-    // Wait for a response from the modem, used during transmit operations.
+    // Collect up to count (at most gReceivePipelineDepth) datagrams,
+    // writing that many AT+MGR commands at once and then reading the answers.
+    // The datagrams are stored one after another from pArena, which must have
+    // room for count of gMaxDatagram bytes, and described in pSpans;
+    // pEmpty is set to true if the modem says it has no more and *pDropped
+    // is incremented for each datagram dropped because it was not whole.
+    // Returns the number collected or -1 if the modem did not answer.
+    int32_t readDatagrams (char * pArena, DatagramSpan * pSpans, uint32_t count, uint32_t timeoutMs, bool * pEmpty,
+                           uint32_t * pDropped);
+    
+    // Ask the modem how many datagrams it is holding with AT+MQS.  Returns
+    // the number or -1 if the modem did not say.
+    int32_t queryBuffered (uint32_t timeoutMs);
+    
+    // If the line at pLine, length len, is a +NMI notification carrying a
+    // datagram then put the datagram in gDownlinkQueue and return true,
+    // otherwise return false.
+    bool handleNmi (const char * pLine, uint32_t len);
+    
+    // Dispatcher handlers, pContext being the Nbiot instance: lines not
+    // matched to anything, +NMI notifications and +SMI notifications.
+    static void unsolicitedHandler (void * pContext, const char * pLine, uint32_t len);
+    static void nmiHandler (void * pContext, const char * pLine, uint32_t len);
+    static void sentHandler (void * pContext, const char * pLine, uint32_t len);
+    static void registrationHandler (void * pContext, const char * pLine, uint32_t len);
+    
+    // Timer callbacks, pContext being the Nbiot instance: the modem did
+    // not answer AT+MGS, the datagram with ticket param was not reported
+    // SENT, and the connect step and deadline timers.
+    static void submitTimeout (void * pContext, uint32_t param);
+    static void sentTimeout (void * pContext, uint32_t param);
+    static void connectStepTimeout (void * pContext, uint32_t param);
+    static void connectDeadlineTimeout (void * pContext, uint32_t param);
+    
+#if READER_THREAD_ENABLED
+    // The body of gReaderThread.
+    void readerThread ();
+#endif
+    
+    // Wait for a response to the outstanding command from the modem, used
+    // during transmit operations; only lines that the dispatcher has matched
+    // to the command arrive here, everything else goes to URC handlers.
     // If pExpected is not NULL, AtResponse will indicate if the received string
     // starts with the characters at pExpected (which must be a NULL terminated
     // string), otherwise it will indicate if the standard strings "OK" and
     // "ERROR" have been received, otherwise it will indicate that something
-    // other has been received. Up to responseBufLen received characters are
-    // stored at pResponseBuf and a NULL terminator is added.  The number of
-    // includes the AT terminator (AT_TERMINATOR).  Any characters over responseBufLen
-    // are discarded.
-    AtResponse waitResponse (const char * pExpected = NULL, time_t timeoutSeconds = DEFAULT_RESPONSE_TIMEOUT_SECONDS,
-                             char * pResponseBuf = NULL, uint32_t responseBufLen = 0);
+    // other has been received.  If the response starts with pExpected and ppLine
+    // is not NULL, *ppLine is pointed at the line where it was received, which
+    // is not NULL terminated, and *pLen set to its length, including the AT
+    // terminator (AT_TERMINATOR) unless the line was too long for the receive
+    // buffer; the line remains valid until the modem is next read.
+    AtResponse waitResponse (const char * pExpected = NULL, uint32_t timeoutMs = DEFAULT_RESPONSE_TIMEOUT_MS,
+                             const char ** ppLine = NULL, uint32_t * pLen = NULL);
+    
+    // Check the line at gpResponse in the same way as waitResponse(), without
+    // waiting.  If it matches nothing gpResponse is reset and AT_RESPONSE_NONE
+    // is returned.
+    AtResponse matchResponse (const char * pExpected);
+};
+
+// An Nbiot with every buffer and queue sized at compile time and held
+// within the instance, so that it allocates nothing: declared static, or
+// on the stack, with a transport that is also not allocated, no heap is
+// used at all.  MaxDatagram is the largest datagram that can be sent or
+// received, in bytes, RxCapacity the longest line that can be read from
+// the modem, in characters, the next three the lengths of the queues and
+// TimerSlots the size of the timer wheel.  For example, for 64 byte
+// datagrams and short queues:
+//
+// static SerialPort gPort;
+// static BasicNbiot<64, 64 * 2 + AT_STRING_MARGIN, 4, 4, 4> gModem(&gPort);
+//
+// The buffers take roughly SendQueueLength * MaxDatagram * 2 +
+// DownlinkQueueLength * MaxDatagram + (RxLineQueueLength + 2) * RxCapacity
+// bytes.  On 64-bit Linux the example comes to 3376 bytes in all if built
+// with METRICS_ENABLED and READER_THREAD_ENABLED set to 0, against 18592
+// with both left on; RxLineQueueLength may then be 1, as only the reader
+// thread queues lines.
+template <uint32_t MaxDatagram, uint32_t RxCapacity = MaxDatagram * 2 + AT_STRING_MARGIN,
+          uint32_t SendQueueLength = DEFAULT_SEND_QUEUE_LENGTH,
+          uint32_t DownlinkQueueLength = DEFAULT_DOWNLINK_QUEUE_LENGTH,
+          uint32_t RxLineQueueLength = DEFAULT_RX_LINE_QUEUE_LENGTH,
+          uint32_t TimerSlots = DEFAULT_BASIC_TIMER_SLOTS>
+class BasicNbiot : public Nbiot
+{
+    static_assert(MaxDatagram > 0, "MaxDatagram must be at least one byte");
+    static_assert(RxCapacity >= MaxDatagram * 2 + AT_STRING_MARGIN,
+                  "RxCapacity must hold a +MGR line carrying a hex encoded datagram of MaxDatagram bytes");
+    static_assert((SendQueueLength > 0) && ((SendQueueLength & (SendQueueLength - 1)) == 0),
+                  "SendQueueLength must be a power of two");
+    static_assert((DownlinkQueueLength > 0) && ((DownlinkQueueLength & (DownlinkQueueLength - 1)) == 0),
+                  "DownlinkQueueLength must be a power of two");
+    static_assert((RxLineQueueLength > 0) && ((RxLineQueueLength & (RxLineQueueLength - 1)) == 0),
+                  "RxLineQueueLength must be a power of two");
+    static_assert((TimerSlots > 0) && ((TimerSlots & (TimerSlots - 1)) == 0),
+                  "TimerSlots must be a power of two");
+
+public:
+    // Constructor, as Nbiot::Nbiot(Transport *).
+    BasicNbiot (Transport * pTransport) : Nbiot(pTransport, gBuffers.getMemory()) {}
+
+    // Destructor: stop the reader thread while the memory it works in
+    // is still here.
+    ~BasicNbiot () {stopAsyncReceive();}
+
+protected:
+    // The memory; the Nbiot constructor only takes its address, and it
+    // needs no construction of its own, so it may be handed over before
+    // this member is initialised.
+    Buffers<MaxDatagram, RxCapacity, SendQueueLength, DownlinkQueueLength, RxLineQueueLength, TimerSlots> gBuffers;
 };
 
 #endif
@@ -0,0 +1,346 @@
+// Pool of NB-IoT modems for NB-IoT example application
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "utilities.h"
+#include "logging.h"
+#include "transport.h"
+#include "serial_driver.h"
+#include "line_buffer.h"
+#include "spsc_queue.h"
+#include "at_dispatcher.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include "modem_driver.h"
+#include "modem_pool.h"
+
+#ifdef __linux__
+# include <sys/epoll.h>
+#endif
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// Where there is no epoll, how long to sleep between checking
+// each of the transports for characters
+#define POOL_POLL_INTERVAL_MS 1
+
+// ----------------------------------------------------------------
+// PROTECTED FUNCTIONS
+// ----------------------------------------------------------------
+
+// Change the state of a modem.
+void ModemPool::setState(uint32_t modem, ModemState state)
+{
+    gpModems[modem]->state = state;
+#ifdef __linux__
+    if (state == POOL_MODEM_FAILED)
+    {
+        // Nothing more to hear from it
+        epoll_ctl(gEpollFd, EPOLL_CTL_DEL, gpModems[modem]->pNbiot->getFd(), NULL);
+    }
+#endif
+    if (gpStateHandler != NULL)
+    {
+        gpStateHandler(gpContext, modem, state);
+    }
+}
+
+// Move a modem along: read what it has sent and move its state
+// machines along, passing on state changes, downlink datagrams and
+// send results.
+void ModemPool::serviceModem(uint32_t modem)
+{
+    PoolModem * pModem = gpModems[modem];
+    Nbiot * pNbiot = pModem->pNbiot;
+    Nbiot::ConnectState connectState;
+    Nbiot::SendStatus status;
+    uint32_t size;
+    bool done = false;
+
+    if (pModem->state == POOL_MODEM_CONNECTING)
+    {
+        connectState = pNbiot->serviceConnect();
+        if (connectState == Nbiot::CONNECT_STATE_CONNECTED)
+        {
+            setState(modem, POOL_MODEM_READY);
+        }
+        else if (connectState == Nbiot::CONNECT_STATE_FAILED)
+        {
+            setState(modem, POOL_MODEM_FAILED);
+        }
+    }
+
+    if (pModem->state == POOL_MODEM_READY)
+    {
+        pNbiot->serviceSends();
+
+        while ((size = pNbiot->getDownlink(gDownlinkBuf, sizeof (gDownlinkBuf))) > 0)
+        {
+            if (gpDownlinkHandler != NULL)
+            {
+                if (size > sizeof (gDownlinkBuf))
+                {
+                    size = sizeof (gDownlinkBuf);
+                }
+                gpDownlinkHandler(gpContext, modem, gDownlinkBuf, size);
+            }
+        }
+
+        // Report datagrams that have finished, in ticket order
+        while (!done && ((int32_t) (pModem->lastTicket - pModem->firstPending) >= 0))
+        {
+            status = pNbiot->getSendStatus(pModem->firstPending);
+            done = (status == Nbiot::SEND_STATUS_QUEUED) || (status == Nbiot::SEND_STATUS_SUBMITTING) ||
+                   (status == Nbiot::SEND_STATUS_SUBMITTED);
+            if (!done)
+            {
+                if (gpSendHandler != NULL)
+                {
+                    gpSendHandler(gpContext, modem, pModem->firstPending, status);
+                }
+                pModem->firstPending++;
+            }
+        }
+    }
+
+    setTimer(modem);
+}
+
+// Set the timer of a modem.
+void ModemPool::setTimer(uint32_t modem)
+{
+    PoolModem * pModem = gpModems[modem];
+    int64_t nextTimeoutMs = -1;
+
+    if (pModem->state != POOL_MODEM_FAILED)
+    {
+        nextTimeoutMs = pModem->pNbiot->getNextTimeoutMs();
+    }
+    if (nextTimeoutMs >= 0)
+    {
+        gTimers.startAt(&pModem->timer, nextTimeoutMs);
+    }
+    else
+    {
+        gTimers.stop(&pModem->timer);
+    }
+}
+
+// Timer callback: one of a modem's timeouts is due.
+void ModemPool::modemTimeout(void * pContext, uint32_t param)
+{
+    ((ModemPool *) pContext)->serviceModem(param);
+}
+
+// Add a modem to the pool
+int32_t ModemPool::addNbiot(Nbiot * pNbiot, bool usingSoftRadio, uint32_t connectTimeoutMs)
+{
+    int32_t modem = -1;
+    PoolModem * pModem;
+#ifdef __linux__
+    struct epoll_event event;
+#endif
+
+    if (gNumModems < POOL_MAX_MODEMS)
+    {
+        pModem = new PoolModem;
+        pModem->pNbiot = pNbiot;
+        pModem->state = POOL_MODEM_CONNECTING;
+        pModem->firstPending = 1; // Nbiot tickets start at 1
+        pModem->lastTicket = 0;
+
+        // Have the modem deliver datagrams in +NMI notifications once
+        // connected, read from here rather than by a thread of its own
+        if (pModem->pNbiot->startConnect(usingSoftRadio, connectTimeoutMs, true))
+        {
+            modem = gNumModems;
+            gpModems[modem] = pModem;
+            gNumModems++;
+            TimerWheel::init(&pModem->timer, modemTimeout, this, modem);
+            setTimer(modem);
+#ifdef __linux__
+            event.events = EPOLLIN;
+            event.data.u32 = modem;
+            if (epoll_ctl(gEpollFd, EPOLL_CTL_ADD, pModem->pNbiot->getFd(), &event) != 0)
+            {
+                LOG_ERROR ("!!! Unable to add modem %d to the event loop.\n", (int) modem);
+            }
+#endif
+        }
+        else
+        {
+            delete pModem->pNbiot;
+            delete pModem;
+        }
+    }
+    else
+    {
+        LOG_ERROR ("!!! The modem pool is full (%d modems).\n", POOL_MAX_MODEMS);
+        delete pNbiot;
+    }
+
+    return modem;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor
+ModemPool::ModemPool()
+{
+    gNumModems = 0;
+    gpStateHandler = NULL;
+    gpDownlinkHandler = NULL;
+    gpSendHandler = NULL;
+    gpContext = NULL;
+    memset (gpModems, 0, sizeof (gpModems));
+
+#ifdef __linux__
+    gEpollFd = epoll_create1(0);
+    if (gEpollFd < 0)
+    {
+        LOG_ERROR ("!!! Unable to create the modem pool event loop.\n");
+    }
+#endif
+}
+
+// Destructor
+ModemPool::~ModemPool()
+{
+    for (uint32_t x = 0; x < gNumModems; x++)
+    {
+        delete gpModems[x]->pNbiot;
+        delete gpModems[x];
+    }
+
+#ifdef __linux__
+    if (gEpollFd >= 0)
+    {
+        close(gEpollFd);
+    }
+#endif
+}
+
+// Set the handlers
+void ModemPool::setHandlers(StateHandler pStateHandler, DownlinkHandler pDownlinkHandler,
+                            SendHandler pSendHandler, void * pContext)
+{
+    gpStateHandler = pStateHandler;
+    gpDownlinkHandler = pDownlinkHandler;
+    gpSendHandler = pSendHandler;
+    gpContext = pContext;
+}
+
+// Add the modem on a serial port to the pool
+int32_t ModemPool::addModem(const char * pPortname, bool usingSoftRadio, uint32_t connectTimeoutMs)
+{
+    return addNbiot(new Nbiot(pPortname), usingSoftRadio, connectTimeoutMs);
+}
+
+// Add the modem on a transport to the pool
+int32_t ModemPool::addModem(Transport * pTransport, bool usingSoftRadio, uint32_t connectTimeoutMs)
+{
+    return addNbiot(new Nbiot(pTransport), usingSoftRadio, connectTimeoutMs);
+}
+
+// Return the number of modems
+uint32_t ModemPool::getNumModems()
+{
+    return gNumModems;
+}
+
+// Return the state of a modem
+ModemPool::ModemState ModemPool::getState(uint32_t modem)
+{
+    ModemState state = POOL_MODEM_FAILED;
+
+    if (modem < gNumModems)
+    {
+        state = gpModems[modem]->state;
+    }
+
+    return state;
+}
+
+// Return the Nbiot instance for a modem
+Nbiot * ModemPool::getModem(uint32_t modem)
+{
+    Nbiot * pNbiot = NULL;
+
+    if (modem < gNumModems)
+    {
+        pNbiot = gpModems[modem]->pNbiot;
+    }
+
+    return pNbiot;
+}
+
+// Queue a datagram on a modem
+uint32_t ModemPool::send(uint32_t modem, const char * pMsg, uint32_t msgSize)
+{
+    uint32_t ticket = 0;
+
+    // Don't let a new ticket take the slot of one not yet reported
+    if ((modem < gNumModems) && (gpModems[modem]->state == POOL_MODEM_READY) &&
+        (gpModems[modem]->lastTicket + 1 - gpModems[modem]->firstPending < gpModems[modem]->pNbiot->getSendQueueLength()))
+    {
+        ticket = gpModems[modem]->pNbiot->sendAsync(pMsg, msgSize);
+        if (ticket != 0)
+        {
+            gpModems[modem]->lastTicket = ticket;
+        }
+        setTimer(modem);
+    }
+
+    return ticket;
+}
+
+// Run the event loop once
+void ModemPool::poll(uint32_t timeoutMs)
+{
+#ifdef __linux__
+    struct epoll_event events[POOL_MAX_MODEMS];
+    int numEvents;
+
+    // Wake up in time for the first timeout of any modem
+    timeoutMs = gTimers.getWaitMs(timeoutMs);
+    numEvents = epoll_wait(gEpollFd, events, POOL_MAX_MODEMS, (int) timeoutMs);
+    for (int x = 0; x < numEvents; x++)
+    {
+        serviceModem(events[x].data.u32);
+    }
+#else
+    // Without epoll, look at each port in turn until one has something
+    bool readable = false;
+    int64_t startMs = getTimeMs();
+
+    // Give up in time for the first timeout of any modem
+    timeoutMs = gTimers.getWaitMs(timeoutMs);
+
+    do
+    {
+        for (uint32_t x = 0; x < gNumModems; x++)
+        {
+            if ((gpModems[x]->state != POOL_MODEM_FAILED) && gpModems[x]->pNbiot->waitReadable(0))
+            {
+                serviceModem(x);
+                readable = true;
+            }
+        }
+        if (!readable)
+        {
+            sleepMs(POOL_POLL_INTERVAL_MS);
+        }
+    } while (!readable && (getTimeMs() - startMs < (int64_t) timeoutMs));
+#endif
+
+    // Service the modems whose timeouts are due
+    gTimers.advance(getTimeMs());
+}
+
+// End Of File
@@ -0,0 +1,144 @@
+// Pool of NB-IoT modems for NB-IoT example application
+
+#ifndef _MODEM_POOL_H_
+#define _MODEM_POOL_H_
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The maximum number of modems in a pool
+#define POOL_MAX_MODEMS 64
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// Drives many Nbiot instances from one thread.  An event loop waits on all
+// the transports at once (epoll on Linux) and, as each one becomes
+// readable, moves that modem's state machines along: first connecting
+// (Nbiot::startConnect(), including setting the modem to deliver datagrams
+// in +NMI notifications), then its send pipeline and downlink queue,
+// reporting events through the handlers.  A modem that has sent nothing is
+// serviced only when one of its timeouts falls due (see
+// Nbiot::getNextTimeoutMs()), a timer wheel holding the next for each
+// modem, so idle modems cost nothing however many there are.  All
+// functions must be called from the one thread that calls poll().
+class ModemPool
+{
+public:
+    // The state of a modem in the pool.
+    typedef enum
+    {
+        POOL_MODEM_CONNECTING, // Connecting to the network
+        POOL_MODEM_READY,      // Sending and receiving
+        POOL_MODEM_FAILED      // Could not be connected
+    } ModemState;
+
+    // Called when a modem changes state.
+    typedef void (*StateHandler) (void * pContext, uint32_t modem, ModemState state);
+
+    // Called with each datagram received by a modem; pData is only
+    // valid for the duration of the call.
+    typedef void (*DownlinkHandler) (void * pContext, uint32_t modem, const char * pData, uint32_t size);
+
+    // Called when a datagram queued with send() is SENT or fails.
+    typedef void (*SendHandler) (void * pContext, uint32_t modem, uint32_t ticket, Nbiot::SendStatus status);
+
+    // Constructor.
+    ModemPool ();
+
+    // Destructor.
+    ~ModemPool ();
+
+    // Set the handlers to be called, with pContext, from poll(); any may
+    // be NULL.
+    void setHandlers (StateHandler pStateHandler, DownlinkHandler pDownlinkHandler,
+                      SendHandler pSendHandler, void * pContext);
+
+    // Add the modem on serial port pPortname (as for the Nbiot constructor)
+    // to the pool and start connecting it, as Nbiot::connect().  Returns the
+    // index of the modem or -1 if the pool is full or the port could not be
+    // opened.
+    int32_t addModem (const char * pPortname, bool usingSoftRadio = false,
+                      uint32_t connectTimeoutMs = DEFAULT_CONNECT_TIMEOUT_MS);
+
+    // As above but for the modem on pTransport (as for the Nbiot constructor),
+    // which must outlive the pool.  On Linux the transport must have a file
+    // descriptor for the event loop to wait on, as SerialPort and
+    // TcpTransport do.
+    int32_t addModem (Transport * pTransport, bool usingSoftRadio = false,
+                      uint32_t connectTimeoutMs = DEFAULT_CONNECT_TIMEOUT_MS);
+
+    // Return the number of modems in the pool.
+    uint32_t getNumModems ();
+
+    // Return the state of a modem.
+    ModemState getState (uint32_t modem);
+
+    // Return the Nbiot instance for a modem, e.g. to read its counters.
+    Nbiot * getModem (uint32_t modem);
+
+    // Queue a datagram to be sent by a ready modem, as Nbiot::sendAsync().
+    // Returns the ticket, which will be passed to the send handler when the
+    // datagram is SENT or fails, or zero if the modem is not ready or its
+    // queue is full.
+    uint32_t send (uint32_t modem, const char * pMsg, uint32_t msgSize);
+
+    // Wait for up to timeoutMs for something to happen on any modem, then
+    // service every modem that needs it, calling the handlers.  Call this
+    // repeatedly to run the pool.
+    void poll (uint32_t timeoutMs);
+
+protected:
+    // A modem in the pool.
+    typedef struct
+    {
+        Nbiot * pNbiot;
+        ModemState state;
+        uint32_t firstPending;      // The oldest ticket not yet reported
+        uint32_t lastTicket;        // The last ticket issued
+        WheelTimer timer;           // Runs until the modem's next timeout
+    } PoolModem;
+
+    // The modems, gNumModems of them.
+    PoolModem * gpModems[POOL_MAX_MODEMS];
+    uint32_t gNumModems;
+
+    // The handlers and their context.
+    StateHandler gpStateHandler;
+    DownlinkHandler gpDownlinkHandler;
+    SendHandler gpSendHandler;
+    void * gpContext;
+
+    // The timers of the modems.
+    TimerWheel gTimers;
+
+#ifdef __linux__
+    // The epoll instance waiting on the transports.
+    int gEpollFd;
+#endif
+
+    // Storage for a datagram on its way to the downlink handler.
+    char gDownlinkBuf[MAX_LEN_SEND_STRING];
+
+    // Add pNbiot, which the pool takes ownership of, and start connecting
+    // it; returns the index of the modem or -1.
+    int32_t addNbiot (Nbiot * pNbiot, bool usingSoftRadio, uint32_t connectTimeoutMs);
+
+    // Change the state of a modem, calling the state handler.
+    void setState (uint32_t modem, ModemState state);
+
+    // Move a modem along, calling the handlers.
+    void serviceModem (uint32_t modem);
+
+    // Set the timer of a modem to when its next timeout is due.
+    void setTimer (uint32_t modem);
+
+    // Timer callback, pContext being the pool and param the modem.
+    static void modemTimeout (void * pContext, uint32_t param);
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,251 @@
+// Uplink payload compression for NB-IoT example application
+
+#include <stdint.h>
+#include <string.h>
+#include "payload_codec.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The most literal bytes in one token
+#define MAX_LITERAL_RUN 128
+
+// The shortest and longest copy in one token
+#define MIN_MATCH 3
+#define MAX_MATCH 18
+
+// The furthest back a copy can start
+#define MAX_OFFSET 2048
+
+// The size of the dictionary
+#define DICTIONARY_SIZE (sizeof (gDictionary) - 1)
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+// The dictionary that compressed payloads are preceded by; it must
+// match the one in server_side/Program.cs byte for byte.
+static const char gDictionary[] =
+    "{\"id\":\"\",\"seq\":,\"time\":\"2026-01-01T00:00:00Z\",\"ts\":1700000000,"
+    "\"temperature\":2,\"temp\":-0.5,\"humidity\":5,\"pressure\":101,"
+    "\"battery\":3.,\"voltage\":,\"current\":,\"rssi\":-,\"snr\":,"
+    "\"lat\":51.,\"lon\":-0.,\"alt\":,\"value\":,\"values\":[,],"
+    "\"count\":,\"level\":,\"state\":\"on\",\"status\":\"ok\","
+    "\"error\":,\"alarm\":true,false,null}\r\n"
+    "Hello World! 0123456789.0,0.1,1.0,10.0,20.5,100";
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Return byte x of the dictionary followed by pPayload.
+static inline uint8_t windowByte (const char * pPayload, uint32_t x)
+{
+    return (uint8_t) ((x < DICTIONARY_SIZE) ? gDictionary[x] : pPayload[x - DICTIONARY_SIZE]);
+}
+
+// Write size bytes at pLiterals as literal tokens to pOutBuf at *pOutLen.
+// Returns false if they would not fit in lenOutBuf.
+static bool writeLiterals (const char * pLiterals, uint32_t size, char * pOutBuf, uint32_t * pOutLen, uint32_t lenOutBuf)
+{
+    bool fits = true;
+    uint32_t run;
+
+    while (fits && (size > 0))
+    {
+        run = (size > MAX_LITERAL_RUN) ? MAX_LITERAL_RUN : size;
+        fits = (*pOutLen + 1 + run <= lenOutBuf);
+        if (fits)
+        {
+            pOutBuf[*pOutLen] = (char) (run - 1);
+            memcpy (pOutBuf + *pOutLen + 1, pLiterals, run);
+            *pOutLen += 1 + run;
+            pLiterals += run;
+            size -= run;
+        }
+    }
+
+    return fits;
+}
+
+// Compress size bytes from pInBuf into pOutBuf, without a header.  Each
+// position takes the longest copy found anywhere within reach, which,
+// with datagrams of a few hundred bytes, is quick enough and needs no
+// memory beyond the output.  Returns the number of bytes written, or 0
+// if they would not fit in lenOutBuf.
+static uint32_t lzCompress (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf)
+{
+    uint32_t outLen = 0;
+    uint32_t literalStart = 0;
+    uint32_t position = 0;
+    uint32_t windowPosition;
+    uint32_t candidate;
+    uint32_t maxLength;
+    uint32_t length;
+    uint32_t bestLength;
+    uint32_t bestCandidate = 0;
+    uint32_t offset;
+    bool fits = true;
+
+    while (fits && (position < size))
+    {
+        windowPosition = DICTIONARY_SIZE + position;
+        candidate = (windowPosition > MAX_OFFSET) ? windowPosition - MAX_OFFSET : 0;
+        maxLength = (size - position > MAX_MATCH) ? MAX_MATCH : size - position;
+        bestLength = 0;
+        if (maxLength >= MIN_MATCH)
+        {
+            for (; (candidate < windowPosition) && (bestLength < maxLength); candidate++)
+            {
+                length = 0;
+                while ((length < maxLength) && (windowByte (pInBuf, candidate + length) == (uint8_t) pInBuf[position + length]))
+                {
+                    length++;
+                }
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    bestCandidate = candidate;
+                }
+            }
+        }
+
+        if (bestLength >= MIN_MATCH)
+        {
+            fits = writeLiterals (pInBuf + literalStart, position - literalStart, pOutBuf, &outLen, lenOutBuf) &&
+                   (outLen + 2 <= lenOutBuf);
+            if (fits)
+            {
+                offset = windowPosition - bestCandidate - 1;
+                pOutBuf[outLen] = (char) (0x80 | ((bestLength - MIN_MATCH) << 3) | (offset >> 8));
+                pOutBuf[outLen + 1] = (char) (offset & 0xFF);
+                outLen += 2;
+            }
+            position += bestLength;
+            literalStart = position;
+        }
+        else
+        {
+            position++;
+        }
+    }
+
+    if (fits)
+    {
+        fits = writeLiterals (pInBuf + literalStart, position - literalStart, pOutBuf, &outLen, lenOutBuf);
+    }
+
+    return fits ? outLen : 0;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Encode a payload.
+uint32_t payloadEncode (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf, bool compress, bool aggregate)
+{
+    uint32_t outLen = 0;
+    uint32_t lenCompressed = 0;
+
+    if (lenOutBuf > 0)
+    {
+        if (compress && (size > 1))
+        {
+            // Only worth having if it is smaller than the payload as-is
+            lenCompressed = lzCompress (pInBuf, size, pOutBuf + 1, (lenOutBuf - 1 < size - 1) ? lenOutBuf - 1 : size - 1);
+        }
+        if (lenCompressed > 0)
+        {
+            pOutBuf[0] = (char) (aggregate ? PAYLOAD_HEADER_AGGREGATE_LZ : PAYLOAD_HEADER_LZ);
+            outLen = 1 + lenCompressed;
+        }
+        else if (size + 1 <= lenOutBuf)
+        {
+            pOutBuf[0] = (char) (aggregate ? PAYLOAD_HEADER_AGGREGATE_STORED : PAYLOAD_HEADER_STORED);
+            memcpy (pOutBuf + 1, pInBuf, size);
+            outLen = 1 + size;
+        }
+    }
+
+    return outLen;
+}
+
+// Decode a payload.
+uint32_t payloadDecode (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf, bool * pAggregate)
+{
+    uint32_t outLen = 0;
+    uint32_t x = 1;
+    uint32_t length;
+    uint32_t offset;
+    uint8_t header = 0;
+    uint8_t token;
+    bool valid = (size > 0);
+
+    if (valid)
+    {
+        header = (uint8_t) pInBuf[0];
+        if (pAggregate != NULL)
+        {
+            *pAggregate = (header == PAYLOAD_HEADER_AGGREGATE_STORED) || (header == PAYLOAD_HEADER_AGGREGATE_LZ);
+        }
+    }
+
+    if (valid && ((header == PAYLOAD_HEADER_STORED) || (header == PAYLOAD_HEADER_AGGREGATE_STORED)))
+    {
+        valid = (size - 1 <= lenOutBuf);
+        if (valid)
+        {
+            memcpy (pOutBuf, pInBuf + 1, size - 1);
+            outLen = size - 1;
+        }
+    }
+    else if (valid && ((header == PAYLOAD_HEADER_LZ) || (header == PAYLOAD_HEADER_AGGREGATE_LZ)))
+    {
+        while (valid && (x < size))
+        {
+            token = (uint8_t) pInBuf[x];
+            if ((token & 0x80) == 0)
+            {
+                length = token + 1;
+                valid = (x + 1 + length <= size) && (outLen + length <= lenOutBuf);
+                if (valid)
+                {
+                    memcpy (pOutBuf + outLen, pInBuf + x + 1, length);
+                    outLen += length;
+                    x += 1 + length;
+                }
+            }
+            else
+            {
+                length = ((token >> 3) & 0x0F) + MIN_MATCH;
+                valid = (x + 2 <= size);
+                if (valid)
+                {
+                    offset = (((token & 0x07) << 8) | (uint8_t) pInBuf[x + 1]) + 1;
+                    valid = (offset <= DICTIONARY_SIZE + outLen) && (outLen + length <= lenOutBuf);
+                }
+                if (valid)
+                {
+                    // Byte by byte, as the copy may overlap what it produces
+                    for (uint32_t y = DICTIONARY_SIZE + outLen - offset; length > 0; y++, length--)
+                    {
+                        pOutBuf[outLen] = (y < DICTIONARY_SIZE) ? gDictionary[y] : pOutBuf[y - DICTIONARY_SIZE];
+                        outLen++;
+                    }
+                    x += 2;
+                }
+            }
+        }
+    }
+    else
+    {
+        valid = false;
+    }
+
+    return valid ? outLen : 0;
+}
+
+// End Of File
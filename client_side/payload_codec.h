@@ -0,0 +1,66 @@
+// Uplink payload compression for NB-IoT example application
+
+#ifndef _PAYLOAD_CODEC_H_
+#define _PAYLOAD_CODEC_H_
+
+// An encoded payload starts with a one-byte header saying what follows,
+// so that compression can be chosen datagram by datagram.  Every uplink
+// datagram is encoded, compressed or not, and the server side goes by
+// the header alone: it never guesses from the bytes of the payload, so
+// any payload, text or binary, comes through as it was sent.  The header
+// also says whether the payload is an aggregate of records (see
+// uplink_aggregator.h), so that nothing inside the payload has to be
+// reserved to mark one.  All four header values are bytes that UTF-8
+// never uses (0xC0, 0xC1 and 0xF5 to 0xFF), so a datagram is not taken
+// for text even by something that knows nothing of this encoding.
+//
+// A compressed payload is a sequence of tokens, each starting with a
+// byte that says what it is:
+//
+//   0LLLLLLL:          L + 1 literal bytes follow (1 to 128).
+//   1LLLLOOO OOOOOOOO: copy L + 3 bytes (3 to 18) from O + 1 bytes back
+//                      (1 to 2048) in the output, which for this purpose
+//                      is preceded by a dictionary; the copy may overlap
+//                      the bytes it is producing.
+//
+// The dictionary is a fixed set of strings common in sensor records,
+// so that even the first bytes of a short datagram have something to
+// match.  It must be the same here and wherever the datagram is decoded
+// (server_side/Program.cs): changing it needs a new header value.
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The header of a payload that is carried as-is
+#define PAYLOAD_HEADER_STORED 0xC0
+
+// The header of a compressed payload
+#define PAYLOAD_HEADER_LZ 0xC1
+
+// The headers of an aggregate of records, carried as-is or compressed
+#define PAYLOAD_HEADER_AGGREGATE_STORED 0xF5
+#define PAYLOAD_HEADER_AGGREGATE_LZ 0xF6
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+// Encode size bytes from pInBuf into pOutBuf, header first, compressing
+// them if compress is true and that makes them smaller, otherwise
+// storing them as-is, with one of the aggregate headers if aggregate is
+// true.  Returns the number of bytes written, or 0 if they would not fit
+// in lenOutBuf.
+uint32_t payloadEncode (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf, bool compress,
+                        bool aggregate = false);
+
+// Decode the encoded payload of size bytes at pInBuf into pOutBuf,
+// setting *pAggregate, if pAggregate is not NULL, to whether it is an
+// aggregate.  Returns the number of bytes written, or 0 if pInBuf is not
+// an encoded payload, is corrupt or would not fit in lenOutBuf.
+uint32_t payloadDecode (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf,
+                        bool * pAggregate = NULL);
+
+#endif
+
+// End Of File
@@ -0,0 +1,36 @@
+// Platform abstraction for NB-IoT example application
+
+#ifndef _PLATFORM_H_
+#define _PLATFORM_H_
+
+// ----------------------------------------------------------------
+// INCLUDES
+// ----------------------------------------------------------------
+
+#ifdef _WIN32
+// winsock2.h must come before windows.h, which would otherwise
+// bring in the old winsock.h
+# include <winsock2.h>
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+#ifndef _WIN32
+// TCHAR is a Windows type; on POSIX platforms port names are plain
+// char strings, e.g. "/dev/ttyUSB0"
+typedef char TCHAR;
+
+// Maximum length of a path name (Windows provides this)
+# ifndef MAX_PATH
+#  define MAX_PATH 260
+# endif
+#endif
+
+#endif
+
+// End Of File
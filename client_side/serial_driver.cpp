@@ -2,13 +2,44 @@
 
 #include "stdint.h"
 #include "stdio.h"
-#include "windows.h"
+#include "string.h"
+#include "platform.h"
+#ifndef _WIN32
+# include <errno.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <termios.h>
+# include <sys/uio.h>
+#endif
+#include "utilities.h"
+#include "logging.h"
+#include "transport.h"
 #include "serial_driver.h"
 
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The baud rate of the AT interface of the NB-IoT module
+#ifdef _WIN32
+# define SERIAL_BAUD_RATE 57600
+#else
+# define SERIAL_BAUD_RATE B57600
+#endif
+
+#ifdef _WIN32
+// Windows provides no way to block on a (non-overlapped) COM port
+// until characters arrive without consuming them, so waitReadable()
+// checks the receive queue at this interval
+# define SERIAL_WAIT_READABLE_POLL_MS 1
+#endif
+
 // ----------------------------------------------------------------
 // CLASSES/METHODS
 // ----------------------------------------------------------------
 
+#ifdef _WIN32
+
 // Constructor.
 SerialPort::SerialPort()
 {
@@ -37,7 +68,7 @@ bool SerialPort::connect(const TCHAR * pPortName)
 
     dcb.DCBlength = sizeof(dcb);
 
-    dcb.BaudRate = 57600;
+    dcb.BaudRate = SERIAL_BAUD_RATE;
     dcb.Parity = NOPARITY;
     dcb.fParity = 0;
     dcb.StopBits = ONESTOPBIT;
@@ -69,9 +100,9 @@ bool SerialPort::connect(const TCHAR * pPortName)
             NULL,
             err,
             MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPTSTR) &pMsgBuf, 0, NULL);
-        printf("!!! Error connecting to serial port '%S': %S.\n", pPortName, pMsgBuf);
+        LOG_ERROR ("!!! Error connecting to serial port '%S': %S.\n", pPortName, pMsgBuf);
 #else
-        printf("!!! Error %d connecting to serial port %s.\n", err, pPortName);
+        LOG_ERROR ("!!! Error %d connecting to serial port %s.\n", err, pPortName);
 #endif
     }
 
@@ -105,13 +136,28 @@ bool SerialPort::transmitBuffer(const char *pBuf, uint32_t lenBuf)
         WriteFile(gSerialPortHandle, pBuf, lenBuf, &result, NULL);
         if (!result)
         {
-            printf ("!!! Transmit failed with error code %ld.\n", GetLastError());
+            LOG_ERROR ("!!! Transmit failed with error code %ld.\n", GetLastError());
         }
     }
 
     return (bool) result;
 }
 
+// Send a number of segments over the serial port, returning true
+// in the case of success.  A non-overlapped COM handle has no
+// gathered write so the segments are written one after another.
+bool SerialPort::transmitVector(const TxSegment * pSegments, uint32_t numSegments)
+{
+    bool success = true;
+
+    for (uint32_t x = 0; success && (x < numSegments); x++)
+    {
+        success = transmitBuffer(pSegments[x].pBuf, pSegments[x].len);
+    }
+
+    return success;
+}
+
 // Get up to lenBuf bytes into pBuf from the serial port,
 // returning the number of characters actually read.
 uint32_t SerialPort::receiveBuffer (char *pBuf, uint32_t lenBuf)
@@ -125,7 +171,7 @@ uint32_t SerialPort::receiveBuffer (char *pBuf, uint32_t lenBuf)
         result = ReadFile(gSerialPortHandle, pBuf, lenBuf, &readLength, NULL);
         if (!result)
         {
-            printf ("!!! Receive failed with error code %ld.\n", GetLastError());
+            LOG_ERROR ("!!! Receive failed with error code %ld.\n", GetLastError());
         }
     }
 
@@ -154,17 +200,322 @@ int32_t SerialPort::receiveChar()
         }
         else
         {
-            printf ("!!! Receive failed with error code %ld.\n", GetLastError());
+            LOG_ERROR ("!!! Receive failed with error code %ld.\n", GetLastError());
         }
     }
 
     return returnChar;
 }
 
+// Wait for up to timeoutMs for characters to be received.
+bool SerialPort::waitReadable(uint32_t timeoutMs)
+{
+    bool readable = false;
+    unsigned long errors;
+    COMSTAT status;
+    uint32_t waitedMs = 0;
+
+    if (gSerialPortHandle != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (ClearCommError(gSerialPortHandle, &errors, &status) && (status.cbInQue > 0))
+            {
+                readable = true;
+            }
+            else if (waitedMs < timeoutMs)
+            {
+                Sleep(SERIAL_WAIT_READABLE_POLL_MS);
+                waitedMs += SERIAL_WAIT_READABLE_POLL_MS;
+            }
+        } while (!readable && (waitedMs < timeoutMs));
+    }
+
+    return readable;
+}
+
+// Return whether the port is connected.
+bool SerialPort::isConnected()
+{
+    return (gSerialPortHandle != INVALID_HANDLE_VALUE);
+}
+
 // Clear the receive and transmit buffers of the serial port
 void SerialPort::clear()
 {
     PurgeComm (gSerialPortHandle, PURGE_RXCLEAR | PURGE_TXCLEAR);
 }
 
+#else
+
+// Constructor.
+SerialPort::SerialPort()
+{
+    gSerialPortFd = -1;
+}
+
+// Destructor.
+SerialPort::~SerialPort()
+{
+    if (gSerialPortFd >= 0)
+    {
+        close(gSerialPortFd);
+    }
+
+    gSerialPortFd = -1;
+}
+
+// Make a connection to a named port.
+bool SerialPort::connect(const TCHAR * pPortName)
+{
+    bool success = false;
+    struct termios settings;
+
+    // Open non-blocking: reads return immediately and waitReadable()
+    // is used to sleep until something arrives
+    gSerialPortFd = open(pPortName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (gSerialPortFd >= 0)
+    {
+        if (tcgetattr(gSerialPortFd, &settings) == 0)
+        {
+            // Raw 8N1, no flow control, ignore modem control lines
+            cfmakeraw(&settings);
+            settings.c_cflag &= ~(PARENB | CSTOPB | CSIZE | CRTSCTS);
+            settings.c_cflag |= CS8 | CLOCAL | CREAD;
+            settings.c_iflag &= ~(IXON | IXOFF | IXANY);
+            settings.c_cc[VMIN] = 0;
+            settings.c_cc[VTIME] = 0;
+
+            if ((cfsetispeed(&settings, SERIAL_BAUD_RATE) == 0) &&
+                (cfsetospeed(&settings, SERIAL_BAUD_RATE) == 0) &&
+                (tcsetattr(gSerialPortFd, TCSANOW, &settings) == 0))
+            {
+                success = true;
+            }
+        }
+
+        if (!success)
+        {
+            LOG_ERROR ("!!! Error %d (%s) configuring serial port %s.\n", errno, strerror(errno), pPortName);
+        }
+    }
+    else
+    {
+        LOG_ERROR ("!!! Error %d (%s) connecting to serial port %s.\n", errno, strerror(errno), pPortName);
+    }
+
+    if (!success)
+    {
+        disconnect();
+    }
+    else
+    {
+        clear();
+    }
+
+    return success;
+}
+
+// Disconnect from the port.
+void SerialPort::disconnect(void)
+{
+    if (gSerialPortFd >= 0)
+    {
+        close(gSerialPortFd);
+    }
+    gSerialPortFd = -1;
+}
+
+// Send lenBuf bytes from pBuf over the serial port, returning true
+// in the case of success.
+bool SerialPort::transmitBuffer(const char *pBuf, uint32_t lenBuf)
+{
+    bool success = false;
+    ssize_t result;
+    struct pollfd pollFd;
+
+    if (gSerialPortFd >= 0)
+    {
+        success = true;
+        while (success && (lenBuf > 0))
+        {
+            result = write(gSerialPortFd, pBuf, lenBuf);
+            if (result > 0)
+            {
+                pBuf += result;
+                lenBuf -= (uint32_t) result;
+            }
+            else if ((result < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            {
+                // The transmit buffer is full, block until it drains
+                pollFd.fd = gSerialPortFd;
+                pollFd.events = POLLOUT;
+                pollFd.revents = 0;
+                poll(&pollFd, 1, -1);
+            }
+            else if ((result < 0) && (errno != EINTR))
+            {
+                LOG_ERROR ("!!! Transmit failed with error code %d.\n", errno);
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+// Send a number of segments over the serial port with a single
+// writev() where possible, returning true in the case of success.
+bool SerialPort::transmitVector(const TxSegment * pSegments, uint32_t numSegments)
+{
+    bool success = false;
+    struct iovec vector[TRANSPORT_MAX_SEGMENTS];
+    struct iovec * pVector = vector;
+    ssize_t result;
+    struct pollfd pollFd;
+
+    if ((gSerialPortFd >= 0) && (numSegments <= TRANSPORT_MAX_SEGMENTS))
+    {
+        for (uint32_t x = 0; x < numSegments; x++)
+        {
+            vector[x].iov_base = (void *) pSegments[x].pBuf;
+            vector[x].iov_len = pSegments[x].len;
+        }
+
+        success = true;
+        while (success && (numSegments > 0))
+        {
+            result = writev(gSerialPortFd, pVector, (int) numSegments);
+            if (result >= 0)
+            {
+                // Step over whatever was written, which may end
+                // part way through a segment
+                while ((numSegments > 0) && ((size_t) result >= pVector->iov_len))
+                {
+                    result -= pVector->iov_len;
+                    pVector++;
+                    numSegments--;
+                }
+                if (numSegments > 0)
+                {
+                    pVector->iov_base = (char *) pVector->iov_base + result;
+                    pVector->iov_len -= result;
+                }
+            }
+            else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                // The transmit buffer is full, block until it drains
+                pollFd.fd = gSerialPortFd;
+                pollFd.events = POLLOUT;
+                pollFd.revents = 0;
+                poll(&pollFd, 1, -1);
+            }
+            else if (errno != EINTR)
+            {
+                LOG_ERROR ("!!! Transmit failed with error code %d.\n", errno);
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+// Get up to lenBuf bytes into pBuf from the serial port,
+// returning the number of characters actually read.
+uint32_t SerialPort::receiveBuffer (char *pBuf, uint32_t lenBuf)
+{
+    ssize_t result = 0;
+
+    if (gSerialPortFd >= 0)
+    {
+        result = read(gSerialPortFd, pBuf, lenBuf);
+        if (result < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                LOG_ERROR ("!!! Receive failed with error code %d.\n", errno);
+                if ((errno == EIO) || (errno == ENXIO) || (errno == ENODEV))
+                {
+                    // The device has gone
+                    disconnect();
+                }
+            }
+            result = 0;
+        }
+    }
+
+    return (uint32_t) result;
+}
+
+// Read a single character from the serial port, returning
+// -1 if no character is read.
+int32_t SerialPort::receiveChar()
+{
+    char readChar = 0;
+    int32_t returnChar = -1;
+
+    if (receiveBuffer(&readChar, sizeof (readChar)) > 0)
+    {
+        returnChar = (int32_t) readChar;
+    }
+
+    return returnChar;
+}
+
+// Wait for up to timeoutMs for characters to be received.
+bool SerialPort::waitReadable(uint32_t timeoutMs)
+{
+    bool readable = false;
+    struct pollfd pollFd;
+
+    if (gSerialPortFd >= 0)
+    {
+        pollFd.fd = gSerialPortFd;
+        pollFd.events = POLLIN;
+        pollFd.revents = 0;
+        if (poll(&pollFd, 1, (int) timeoutMs) > 0)
+        {
+            if ((pollFd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0)
+            {
+                // Hung up, e.g. a USB modem unplugged: poll() would
+                // return at once from now on, so let it go
+                LOG_ERROR ("!!! Serial port has gone away.\n");
+                disconnect();
+            }
+            else
+            {
+                readable = ((pollFd.revents & POLLIN) != 0);
+            }
+        }
+    }
+    else
+    {
+        sleepMs(timeoutMs);
+    }
+
+    return readable;
+}
+
+// Return whether the port is connected.
+bool SerialPort::isConnected()
+{
+    return (gSerialPortFd >= 0);
+}
+
+// Clear the receive and transmit buffers of the serial port
+void SerialPort::clear()
+{
+    tcflush(gSerialPortFd, TCIOFLUSH);
+}
+
+// Return the file descriptor of the serial port.
+int SerialPort::getFd()
+{
+    return gSerialPortFd;
+}
+
+#endif
+
 // End Of File
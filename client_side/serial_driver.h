@@ -7,8 +7,8 @@
 // CLASSES
 // ----------------------------------------------------------------
 
-// Serial port interface
-class SerialPort {
+// Serial port interface: a Transport over a COM port or terminal device
+class SerialPort : public Transport {
 public:
     SerialPort();
     ~SerialPort();
@@ -23,6 +23,9 @@ public:
     //
     // "\\\\.\\COM17"
     //
+    // On POSIX platforms it is simply the path of the terminal device,
+    // e.g. "/dev/ttyUSB0".
+    //
     // Returns TRUE on success, otherwise FALSE.
     bool connect(const TCHAR * pPortName);
     
@@ -32,6 +35,12 @@ public:
     // Transmit lenBuf characters from pBuf over the serial port.
     // Returns TRUE on success, otherwise FALSE.
     bool transmitBuffer(const char * pBuf, uint32_t lenBuf);
+
+    // Transmit the numSegments segments at pSegments over the serial
+    // port, in order, as a single gathered write where the platform
+    // allows.  numSegments may be at most TRANSPORT_MAX_SEGMENTS.
+    // Returns TRUE on success, otherwise FALSE.
+    bool transmitVector(const TxSegment * pSegments, uint32_t numSegments);
     
     // Receive up to lenBuf characters into pBuf over the serial port.
     // Returns the number of characters received.
@@ -41,14 +50,36 @@ public:
     // Returns -1 if there are no characters, otherwise it
     // returns the character (i.e. it can be cast to char).
     int32_t receiveChar();
+
+    // Block for up to timeoutMs milliseconds waiting for received
+    // characters to become available, without consuming them.  If the
+    // device has gone away the port is disconnected and, from then on,
+    // this waits out the timeout, so that callers do not spin.
+    // Returns TRUE if characters are waiting, otherwise FALSE.
+    bool waitReadable(uint32_t timeoutMs);
+
+    // Return TRUE while the port is connected.
+    bool isConnected();
     
     // Clear the serial port buffers, both transmit and receive.
     void clear();
 
+#ifndef _WIN32
+    // Return the file descriptor of the serial port, for adding to
+    // an event loop, or -1 if not connected.
+    int getFd();
+#endif
+
 protected:
+#ifdef _WIN32
     // The serial port handle, set to INVALID_HANDLE_VALUE if
     // not configured.
     HANDLE gSerialPortHandle;
+#else
+    // The serial port file descriptor, set to -1 if not
+    // configured.
+    int gSerialPortFd;
+#endif
 };
 
 #endif
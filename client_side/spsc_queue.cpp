@@ -0,0 +1,69 @@
+// Lock-free queue for the NB-IoT example application
+
+#include "stdint.h"
+#include "stddef.h"
+#include "spsc_queue.h"
+
+// ----------------------------------------------------------------
+// CLASSES/METHODS
+// ----------------------------------------------------------------
+
+// Constructor.
+SpscQueue::SpscQueue(void * pStorage, uint32_t recordSize, uint32_t numRecords)
+{
+    gpStorage = (char *) pStorage;
+    gRecordSize = recordSize;
+    gNumRecords = numRecords;
+    gIndexMask = numRecords - 1;
+    gHead.store(0);
+    gTail.store(0);
+}
+
+// Get the next free record; producer only.
+void * SpscQueue::getWriteRecord()
+{
+    void * pRecord = NULL;
+    uint32_t head = gHead.load(std::memory_order_relaxed);
+
+    // The counts wrap at 2^32, the unsigned difference stays correct
+    if (head - gTail.load(std::memory_order_acquire) < gNumRecords)
+    {
+        pRecord = gpStorage + (head & gIndexMask) * gRecordSize;
+    }
+
+    return pRecord;
+}
+
+// Publish the record from getWriteRecord(); producer only.
+void SpscQueue::push()
+{
+    gHead.store(gHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Get the oldest record; consumer only.
+const void * SpscQueue::getReadRecord()
+{
+    const void * pRecord = NULL;
+    uint32_t tail = gTail.load(std::memory_order_relaxed);
+
+    if (gHead.load(std::memory_order_acquire) != tail)
+    {
+        pRecord = gpStorage + (tail & gIndexMask) * gRecordSize;
+    }
+
+    return pRecord;
+}
+
+// Release the record from getReadRecord(); consumer only.
+void SpscQueue::pop()
+{
+    gTail.store(gTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Return the number of records in the queue.
+uint32_t SpscQueue::getCount()
+{
+    return gHead.load(std::memory_order_acquire) - gTail.load(std::memory_order_acquire);
+}
+
+// End Of File
@@ -0,0 +1,76 @@
+// Lock-free queue for the NB-IoT example application
+
+#ifndef _SPSC_QUEUE_H_
+#define _SPSC_QUEUE_H_
+
+#include <atomic>
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The size of a CPU cache line
+#define SPSC_QUEUE_CACHE_LINE_SIZE 64
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// A bounded queue of fixed-size records for passing data from exactly
+// one producer thread to exactly one consumer thread without locking.
+// Records are written and read in place: the producer fills the record
+// returned by getWriteRecord() and then calls push(), the consumer
+// reads the record returned by getReadRecord() and then calls pop().
+class SpscQueue
+{
+public:
+    // Constructor.  pStorage is the memory to use, which must be at
+    // least recordSize * numRecords bytes, must be suitably aligned for
+    // the records to be stored and must remain valid for the lifetime
+    // of this object.  numRecords must be a power of two.
+    SpscQueue (void * pStorage, uint32_t recordSize, uint32_t numRecords);
+
+    // Producer: get the next free record, or NULL if the queue is full.
+    void * getWriteRecord ();
+
+    // Producer: make the record from getWriteRecord() visible to the
+    // consumer.
+    void push ();
+
+    // Consumer: get the oldest record, or NULL if the queue is empty.
+    const void * getReadRecord ();
+
+    // Consumer: release the record from getReadRecord().
+    void pop ();
+
+    // Return the number of records in the queue; from any thread
+    // other than the producer or consumer this is only a snapshot.
+    uint32_t getCount ();
+
+protected:
+    // The storage for the records.
+    char * gpStorage;
+
+    // The size of each record.
+    uint32_t gRecordSize;
+
+    // The number of records in gpStorage.
+    uint32_t gNumRecords;
+
+    // gNumRecords - 1, to turn a count into a record index.
+    uint32_t gIndexMask;
+
+    // Count of records pushed, only written by the producer.
+    std::atomic<uint32_t> gHead;
+
+    // Padding to keep gHead and gTail in different cache lines, so
+    // that the producer and consumer do not contend for one.
+    char gPad[SPSC_QUEUE_CACHE_LINE_SIZE];
+
+    // Count of records popped, only written by the consumer.
+    std::atomic<uint32_t> gTail;
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,512 @@
+// TCP transport for NB-IoT example application
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "platform.h"
+#ifdef _WIN32
+# include <ws2tcpip.h>
+#else
+# include <errno.h>
+# include <fcntl.h>
+# include <netdb.h>
+# include <poll.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+# include <sys/socket.h>
+# include <sys/uio.h>
+#endif
+#include "utilities.h"
+#include "logging.h"
+#include "transport.h"
+#include "tcp_transport.h"
+
+#ifdef _MSC_VER
+# pragma comment(lib, "Ws2_32.lib")
+#endif
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The longest host name that can be given to connect()
+#define TCP_MAX_LEN_HOST 256
+
+// The longest port (service) name that can be given to connect()
+#define TCP_MAX_LEN_PORT 32
+
+#ifndef MSG_NOSIGNAL
+// Where there is no MSG_NOSIGNAL, sending to a closed connection
+// may raise SIGPIPE
+# define MSG_NOSIGNAL 0
+#endif
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Split pAddress, "host:port" or "[host]:port", into its parts.
+static bool splitAddress(const char * pAddress, char * pHost, char * pPort)
+{
+    bool success = false;
+    const char * pHostStart = pAddress;
+    const char * pHostEnd;
+    const char * pColon = strrchr(pAddress, ':');
+
+    if (pColon != NULL)
+    {
+        pHostEnd = pColon;
+        if ((*pAddress == '[') && (pColon > pAddress) && (*(pColon - 1) == ']'))
+        {
+            // An IPv6 address in brackets
+            pHostStart++;
+            pHostEnd--;
+        }
+        if ((pHostEnd > pHostStart) && (pHostEnd - pHostStart < TCP_MAX_LEN_HOST) &&
+            (*(pColon + 1) != 0) && (strlen(pColon + 1) < TCP_MAX_LEN_PORT))
+        {
+            memcpy(pHost, pHostStart, pHostEnd - pHostStart);
+            pHost[pHostEnd - pHostStart] = 0;
+            strcpy(pPort, pColon + 1);
+            success = true;
+        }
+    }
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// CLASSES/METHODS
+// ----------------------------------------------------------------
+
+#ifdef _WIN32
+
+// Constructor.
+TcpTransport::TcpTransport()
+{
+    WSADATA wsaData;
+
+    gSocket = INVALID_SOCKET;
+    gWsaStarted = (WSAStartup(MAKEWORD(2, 2), &wsaData) == 0);
+    if (!gWsaStarted)
+    {
+        LOG_ERROR ("!!! Unable to start Winsock.\n");
+    }
+}
+
+// Destructor.
+TcpTransport::~TcpTransport()
+{
+    disconnect();
+    if (gWsaStarted)
+    {
+        WSACleanup();
+    }
+}
+
+// Make a connection to an address.
+bool TcpTransport::connect(const char * pAddress)
+{
+    bool success = false;
+    char host[TCP_MAX_LEN_HOST];
+    char port[TCP_MAX_LEN_PORT];
+    struct addrinfo hints;
+    struct addrinfo * pResult = NULL;
+    struct addrinfo * pEntry;
+    u_long nonBlocking = 1;
+    BOOL noDelay = TRUE;
+
+    disconnect();
+
+    if (splitAddress(pAddress, host, port))
+    {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        if (gWsaStarted && (getaddrinfo(host, port, &hints, &pResult) == 0))
+        {
+            // Try each address in turn until one answers
+            for (pEntry = pResult; (gSocket == INVALID_SOCKET) && (pEntry != NULL); pEntry = pEntry->ai_next)
+            {
+                gSocket = socket(pEntry->ai_family, pEntry->ai_socktype, pEntry->ai_protocol);
+                if ((gSocket != INVALID_SOCKET) &&
+                    (::connect(gSocket, pEntry->ai_addr, (int) pEntry->ai_addrlen) != 0))
+                {
+                    closesocket(gSocket);
+                    gSocket = INVALID_SOCKET;
+                }
+            }
+            freeaddrinfo(pResult);
+
+            if ((gSocket != INVALID_SOCKET) &&
+                (setsockopt(gSocket, IPPROTO_TCP, TCP_NODELAY, (const char *) &noDelay, sizeof(noDelay)) == 0) &&
+                (ioctlsocket(gSocket, FIONBIO, &nonBlocking) == 0))
+            {
+                success = true;
+            }
+            else
+            {
+                LOG_ERROR ("!!! Error %d connecting to %s.\n", WSAGetLastError(), pAddress);
+            }
+        }
+        else
+        {
+            LOG_ERROR ("!!! Unable to resolve %s.\n", pAddress);
+        }
+    }
+    else
+    {
+        LOG_ERROR ("!!! Address \"%s\" is not of the form host:port.\n", pAddress);
+    }
+
+    if (!success)
+    {
+        disconnect();
+    }
+
+    return success;
+}
+
+// Close the connection.
+void TcpTransport::disconnect(void)
+{
+    if (gSocket != INVALID_SOCKET)
+    {
+        closesocket(gSocket);
+    }
+    gSocket = INVALID_SOCKET;
+}
+
+// Send a number of segments with a single WSASend() where possible,
+// returning true in the case of success.
+bool TcpTransport::transmitVector(const TxSegment * pSegments, uint32_t numSegments)
+{
+    bool success = false;
+    WSABUF vector[TRANSPORT_MAX_SEGMENTS];
+    WSABUF * pVector = vector;
+    DWORD result;
+    fd_set writeSet;
+
+    if ((gSocket != INVALID_SOCKET) && (numSegments <= TRANSPORT_MAX_SEGMENTS))
+    {
+        for (uint32_t x = 0; x < numSegments; x++)
+        {
+            vector[x].buf = (char *) pSegments[x].pBuf;
+            vector[x].len = pSegments[x].len;
+        }
+
+        success = true;
+        while (success && (numSegments > 0))
+        {
+            if (WSASend(gSocket, pVector, numSegments, &result, 0, NULL, NULL) == 0)
+            {
+                // Step over whatever was sent, which may end
+                // part way through a segment
+                while ((numSegments > 0) && (result >= pVector->len))
+                {
+                    result -= pVector->len;
+                    pVector++;
+                    numSegments--;
+                }
+                if (numSegments > 0)
+                {
+                    pVector->buf += result;
+                    pVector->len -= result;
+                }
+            }
+            else if (WSAGetLastError() == WSAEWOULDBLOCK)
+            {
+                // The transmit buffer is full, block until it drains
+                FD_ZERO(&writeSet);
+                FD_SET(gSocket, &writeSet);
+                select(0, NULL, &writeSet, NULL, NULL);
+            }
+            else
+            {
+                LOG_ERROR ("!!! Transmit failed with error code %d.\n", WSAGetLastError());
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+// Get up to lenBuf bytes into pBuf from the socket,
+// returning the number of characters actually read.
+uint32_t TcpTransport::receiveBuffer(char * pBuf, uint32_t lenBuf)
+{
+    int result = 0;
+
+    if (gSocket != INVALID_SOCKET)
+    {
+        result = recv(gSocket, pBuf, (int) lenBuf, 0);
+        if ((result == 0) && (lenBuf > 0))
+        {
+            LOG_ERROR ("!!! The far end closed the connection.\n");
+            disconnect();
+        }
+        else if (result < 0)
+        {
+            if (WSAGetLastError() != WSAEWOULDBLOCK)
+            {
+                LOG_ERROR ("!!! Receive failed with error code %d.\n", WSAGetLastError());
+                disconnect();
+            }
+            result = 0;
+        }
+    }
+
+    return (uint32_t) result;
+}
+
+// Wait for up to timeoutMs for characters to be received.
+bool TcpTransport::waitReadable(uint32_t timeoutMs)
+{
+    bool readable = false;
+    fd_set readSet;
+    struct timeval timeout;
+
+    if (gSocket != INVALID_SOCKET)
+    {
+        FD_ZERO(&readSet);
+        FD_SET(gSocket, &readSet);
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        readable = (select(0, &readSet, NULL, NULL, &timeout) > 0);
+    }
+    else
+    {
+        sleepMs(timeoutMs);
+    }
+
+    return readable;
+}
+
+// Return whether the connection is open.
+bool TcpTransport::isConnected()
+{
+    return (gSocket != INVALID_SOCKET);
+}
+
+#else
+
+// Constructor.
+TcpTransport::TcpTransport()
+{
+    gSocket = -1;
+}
+
+// Destructor.
+TcpTransport::~TcpTransport()
+{
+    disconnect();
+}
+
+// Make a connection to an address.
+bool TcpTransport::connect(const char * pAddress)
+{
+    bool success = false;
+    char host[TCP_MAX_LEN_HOST];
+    char port[TCP_MAX_LEN_PORT];
+    struct addrinfo hints;
+    struct addrinfo * pResult = NULL;
+    struct addrinfo * pEntry;
+    int noDelay = 1;
+    int flags;
+    int error;
+
+    disconnect();
+
+    if (splitAddress(pAddress, host, port))
+    {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        error = getaddrinfo(host, port, &hints, &pResult);
+        if (error == 0)
+        {
+            // Try each address in turn until one answers
+            for (pEntry = pResult; (gSocket < 0) && (pEntry != NULL); pEntry = pEntry->ai_next)
+            {
+                gSocket = socket(pEntry->ai_family, pEntry->ai_socktype, pEntry->ai_protocol);
+                if ((gSocket >= 0) && (::connect(gSocket, pEntry->ai_addr, pEntry->ai_addrlen) != 0))
+                {
+                    close(gSocket);
+                    gSocket = -1;
+                }
+            }
+            freeaddrinfo(pResult);
+
+            if ((gSocket >= 0) &&
+                (setsockopt(gSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) == 0) &&
+                ((flags = fcntl(gSocket, F_GETFL)) >= 0) &&
+                (fcntl(gSocket, F_SETFL, flags | O_NONBLOCK) == 0))
+            {
+                success = true;
+            }
+            else
+            {
+                LOG_ERROR ("!!! Error %d (%s) connecting to %s.\n", errno, strerror(errno), pAddress);
+            }
+        }
+        else
+        {
+            LOG_ERROR ("!!! Unable to resolve %s (%s).\n", pAddress, gai_strerror(error));
+        }
+    }
+    else
+    {
+        LOG_ERROR ("!!! Address \"%s\" is not of the form host:port.\n", pAddress);
+    }
+
+    if (!success)
+    {
+        disconnect();
+    }
+
+    return success;
+}
+
+// Close the connection.
+void TcpTransport::disconnect(void)
+{
+    if (gSocket >= 0)
+    {
+        close(gSocket);
+    }
+    gSocket = -1;
+}
+
+// Send a number of segments with a single sendmsg() where possible,
+// returning true in the case of success.
+bool TcpTransport::transmitVector(const TxSegment * pSegments, uint32_t numSegments)
+{
+    bool success = false;
+    struct iovec vector[TRANSPORT_MAX_SEGMENTS];
+    struct msghdr message;
+    ssize_t result;
+    struct pollfd pollFd;
+
+    if ((gSocket >= 0) && (numSegments <= TRANSPORT_MAX_SEGMENTS))
+    {
+        for (uint32_t x = 0; x < numSegments; x++)
+        {
+            vector[x].iov_base = (void *) pSegments[x].pBuf;
+            vector[x].iov_len = pSegments[x].len;
+        }
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = vector;
+
+        success = true;
+        while (success && (numSegments > 0))
+        {
+            message.msg_iovlen = numSegments;
+            result = sendmsg(gSocket, &message, MSG_NOSIGNAL);
+            if (result >= 0)
+            {
+                // Step over whatever was sent, which may end
+                // part way through a segment
+                while ((numSegments > 0) && ((size_t) result >= message.msg_iov->iov_len))
+                {
+                    result -= message.msg_iov->iov_len;
+                    message.msg_iov++;
+                    numSegments--;
+                }
+                if (numSegments > 0)
+                {
+                    message.msg_iov->iov_base = (char *) message.msg_iov->iov_base + result;
+                    message.msg_iov->iov_len -= result;
+                }
+            }
+            else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                // The transmit buffer is full, block until it drains
+                pollFd.fd = gSocket;
+                pollFd.events = POLLOUT;
+                pollFd.revents = 0;
+                poll(&pollFd, 1, -1);
+            }
+            else if (errno != EINTR)
+            {
+                LOG_ERROR ("!!! Transmit failed with error code %d.\n", errno);
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+// Get up to lenBuf bytes into pBuf from the socket,
+// returning the number of characters actually read.
+uint32_t TcpTransport::receiveBuffer(char * pBuf, uint32_t lenBuf)
+{
+    ssize_t result = 0;
+
+    if (gSocket >= 0)
+    {
+        result = recv(gSocket, pBuf, lenBuf, 0);
+        if ((result == 0) && (lenBuf > 0))
+        {
+            LOG_ERROR ("!!! The far end closed the connection.\n");
+            disconnect();
+        }
+        else if (result < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                LOG_ERROR ("!!! Receive failed with error code %d.\n", errno);
+                disconnect();
+            }
+            result = 0;
+        }
+    }
+
+    return (uint32_t) result;
+}
+
+// Wait for up to timeoutMs for characters to be received.
+bool TcpTransport::waitReadable(uint32_t timeoutMs)
+{
+    bool readable = false;
+    struct pollfd pollFd;
+
+    if (gSocket >= 0)
+    {
+        pollFd.fd = gSocket;
+        pollFd.events = POLLIN;
+        pollFd.revents = 0;
+        if (poll(&pollFd, 1, (int) timeoutMs) > 0)
+        {
+            // A hang-up counts, so that receiveBuffer() gets to see it
+            readable = ((pollFd.revents & (POLLIN | POLLHUP | POLLERR)) != 0);
+        }
+    }
+    else
+    {
+        sleepMs(timeoutMs);
+    }
+
+    return readable;
+}
+
+// Return whether the connection is open.
+bool TcpTransport::isConnected()
+{
+    return (gSocket >= 0);
+}
+
+// Return the file descriptor of the socket.
+int TcpTransport::getFd()
+{
+    return gSocket;
+}
+
+#endif
+
+// End Of File
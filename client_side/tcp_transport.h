@@ -0,0 +1,68 @@
+// TCP transport for NB-IoT example application
+
+#ifndef _TCP_TRANSPORT_H_
+#define _TCP_TRANSPORT_H_
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// A Transport over a TCP connection, for reaching the AT interface of
+// a module through a terminal server or serial-to-network bridge.  The
+// socket is non-blocking with Nagle's algorithm off, so that each AT
+// command goes out in one segment as soon as it is written.
+class TcpTransport : public Transport {
+public:
+    TcpTransport();
+    ~TcpTransport();
+
+    // Make a connection to pAddress, of the form "host:port", e.g.
+    // "192.168.1.20:4001" or "[::1]:4001".
+    // Returns TRUE on success, otherwise FALSE.
+    bool connect(const char * pAddress);
+
+    // Close the connection.
+    void disconnect(void);
+
+    // Transmit the numSegments segments at pSegments with a single
+    // gathered send where possible.
+    // Returns TRUE on success, otherwise FALSE.
+    bool transmitVector(const TxSegment * pSegments, uint32_t numSegments);
+
+    // Receive up to lenBuf characters into pBuf.  If the far end has
+    // closed the connection, or it has failed, it is closed here too.
+    // Returns the number of characters received.
+    uint32_t receiveBuffer(char * pBuf, uint32_t lenBuf);
+
+    // Block for up to timeoutMs milliseconds waiting for received
+    // characters to become available, without consuming them.  Once the
+    // connection is closed this waits out the timeout, so that callers
+    // do not spin.
+    // Returns TRUE if characters are waiting, otherwise FALSE.
+    bool waitReadable(uint32_t timeoutMs);
+
+    // Return TRUE while the connection is open.
+    bool isConnected();
+
+#ifndef _WIN32
+    // Return the file descriptor of the socket, for adding to an event
+    // loop, or -1 if not connected.
+    int getFd();
+#endif
+
+protected:
+#ifdef _WIN32
+    // The socket, set to INVALID_SOCKET if not connected.
+    SOCKET gSocket;
+
+    // Whether WSAStartup() succeeded and so needs a WSACleanup().
+    bool gWsaStarted;
+#else
+    // The socket file descriptor, set to -1 if not connected.
+    int gSocket;
+#endif
+};
+
+#endif
+
+// End Of File
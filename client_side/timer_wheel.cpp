@@ -0,0 +1,252 @@
+// Timer wheel for the NB-IoT example application
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utilities.h"
+#include "timer_wheel.h"
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Set up the slots.
+void TimerWheel::initSlots()
+{
+    for (uint32_t x = 0; x < gNumSlots; x++)
+    {
+        gpSlots[x] = NULL;
+    }
+    gTick = getTimeMs() / TIMER_WHEEL_TICK_MS;
+    gNumRunning = 0;
+    gNextExpiryMs = -1;
+    gNextExpiryValid = true;
+}
+
+// Return the slot for a tick.
+uint32_t TimerWheel::getSlot(int64_t tick)
+{
+    return (uint32_t) tick & (gNumSlots - 1);
+}
+
+// Take a timer out of its slot.
+void TimerWheel::unlink(WheelTimer * pTimer)
+{
+    if (pTimer->pPrev != NULL)
+    {
+        pTimer->pPrev->pNext = pTimer->pNext;
+    }
+    else
+    {
+        gpSlots[getSlot((pTimer->expiryMs + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS)] = pTimer->pNext;
+    }
+    if (pTimer->pNext != NULL)
+    {
+        pTimer->pNext->pPrev = pTimer->pPrev;
+    }
+    pTimer->pNext = NULL;
+    pTimer->pPrev = NULL;
+    pTimer->running = false;
+    gNumRunning--;
+    if (pTimer->expiryMs <= gNextExpiryMs)
+    {
+        gNextExpiryValid = false;
+    }
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor, allocating the slots
+TimerWheel::TimerWheel()
+{
+    gpSlots = new WheelTimer * [TIMER_WHEEL_SLOTS];
+    gNumSlots = TIMER_WHEEL_SLOTS;
+    gOwnSlots = true;
+    initSlots();
+}
+
+// Constructor, on slots provided
+TimerWheel::TimerWheel(WheelTimer ** ppSlots, uint32_t numSlots)
+{
+    gpSlots = ppSlots;
+    gNumSlots = numSlots;
+    gOwnSlots = false;
+    initSlots();
+}
+
+// Destructor
+TimerWheel::~TimerWheel()
+{
+    if (gOwnSlots)
+    {
+        delete[] gpSlots;
+    }
+}
+
+// Set up a timer
+void TimerWheel::init(WheelTimer * pTimer, WheelTimerCallback pCallback, void * pContext, uint32_t param)
+{
+    pTimer->pNext = NULL;
+    pTimer->pPrev = NULL;
+    pTimer->expiryMs = 0;
+    pTimer->pCallback = pCallback;
+    pTimer->pContext = pContext;
+    pTimer->param = param;
+    pTimer->running = false;
+}
+
+// Start a timer, expiring after a delay
+void TimerWheel::start(WheelTimer * pTimer, uint32_t delayMs)
+{
+    startAt(pTimer, getTimeMs() + delayMs);
+}
+
+// Start a timer, expiring at a given time
+void TimerWheel::startAt(WheelTimer * pTimer, int64_t expiryMs)
+{
+    int64_t tick;
+    uint32_t slot;
+
+    stop(pTimer);
+
+    // A timer goes in the slot of the first tick at or after its expiry
+    // that advance() has yet to deal with; it is the expiry time itself
+    // that decides when it fires, so the slot of a timer due more than
+    // a turn of the wheel away is visited without firing it until then
+    tick = (expiryMs + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    if (tick <= gTick)
+    {
+        tick = gTick + 1;
+        expiryMs = tick * TIMER_WHEEL_TICK_MS;
+    }
+    slot = getSlot(tick);
+
+    pTimer->expiryMs = expiryMs;
+    pTimer->pPrev = NULL;
+    pTimer->pNext = gpSlots[slot];
+    if (pTimer->pNext != NULL)
+    {
+        pTimer->pNext->pPrev = pTimer;
+    }
+    gpSlots[slot] = pTimer;
+    pTimer->running = true;
+    gNumRunning++;
+
+    if (gNextExpiryValid && ((gNextExpiryMs < 0) || (expiryMs < gNextExpiryMs)))
+    {
+        gNextExpiryMs = expiryMs;
+    }
+}
+
+// Stop a timer
+void TimerWheel::stop(WheelTimer * pTimer)
+{
+    if (pTimer->running)
+    {
+        unlink(pTimer);
+    }
+}
+
+// Return true if a timer is running
+bool TimerWheel::isRunning(const WheelTimer * pTimer)
+{
+    return pTimer->running;
+}
+
+// Fire the timers that have expired
+uint32_t TimerWheel::advance(int64_t nowMs)
+{
+    uint32_t numExpired = 0;
+    int64_t nowTick = nowMs / TIMER_WHEEL_TICK_MS;
+    WheelTimer * pTimer;
+
+    if ((gNumRunning == 0) || (nowTick - gTick > gNumSlots))
+    {
+        // Nothing to find on the way, or every slot is to be visited
+        // anyway, so only the last turn of the wheel need be walked
+        if (nowTick - gTick > gNumSlots)
+        {
+            gTick = nowTick - gNumSlots;
+        }
+        if (gNumRunning == 0)
+        {
+            gTick = nowTick;
+        }
+    }
+
+    while (gTick < nowTick)
+    {
+        // Move gTick on first, so that a timer started by a callback
+        // goes in a later slot rather than the one being walked
+        gTick++;
+        pTimer = gpSlots[getSlot(gTick)];
+        while (pTimer != NULL)
+        {
+            if (pTimer->expiryMs <= nowMs)
+            {
+                // A callback may stop any timer, so take this one out and
+                // start again from the head of the slot once it's done
+                unlink(pTimer);
+                numExpired++;
+                pTimer->pCallback(pTimer->pContext, pTimer->param);
+                pTimer = gpSlots[getSlot(gTick)];
+            }
+            else
+            {
+                pTimer = pTimer->pNext;
+            }
+        }
+    }
+
+    return numExpired;
+}
+
+// Return when the next timer expires
+int64_t TimerWheel::getNextExpiryMs()
+{
+    WheelTimer * pTimer;
+
+    if (!gNextExpiryValid)
+    {
+        // The earliest timer has gone, so look through them all
+        gNextExpiryMs = -1;
+        for (uint32_t x = 0; (x < gNumSlots) && (gNumRunning > 0); x++)
+        {
+            for (pTimer = gpSlots[x]; pTimer != NULL; pTimer = pTimer->pNext)
+            {
+                if ((gNextExpiryMs < 0) || (pTimer->expiryMs < gNextExpiryMs))
+                {
+                    gNextExpiryMs = pTimer->expiryMs;
+                }
+            }
+        }
+        gNextExpiryValid = true;
+    }
+
+    return gNextExpiryMs;
+}
+
+// Return how long to wait for the next timer
+uint32_t TimerWheel::getWaitMs(uint32_t maxMs)
+{
+    int64_t nextExpiryMs = getNextExpiryMs();
+    int64_t nowMs;
+
+    if (nextExpiryMs >= 0)
+    {
+        nowMs = getTimeMs();
+        if (nextExpiryMs <= nowMs)
+        {
+            maxMs = 0;
+        }
+        else if (nextExpiryMs - nowMs < maxMs)
+        {
+            maxMs = (uint32_t) (nextExpiryMs - nowMs);
+        }
+    }
+
+    return maxMs;
+}
+
+// End Of File
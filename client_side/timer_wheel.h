@@ -0,0 +1,128 @@
+// Timer wheel for the NB-IoT example application
+
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The number of slots in a wheel made with the default constructor; a
+// wheel given its slots may have any power of two.  Fewer slots cost
+// nothing in accuracy, only a walk past more timers not yet due
+#ifndef TIMER_WHEEL_SLOTS
+# define TIMER_WHEEL_SLOTS 1024
+#endif
+
+// The time covered by each slot, which is the resolution of the
+// timers: none fires early and none more than this late (given
+// that TimerWheel::advance() is called when it should be)
+#define TIMER_WHEEL_TICK_MS 1
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// Called when a timer expires, with the context and parameter it was
+// set up with.
+typedef void (*WheelTimerCallback) (void * pContext, uint32_t param);
+
+// A timer, owned by whoever starts it and linked into the wheel while
+// it is running; set it up with TimerWheel::init() before first use.
+typedef struct WheelTimer
+{
+    struct WheelTimer * pNext;
+    struct WheelTimer * pPrev;
+    int64_t expiryMs;
+    WheelTimerCallback pCallback;
+    void * pContext;
+    uint32_t param;
+    bool running;
+} WheelTimer;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// A hashed timing wheel: timers are kept in lists by the slot that
+// their expiry time falls in, so starting and stopping a timer is
+// constant time however many are running, and advance() only has to
+// look at the slots that the clock has passed through to find those
+// that have expired.  Times are from getTimeMs().  Not thread safe: a
+// wheel and its timers belong to one thread.
+class TimerWheel
+{
+public:
+    // Constructor, with TIMER_WHEEL_SLOTS slots allocated from the heap.
+    TimerWheel ();
+
+    // Constructor, with the numSlots slots at ppSlots, numSlots being a
+    // power of two; they must outlive this instance.
+    TimerWheel (WheelTimer ** ppSlots, uint32_t numSlots);
+
+    // Destructor.
+    ~TimerWheel ();
+
+    // Set up pTimer to call pCallback with pContext and param when
+    // it expires.
+    static void init (WheelTimer * pTimer, WheelTimerCallback pCallback, void * pContext, uint32_t param = 0);
+
+    // Start pTimer, expiring delayMs from now; if it is already
+    // running it is restarted.
+    void start (WheelTimer * pTimer, uint32_t delayMs);
+
+    // Start pTimer, expiring at expiryMs; if that has passed it
+    // expires on the next call to advance().
+    void startAt (WheelTimer * pTimer, int64_t expiryMs);
+
+    // Stop pTimer, if it is running.
+    void stop (WheelTimer * pTimer);
+
+    // Return true if pTimer is running.
+    static bool isRunning (const WheelTimer * pTimer);
+
+    // Call the callback of every timer that has expired by nowMs,
+    // earliest slot first; a callback may start or stop any timer.
+    // Returns the number of timers that expired.
+    uint32_t advance (int64_t nowMs);
+
+    // Return the time at which the next timer expires, or -1 if
+    // none is running.
+    int64_t getNextExpiryMs ();
+
+    // Return how long to wait, at most maxMs, before the next timer
+    // expires.
+    uint32_t getWaitMs (uint32_t maxMs);
+
+protected:
+    // The slots, each the head of a list of timers, gNumSlots of them,
+    // and whether they were allocated by this instance.
+    WheelTimer ** gpSlots;
+    uint32_t gNumSlots;
+    bool gOwnSlots;
+
+    // The last tick that advance() has dealt with.
+    int64_t gTick;
+
+    // The number of timers running.
+    uint32_t gNumRunning;
+
+    // The earliest expiry time of the running timers, or -1 if there
+    // are none, which is worked out again when gNextExpiryValid is
+    // false because the earliest timer has been stopped or has fired.
+    int64_t gNextExpiryMs;
+    bool gNextExpiryValid;
+
+    // Set up the slots.
+    void initSlots ();
+
+    // Return the slot for a tick.
+    uint32_t getSlot (int64_t tick);
+
+    // Take pTimer out of its slot.
+    void unlink (WheelTimer * pTimer);
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,694 @@
+// AT command pipeline benchmark for NB-IoT example application
+//
+// Drives Nbiot::connect(), Nbiot::send(), Nbiot::receive(),
+// Nbiot::receiveBatch(), the Nbiot::sendAsync() pipeline and records
+// packed into datagrams by an UplinkAggregator against a local
+// modem, by default a copy of modem_sim started for the purpose, or with -i
+// an ideal module in this process on a LoopbackTransport, which measures the
+// AT engine alone at memory speed, and reports for each:
+//
+// - the p50, p99 and p999 round-trip latency of a call, in microseconds
+//   (for receiveBatch() that of a batch shared among its datagrams),
+// - the number of calls (datagrams, or records when aggregating) per second,
+// - the number of read/write system calls made per call, from the
+//   syscr/syscw counts in /proc/self/io,
+// - the CPU time (user + system) used per call, in microseconds.
+//
+// Only this process is measured: the time the simulator takes is in the
+// latencies but not in the CPU or system call figures.  Output from the
+// driver itself is discarded, unless -v is given, so that the results
+// can be read by a script; with -j they are printed as JSON.
+// Linux only.
+//
+// Usage: at_bench [options], where options are:
+//   -n <n>    number of send/receive calls per test (default 1000)
+//   -c <n>    number of connect calls (default 20)
+//   -l <n>    datagram size in bytes (default 32)
+//   -d <n>    number of AT+MGR commands receiveBatch() writes at once
+//             (default DEFAULT_RECEIVE_PIPELINE_DEPTH); modem_sim and the
+//             ideal module take up to MAX_RECEIVE_PIPELINE_DEPTH
+//   -m <path> the simulator to start (default ./modem_sim)
+//   -p <port> use the modem on this serial port instead of starting
+//             the simulator
+//   -i        use an ideal module in memory instead of starting the
+//             simulator
+//   -j        print the results as JSON
+//   -x        follow the results with the driver's own measurements
+//             (Nbiot::getMetrics()) in Prometheus text format
+//   -v        don't discard output from the driver
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <vector>
+#include "platform.h"
+#include "utilities.h"
+#include "transport.h"
+#include "serial_driver.h"
+#include "loopback_transport.h"
+#include "line_buffer.h"
+#include "spsc_queue.h"
+#include "at_dispatcher.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include "modem_driver.h"
+#include "payload_codec.h"
+#include "uplink_aggregator.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// Default number of send/receive calls per test
+#define DEFAULT_BENCH_CALLS 1000
+
+// Default number of connect calls
+#define DEFAULT_BENCH_CONNECTS 20
+
+// Default datagram size
+#define DEFAULT_BENCH_DATAGRAM_SIZE 32
+
+// Default simulator
+#define DEFAULT_BENCH_SIMULATOR "./modem_sim"
+
+// The most datagrams collected by each receiveBatch() call
+#define BENCH_BATCH_DATAGRAMS 8
+
+// The number of tests
+#define BENCH_NUM_TESTS 6
+
+// The longest AT line that the in-memory module handles, an AT+MGS
+// carrying the largest datagram
+#define BENCH_MAX_LINE_LENGTH (MAX_LEN_SEND_STRING * 2 + 32)
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// Resources used by the process at a point in time.
+typedef struct
+{
+    int64_t syscalls;
+    int64_t cpuUs;
+    int64_t wallUs;
+} Usage;
+
+// The results of one test.
+typedef struct
+{
+    const char * pName;
+    uint32_t calls;
+    uint32_t failures;
+    int64_t p50Us;
+    int64_t p99Us;
+    int64_t p999Us;
+    double callsPerSecond;
+    double syscallsPerCall;
+    double cpuUsPerCall;
+} Result;
+
+// An ideal module in memory, at the far end of a LoopbackTransport:
+// it answers every command at once and always has a downlink datagram
+// waiting.
+typedef struct
+{
+    LoopbackTransport * pTransport;
+    char line[BENCH_MAX_LINE_LENGTH];
+    uint32_t len;
+    bool sentIndications;
+    char mgrResponse[BENCH_MAX_LINE_LENGTH];
+} MemoryModem;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Return the number of read/write system calls made by the
+// process so far, or zero if that is not known.
+static int64_t getSyscalls(void)
+{
+    int64_t syscalls = 0;
+    long long value;
+    char name[32];
+    FILE * pFile = fopen("/proc/self/io", "r");
+
+    if (pFile != NULL)
+    {
+        while (fscanf(pFile, "%31s %lld", name, &value) == 2)
+        {
+            if ((strcmp(name, "syscr:") == 0) || (strcmp(name, "syscw:") == 0))
+            {
+                syscalls += value;
+            }
+        }
+        fclose(pFile);
+    }
+
+    return syscalls;
+}
+
+// Take a snapshot of the resources used so far.
+static void getUsage(Usage * pUsage)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    pUsage->cpuUs = (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+                    usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    pUsage->syscalls = getSyscalls();
+    pUsage->wallUs = getTimeUs();
+}
+
+// Fill in pResult from the latencies of its calls and the resources
+// used between pStart and pEnd.
+static void summarise(Result * pResult, std::vector<int64_t> & latencies, const Usage * pStart, const Usage * pEnd)
+{
+    uint32_t calls = latencies.size();
+
+    pResult->calls = calls;
+    if (calls > 0)
+    {
+        std::sort(latencies.begin(), latencies.end());
+        pResult->p50Us = latencies[(calls - 1) * 50 / 100];
+        pResult->p99Us = latencies[(calls - 1) * 99 / 100];
+        pResult->p999Us = latencies[(calls - 1) * 999 / 1000];
+        pResult->callsPerSecond = (pEnd->wallUs > pStart->wallUs) ? calls * 1e6 / (pEnd->wallUs - pStart->wallUs) : 0;
+        // The reads of /proc/self/io themselves count, so leave one out
+        pResult->syscallsPerCall = (double) (pEnd->syscalls - pStart->syscalls - 1) / calls;
+        pResult->cpuUsPerCall = (double) (pEnd->cpuUs - pStart->cpuUs) / calls;
+    }
+}
+
+// Wait for the datagram with the given ticket, queued at submitUs,
+// to be SENT, adding its latency or counting it as a failure.
+static void collectSend(Nbiot * pModem, uint32_t ticket, int64_t submitUs, std::vector<int64_t> & latencies, Result * pResult)
+{
+    if (pModem->waitSend(ticket) == Nbiot::SEND_STATUS_SENT)
+    {
+        latencies.push_back(getTimeUs() - submitUs);
+    }
+    else
+    {
+        pResult->failures++;
+    }
+}
+
+// Encode an aggregate and send it on the Nbiot that is pContext.
+static bool sendAggregate(void * pContext, const char * pDatagram, uint32_t size)
+{
+    char encoded[MAX_LEN_SEND_STRING];
+
+    size = payloadEncode(pDatagram, size, encoded, sizeof (encoded), false, true);
+
+    return (size > 0) && ((Nbiot *) pContext)->send(encoded, size);
+}
+
+// Answer a complete line from Nbiot in the way modem_sim does.
+static void memoryModemLine(MemoryModem * pModem, const char * pLine, uint32_t len)
+{
+    const char * pResponse = "ERROR\r\n";
+
+    if ((len == 6) && (memcmp(pLine, "AT+NAS", 6) == 0))
+    {
+        pResponse = "+NAS: Connected (activated)\r\nOK\r\n";
+    }
+    else if ((len == 6) && (memcmp(pLine, "AT+RAS", 6) == 0))
+    {
+        pResponse = "+RAS:CONNECTED\r\nOK\r\n";
+    }
+    else if ((len == 8) && (memcmp(pLine, "AT+SMI=", 7) == 0))
+    {
+        pModem->sentIndications = (pLine[7] == '1');
+        pResponse = "+SMI:OK\r\nOK\r\n";
+    }
+    else if ((len == 8) && (memcmp(pLine, "AT+NMI=", 7) == 0))
+    {
+        pResponse = "+NMI:OK\r\nOK\r\n";
+    }
+    else if ((len > 7) && (memcmp(pLine, "AT+MGS=", 7) == 0))
+    {
+        pResponse = pModem->sentIndications ? "+MGS:OK\r\nOK\r\n+SMI:SENT\r\n" : "+MGS:OK\r\nOK\r\n";
+    }
+    else if ((len == 6) && (memcmp(pLine, "AT+MGR", 6) == 0))
+    {
+        pResponse = pModem->mgrResponse;
+    }
+    else if ((len == 6) && (memcmp(pLine, "AT+MQS", 6) == 0))
+    {
+        pResponse = "+MQS:BUFFERED=64,RECEIVED=64,DROPPED=0\r\nOK\r\n";
+    }
+    else if ((len == 2) && (memcmp(pLine, "AT", 2) == 0))
+    {
+        pResponse = "OK\r\n";
+    }
+
+    pModem->pTransport->inject(pResponse, strlen(pResponse));
+}
+
+// LoopbackTransport write handler: gather what Nbiot sends into
+// lines and answer each.
+static void memoryModemWrite(void * pContext, const char * pBuf, uint32_t len)
+{
+    MemoryModem * pModem = (MemoryModem *) pContext;
+
+    for (uint32_t x = 0; x < len; x++)
+    {
+        if (pBuf[x] == '\r')
+        {
+            memoryModemLine(pModem, pModem->line, pModem->len);
+            pModem->len = 0;
+        }
+        else if ((pBuf[x] != '\n') && (pModem->len < sizeof (pModem->line)))
+        {
+            pModem->line[pModem->len] = pBuf[x];
+            pModem->len++;
+        }
+    }
+}
+
+// Set up the in-memory module on pTransport, its downlink datagrams
+// being the size bytes at pDatagram.
+static void memoryModemInit(MemoryModem * pModem, LoopbackTransport * pTransport, const char * pDatagram, uint32_t size)
+{
+    uint32_t len;
+
+    pModem->pTransport = pTransport;
+    pModem->len = 0;
+    pModem->sentIndications = false;
+    len = snprintf(pModem->mgrResponse, sizeof (pModem->mgrResponse), "+MGR:%u,", size);
+    len += bytesToHexString(pDatagram, size, pModem->mgrResponse + len, sizeof (pModem->mgrResponse) - len);
+    snprintf(pModem->mgrResponse + len, sizeof (pModem->mgrResponse) - len, "\r\n+MGR:OK\r\n");
+    pTransport->setWriteHandler(memoryModemWrite, pModem);
+}
+
+// Start the simulator at pPath with the given arguments, putting the
+// path of its serial port into pPort and returning its process ID, or
+// -1 on failure.
+static pid_t startSimulator(const char * pPath, char * pPort, uint32_t lenPort, bool verbose)
+{
+    pid_t pid;
+    int fds[2];
+    int devNull;
+    FILE * pFile;
+    bool success = false;
+
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+
+    pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        if (!verbose)
+        {
+            devNull = open("/dev/null", O_WRONLY);
+            dup2(devNull, STDERR_FILENO);
+        }
+        close(fds[0]);
+        close(fds[1]);
+        // An ideal module, with downlinks always waiting for AT+MGR
+        execl(pPath, pPath, "-a", (char *) NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    if (pid > 0)
+    {
+        pFile = fdopen(fds[0], "r");
+        if ((pFile != NULL) && (fgets(pPort, lenPort, pFile) != NULL))
+        {
+            pPort[strcspn(pPort, "\r\n")] = 0;
+            success = (pPort[0] != 0);
+        }
+        if (pFile != NULL)
+        {
+            fclose(pFile);
+        }
+        else
+        {
+            close(fds[0]);
+        }
+        if (!success)
+        {
+            kill(pid, SIGTERM);
+            waitpid(pid, NULL, 0);
+            pid = -1;
+        }
+    }
+    else
+    {
+        close(fds[0]);
+    }
+
+    return pid;
+}
+
+// Print the results in human-readable form.
+static void printText(FILE * pOut, const Result * pResults, uint32_t numResults, uint32_t datagramSize)
+{
+    fprintf(pOut, "%d byte datagrams.\n", datagramSize);
+    fprintf(pOut, "%-13s %7s %6s %9s %9s %9s %10s %10s %10s\n", "test", "calls", "failed",
+            "p50 us", "p99 us", "p999 us", "calls/s", "syscalls", "cpu us");
+    for (uint32_t x = 0; x < numResults; x++)
+    {
+        fprintf(pOut, "%-13s %7u %6u %9lld %9lld %9lld %10.1f %10.2f %10.2f\n", pResults[x].pName,
+                pResults[x].calls, pResults[x].failures, (long long) pResults[x].p50Us,
+                (long long) pResults[x].p99Us, (long long) pResults[x].p999Us, pResults[x].callsPerSecond,
+                pResults[x].syscallsPerCall, pResults[x].cpuUsPerCall);
+    }
+}
+
+// Print the results as JSON.
+static void printJson(FILE * pOut, const Result * pResults, uint32_t numResults, uint32_t datagramSize)
+{
+    fprintf(pOut, "{\"datagram_size\": %u, \"tests\": [", datagramSize);
+    for (uint32_t x = 0; x < numResults; x++)
+    {
+        fprintf(pOut, "%s\n  {\"name\": \"%s\", \"calls\": %u, \"failures\": %u, \"p50_us\": %lld, \"p99_us\": %lld, "
+                "\"p999_us\": %lld, \"calls_per_second\": %.1f, \"syscalls_per_call\": %.2f, \"cpu_us_per_call\": %.2f}",
+                (x > 0) ? "," : "", pResults[x].pName, pResults[x].calls, pResults[x].failures,
+                (long long) pResults[x].p50Us, (long long) pResults[x].p99Us, (long long) pResults[x].p999Us,
+                pResults[x].callsPerSecond, pResults[x].syscallsPerCall, pResults[x].cpuUsPerCall);
+    }
+    fprintf(pOut, "\n]}\n");
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+    uint32_t calls = DEFAULT_BENCH_CALLS;
+    uint32_t connects = DEFAULT_BENCH_CONNECTS;
+    uint32_t datagramSize = DEFAULT_BENCH_DATAGRAM_SIZE;
+    uint32_t pipelineDepth = DEFAULT_RECEIVE_PIPELINE_DEPTH;
+    const char * pSimulator = DEFAULT_BENCH_SIMULATOR;
+    const char * pPort = NULL;
+    bool json = false;
+    bool verbose = false;
+    bool exportMetrics = false;
+    bool inMemory = false;
+    LoopbackTransport * pLoopback = NULL;
+    MemoryModem * pMemoryModem = NULL;
+    MetricsSnapshot * pMetrics;
+    char * pText;
+    char port[256];
+    char datagram[MAX_LEN_SEND_STRING];
+    char arena[MAX_LEN_SEND_STRING * BENCH_BATCH_DATAGRAMS];
+    Nbiot::DatagramSpan spans[BENCH_BATCH_DATAGRAMS];
+    uint32_t received;
+    int64_t callUs;
+    pid_t simulator = -1;
+    FILE * pOut = stdout;
+    int outFd;
+    int devNull;
+    Result results[BENCH_NUM_TESTS];
+    uint32_t numResults = 0;
+    std::vector<int64_t> latencies;
+    std::vector<int64_t> submitUs;
+    Usage start;
+    Usage end;
+    int64_t callStartUs;
+    uint32_t ticket;
+    uint32_t firstTicket;
+    uint32_t collected;
+    Nbiot * pModem;
+    UplinkAggregator * pAggregator;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:c:l:d:m:p:ijxv")) != -1)
+    {
+        switch (c)
+        {
+            case 'n':
+                calls = strtoul(optarg, NULL, 0);
+            break;
+            case 'c':
+                connects = strtoul(optarg, NULL, 0);
+            break;
+            case 'l':
+                datagramSize = strtoul(optarg, NULL, 0);
+            break;
+            case 'd':
+                pipelineDepth = strtoul(optarg, NULL, 0);
+            break;
+            case 'm':
+                pSimulator = optarg;
+            break;
+            case 'p':
+                pPort = optarg;
+            break;
+            case 'i':
+                inMemory = true;
+            break;
+            case 'j':
+                json = true;
+            break;
+            case 'x':
+                exportMetrics = true;
+            break;
+            case 'v':
+                verbose = true;
+            break;
+            default:
+                calls = 0;
+            break;
+        }
+    }
+    if ((calls == 0) || (datagramSize == 0) || (datagramSize > sizeof (datagram)))
+    {
+        fprintf(stderr, "Usage: %s [-n calls] [-c connects] [-l datagram_bytes] [-d pipeline_depth] [-m simulator] [-p port] [-i] [-j] [-x] [-v]\n", argv[0]);
+        return -1;
+    }
+
+    if ((pPort == NULL) && !inMemory)
+    {
+        simulator = startSimulator(pSimulator, port, sizeof (port), verbose);
+        if (simulator < 0)
+        {
+            fprintf(stderr, "!!! Unable to start the simulator %s.\n", pSimulator);
+            return -1;
+        }
+        pPort = port;
+    }
+
+    // Keep stdout for the results, sending the driver's output elsewhere
+    fflush(stdout);
+    outFd = dup(STDOUT_FILENO);
+    if (!verbose)
+    {
+        devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+    }
+    else
+    {
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    pOut = fdopen(outFd, "w");
+
+    for (uint32_t x = 0; x < datagramSize; x++)
+    {
+        datagram[x] = (char) x;
+    }
+
+    if (inMemory)
+    {
+        pLoopback = new LoopbackTransport();
+        pMemoryModem = new MemoryModem;
+        memoryModemInit(pMemoryModem, pLoopback, datagram, datagramSize);
+        pModem = new Nbiot(pLoopback);
+    }
+    else
+    {
+        pModem = new Nbiot(pPort);
+    }
+    pModem->setReceivePipelineDepth(pipelineDepth);
+    memset(results, 0, sizeof (results));
+
+    // connect(): AT+NAS and AT+SMI=1
+    results[numResults].pName = "connect";
+    latencies.clear();
+    getUsage(&start);
+    for (uint32_t x = 0; x < connects; x++)
+    {
+        callStartUs = getTimeUs();
+        if (!pModem->connect())
+        {
+            results[numResults].failures++;
+        }
+        latencies.push_back(getTimeUs() - callStartUs);
+    }
+    getUsage(&end);
+    summarise(&results[numResults], latencies, &start, &end);
+    numResults++;
+
+    // send(): AT+MGS through to +SMI:SENT, one at a time
+    results[numResults].pName = "send";
+    latencies.clear();
+    getUsage(&start);
+    for (uint32_t x = 0; x < calls; x++)
+    {
+        callStartUs = getTimeUs();
+        if (!pModem->send(datagram, datagramSize))
+        {
+            results[numResults].failures++;
+        }
+        latencies.push_back(getTimeUs() - callStartUs);
+    }
+    getUsage(&end);
+    summarise(&results[numResults], latencies, &start, &end);
+    numResults++;
+
+    // receive(): AT+MGR
+    results[numResults].pName = "receive";
+    latencies.clear();
+    getUsage(&start);
+    for (uint32_t x = 0; x < calls; x++)
+    {
+        callStartUs = getTimeUs();
+        if (pModem->receive(datagram, sizeof (datagram)) == 0)
+        {
+            results[numResults].failures++;
+        }
+        latencies.push_back(getTimeUs() - callStartUs);
+    }
+    getUsage(&end);
+    summarise(&results[numResults], latencies, &start, &end);
+    numResults++;
+
+    // receiveBatch(): AT+MQS then AT+MGR back to back
+    results[numResults].pName = "receive_batch";
+    latencies.clear();
+    getUsage(&start);
+    for (uint32_t x = 0; x < calls; x += (received > 0) ? received : 1)
+    {
+        callStartUs = getTimeUs();
+        received = pModem->receiveBatch(arena, sizeof (arena), spans, BENCH_BATCH_DATAGRAMS);
+        callUs = getTimeUs() - callStartUs;
+        if (received == 0)
+        {
+            results[numResults].failures++;
+            latencies.push_back(callUs);
+        }
+        for (uint32_t y = 0; y < received; y++)
+        {
+            latencies.push_back(callUs / received);
+        }
+    }
+    getUsage(&end);
+    summarise(&results[numResults], latencies, &start, &end);
+    numResults++;
+
+    // sendAsync(): the pipeline, latency being from queueing a
+    // datagram to seeing it SENT
+    results[numResults].pName = "send_async";
+    latencies.clear();
+    submitUs.assign(calls, 0);
+    firstTicket = 0;
+    collected = 0;
+    getUsage(&start);
+    for (uint32_t x = 0; x < calls; x++)
+    {
+        // Tickets are forgotten once the queue wraps, so collect the
+        // result of any that would be
+        while (x - collected >= pModem->getSendQueueLength())
+        {
+            collectSend(pModem, firstTicket + collected, submitUs[collected], latencies, &results[numResults]);
+            collected++;
+        }
+        while ((ticket = pModem->sendAsync(datagram, datagramSize)) == 0)
+        {
+            pModem->waitReadable(1);
+            pModem->serviceSends();
+        }
+        if (firstTicket == 0)
+        {
+            firstTicket = ticket;
+        }
+        submitUs[x] = getTimeUs();
+    }
+    for (; collected < calls; collected++)
+    {
+        collectSend(pModem, firstTicket + collected, submitUs[collected], latencies, &results[numResults]);
+    }
+    getUsage(&end);
+    summarise(&results[numResults], latencies, &start, &end);
+    // Throughput is of all datagrams, so that failures show
+    results[numResults].calls = calls;
+    results[numResults].callsPerSecond = calls * 1e6 / (end.wallUs - start.wallUs);
+    results[numResults].syscallsPerCall = (double) (end.syscalls - start.syscalls - 1) / calls;
+    results[numResults].cpuUsPerCall = (double) (end.cpuUs - start.cpuUs) / calls;
+    numResults++;
+
+    // UplinkAggregator: records of the datagram size packed into full
+    // datagrams sent with send(), latency being that of adding a record
+    // (most cost nothing, one in a datagram's worth costs a send())
+    results[numResults].pName = "aggregate";
+    latencies.clear();
+    pAggregator = new UplinkAggregator(sendAggregate, pModem, pModem->getMaxDatagramSize() - 1, 0);
+    getUsage(&start);
+    for (uint32_t x = 0; x < calls; x++)
+    {
+        callStartUs = getTimeUs();
+        if (!pAggregator->add(datagram, datagramSize))
+        {
+            results[numResults].failures++;
+        }
+        latencies.push_back(getTimeUs() - callStartUs);
+    }
+    if (!pAggregator->flush())
+    {
+        results[numResults].failures++;
+    }
+    getUsage(&end);
+    summarise(&results[numResults], latencies, &start, &end);
+    numResults++;
+    delete pAggregator;
+
+    fflush(stdout);
+
+    if (json)
+    {
+        printJson(pOut, results, numResults, datagramSize);
+    }
+    else
+    {
+        printText(pOut, results, numResults, datagramSize);
+    }
+    if (exportMetrics)
+    {
+        pMetrics = new MetricsSnapshot;
+        pText = new char[65536];
+        pModem->getMetrics(pMetrics);
+        Metrics::exportText(pMetrics, pText, 65536);
+        fprintf(pOut, "%s", pText);
+        delete[] pText;
+        delete pMetrics;
+    }
+    fclose(pOut);
+    delete pModem;
+    delete pLoopback;
+    delete pMemoryModem;
+
+    if (simulator > 0)
+    {
+        kill(simulator, SIGTERM);
+        waitpid(simulator, NULL, 0);
+    }
+
+    return 0;
+}
+
+// End Of File
@@ -0,0 +1,766 @@
+// Fuzzing harness for the AT engine of the NB-IoT example application
+//
+// Feeds arbitrary bytes, as if from a module, through a LoopbackTransport
+// into an Nbiot and into the codecs that take what a module sends apart,
+// so that a sanitizer build (make fuzz, see the Makefile) catches any
+// read or write outside a buffer and any undefined behaviour.  The first
+// byte of an input picks what is driven, the second sets a size for it
+// and the rest is what the module says:
+//
+// - getLine() and the URC handlers (+NMI notifications in particular),
+//   in chunks of a given size, checking that the lines handed out put
+//   back together make the input and that getDownlink() keeps to its
+//   buffer,
+// - waitResponse() with a given expected prefix, checking that the
+//   line it hands back starts with it,
+// - receive() into a buffer of a given size,
+// - receiveBatch() into an arena and spans of given sizes, checking that
+//   every span lies in the arena,
+// - hexStringToBytes(), every variant of it against the scalar one, and
+//   the payload codec, with an output buffer of a given size.
+//
+// Every buffer handed in is allocated at exactly its size, so that
+// AddressSanitizer sees the first byte outside it, and every byte said
+// to have been received is read.  Where commands are written the module
+// answers each with the next piece of the input, the pieces being
+// separated by NUL characters, followed by ERROR, so that nothing waits
+// for a timeout.
+//
+// Built with FUZZ_LIBFUZZER defined (make fuzz FUZZER=libfuzzer, with
+// clang) LLVMFuzzerTestOneInput() is all there is.  Otherwise there is a
+// main() of its own, which also suits AFL (afl-fuzz ... -- at_fuzz @@):
+//
+// Usage: at_fuzz [options] [file...], where options are:
+//   -r <n>    run n inputs made by mutating the files given, or the
+//             built-in seeds if there are none (default: run each file
+//             given once, or stdin if there are none)
+//   -s <n>    seed for the mutations (default: from the time)
+//   -w <dir>  write the built-in seeds to dir, as a starting corpus
+//   -v        don't discard output from the driver
+//
+// An input that fails is written to crash-<run> in the current directory.
+// Linux only.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "platform.h"
+#include "utilities.h"
+#include "hex_codec.h"
+#include "payload_codec.h"
+#include "transport.h"
+#include "loopback_transport.h"
+#include "line_buffer.h"
+#include "spsc_queue.h"
+#include "at_dispatcher.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include "modem_driver.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+# define FUZZ_SANITIZED 1
+#elif defined(__has_feature)
+# if __has_feature(address_sanitizer)
+#  define FUZZ_SANITIZED 1
+# endif
+#endif
+#ifdef FUZZ_SANITIZED
+# include <sanitizer/common_interface_defs.h>
+#endif
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The largest datagram of the Nbiot under test; small, so that lines
+// longer than its buffers are easy to come by
+#define FUZZ_MAX_DATAGRAM 64
+
+// The most of an input used, leaving room in the LoopbackTransport
+// for the ERRORs that follow it
+#define FUZZ_MAX_INPUT (LOOPBACK_BUFFER_SIZE / 2)
+
+// How long any one call may wait for the module; it should never
+// have to, the module having always answered
+#define FUZZ_TIMEOUT_MS 10
+
+// The most times receive() is called for one input
+#define FUZZ_MAX_RECEIVES 8
+
+// What the module says to each command after its piece of the input;
+// the leading terminator ends any line the piece left unfinished
+#define FUZZ_ANSWER "\r\nERROR\r\n"
+
+// The most mutations made to a seed for one run
+#define FUZZ_MAX_MUTATIONS 8
+
+// Fail, with the input saved, if condition does not hold
+#define FUZZ_CHECK(condition) fuzzCheck(condition, #condition, __LINE__)
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// What the first byte of an input drives, modulo the number of them.
+typedef enum
+{
+    FUZZ_TARGET_LINES,
+    FUZZ_TARGET_RESPONSE,
+    FUZZ_TARGET_RECEIVE,
+    FUZZ_TARGET_BATCH,
+    FUZZ_TARGET_HEX,
+    MAX_NUM_FUZZ_TARGETS
+} FuzzTarget;
+
+// The module at the far end of the LoopbackTransport: it answers each
+// command with the next piece of the input, pData being what is left
+// of it, len characters, and then FUZZ_ANSWER.
+typedef struct
+{
+    LoopbackTransport * pTransport;
+    const char * pData;
+    uint32_t len;
+} FuzzModule;
+
+// A built-in seed.
+typedef struct
+{
+    FuzzTarget target;
+    uint8_t param;
+    const char * pData;
+    uint32_t len;
+} FuzzSeed;
+
+// A built-in seed from a string, which may contain NULs.
+#define FUZZ_SEED(target, param, string) {target, param, string, sizeof (string) - 1}
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// An Nbiot with the innards the harness drives directly opened up.
+class FuzzNbiot : public BasicNbiot<FUZZ_MAX_DATAGRAM>
+{
+public:
+    FuzzNbiot(Transport * pTransport) : BasicNbiot<FUZZ_MAX_DATAGRAM>(pTransport) {}
+
+    void fuzzLines(LoopbackTransport * pTransport, uint8_t param, const char * pData, uint32_t len);
+    void fuzzResponse(LoopbackTransport * pTransport, uint8_t param, const char * pData, uint32_t len);
+};
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+// The prefixes that waitResponse() is given to expect.
+static const char * const gExpected[] = {NULL, "+MGR:", "+MQS:", "+NMI:", "+MGR:OK\r\n", "+MGS:OK\r\n", "OK", ""};
+
+// The built-in seeds, one or more for each target.
+static const FuzzSeed gSeeds[] = {
+    FUZZ_SEED(FUZZ_TARGET_LINES, 7, "\r\nOK\r\n+NMI:3,414243\r\n+SMI:SENT\r\n+CEREG:1\r\nERROR\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_LINES, 1, "+NMI:65,41424344454647484950515253545556575859606162636465666768697071727374757677787980818283848586878889909192939495969798999A9B9C9D9E9FA0A1\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_LINES, 200, "+NMI:1111111111111111111111111111111111111111111111111111111111111111111111111111"
+                                      "111111111111111111111111111111111111111111111111111111111111111111111111111111,\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_RESPONSE, 1, "+MGR:3,414243\r\nOK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_RESPONSE, 2, "+MQS:BUFFERED=2,RECEIVED=2,DROPPED=0\r\n+NMI:1,41\r\nOK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_RECEIVE, 8, "\r\n+MGR:4,01020304\r\n\r\n+MGR:OK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_RECEIVE, 2, "+MGR:8,4142434445464748\r\n+MGR:OK\r\n\0+MGR:0,\r\n+MGR:OK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_RECEIVE, 8, "+MGR:4,0102x\r\n+MGR:OK\r\n\0+MGR:4,01020304\r\n+MGR:OK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_RECEIVE, 64, "+MGR:64,000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+                                       "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F\r\n+MGR:OK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_BATCH, 0x33, "+MQS:BUFFERED=2,RECEIVED=2,DROPPED=0\r\nOK\r\n\0+MGR:2,4142\r\n+MGR:OK\r\n\0+MGR:1,43\r\n+MGR:OK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_BATCH, 0xF1, "+MQS:BUFFERED=9\r\nOK\r\n\0+MGR:64,00\r\n+MGR:OK\r\n\0OK\r\n\0+MGR:0,\r\nOK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_BATCH, 0x33, "+MQS:BUFFERED=3\r\nOK\r\n\0+MGR:2,4142\r\n+MGR:OK\r\n\0+MGR:2,41\r\n+MGR:OK\r\n\0+MGR:1,43\r\n+MGR:OK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_BATCH, 0x02, "+MQS:BUFFERED=1\r\nOK\r\n\0+MGR:1,41\r\n+MGR:1,42\r\n+MGR:1,43\r\n+MGR:OK\r\n"),
+    FUZZ_SEED(FUZZ_TARGET_HEX, 16, "0123456789abcdefABCDEF xyz 0123456789abcdefABCDEF"),
+    FUZZ_SEED(FUZZ_TARGET_HEX, 200, "\xC1\x05hello\x90\x04\xC0stored")
+};
+
+// Tokens that the mutator drops in, being what the parsers look for.
+static const char * const gTokens[] = {"\r\n", "\r", "\n", ",", "+MGR:", "+NMI:", "+MQS:BUFFERED=", "OK\r\n",
+                                       "ERROR\r\n", "+MGR:OK\r\n", "+SMI:SENT\r\n", "4294967296", "-1", "00", "fF"};
+
+// The input being run, written out should it fail.
+static const uint8_t * gpInput = NULL;
+static size_t gInputLen = 0;
+static uint32_t gRun = 0;
+
+// Somewhere for the bytes read from every buffer to go, so that the
+// reading is not optimised away.
+static volatile uint32_t gSink = 0;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Write the input being run to crash-<run>.
+static void saveInput()
+{
+    char fileName[32];
+    FILE * pFile;
+
+    if (gpInput != NULL)
+    {
+        snprintf(fileName, sizeof (fileName), "crash-%u", gRun);
+        pFile = fopen(fileName, "wb");
+        if (pFile != NULL)
+        {
+            fwrite(gpInput, 1, gInputLen, pFile);
+            fclose(pFile);
+            fprintf(stderr, "Input written to %s.\n", fileName);
+        }
+        gpInput = NULL;
+    }
+}
+
+// Fail, with the input saved, if condition does not hold.
+static void fuzzCheck(bool condition, const char * pCondition, int line)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "!!! at_fuzz.cpp:%d: check failed: %s\n", line, pCondition);
+        saveInput();
+        abort();
+    }
+}
+
+// Read the len bytes at pBuf.
+static void touch(const char * pBuf, uint32_t len)
+{
+    uint32_t sum = 0;
+
+    for (uint32_t x = 0; x < len; x++)
+    {
+        sum += (uint8_t) pBuf[x];
+    }
+    gSink += sum;
+}
+
+// LoopbackTransport write handler: play the module.
+static void moduleWrite(void * pContext, const char * pBuf, uint32_t len)
+{
+    FuzzModule * pModule = (FuzzModule *) pContext;
+    const char * pEnd;
+    uint32_t lenPiece;
+
+    for (uint32_t x = 0; x < len; x++)
+    {
+        if (pBuf[x] == '\n')
+        {
+            pEnd = (const char *) memchr(pModule->pData, 0, pModule->len);
+            lenPiece = (pEnd != NULL) ? pEnd - pModule->pData : pModule->len;
+            pModule->pTransport->inject(pModule->pData, lenPiece);
+            pModule->pTransport->inject(FUZZ_ANSWER, sizeof (FUZZ_ANSWER) - 1);
+            if (pEnd != NULL)
+            {
+                lenPiece++;
+            }
+            pModule->pData += lenPiece;
+            pModule->len -= lenPiece;
+        }
+    }
+}
+
+// Drive receive() into a buffer of param bytes.
+static void fuzzReceive(Nbiot * pModem, uint8_t param)
+{
+    uint32_t msgSize = param;
+    char * pMsg = new char[msgSize];
+    uint32_t size;
+    uint32_t calls = 0;
+
+    do
+    {
+        size = pModem->receive(pMsg, msgSize, FUZZ_TIMEOUT_MS);
+        touch(pMsg, (size < msgSize) ? size : msgSize);
+        calls++;
+    } while ((size > 0) && (calls < FUZZ_MAX_RECEIVES));
+
+    delete[] pMsg;
+}
+
+// Drive receiveBatch() into an arena and spans sized by param.
+static void fuzzBatch(Nbiot * pModem, uint8_t param)
+{
+    uint32_t arenaSize = (param & 0x0F) * (FUZZ_MAX_DATAGRAM / 2);
+    uint32_t maxDatagrams = (param >> 4) + 1;
+    char * pArena = new char[arenaSize];
+    Nbiot::DatagramSpan * pSpans = new Nbiot::DatagramSpan[maxDatagrams];
+    uint32_t numDatagrams;
+    uint32_t used = 0;
+
+    numDatagrams = pModem->receiveBatch(pArena, arenaSize, pSpans, maxDatagrams, FUZZ_TIMEOUT_MS);
+    FUZZ_CHECK(numDatagrams <= maxDatagrams);
+    for (uint32_t x = 0; x < numDatagrams; x++)
+    {
+        FUZZ_CHECK((pSpans[x].pData >= pArena) && (pSpans[x].size <= arenaSize) &&
+                   (pSpans[x].pData - pArena <= arenaSize - pSpans[x].size));
+        touch(pSpans[x].pData, pSpans[x].size);
+        used += pSpans[x].size;
+    }
+    FUZZ_CHECK(used <= arenaSize);
+
+    delete[] pSpans;
+    delete[] pArena;
+}
+
+// Decode the len characters at pData as hex into a buffer of param
+// bytes with each hexStringToBytes() variant, and through the payload
+// codec, checking that they agree.
+static void fuzzHex(uint8_t param, const char * pData, uint32_t len)
+{
+    uint32_t lenOut = param;
+    char * pScalar = new char[lenOut];
+    char * pOther = new char[lenOut];
+    char * pHex = new char[len * 2];
+    char * pEncoded = new char[len * 2 + 2];
+    char * pDecoded = new char[len];
+    uint32_t size;
+    uint32_t sizeOther;
+    bool aggregate = false;
+
+    size = hexStringToBytesScalar(pData, len, pScalar, lenOut);
+    FUZZ_CHECK(size <= lenOut);
+    FUZZ_CHECK(hexStringToBytes(pData, len, pOther, lenOut) == size);
+    FUZZ_CHECK(memcmp(pScalar, pOther, size) == 0);
+    if (hexCodecSse2Supported())
+    {
+        FUZZ_CHECK(hexStringToBytesSse2(pData, len, pOther, lenOut) == size);
+        FUZZ_CHECK(memcmp(pScalar, pOther, size) == 0);
+    }
+    if (hexCodecAvx2Supported())
+    {
+        FUZZ_CHECK(hexStringToBytesAvx2(pData, len, pOther, lenOut) == size);
+        FUZZ_CHECK(memcmp(pScalar, pOther, size) == 0);
+    }
+
+    // What is encoded decodes to the same
+    size = bytesToHexString(pData, len, pHex, len * 2);
+    FUZZ_CHECK(size == len * 2);
+    FUZZ_CHECK(hexStringToBytes(pHex, size, pDecoded, len) == len);
+    FUZZ_CHECK(memcmp(pDecoded, pData, len) == 0);
+
+    // The input as an encoded payload, and as one to encode
+    size = payloadDecode(pData, len, pOther, lenOut);
+    FUZZ_CHECK(size <= lenOut);
+    touch(pOther, size);
+    size = payloadEncode(pData, len, pEncoded, len * 2 + 2, (param & 1) != 0, (param & 2) != 0);
+    if (size > 0)
+    {
+        sizeOther = payloadDecode(pEncoded, size, pDecoded, len, &aggregate);
+        FUZZ_CHECK((sizeOther == len) && (memcmp(pDecoded, pData, len) == 0));
+        FUZZ_CHECK(aggregate == ((param & 2) != 0));
+    }
+
+    delete[] pDecoded;
+    delete[] pEncoded;
+    delete[] pHex;
+    delete[] pOther;
+    delete[] pScalar;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Drive getLine(), param + 1 characters at a time, and hand each line
+// to the URC handlers as beginCommand() does.
+void FuzzNbiot::fuzzLines(LoopbackTransport * pTransport, uint8_t param, const char * pData, uint32_t len)
+{
+    std::vector<char> lines;
+    const char * pLine;
+    uint32_t lineLen;
+    uint32_t chunk = (uint32_t) param + 1;
+    uint32_t offset = 0;
+    uint32_t size;
+    char * pMsg = new char[param];
+
+    while (offset < len)
+    {
+        if (chunk > len - offset)
+        {
+            chunk = len - offset;
+        }
+        pTransport->inject(pData + offset, chunk);
+        offset += chunk;
+        while ((lineLen = getLine(&pLine)) > 0)
+        {
+            FUZZ_CHECK(lineLen <= FUZZ_MAX_DATAGRAM * 2 + AT_STRING_MARGIN);
+            FUZZ_CHECK(((lineLen >= sizeof (AT_TERMINATOR) - 1) &&
+                        (memcmp(pLine + lineLen - (sizeof (AT_TERMINATOR) - 1), AT_TERMINATOR, sizeof (AT_TERMINATOR) - 1) == 0)) ||
+                       (lineLen == FUZZ_MAX_DATAGRAM * 2 + AT_STRING_MARGIN));
+            lines.insert(lines.end(), pLine, pLine + lineLen);
+            if (lineLen > sizeof (AT_TERMINATOR) - 1) // -1 to omit NULL terminator
+            {
+                gDispatcher.dispatch(pLine, lineLen);
+            }
+        }
+    }
+
+    // Nothing lost or made up
+    FUZZ_CHECK(lines.size() + gRxLineBuffer.getLength() == len);
+    FUZZ_CHECK((lines.size() == 0) || (memcmp(lines.data(), pData, lines.size()) == 0));
+
+    while ((size = getDownlink(pMsg, param)) > 0)
+    {
+        FUZZ_CHECK(size <= FUZZ_MAX_DATAGRAM);
+        touch(pMsg, (size < param) ? size : param);
+    }
+
+    delete[] pMsg;
+}
+
+// Drive waitResponse() for a command expecting one of gExpected until
+// the module is done.
+void FuzzNbiot::fuzzResponse(LoopbackTransport * pTransport, uint8_t param, const char * pData, uint32_t len)
+{
+    const char * pExpected = gExpected[param % (sizeof (gExpected) / sizeof (gExpected[0]))];
+    const char * pLine;
+    uint32_t lineLen;
+    AtResponse response;
+
+    beginCommand(pExpected);
+    pTransport->inject(pData, len);
+    pTransport->inject(FUZZ_ANSWER, sizeof (FUZZ_ANSWER) - 1);
+    do
+    {
+        response = waitResponse(pExpected, FUZZ_TIMEOUT_MS, &pLine, &lineLen);
+        if (response == AT_RESPONSE_STARTS_AS_EXPECTED)
+        {
+            FUZZ_CHECK((lineLen >= strlen(pExpected)) && (lineLen <= FUZZ_MAX_DATAGRAM * 2 + AT_STRING_MARGIN) &&
+                       (memcmp(pLine, pExpected, strlen(pExpected)) == 0));
+            touch(pLine, lineLen);
+        }
+    } while ((response != AT_RESPONSE_NONE) && (pTransport->waitReadable(0) || (gRxLineBuffer.getLength() > 0)));
+    endCommand();
+}
+
+// The entry point for libFuzzer, and for every input otherwise.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * pInput, size_t size)
+{
+    LoopbackTransport * pTransport;
+    FuzzNbiot * pModem;
+    FuzzModule module;
+    const char * pData = (const char *) pInput + 2;
+    uint32_t len;
+    uint8_t param;
+
+    if (size >= 2)
+    {
+        gpInput = pInput;
+        gInputLen = size;
+        param = pInput[1];
+        len = (uint32_t) size - 2;
+        if (len > FUZZ_MAX_INPUT)
+        {
+            len = FUZZ_MAX_INPUT;
+        }
+
+        if (pInput[0] % MAX_NUM_FUZZ_TARGETS == FUZZ_TARGET_HEX)
+        {
+            fuzzHex(param, pData, len);
+        }
+        else
+        {
+            pTransport = new LoopbackTransport();
+            pModem = new FuzzNbiot(pTransport);
+            module.pTransport = pTransport;
+            module.pData = pData;
+            module.len = len;
+            pTransport->setWriteHandler(moduleWrite, &module);
+
+            switch (pInput[0] % MAX_NUM_FUZZ_TARGETS)
+            {
+                case FUZZ_TARGET_LINES:
+                    pModem->fuzzLines(pTransport, param, pData, len);
+                break;
+                case FUZZ_TARGET_RESPONSE:
+                    pModem->fuzzResponse(pTransport, param, pData, len);
+                break;
+                case FUZZ_TARGET_RECEIVE:
+                    fuzzReceive(pModem, param);
+                break;
+                case FUZZ_TARGET_BATCH:
+                    fuzzBatch(pModem, param);
+                break;
+                default:
+                break;
+            }
+
+            delete pModem;
+            delete pTransport;
+        }
+        gpInput = NULL;
+    }
+
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+// Read the file pFileName ("-" for stdin) into pInput.
+static bool readInput(const char * pFileName, std::vector<uint8_t> * pInput)
+{
+    FILE * pFile = (strcmp(pFileName, "-") == 0) ? stdin : fopen(pFileName, "rb");
+    uint8_t buf[1024];
+    size_t len;
+
+    pInput->clear();
+    if (pFile != NULL)
+    {
+        while ((len = fread(buf, 1, sizeof (buf), pFile)) > 0)
+        {
+            pInput->insert(pInput->end(), buf, buf + len);
+        }
+        if (pFile != stdin)
+        {
+            fclose(pFile);
+        }
+    }
+
+    return (pFile != NULL);
+}
+
+// Turn a built-in seed into an input.
+static void seedInput(const FuzzSeed * pSeed, std::vector<uint8_t> * pInput)
+{
+    pInput->clear();
+    pInput->push_back((uint8_t) pSeed->target);
+    pInput->push_back(pSeed->param);
+    pInput->insert(pInput->end(), pSeed->pData, pSeed->pData + pSeed->len);
+}
+
+// Write the built-in seeds to the directory pDir.
+static bool writeSeeds(const char * pDir)
+{
+    std::vector<uint8_t> input;
+    char fileName[1024];
+    FILE * pFile;
+    bool success = true;
+
+    for (uint32_t x = 0; success && (x < sizeof (gSeeds) / sizeof (gSeeds[0])); x++)
+    {
+        seedInput(&gSeeds[x], &input);
+        snprintf(fileName, sizeof (fileName), "%s/seed-%02u", pDir, x);
+        pFile = fopen(fileName, "wb");
+        success = (pFile != NULL) && (fwrite(input.data(), 1, input.size(), pFile) == input.size());
+        if (pFile != NULL)
+        {
+            success = (fclose(pFile) == 0) && success;
+        }
+    }
+
+    return success;
+}
+
+// Make between one and FUZZ_MAX_MUTATIONS random changes to pInput.
+static void mutate(std::vector<uint8_t> * pInput)
+{
+    uint32_t mutations = (rand() % FUZZ_MAX_MUTATIONS) + 1;
+    uint32_t offset;
+    uint32_t len;
+    const char * pToken;
+
+    for (uint32_t x = 0; x < mutations; x++)
+    {
+        offset = (pInput->size() > 0) ? rand() % (pInput->size() + 1) : 0;
+        len = (rand() % 16) + 1;
+        switch (rand() % 8)
+        {
+            case 0:
+                // Flip a bit
+                if (offset < pInput->size())
+                {
+                    (*pInput)[offset] ^= (uint8_t) (1 << (rand() % 8));
+                }
+            break;
+            case 1:
+                // Put in a random byte
+                pInput->insert(pInput->begin() + offset, (uint8_t) rand());
+            break;
+            case 2:
+                // Put in a token
+                pToken = gTokens[rand() % (sizeof (gTokens) / sizeof (gTokens[0]))];
+                pInput->insert(pInput->begin() + offset, pToken, pToken + strlen(pToken));
+            break;
+            case 3:
+                // Take some out
+                if (len > pInput->size() - offset)
+                {
+                    len = pInput->size() - offset;
+                }
+                pInput->erase(pInput->begin() + offset, pInput->begin() + offset + len);
+            break;
+            case 4:
+                // Repeat some
+                if (len > pInput->size() - offset)
+                {
+                    len = pInput->size() - offset;
+                }
+                {
+                    std::vector<uint8_t> copy(pInput->begin() + offset, pInput->begin() + offset + len);
+                    pInput->insert(pInput->begin() + offset, copy.begin(), copy.end());
+                }
+            break;
+            case 5:
+                // Split the answer to a command in two
+                pInput->insert(pInput->begin() + offset, 0);
+            break;
+            case 6:
+                // Change a digit, which are mostly lengths
+                if ((offset < pInput->size()) && ((*pInput)[offset] >= '0') && ((*pInput)[offset] <= '9'))
+                {
+                    (*pInput)[offset] = '0' + (rand() % 10);
+                }
+            break;
+            default:
+                // Change the size given to the target
+                if (pInput->size() > 1)
+                {
+                    (*pInput)[1] = (uint8_t) rand();
+                }
+            break;
+        }
+    }
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+    std::vector<std::vector<uint8_t> > corpus;
+    std::vector<uint8_t> input;
+    const char * pSeedDir = NULL;
+    bool verbose = false;
+    uint32_t runs = 0;
+    uint32_t seed = (uint32_t) time(NULL);
+    bool success = true;
+    int64_t startMs;
+    int outFd;
+    int devNull;
+    FILE * pOut;
+    int c;
+
+    while ((c = getopt(argc, argv, "r:s:w:v")) != -1)
+    {
+        switch (c)
+        {
+            case 'r':
+                runs = strtoul(optarg, NULL, 0);
+            break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+            break;
+            case 'w':
+                pSeedDir = optarg;
+            break;
+            case 'v':
+                verbose = true;
+            break;
+            default:
+                success = false;
+            break;
+        }
+    }
+    if (!success)
+    {
+        fprintf(stderr, "Usage: %s [-r runs] [-s seed] [-w dir] [-v] [file...]\n", argv[0]);
+        return -1;
+    }
+
+    if (pSeedDir != NULL)
+    {
+        if (!writeSeeds(pSeedDir))
+        {
+            fprintf(stderr, "!!! Unable to write the seeds to %s.\n", pSeedDir);
+            return -1;
+        }
+        return 0;
+    }
+
+    for (int x = optind; x < argc; x++)
+    {
+        if (!readInput(argv[x], &input))
+        {
+            fprintf(stderr, "!!! Unable to read %s.\n", argv[x]);
+            return -1;
+        }
+        corpus.push_back(input);
+    }
+    if ((corpus.size() == 0) && (runs == 0))
+    {
+        readInput("-", &input);
+        corpus.push_back(input);
+    }
+
+    // Keep stdout for the results, sending the driver's output elsewhere
+    fflush(stdout);
+    outFd = dup(STDOUT_FILENO);
+    if (!verbose)
+    {
+        devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+    }
+    else
+    {
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    pOut = fdopen(outFd, "w");
+#ifdef FUZZ_SANITIZED
+    __sanitizer_set_death_callback(saveInput);
+#endif
+
+    startMs = getTimeMs();
+    if (runs == 0)
+    {
+        // Each input once, e.g. to check a crash or a corpus
+        for (gRun = 0; gRun < corpus.size(); gRun++)
+        {
+            LLVMFuzzerTestOneInput(corpus[gRun].data(), corpus[gRun].size());
+        }
+        fprintf(pOut, "%u input(s) run in %d ms.\n", (uint32_t) corpus.size(), (int) (getTimeMs() - startMs));
+    }
+    else
+    {
+        srand(seed);
+        if (corpus.size() == 0)
+        {
+            for (uint32_t x = 0; x < sizeof (gSeeds) / sizeof (gSeeds[0]); x++)
+            {
+                seedInput(&gSeeds[x], &input);
+                corpus.push_back(input);
+            }
+        }
+        for (gRun = 0; gRun < runs; gRun++)
+        {
+            // Everything as it is first, then mutations of it
+            if (gRun < corpus.size())
+            {
+                input = corpus[gRun];
+            }
+            else
+            {
+                input = corpus[rand() % corpus.size()];
+                mutate(&input);
+            }
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+        fprintf(pOut, "%u run(s) from %u input(s), seed %u, in %d ms.\n", runs, (uint32_t) corpus.size(), seed,
+                (int) (getTimeMs() - startMs));
+    }
+    fclose(pOut);
+
+    return 0;
+}
+
+#endif
+
+// End Of File
@@ -0,0 +1,598 @@
+// AT capture replay for NB-IoT example application
+//
+// Reads a capture written by CaptureTransport (see capture_transport.h;
+// client_side writes one with -c) and plays it back into Nbiot on a
+// LoopbackTransport, so that a session with a real module, e.g. one
+// that went wrong in the field, can be reproduced, regression tested
+// and profiled without the module.  This tool plays the module: each
+// line that Nbiot writes is matched against the next command in the
+// capture and answered with what the module sent after that command
+// in the capture, up to the command after it.  Nbiot is driven by the
+// calls that the commands in the capture imply:
+//
+// AT+NAS, AT+RAS -> connect()
+// AT+MGS=n, hex  -> sendAsync() with the datagram
+// AT+MGR         -> receive()
+// AT+MQS         -> receiveBatch() of up to REPLAY_BATCH_DATAGRAMS
+// AT+NMI=2       -> startAsyncReceive(false)
+//
+// Any other command left over by a call is passed over along with what
+// was read after it.  By default the replay goes as fast as Nbiot
+// takes it; with -t each command is made and each piece of the
+// module's output arrives no earlier than it did in the capture.  At
+// the end the tool prints, on stdout, how the commands Nbiot wrote
+// compared with those in the capture, and the lines read per second.
+// Output from the driver itself is discarded, unless -v is given, when
+// it goes to stderr along with every command that differed.
+// Linux only.
+//
+// Usage: at_replay [options] <capture file>, where options are:
+//   -t        keep to the timing of the capture
+//   -n <n>    replay the capture n times over (default 1)
+//   -v        don't discard output from the driver
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "platform.h"
+#include "utilities.h"
+#include "transport.h"
+#include "loopback_transport.h"
+#include "capture_transport.h"
+#include "line_buffer.h"
+#include "spsc_queue.h"
+#include "at_dispatcher.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include "modem_driver.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The most datagrams collected by each receiveBatch() call, as main.cpp
+#define REPLAY_BATCH_DATAGRAMS 8
+
+// The longest AT line compared, an AT+MGS carrying the largest datagram
+#define REPLAY_MAX_LINE_LENGTH (MAX_LEN_SEND_STRING * 2 + 32)
+
+// How long each call is given, so that a replay that has gone astray
+// still finishes
+#define REPLAY_CALL_TIMEOUT_MS 2000
+
+// How long to wait each time round while pumping Nbiot
+#define REPLAY_POLL_MS 1
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// A replay in progress.  The records from cursor up to released are
+// for the module to send now, the commands among them being passed
+// over; nextCommand is the command in the capture that the next line
+// Nbiot writes is compared with.
+typedef struct
+{
+    std::vector<CaptureRecord> * pRecords;
+    LoopbackTransport * pTransport;
+    bool timed;
+    bool verbose;
+    int64_t startUs;
+    std::mutex mutex;
+    std::condition_variable signal;
+    std::atomic<bool> stop;
+    uint32_t cursor;
+    uint32_t offset;
+    uint32_t released;
+    uint32_t nextCommand;
+    char line[REPLAY_MAX_LINE_LENGTH];
+    uint32_t len;
+    uint32_t matched;
+    uint32_t different;
+    uint32_t passedOver;
+    uint32_t unexpected;
+    uint32_t downlinks;
+} Replay;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Return the index of the first command in the capture after index,
+// or the number of records if there is none.
+static uint32_t nextCommandAfter(Replay * pReplay, int64_t index)
+{
+    uint32_t x = (uint32_t) (index + 1);
+
+    while ((x < pReplay->pRecords->size()) && ((*pReplay->pRecords)[x].direction != CAPTURE_DIRECTION_TX))
+    {
+        x++;
+    }
+
+    return x;
+}
+
+// Return the length of the first line of a record, without its
+// terminator.
+static uint32_t lineLength(const CaptureRecord * pRecord)
+{
+    uint32_t len = 0;
+
+    while ((len < pRecord->len) && (pRecord->pData[len] != '\r') && (pRecord->pData[len] != '\n'))
+    {
+        len++;
+    }
+
+    return len;
+}
+
+// Return when the record at index is due, in getTimeUs() terms.
+static int64_t dueUs(Replay * pReplay, uint32_t index)
+{
+    return pReplay->startUs + (*pReplay->pRecords)[index].timeUs;
+}
+
+// Give the module's output that has been released, and is due, to
+// Nbiot, without blocking; call with the mutex locked.  Returns true
+// if the loopback buffer filled before everything released went.
+static bool feed(Replay * pReplay)
+{
+    CaptureRecord * pRecord;
+    bool full = false;
+    bool notDue = false;
+
+    while (!full && !notDue && (pReplay->cursor < pReplay->released))
+    {
+        pRecord = &(*pReplay->pRecords)[pReplay->cursor];
+        if (pRecord->direction == CAPTURE_DIRECTION_TX)
+        {
+            pReplay->cursor++;
+        }
+        else if (pReplay->timed && (pReplay->offset == 0) && (dueUs(pReplay, pReplay->cursor) > getTimeUs()))
+        {
+            notDue = true;
+        }
+        else
+        {
+            pReplay->offset += pReplay->pTransport->inject(pRecord->pData + pReplay->offset, pRecord->len - pReplay->offset);
+            if (pReplay->offset == pRecord->len)
+            {
+                pReplay->cursor++;
+                pReplay->offset = 0;
+            }
+            else
+            {
+                full = true;
+            }
+        }
+    }
+
+    return full;
+}
+
+// The feeder thread: gives Nbiot what feed() could not when it was
+// released, because it was not yet due or there was no room for it.
+static void feeder(Replay * pReplay)
+{
+    std::unique_lock<std::mutex> lock(pReplay->mutex);
+    int64_t waitUs;
+
+    while (!pReplay->stop)
+    {
+        if (feed(pReplay))
+        {
+            // Wait for Nbiot to make room
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+        else if (pReplay->cursor < pReplay->released)
+        {
+            // Wait until the next piece is due, or to be stopped
+            waitUs = dueUs(pReplay, pReplay->cursor) - getTimeUs();
+            pReplay->signal.wait_for(lock, std::chrono::microseconds((waitUs > 0) ? waitUs : 0));
+        }
+        else
+        {
+            pReplay->signal.wait(lock, [pReplay] {return pReplay->stop || (pReplay->cursor < pReplay->released);});
+        }
+    }
+}
+
+// Compare a line Nbiot has written with the next command in the
+// capture, then release what the module sent after that command.
+static void replayLine(Replay * pReplay)
+{
+    CaptureRecord * pRecord;
+    uint32_t len;
+    bool wake = false;
+
+    {
+        std::lock_guard<std::mutex> lock(pReplay->mutex);
+
+        if (pReplay->nextCommand < pReplay->pRecords->size())
+        {
+            pRecord = &(*pReplay->pRecords)[pReplay->nextCommand];
+            len = lineLength(pRecord);
+            if ((len == pReplay->len) && (memcmp(pRecord->pData, pReplay->line, len) == 0))
+            {
+                pReplay->matched++;
+            }
+            else
+            {
+                pReplay->different++;
+                if (pReplay->verbose)
+                {
+                    fprintf(stderr, "Command %u: \"%.*s\" where the capture has \"%.*s\".\n", pReplay->nextCommand,
+                            (int) pReplay->len, pReplay->line, (int) len, pRecord->pData);
+                }
+            }
+            pReplay->nextCommand = nextCommandAfter(pReplay, pReplay->nextCommand);
+            pReplay->released = pReplay->nextCommand;
+
+            // Answer at once if that can be done from here, without
+            // waking the feeder
+            if (!pReplay->timed)
+            {
+                feed(pReplay);
+            }
+            wake = (pReplay->cursor < pReplay->released);
+        }
+        else
+        {
+            pReplay->unexpected++;
+            if (pReplay->verbose)
+            {
+                fprintf(stderr, "Command \"%.*s\" beyond the end of the capture.\n", (int) pReplay->len, pReplay->line);
+            }
+        }
+    }
+
+    if (wake)
+    {
+        pReplay->signal.notify_all();
+    }
+}
+
+// LoopbackTransport write handler: gather what Nbiot writes into lines.
+static void replayWrite(void * pContext, const char * pBuf, uint32_t len)
+{
+    Replay * pReplay = (Replay *) pContext;
+
+    for (uint32_t x = 0; x < len; x++)
+    {
+        if (pBuf[x] == '\r')
+        {
+            replayLine(pReplay);
+            pReplay->len = 0;
+        }
+        else if ((pBuf[x] != '\n') && (pReplay->len < sizeof (pReplay->line)))
+        {
+            pReplay->line[pReplay->len] = pBuf[x];
+            pReplay->len++;
+        }
+    }
+}
+
+// Return the index of the next command in the capture still to be
+// matched.
+static uint32_t getNextCommand(Replay * pReplay)
+{
+    std::lock_guard<std::mutex> lock(pReplay->mutex);
+
+    return pReplay->nextCommand;
+}
+
+// Collect the downlink datagrams that Nbiot has queued.
+static void collectDownlinks(Replay * pReplay, Nbiot * pModem)
+{
+    while (pModem->getDownlink(NULL, 0) > 0)
+    {
+        pReplay->downlinks++;
+    }
+}
+
+// Pump Nbiot until the command in the capture at index has been
+// matched, or the call timeout passes.
+static void pumpUntilPast(Replay * pReplay, Nbiot * pModem, uint32_t index)
+{
+    int64_t deadlineMs = getTimeMs() + REPLAY_CALL_TIMEOUT_MS;
+
+    while ((getNextCommand(pReplay) <= index) && (getTimeMs() < deadlineMs))
+    {
+        pModem->serviceSends();
+        pModem->waitReadable(REPLAY_POLL_MS);
+    }
+}
+
+// Make the call on pModem that the command in the capture at index
+// implies.
+static void replayCommand(Replay * pReplay, Nbiot * pModem, uint32_t index)
+{
+    const CaptureRecord * pRecord = &(*pReplay->pRecords)[index];
+    char datagram[MAX_LEN_SEND_STRING];
+    char arena[MAX_LEN_SEND_STRING * REPLAY_BATCH_DATAGRAMS];
+    Nbiot::DatagramSpan spans[REPLAY_BATCH_DATAGRAMS];
+    uint32_t len = lineLength(pRecord);
+    const char * pHex;
+    uint32_t size;
+    int64_t deadlineMs;
+
+    if (((len == 6) && (memcmp(pRecord->pData, "AT+NAS", 6) == 0)) ||
+        ((len == 6) && (memcmp(pRecord->pData, "AT+RAS", 6) == 0)))
+    {
+        pModem->connect(pRecord->pData[3] == 'R', REPLAY_CALL_TIMEOUT_MS);
+    }
+    else if ((len > 7) && (memcmp(pRecord->pData, "AT+MGS=", 7) == 0))
+    {
+        pHex = (const char *) memchr(pRecord->pData, ' ', len);
+        if (pHex != NULL)
+        {
+            pHex++;
+            size = hexStringToBytes(pHex, len - (pHex - pRecord->pData), datagram, sizeof (datagram));
+            deadlineMs = getTimeMs() + REPLAY_CALL_TIMEOUT_MS;
+            while ((pModem->sendAsync(datagram, size) == 0) && (getTimeMs() < deadlineMs))
+            {
+                pModem->serviceSends();
+                pModem->waitReadable(REPLAY_POLL_MS);
+            }
+            pumpUntilPast(pReplay, pModem, index);
+        }
+    }
+    else if ((len == 6) && (memcmp(pRecord->pData, "AT+MGR", 6) == 0))
+    {
+        pModem->receive(datagram, sizeof (datagram), REPLAY_CALL_TIMEOUT_MS);
+    }
+    else if ((len == 6) && (memcmp(pRecord->pData, "AT+MQS", 6) == 0))
+    {
+        pModem->receiveBatch(arena, sizeof (arena), spans, REPLAY_BATCH_DATAGRAMS, REPLAY_CALL_TIMEOUT_MS);
+    }
+    else if ((len == 8) && (memcmp(pRecord->pData, "AT+NMI=2", 8) == 0))
+    {
+        pModem->startAsyncReceive(false);
+    }
+    collectDownlinks(pReplay, pModem);
+}
+
+// Replay the capture once into a new Nbiot.
+static void replayPass(Replay * pReplay)
+{
+    LoopbackTransport transport;
+    Nbiot * pModem = new Nbiot(&transport);
+    std::thread * pFeeder;
+    uint32_t index;
+    int64_t deadlineMs;
+    bool done = false;
+
+    pReplay->pTransport = &transport;
+    pReplay->stop = false;
+    pReplay->cursor = 0;
+    pReplay->offset = 0;
+    pReplay->nextCommand = nextCommandAfter(pReplay, -1);
+    pReplay->released = pReplay->nextCommand;
+    pReplay->len = 0;
+    pReplay->startUs = getTimeUs() - ((pReplay->pRecords->size() > 0) ? (*pReplay->pRecords)[0].timeUs : 0);
+    transport.setWriteHandler(replayWrite, pReplay);
+    pFeeder = new std::thread(feeder, pReplay);
+
+    while (!done)
+    {
+        index = getNextCommand(pReplay);
+        if (index < pReplay->pRecords->size())
+        {
+            if (pReplay->timed && (dueUs(pReplay, index) > getTimeUs()))
+            {
+                sleepMs((uint32_t) ((dueUs(pReplay, index) - getTimeUs() + 999) / 1000));
+            }
+            replayCommand(pReplay, pModem, index);
+
+            std::lock_guard<std::mutex> lock(pReplay->mutex);
+            if (pReplay->nextCommand == index)
+            {
+                // Nothing written for it: pass over it and what followed
+                pReplay->passedOver++;
+                pReplay->nextCommand = nextCommandAfter(pReplay, index);
+                pReplay->released = pReplay->nextCommand;
+                pReplay->signal.notify_all();
+            }
+        }
+        else
+        {
+            done = true;
+        }
+    }
+
+    // Let Nbiot read the last of the module's output
+    deadlineMs = getTimeMs() + REPLAY_CALL_TIMEOUT_MS;
+    done = false;
+    while (!done && (getTimeMs() < deadlineMs))
+    {
+        {
+            std::lock_guard<std::mutex> lock(pReplay->mutex);
+            done = (pReplay->cursor >= pReplay->pRecords->size());
+        }
+        pModem->serviceSends();
+        collectDownlinks(pReplay, pModem);
+        if (!done)
+        {
+            pModem->waitReadable(REPLAY_POLL_MS);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pReplay->mutex);
+        pReplay->stop = true;
+    }
+    pReplay->signal.notify_all();
+    pFeeder->join();
+    delete pFeeder;
+    transport.setWriteHandler(NULL, NULL);
+    delete pModem;
+}
+
+// Read the capture file pFileName into pCapture and decode its records
+// into pRecords.  Returns false if it is not a capture.
+static bool readCapture(const char * pFileName, std::vector<char> * pCapture, std::vector<CaptureRecord> * pRecords)
+{
+    FILE * pFile = fopen(pFileName, "rb");
+    CaptureRecord record;
+    uint32_t offset = 0;
+    long size = -1;
+
+    if (pFile != NULL)
+    {
+        if ((fseek(pFile, 0, SEEK_END) == 0) && ((size = ftell(pFile)) >= 0) && (fseek(pFile, 0, SEEK_SET) == 0))
+        {
+            pCapture->resize(size);
+            if ((size > 0) && (fread(pCapture->data(), 1, size, pFile) != (size_t) size))
+            {
+                size = -1;
+            }
+        }
+        fclose(pFile);
+    }
+
+    if (size > 0)
+    {
+        offset = captureStart(pCapture->data(), size);
+    }
+    if (offset > 0)
+    {
+        record.timeUs = 0;
+        while (captureNext(pCapture->data(), size, &offset, &record))
+        {
+            pRecords->push_back(record);
+        }
+        if (offset < (uint32_t) size)
+        {
+            fprintf(stderr, "WARNING: the last %u byte(s) of %s are not a whole record.\n", (uint32_t) size - offset, pFileName);
+        }
+    }
+
+    return (offset > 0);
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+    std::vector<char> capture;
+    std::vector<CaptureRecord> records;
+    Replay * pReplay;
+    bool timed = false;
+    bool verbose = false;
+    uint32_t passes = 1;
+    uint64_t lines = 0;
+    uint64_t bytes = 0;
+    uint32_t commands = 0;
+    int64_t startUs;
+    int64_t elapsedUs;
+    FILE * pOut;
+    int outFd;
+    int devNull;
+    int c;
+
+    while ((c = getopt(argc, argv, "tn:v")) != -1)
+    {
+        switch (c)
+        {
+            case 't':
+                timed = true;
+            break;
+            case 'n':
+                passes = strtoul(optarg, NULL, 0);
+            break;
+            case 'v':
+                verbose = true;
+            break;
+            default:
+                passes = 0;
+            break;
+        }
+    }
+    if ((passes == 0) || (optind != argc - 1))
+    {
+        fprintf(stderr, "Usage: %s [-t] [-n passes] [-v] <capture file>\n", argv[0]);
+        return -1;
+    }
+
+    if (!readCapture(argv[optind], &capture, &records))
+    {
+        fprintf(stderr, "!!! %s is not a capture.\n", argv[optind]);
+        return -1;
+    }
+    for (uint32_t x = 0; x < records.size(); x++)
+    {
+        if (records[x].direction == CAPTURE_DIRECTION_RX)
+        {
+            bytes += records[x].len;
+            for (uint32_t y = 0; y < records[x].len; y++)
+            {
+                lines += (records[x].pData[y] == '\n');
+            }
+        }
+        else
+        {
+            commands++;
+        }
+    }
+
+    // Keep stdout for the results, sending the driver's output elsewhere
+    fflush(stdout);
+    outFd = dup(STDOUT_FILENO);
+    if (!verbose)
+    {
+        devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+    }
+    else
+    {
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    pOut = fdopen(outFd, "w");
+
+    pReplay = new Replay;
+    pReplay->pRecords = &records;
+    pReplay->timed = timed;
+    pReplay->verbose = verbose;
+    pReplay->matched = 0;
+    pReplay->different = 0;
+    pReplay->passedOver = 0;
+    pReplay->unexpected = 0;
+    pReplay->downlinks = 0;
+    startUs = getTimeUs();
+    for (uint32_t x = 0; x < passes; x++)
+    {
+        replayPass(pReplay);
+    }
+    elapsedUs = getTimeUs() - startUs;
+    fflush(stdout);
+
+    fprintf(pOut, "%u record(s): %llu line(s), %llu byte(s) from the module, %u command(s) to it.\n",
+            (uint32_t) records.size(), (unsigned long long) lines, (unsigned long long) bytes, commands);
+    fprintf(pOut, "%u pass(es): %u command(s) as captured, %u different, %u passed over, %u beyond the capture, "
+                  "%u downlink datagram(s).\n",
+            passes, pReplay->matched, pReplay->different, pReplay->passedOver, pReplay->unexpected, pReplay->downlinks);
+    fprintf(pOut, "%.3f s, %.0f line(s)/s, %.0f command(s)/s.\n", elapsedUs / 1e6,
+            (elapsedUs > 0) ? (double) lines * passes * 1e6 / elapsedUs : 0.0,
+            (elapsedUs > 0) ? (double) pReplay->matched * 1e6 / elapsedUs : 0.0);
+    fclose(pOut);
+
+    c = ((pReplay->different == 0) && (pReplay->unexpected == 0)) ? 0 : -1;
+    delete pReplay;
+
+    return c;
+}
+
+// End Of File
@@ -0,0 +1,240 @@
+// Hex codec microbenchmark for NB-IoT example application
+//
+// Times the scalar, SSE2 and AVX2 versions of the hex encoder and decoder
+// in hex_codec.h, checking that each produces exactly what the scalar
+// version does, and prints the throughput of each in GB/s of input.
+// Decoding is timed on clean hex and on hex broken up with separators
+// (which exercises the lenient, non-hex-skipping path).
+//
+// Usage: hex_bench [bytes [iterations]]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "hex_codec.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// Default number of bytes to encode per iteration
+#define DEFAULT_BENCH_BYTES 65536
+
+// Default number of iterations of each function
+#define DEFAULT_BENCH_ITERATIONS 2000
+
+// Insert a separator after this many hex characters in the
+// lenient decode test
+#define SEPARATOR_INTERVAL 40
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// The form of all the hex codec functions.
+typedef uint32_t (*HexCodecFunction) (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf);
+
+// A variant of a codec function to be timed.
+typedef struct
+{
+    const char * pName;
+    HexCodecFunction pFunction;
+    bool supported;
+} Variant;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Time iterations calls of pFunction, check that its output matches
+// pExpected and print the throughput.  Returns false on a mismatch.
+static bool bench (const char * pTest, const Variant * pVariant, const char * pIn, uint32_t lenIn,
+                   char * pOut, uint32_t lenOut, const char * pExpected, uint32_t lenExpected, uint32_t iterations)
+{
+    bool success = true;
+    uint32_t len = 0;
+    double seconds;
+
+    if (!pVariant->supported)
+    {
+        printf ("%-16s %-8s  not supported by this processor\n", pTest, pVariant->pName);
+    }
+    else
+    {
+        memset (pOut, 0, lenOut);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint32_t x = 0; x < iterations; x++)
+        {
+            len += pVariant->pFunction (pIn, lenIn, pOut, lenOut);
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if ((len != lenExpected * iterations) || (memcmp (pOut, pExpected, lenExpected) != 0))
+        {
+            printf ("!!! %s %s output does not match the scalar version.\n", pTest, pVariant->pName);
+            success = false;
+        }
+        else
+        {
+            printf ("%-16s %-8s %8.3f GB/s\n", pTest, pVariant->pName, ((double) lenIn * iterations) / seconds / 1e9);
+        }
+    }
+
+    return success;
+}
+
+// Check that the variants agree with the scalar version on short and
+// awkward inputs, including bounded output and odd nibble counts.
+static bool checkEdges (const Variant * pEncoders, const Variant * pDecoders, uint32_t numVariants)
+{
+    bool success = true;
+    char bytes[200];
+    char hex[400];
+    char expected[400];
+    char actual[400];
+    uint32_t lenExpected;
+    uint32_t lenActual;
+
+    for (uint32_t x = 0; x < sizeof (bytes); x++)
+    {
+        bytes[x] = (char) rand();
+    }
+    for (uint32_t x = 0; x < sizeof (hex); x++)
+    {
+        // Mostly hex, with the odd stray character
+        hex[x] = "0123456789abcdefABCDEF"[rand() % 22];
+        if (rand() % 50 == 0)
+        {
+            hex[x] = " ,\r\nxG\x80"[rand() % 7];
+        }
+    }
+
+    for (uint32_t v = 1; v < numVariants; v++)
+    {
+        for (uint32_t size = 0; (size < sizeof (bytes)) && success; size += 7)
+        {
+            for (uint32_t lenOut = 0; (lenOut < sizeof (expected)) && success; lenOut += 13)
+            {
+                if (pEncoders[v].supported)
+                {
+                    memset (expected, 0, sizeof (expected));
+                    memset (actual, 0, sizeof (actual));
+                    lenExpected = pEncoders[0].pFunction (bytes, size, expected, lenOut);
+                    lenActual = pEncoders[v].pFunction (bytes, size, actual, lenOut);
+                    if ((lenActual != lenExpected) || (memcmp (actual, expected, sizeof (actual)) != 0))
+                    {
+                        printf ("!!! %s encode differs for %d bytes into %d.\n", pEncoders[v].pName, size, lenOut);
+                        success = false;
+                    }
+                }
+                if (pDecoders[v].supported)
+                {
+                    memset (expected, 0, sizeof (expected));
+                    memset (actual, 0, sizeof (actual));
+                    lenExpected = pDecoders[0].pFunction (hex, size * 2, expected, lenOut / 2);
+                    lenActual = pDecoders[v].pFunction (hex, size * 2, actual, lenOut / 2);
+                    if ((lenActual != lenExpected) || (memcmp (actual, expected, sizeof (actual)) != 0))
+                    {
+                        printf ("!!! %s decode differs for %d characters into %d.\n", pDecoders[v].pName, size * 2, lenOut / 2);
+                        success = false;
+                    }
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+int main (int argc, char * argv[])
+{
+    bool success = true;
+    uint32_t size = DEFAULT_BENCH_BYTES;
+    uint32_t iterations = DEFAULT_BENCH_ITERATIONS;
+    uint32_t lenHex;
+    uint32_t lenSeparated = 0;
+    char * pBytes;
+    char * pHex;
+    char * pSeparated;
+    char * pOut;
+    Variant encoders[] = {{"scalar", bytesToHexStringScalar, true},
+                          {"sse2", bytesToHexStringSse2, hexCodecSse2Supported()},
+                          {"avx2", bytesToHexStringAvx2, hexCodecAvx2Supported()}};
+    Variant decoders[] = {{"scalar", hexStringToBytesScalar, true},
+                          {"sse2", hexStringToBytesSse2, hexCodecSse2Supported()},
+                          {"avx2", hexStringToBytesAvx2, hexCodecAvx2Supported()}};
+    uint32_t numVariants = sizeof (encoders) / sizeof (encoders[0]);
+
+    if (argc > 1)
+    {
+        size = strtoul (argv[1], NULL, 0);
+    }
+    if (argc > 2)
+    {
+        iterations = strtoul (argv[2], NULL, 0);
+    }
+    if ((size == 0) || (iterations == 0))
+    {
+        printf ("Usage: %s [bytes [iterations]]\n", argv[0]);
+        return -1;
+    }
+
+    lenHex = size * 2;
+    pBytes = (char *) malloc (size);
+    pHex = (char *) malloc (lenHex);
+    pSeparated = (char *) malloc (lenHex + lenHex / SEPARATOR_INTERVAL + 1);
+    pOut = (char *) malloc (lenHex);
+    if ((pBytes == NULL) || (pHex == NULL) || (pSeparated == NULL) || (pOut == NULL))
+    {
+        printf ("!!! Unable to allocate buffers for %d bytes.\n", size);
+        return -1;
+    }
+
+    srand (1);
+    for (uint32_t x = 0; x < size; x++)
+    {
+        pBytes[x] = (char) rand();
+    }
+    bytesToHexStringScalar (pBytes, size, pHex, lenHex);
+    for (uint32_t x = 0; x < lenHex; x++)
+    {
+        if ((x > 0) && (x % SEPARATOR_INTERVAL == 0))
+        {
+            pSeparated[lenSeparated] = ' ';
+            lenSeparated++;
+        }
+        pSeparated[lenSeparated] = pHex[x];
+        lenSeparated++;
+    }
+
+    success = checkEdges (encoders, decoders, numVariants);
+
+    printf ("%d bytes, %d iterations, throughput is of input.\n", size, iterations);
+    for (uint32_t v = 0; v < numVariants; v++)
+    {
+        success = bench ("encode", &encoders[v], pBytes, size, pOut, lenHex, pHex, lenHex, iterations) && success;
+    }
+    for (uint32_t v = 0; v < numVariants; v++)
+    {
+        success = bench ("decode", &decoders[v], pHex, lenHex, pOut, size, pBytes, size, iterations) && success;
+    }
+    for (uint32_t v = 0; v < numVariants; v++)
+    {
+        success = bench ("decode lenient", &decoders[v], pSeparated, lenSeparated, pOut, size, pBytes, size, iterations) && success;
+    }
+
+    free (pBytes);
+    free (pHex);
+    free (pSeparated);
+    free (pOut);
+
+    return success ? 0 : -1;
+}
+
+// End Of File
@@ -0,0 +1,641 @@
+// Pseudo-terminal NB-IoT modem simulator for NB-IoT example application
+//
+// Opens a pseudo-terminal pair and behaves, on the slave side, like an
+// NB-IoT module speaking the AT dialect that Nbiot uses, so that the
+// client can be run and load tested without hardware:
+//
+// AT+NAS       -> +NAS: Connected (activated) / OK  (or +NAS: Not connected / OK)
+// AT+RAS       -> +RAS:CONNECTED / OK               (or +RAS:NOT CONNECTED / OK)
+// AT+SMI=1     -> +SMI:OK / OK, then +SMI:SENT after each datagram is sent
+// AT+NMI=2     -> +NMI:OK / OK, then +NMI:<n>,<hex> for each downlink datagram
+// AT+MGS=n,hex -> +MGS:OK / OK, then (if AT+SMI=1) +SMI:SENT
+// AT+MGR       -> +MGR:<n>,<hex> / +MGR:OK           (+MGR:0, when none waiting)
+// AT+MQS       -> +MQS:BUFFERED=<n>,RECEIVED=<n>,DROPPED=<n> / OK
+//
+// The path of the slave device is printed on stdout, on a line of its own,
+// for the client to be pointed at; statistics go to stderr on exit.
+// Linux only.
+//
+// Usage: modem_sim [options], where options are:
+//   -r <ms>   delay before each response (default 0)
+//   -s <ms>   delay between +MGS:OK and +SMI:SENT (default 0)
+//   -d <n>    downlink datagrams per second (default 0, none)
+//   -l <n>    size of each downlink datagram in bytes (default 16)
+//   -u <ms>   time until the module registers with the network, before
+//             which AT+NAS/AT+RAS report not connected; +CEREG:1 is
+//             sent at the moment of registration (default 0)
+//   -e <pct>  percentage of commands answered with ERROR (default 0)
+//   -x <pct>  percentage of +SMI:SENT notifications lost (default 0)
+//   -b <n>    number of downlink datagrams buffered before more are dropped
+//             (default 64)
+//   -g <n>    number of downlink datagrams buffered at the start, as
+//             after a coverage gap (default 0)
+//   -a        keep the downlink buffer full for AT+MGR and AT+MQS, so
+//             that there is always a datagram waiting
+//   -S <n>    random number seed, for repeatable runs (default 1)
+//   -t <s>    run time in seconds (default 0, forever)
+//   -v        print every line received and sent on stderr
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include "utilities.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The longest AT line handled, which is an AT+MGS carrying the
+// largest datagram
+#define SIM_MAX_LINE_LENGTH 2048
+
+// The largest datagram, either way
+#define SIM_MAX_DATAGRAM 1024
+
+// The number of outputs that can be waiting for their time to come
+#define SIM_MAX_PENDING 1024
+
+// The longest line of output
+#define SIM_MAX_OUTPUT (SIM_MAX_DATAGRAM * 2 + 32)
+
+// The maximum number of downlink datagrams that can be buffered
+#define SIM_MAX_DOWNLINKS 1024
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// Some output waiting to be written to the client at a given time.
+typedef struct
+{
+    int64_t dueMs;
+    uint32_t sequence; // Keeps outputs due at the same time in order
+    uint32_t len;
+    char * pData;
+} Pending;
+
+// The configuration, from the command line.
+typedef struct
+{
+    uint32_t responseDelayMs;
+    uint32_t sentDelayMs;
+    double downlinksPerSecond;
+    uint32_t downlinkSize;
+    uint32_t registrationDelayMs;
+    uint32_t errorPercent;
+    uint32_t lostSentPercent;
+    uint32_t downlinkBufferLength;
+    uint32_t initialDownlinks;
+    bool alwaysDownlink;
+    uint32_t seed;
+    uint32_t runSeconds;
+    bool verbose;
+} Config;
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+static Config gConfig = {0, 0, 0, 16, 0, 0, 0, 64, 0, false, 1, 0, false};
+static int gMasterFd = -1;
+static Pending gPending[SIM_MAX_PENDING];
+static uint32_t gNumPending = 0;
+static uint32_t gSequence = 0;
+static uint32_t gRandom = 1;
+static bool gRegistered = false;
+static bool gSmiEnabled = false;
+static bool gNmiEnabled = false;
+static uint32_t gDownlinkSizes[SIM_MAX_DOWNLINKS];
+static char gDownlinks[SIM_MAX_DOWNLINKS][SIM_MAX_DATAGRAM];
+static uint32_t gDownlinkHead = 0;
+static uint32_t gDownlinkTail = 0;
+static volatile sig_atomic_t gStop = 0;
+
+// Statistics
+static uint32_t gCommands = 0;
+static uint32_t gUplinks = 0;
+static uint32_t gUplinkBytes = 0;
+static uint32_t gDownlinksDelivered = 0;
+static uint32_t gDownlinksDropped = 0;
+static uint32_t gErrorsInjected = 0;
+static uint32_t gSentLost = 0;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+static void signalHandler(int signal)
+{
+    (void) signal;
+    gStop = 1;
+}
+
+// A small repeatable random number generator (xorshift32).
+static uint32_t nextRandom(void)
+{
+    gRandom ^= gRandom << 13;
+    gRandom ^= gRandom >> 17;
+    gRandom ^= gRandom << 5;
+
+    return gRandom;
+}
+
+// Return true with the given percentage probability.
+static bool chance(uint32_t percent)
+{
+    return (nextRandom() % 100) < percent;
+}
+
+// Queue len characters at pData to be written to the client
+// delayMs from now.
+static void queueOutput(const char * pData, uint32_t len, uint32_t delayMs)
+{
+    Pending * pPending;
+
+    if (gNumPending < SIM_MAX_PENDING)
+    {
+        pPending = &gPending[gNumPending];
+        pPending->dueMs = getTimeMs() + delayMs;
+        pPending->sequence = gSequence;
+        pPending->len = len;
+        pPending->pData = (char *) malloc(len);
+        if (pPending->pData != NULL)
+        {
+            memcpy(pPending->pData, pData, len);
+            gSequence++;
+            gNumPending++;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "WARNING: simulator output queue full, \"%.*s\" lost.\n", (int) len, pData);
+    }
+}
+
+// Queue a NULL terminated line, adding the AT terminator.
+static void queueLine(const char * pLine, uint32_t delayMs)
+{
+    char buffer[SIM_MAX_OUTPUT + 2];
+    uint32_t len = strlen(pLine);
+
+    if (len > SIM_MAX_OUTPUT)
+    {
+        len = SIM_MAX_OUTPUT;
+    }
+    memcpy(buffer, pLine, len);
+    memcpy(buffer + len, "\r\n", 2);
+    queueOutput(buffer, len + 2, delayMs);
+}
+
+// Write everything whose time has come, in order, returning the
+// time until the next output is due in milliseconds, or -1 if
+// nothing is waiting.
+static int32_t writeDue(void)
+{
+    int64_t nowMs = getTimeMs();
+    int64_t nextMs = -1;
+    uint32_t next;
+    bool found = true;
+    ssize_t written;
+    uint32_t offset;
+
+    while (found)
+    {
+        // Find the earliest output, the first queued of equals
+        found = false;
+        next = 0;
+        for (uint32_t x = 0; x < gNumPending; x++)
+        {
+            if (!found || (gPending[x].dueMs < gPending[next].dueMs) ||
+                ((gPending[x].dueMs == gPending[next].dueMs) && ((int32_t) (gPending[x].sequence - gPending[next].sequence) < 0)))
+            {
+                next = x;
+                found = true;
+            }
+        }
+
+        nextMs = -1;
+        if (found)
+        {
+            if (gPending[next].dueMs <= nowMs)
+            {
+                if (gConfig.verbose)
+                {
+                    fprintf(stderr, "SIM -> %.*s", (int) gPending[next].len, gPending[next].pData);
+                }
+                offset = 0;
+                while (offset < gPending[next].len)
+                {
+                    written = write(gMasterFd, gPending[next].pData + offset, gPending[next].len - offset);
+                    if (written > 0)
+                    {
+                        offset += written;
+                    }
+                    else if ((written < 0) && (errno != EAGAIN) && (errno != EINTR))
+                    {
+                        break;
+                    }
+                }
+                free(gPending[next].pData);
+                gNumPending--;
+                gPending[next] = gPending[gNumPending];
+            }
+            else
+            {
+                nextMs = gPending[next].dueMs;
+                found = false;
+            }
+        }
+    }
+
+    return (nextMs < 0) ? -1 : (int32_t) (nextMs - nowMs);
+}
+
+// Send a downlink datagram to the client if AT+NMI=2 is set, or
+// else buffer it for AT+MGR.
+static void newDownlink(void)
+{
+    uint32_t size = gConfig.downlinkSize;
+    char line[SIM_MAX_OUTPUT];
+    uint32_t len;
+    char * pData;
+
+    if (gDownlinkHead - gDownlinkTail < gConfig.downlinkBufferLength)
+    {
+        pData = gDownlinks[gDownlinkHead % SIM_MAX_DOWNLINKS];
+        for (uint32_t x = 0; x < size; x++)
+        {
+            pData[x] = (char) nextRandom();
+        }
+        gDownlinkSizes[gDownlinkHead % SIM_MAX_DOWNLINKS] = size;
+        gDownlinkHead++;
+
+        if (gNmiEnabled)
+        {
+            len = snprintf(line, sizeof (line), "+NMI:%u,", size);
+            len += bytesToHexString(pData, size, line + len, sizeof (line) - len - 1);
+            line[len] = 0;
+            queueLine(line, 0);
+            gDownlinkTail++;
+            gDownlinksDelivered++;
+        }
+    }
+    else
+    {
+        gDownlinksDropped++;
+    }
+}
+
+// With -a, fill the downlink buffer up for AT+MGR and AT+MQS.
+static void topUpDownlinks(void)
+{
+    if (gConfig.alwaysDownlink && !gNmiEnabled)
+    {
+        while (gDownlinkHead - gDownlinkTail < gConfig.downlinkBufferLength)
+        {
+            newDownlink();
+        }
+    }
+}
+
+// Deal with a line from the client.
+static void handleLine(const char * pLine, uint32_t len)
+{
+    uint32_t delay = gConfig.responseDelayMs;
+    char response[SIM_MAX_OUTPUT];
+    char datagram[SIM_MAX_DATAGRAM];
+    uint32_t size;
+    uint32_t decoded;
+    const char * pHex;
+    char * pData;
+
+    if (gConfig.verbose)
+    {
+        fprintf(stderr, "SIM <- %.*s\n", (int) len, pLine);
+    }
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    gCommands++;
+    if (chance(gConfig.errorPercent))
+    {
+        gErrorsInjected++;
+        queueLine("ERROR", delay);
+    }
+    else if ((len == 6) && (memcmp(pLine, "AT+NAS", 6) == 0))
+    {
+        queueLine(gRegistered ? "+NAS: Connected (activated)" : "+NAS: Not connected", delay);
+        queueLine("OK", delay);
+    }
+    else if ((len == 6) && (memcmp(pLine, "AT+RAS", 6) == 0))
+    {
+        queueLine(gRegistered ? "+RAS:CONNECTED" : "+RAS:NOT CONNECTED", delay);
+        queueLine("OK", delay);
+    }
+    else if ((len == 8) && (memcmp(pLine, "AT+SMI=", 7) == 0))
+    {
+        gSmiEnabled = (pLine[7] != '0');
+        queueLine("+SMI:OK", delay);
+        queueLine("OK", delay);
+    }
+    else if ((len == 8) && (memcmp(pLine, "AT+NMI=", 7) == 0))
+    {
+        gNmiEnabled = (pLine[7] != '0');
+        queueLine("+NMI:OK", delay);
+        queueLine("OK", delay);
+    }
+    else if ((len > 7) && (memcmp(pLine, "AT+MGS=", 7) == 0))
+    {
+        size = strtoul(pLine + 7, NULL, 10);
+        pHex = (const char *) memchr(pLine, ',', len);
+        if ((pHex != NULL) && (size <= SIM_MAX_DATAGRAM))
+        {
+            pHex++;
+            decoded = hexStringToBytes(pHex, len - (pHex - pLine), datagram, sizeof (datagram));
+            if (decoded == size)
+            {
+                gUplinks++;
+                gUplinkBytes += size;
+                queueLine("+MGS:OK", delay);
+                queueLine("OK", delay);
+                if (gSmiEnabled)
+                {
+                    if (chance(gConfig.lostSentPercent))
+                    {
+                        gSentLost++;
+                    }
+                    else
+                    {
+                        queueLine("+SMI:SENT", delay + gConfig.sentDelayMs);
+                    }
+                }
+            }
+            else
+            {
+                queueLine("ERROR", delay);
+            }
+        }
+        else
+        {
+            queueLine("ERROR", delay);
+        }
+    }
+    else if ((len == 6) && (memcmp(pLine, "AT+MGR", 6) == 0))
+    {
+        topUpDownlinks();
+        if (gDownlinkHead != gDownlinkTail)
+        {
+            pData = gDownlinks[gDownlinkTail % SIM_MAX_DOWNLINKS];
+            size = gDownlinkSizes[gDownlinkTail % SIM_MAX_DOWNLINKS];
+            gDownlinkTail++;
+            gDownlinksDelivered++;
+            decoded = snprintf(response, sizeof (response), "+MGR:%u,", size);
+            decoded += bytesToHexString(pData, size, response + decoded, sizeof (response) - decoded - 1);
+            response[decoded] = 0;
+            queueLine(response, delay);
+        }
+        else
+        {
+            queueLine("+MGR:0,", delay);
+        }
+        queueLine("+MGR:OK", delay);
+    }
+    else if ((len == 6) && (memcmp(pLine, "AT+MQS", 6) == 0))
+    {
+        topUpDownlinks();
+        snprintf(response, sizeof (response), "+MQS:BUFFERED=%u,RECEIVED=%u,DROPPED=%u",
+                 gDownlinkHead - gDownlinkTail, gDownlinkHead, gDownlinksDropped);
+        queueLine(response, delay);
+        queueLine("OK", delay);
+    }
+    else if ((len == 2) && (memcmp(pLine, "AT", 2) == 0))
+    {
+        queueLine("OK", delay);
+    }
+    else
+    {
+        queueLine("ERROR", delay);
+    }
+}
+
+// Read the command line into gConfig, returning false if it is bad.
+static bool parseArgs(int argc, char * argv[])
+{
+    bool success = true;
+    int c;
+
+    while (success && ((c = getopt(argc, argv, "r:s:d:l:u:e:x:b:g:aS:t:v")) != -1))
+    {
+        switch (c)
+        {
+            case 'r':
+                gConfig.responseDelayMs = strtoul(optarg, NULL, 0);
+            break;
+            case 's':
+                gConfig.sentDelayMs = strtoul(optarg, NULL, 0);
+            break;
+            case 'd':
+                gConfig.downlinksPerSecond = strtod(optarg, NULL);
+            break;
+            case 'l':
+                gConfig.downlinkSize = strtoul(optarg, NULL, 0);
+            break;
+            case 'u':
+                gConfig.registrationDelayMs = strtoul(optarg, NULL, 0);
+            break;
+            case 'e':
+                gConfig.errorPercent = strtoul(optarg, NULL, 0);
+            break;
+            case 'x':
+                gConfig.lostSentPercent = strtoul(optarg, NULL, 0);
+            break;
+            case 'b':
+                gConfig.downlinkBufferLength = strtoul(optarg, NULL, 0);
+            break;
+            case 'g':
+                gConfig.initialDownlinks = strtoul(optarg, NULL, 0);
+            break;
+            case 'a':
+                gConfig.alwaysDownlink = true;
+            break;
+            case 'S':
+                gConfig.seed = strtoul(optarg, NULL, 0);
+            break;
+            case 't':
+                gConfig.runSeconds = strtoul(optarg, NULL, 0);
+            break;
+            case 'v':
+                gConfig.verbose = true;
+            break;
+            default:
+                success = false;
+            break;
+        }
+    }
+
+    if ((gConfig.downlinkSize == 0) || (gConfig.downlinkSize > SIM_MAX_DATAGRAM) ||
+        (gConfig.downlinkBufferLength > SIM_MAX_DOWNLINKS) ||
+        (gConfig.initialDownlinks > gConfig.downlinkBufferLength))
+    {
+        success = false;
+    }
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+    int slaveFd;
+    struct termios settings;
+    struct pollfd pollFd;
+    char line[SIM_MAX_LINE_LENGTH];
+    uint32_t lineLen = 0;
+    bool overflow = false;
+    char buffer[512];
+    ssize_t len;
+    int64_t startMs;
+    int64_t nextDownlinkMs = 0;
+    int64_t downlinkIntervalMs = 0;
+    int32_t waitMs;
+    int32_t dueMs;
+
+    if (!parseArgs(argc, argv))
+    {
+        fprintf(stderr, "Usage: %s [-r response_ms] [-s sent_ms] [-d downlinks_per_second] [-l downlink_bytes]\n"
+                        "          [-u registration_ms] [-e error_percent] [-x lost_sent_percent]\n"
+                        "          [-b downlink_buffer] [-g initial_downlinks] [-a] [-S seed] [-t seconds] [-v]\n", argv[0]);
+        return -1;
+    }
+
+    gRandom = (gConfig.seed != 0) ? gConfig.seed : 1;
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Open the pseudo-terminal pair; the slave is kept open here so
+    // that the master does not see a hang-up between clients
+    gMasterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((gMasterFd < 0) || (grantpt(gMasterFd) != 0) || (unlockpt(gMasterFd) != 0))
+    {
+        fprintf(stderr, "!!! Unable to open a pseudo-terminal (%s).\n", strerror(errno));
+        return -1;
+    }
+    slaveFd = open(ptsname(gMasterFd), O_RDWR | O_NOCTTY);
+    if ((slaveFd < 0) || (tcgetattr(slaveFd, &settings) != 0))
+    {
+        fprintf(stderr, "!!! Unable to open %s (%s).\n", ptsname(gMasterFd), strerror(errno));
+        return -1;
+    }
+    cfmakeraw(&settings);
+    tcsetattr(slaveFd, TCSANOW, &settings);
+    fcntl(gMasterFd, F_SETFL, fcntl(gMasterFd, F_GETFL) | O_NONBLOCK);
+
+    printf("%s\n", ptsname(gMasterFd));
+    fflush(stdout);
+
+    startMs = getTimeMs();
+    if (gConfig.downlinksPerSecond > 0)
+    {
+        downlinkIntervalMs = (int64_t) (1000 / gConfig.downlinksPerSecond);
+        if (downlinkIntervalMs < 1)
+        {
+            downlinkIntervalMs = 1;
+        }
+        nextDownlinkMs = startMs + downlinkIntervalMs;
+    }
+    gRegistered = (gConfig.registrationDelayMs == 0);
+    for (uint32_t x = 0; x < gConfig.initialDownlinks; x++)
+    {
+        newDownlink();
+    }
+
+    while (!gStop && ((gConfig.runSeconds == 0) || (getTimeMs() - startMs < (int64_t) gConfig.runSeconds * 1000)))
+    {
+        // Things that happen at a given time
+        if (!gRegistered && (getTimeMs() - startMs >= gConfig.registrationDelayMs))
+        {
+            gRegistered = true;
+            queueLine("+CEREG:1", 0);
+        }
+        while ((downlinkIntervalMs > 0) && (getTimeMs() >= nextDownlinkMs))
+        {
+            newDownlink();
+            nextDownlinkMs += downlinkIntervalMs;
+        }
+
+        // Sleep until the client sends something or something is due
+        waitMs = 100;
+        dueMs = writeDue();
+        if ((dueMs >= 0) && (dueMs < waitMs))
+        {
+            waitMs = dueMs;
+        }
+        if ((downlinkIntervalMs > 0) && (nextDownlinkMs - getTimeMs() < waitMs))
+        {
+            waitMs = (int32_t) (nextDownlinkMs - getTimeMs());
+        }
+        if (!gRegistered && (startMs + gConfig.registrationDelayMs - getTimeMs() < waitMs))
+        {
+            waitMs = (int32_t) (startMs + gConfig.registrationDelayMs - getTimeMs());
+        }
+        if (waitMs < 0)
+        {
+            waitMs = 0;
+        }
+
+        pollFd.fd = gMasterFd;
+        pollFd.events = POLLIN;
+        pollFd.revents = 0;
+        if ((poll(&pollFd, 1, waitMs) > 0) && ((pollFd.revents & POLLIN) != 0))
+        {
+            len = read(gMasterFd, buffer, sizeof (buffer));
+            for (ssize_t x = 0; x < len; x++)
+            {
+                if ((buffer[x] == '\r') || (buffer[x] == '\n'))
+                {
+                    if (!overflow && ((lineLen > 0) || (buffer[x] == '\r')))
+                    {
+                        handleLine(line, lineLen);
+                    }
+                    lineLen = 0;
+                    overflow = false;
+                }
+                else if (lineLen < sizeof (line))
+                {
+                    line[lineLen] = buffer[x];
+                    lineLen++;
+                }
+                else if (!overflow)
+                {
+                    overflow = true;
+                    queueLine("ERROR", gConfig.responseDelayMs);
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "modem_sim: %u command(s), %u uplink datagram(s) (%u byte(s)), %u downlink datagram(s) "
+                    "delivered, %u dropped, %u error(s) injected, %u +SMI:SENT lost.\n",
+            gCommands, gUplinks, gUplinkBytes, gDownlinksDelivered, gDownlinksDropped, gErrorsInjected, gSentLost);
+
+    close(slaveFd);
+    close(gMasterFd);
+
+    return 0;
+}
+
+// End Of File
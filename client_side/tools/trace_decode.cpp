@@ -0,0 +1,182 @@
+// Trace file decoder for NB-IoT example application
+//
+// Reads a trace file written by traceDump() (see trace.h; client_side
+// writes TRACE_FILE_NAME on exit when built with TRACE_ENABLED) and prints
+// the events of all threads merged in time order, one per line:
+//
+// <ms since first event> T<thread> <event> [len <n>] <text or values>
+//
+// Text is printed with anything unprintable escaped and "..." where
+// the event carried more than was kept.  The file must have been written
+// on a machine of the same byte order.
+//
+// Usage: trace_decode <file>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "metrics.h"
+#include "trace.h"
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// An event and the thread that recorded it.
+typedef struct
+{
+    uint32_t thread;
+    TraceEvent event;
+} ThreadEvent;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Order events by time, then by thread and sequence.
+static bool earlier(const ThreadEvent & a, const ThreadEvent & b)
+{
+    if (a.event.timeUs != b.event.timeUs)
+    {
+        return a.event.timeUs < b.event.timeUs;
+    }
+    if (a.thread != b.thread)
+    {
+        return a.thread < b.thread;
+    }
+    return a.event.sequence < b.event.sequence;
+}
+
+// Print the data carried by a text event.
+static void printText(const TraceEvent * pEvent)
+{
+    uint32_t len = (pEvent->len > TRACE_PAYLOAD_SIZE) ? TRACE_PAYLOAD_SIZE : pEvent->len;
+    unsigned char c;
+
+    printf(" len %3u \"", pEvent->len);
+    for (uint32_t x = 0; x < len; x++)
+    {
+        c = (unsigned char) pEvent->payload[x];
+        if (c == '\r')
+        {
+            printf("\\r");
+        }
+        else if (c == '\n')
+        {
+            printf("\\n");
+        }
+        else if ((c == '"') || (c == '\\'))
+        {
+            printf("\\%c", c);
+        }
+        else if ((c >= 0x20) && (c < 0x7f))
+        {
+            printf("%c", c);
+        }
+        else
+        {
+            printf("\\x%02x", c);
+        }
+    }
+    printf("\"%s", (pEvent->len > TRACE_PAYLOAD_SIZE) ? "..." : "");
+}
+
+// Print the values carried by an event.
+static void printValues(const TraceEvent * pEvent)
+{
+    uint32_t values[TRACE_PAYLOAD_SIZE / sizeof (uint32_t)];
+    uint32_t numValues = ((pEvent->len > TRACE_PAYLOAD_SIZE) ? TRACE_PAYLOAD_SIZE : pEvent->len) / sizeof (uint32_t);
+    static const char * const outcomes[] = {"ok", "error", "timeout"};
+
+    memcpy(values, pEvent->payload, numValues * sizeof (uint32_t));
+    if ((pEvent->id == TRACE_EVENT_COMMAND_END) && (numValues == 3) &&
+        (values[0] < METRICS_NUM_COMMANDS) && (values[1] < sizeof (outcomes) / sizeof (outcomes[0])))
+    {
+        printf(" %s %s %u us", Metrics::getCommandName((MetricsCommand) values[0]), outcomes[values[1]], values[2]);
+    }
+    else
+    {
+        for (uint32_t x = 0; x < numValues; x++)
+        {
+            printf(" %u", values[x]);
+        }
+    }
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+    FILE * pFile;
+    TraceFileHeader fileHeader;
+    TraceThreadHeader threadHeader;
+    std::vector<ThreadEvent> events;
+    ThreadEvent threadEvent;
+    bool success = true;
+
+    if (argc != 2)
+    {
+        printf("Usage: %s <file>\n", argv[0]);
+        return -1;
+    }
+
+    pFile = fopen(argv[1], "rb");
+    if (pFile == NULL)
+    {
+        printf("!!! Unable to open %s.\n", argv[1]);
+        return -1;
+    }
+
+    if ((fread(&fileHeader, sizeof (fileHeader), 1, pFile) != 1) ||
+        (memcmp(fileHeader.magic, TRACE_FILE_MAGIC, sizeof (fileHeader.magic)) != 0) ||
+        (fileHeader.eventSize != sizeof (TraceEvent)))
+    {
+        printf("!!! %s is not a trace file from this build.\n", argv[1]);
+        fclose(pFile);
+        return -1;
+    }
+
+    for (uint32_t t = 0; (t < fileHeader.numThreads) && success; t++)
+    {
+        success = (fread(&threadHeader, sizeof (threadHeader), 1, pFile) == 1);
+        for (uint32_t x = 0; (x < threadHeader.numEvents) && success; x++)
+        {
+            threadEvent.thread = threadHeader.thread;
+            success = (fread(&threadEvent.event, sizeof (threadEvent.event), 1, pFile) == 1);
+            if (success)
+            {
+                events.push_back(threadEvent);
+            }
+        }
+    }
+    fclose(pFile);
+    if (!success)
+    {
+        printf("WARNING: %s is truncated, decoding what there is.\n", argv[1]);
+    }
+
+    std::stable_sort(events.begin(), events.end(), earlier);
+    for (uint32_t x = 0; x < events.size(); x++)
+    {
+        printf("%12.3f T%u %-13s", (double) (events[x].event.timeUs - events[0].event.timeUs) / 1000,
+               events[x].thread, traceEventName(events[x].event.id));
+        if (traceEventIsText(events[x].event.id))
+        {
+            printText(&events[x].event);
+        }
+        else
+        {
+            printValues(&events[x].event);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
+
+// End Of File
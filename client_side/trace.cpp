@@ -0,0 +1,206 @@
+// Binary trace for the NB-IoT example application
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "utilities.h"
+#include "trace.h"
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// An event in a ring.  sequence is zero while the event is being
+// written and the event's sequence number once it has been, so that
+// traceDump() can tell a whole event from one being overwritten.
+typedef struct
+{
+    std::atomic<uint32_t> sequence;
+    int64_t timeUs;
+    uint16_t id;
+    uint16_t len;
+    char payload[TRACE_PAYLOAD_SIZE];
+} TraceSlot;
+
+// The events of one thread, written only by that thread.
+typedef struct
+{
+    std::atomic<uint32_t> head; // The number of events recorded
+    TraceSlot slots[TRACE_RING_EVENTS];
+} TraceRing;
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+// The rings, in the order their threads first recorded; rings are
+// never freed, so that the events of threads that have exited can
+// still be dumped.
+static std::atomic<TraceRing *> gpRings[TRACE_MAX_THREADS];
+
+// The number of rings claimed, which may be more than TRACE_MAX_THREADS.
+static std::atomic<uint32_t> gNumRings(0);
+
+// The calling thread's ring, and whether it has tried to get one.
+static thread_local TraceRing * gpThreadRing = NULL;
+static thread_local bool gThreadRingClaimed = false;
+
+// The names of the events, in TraceEventId order.
+static const char * const gEventNames[TRACE_NUM_EVENTS] = {"NONE", "TX", "RX_RESPONSE", "RX_URC", "DOWNLINK",
+                                                          "COMMAND_END", "SUBMIT", "SENT", "SEND_FAILED",
+                                                          "CONNECT_STATE"};
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Return the calling thread's ring, creating it if need be, or NULL
+// if there are no rings left.
+static TraceRing * getThreadRing(void)
+{
+    uint32_t ring;
+
+    if (!gThreadRingClaimed)
+    {
+        gThreadRingClaimed = true;
+        ring = gNumRings.fetch_add(1);
+        if (ring < TRACE_MAX_THREADS)
+        {
+            gpThreadRing = new TraceRing;
+            gpThreadRing->head.store(0, std::memory_order_relaxed);
+            for (uint32_t x = 0; x < TRACE_RING_EVENTS; x++)
+            {
+                gpThreadRing->slots[x].sequence.store(0, std::memory_order_relaxed);
+            }
+            gpRings[ring].store(gpThreadRing, std::memory_order_release);
+        }
+    }
+
+    return gpThreadRing;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Record an event
+void traceRecord(TraceEventId id, const char * pData, uint32_t len)
+{
+    TraceRing * pRing = getThreadRing();
+    TraceSlot * pSlot;
+    uint32_t head;
+
+    if (pRing != NULL)
+    {
+        head = pRing->head.load(std::memory_order_relaxed);
+        pSlot = &pRing->slots[head & (TRACE_RING_EVENTS - 1)];
+
+        pSlot->sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        pSlot->timeUs = getTimeUs();
+        pSlot->id = (uint16_t) id;
+        pSlot->len = (len > 0xFFFF) ? 0xFFFF : (uint16_t) len;
+        if (len > TRACE_PAYLOAD_SIZE)
+        {
+            len = TRACE_PAYLOAD_SIZE;
+        }
+        memcpy(pSlot->payload, pData, len);
+        pSlot->sequence.store(head + 1, std::memory_order_release);
+
+        pRing->head.store(head + 1, std::memory_order_release);
+    }
+}
+
+// Record an event carrying a value
+void traceRecordValue(TraceEventId id, uint32_t value)
+{
+    traceRecord(id, (const char *) &value, sizeof (value));
+}
+
+// Write the rings to a file
+bool traceDump(const char * pFileName)
+{
+    bool success = false;
+    FILE * pFile = fopen(pFileName, "wb");
+    TraceFileHeader fileHeader;
+    TraceThreadHeader threadHeader;
+    TraceEvent * pEvents;
+    TraceRing * pRing;
+    TraceSlot * pSlot;
+    uint32_t numRings = gNumRings.load(std::memory_order_acquire);
+    uint32_t head;
+    uint32_t sequence;
+
+    if (numRings > TRACE_MAX_THREADS)
+    {
+        numRings = TRACE_MAX_THREADS;
+    }
+
+    if (pFile != NULL)
+    {
+        pEvents = new TraceEvent[TRACE_RING_EVENTS];
+        memcpy(fileHeader.magic, TRACE_FILE_MAGIC, sizeof (fileHeader.magic));
+        fileHeader.eventSize = sizeof (TraceEvent);
+        fileHeader.numThreads = numRings;
+        success = (fwrite(&fileHeader, sizeof (fileHeader), 1, pFile) == 1);
+
+        for (uint32_t r = 0; (r < numRings) && success; r++)
+        {
+            threadHeader.thread = r;
+            threadHeader.numEvents = 0;
+            pRing = gpRings[r].load(std::memory_order_acquire);
+            if (pRing != NULL)
+            {
+                head = pRing->head.load(std::memory_order_acquire);
+                for (uint32_t x = (head > TRACE_RING_EVENTS) ? head - TRACE_RING_EVENTS : 0; x < head; x++)
+                {
+                    pSlot = &pRing->slots[x & (TRACE_RING_EVENTS - 1)];
+                    sequence = pSlot->sequence.load(std::memory_order_acquire);
+                    if (sequence == x + 1)
+                    {
+                        pEvents[threadHeader.numEvents].timeUs = pSlot->timeUs;
+                        pEvents[threadHeader.numEvents].sequence = sequence;
+                        pEvents[threadHeader.numEvents].id = pSlot->id;
+                        pEvents[threadHeader.numEvents].len = pSlot->len;
+                        memcpy(pEvents[threadHeader.numEvents].payload, pSlot->payload, TRACE_PAYLOAD_SIZE);
+                        std::atomic_thread_fence(std::memory_order_acquire);
+                        // Keep it only if it wasn't overwritten while being copied
+                        if (pSlot->sequence.load(std::memory_order_relaxed) == sequence)
+                        {
+                            threadHeader.numEvents++;
+                        }
+                    }
+                }
+            }
+            success = (fwrite(&threadHeader, sizeof (threadHeader), 1, pFile) == 1) &&
+                      (fwrite(pEvents, sizeof (TraceEvent), threadHeader.numEvents, pFile) == threadHeader.numEvents);
+        }
+
+        delete[] pEvents;
+        success = (fclose(pFile) == 0) && success;
+    }
+
+    return success;
+}
+
+// Return the name of an event
+const char * traceEventName(uint32_t id)
+{
+    const char * pName = "UNKNOWN";
+
+    if (id < TRACE_NUM_EVENTS)
+    {
+        pName = gEventNames[id];
+    }
+
+    return pName;
+}
+
+// Return true if an event carries text
+bool traceEventIsText(uint32_t id)
+{
+    return (id == TRACE_EVENT_TX) || (id == TRACE_EVENT_RX_RESPONSE) ||
+           (id == TRACE_EVENT_RX_URC) || (id == TRACE_EVENT_DOWNLINK);
+}
+
+// End Of File
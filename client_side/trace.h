@@ -0,0 +1,120 @@
+// Binary trace for the NB-IoT example application
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <atomic>
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// Set to 1, e.g. with -DTRACE_ENABLED=1, to compile in the TRACE()
+// events; otherwise they compile out entirely
+#ifndef TRACE_ENABLED
+# define TRACE_ENABLED 0
+#endif
+
+// The number of events each thread's ring holds before the oldest
+// is overwritten; must be a power of two
+#ifndef TRACE_RING_EVENTS
+# define TRACE_RING_EVENTS 4096
+#endif
+
+// The maximum number of threads that can record events
+#define TRACE_MAX_THREADS 16
+
+// The number of bytes of data kept with each event
+#define TRACE_PAYLOAD_SIZE 16
+
+// The first bytes of a trace file
+#define TRACE_FILE_MAGIC "NBTRACE1"
+
+// The file main() writes the trace to on exit
+#define TRACE_FILE_NAME "client_side.trace"
+
+// Record an event carrying up to TRACE_PAYLOAD_SIZE bytes of the len
+// bytes at pData, or one carrying a uint32_t value
+#if TRACE_ENABLED
+# define TRACE(id, pData, len) traceRecord(id, pData, len)
+# define TRACE_VALUE(id, value) traceRecordValue(id, value)
+#else
+# define TRACE(id, pData, len)
+# define TRACE_VALUE(id, value)
+#endif
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// The events that are traced.  Those marked text carry the start of
+// what was written or read; the rest carry uint32_t values.
+typedef enum
+{
+    TRACE_EVENT_NONE,
+    TRACE_EVENT_TX,               // Text: written to the modem
+    TRACE_EVENT_RX_RESPONSE,      // Text: a response read from the modem
+    TRACE_EVENT_RX_URC,           // Text: an unsolicited line read from the modem
+    TRACE_EVENT_DOWNLINK,         // Text: a datagram received in a +NMI
+    TRACE_EVENT_COMMAND_END,      // An AT command finished: MetricsCommand, MetricsOutcome, latency in us
+    TRACE_EVENT_SUBMIT,           // A datagram handed to the modem: ticket
+    TRACE_EVENT_SENT,             // A datagram reported sent: ticket
+    TRACE_EVENT_SEND_FAILED,      // A datagram failed: ticket
+    TRACE_EVENT_CONNECT_STATE,    // The connect state machine moved: Nbiot::ConnectState
+    TRACE_NUM_EVENTS
+} TraceEventId;
+
+// An event as written to a trace file, in the byte order of the
+// machine that wrote it.
+typedef struct
+{
+    int64_t timeUs;       // From getTimeUs()
+    uint32_t sequence;    // Count of events recorded by the thread, from 1
+    uint16_t id;          // TraceEventId
+    uint16_t len;         // Length of the data, of which payload holds the start
+    char payload[TRACE_PAYLOAD_SIZE];
+} TraceEvent;
+
+// A trace file is a TraceFileHeader followed by, for each thread, a
+// TraceThreadHeader and then that thread's events, oldest first.
+typedef struct
+{
+    char magic[8];        // TRACE_FILE_MAGIC, without a terminator
+    uint32_t eventSize;   // sizeof (TraceEvent)
+    uint32_t numThreads;
+} TraceFileHeader;
+
+typedef struct
+{
+    uint32_t thread;      // The order in which threads first recorded
+    uint32_t numEvents;
+} TraceThreadHeader;
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+// Record an event in the calling thread's ring, which is created on
+// the thread's first event.  Recording takes no locks and makes no
+// system calls; if there are already TRACE_MAX_THREADS rings the
+// event is lost.
+void traceRecord (TraceEventId id, const char * pData, uint32_t len);
+
+// Record an event carrying a single value.
+void traceRecordValue (TraceEventId id, uint32_t value);
+
+// Write everything in every thread's ring to the file pFileName, for
+// decoding with the trace_decode tool.  Threads may go on recording
+// while this is done; an event overwritten as it is copied is left
+// out.  Returns false if the file could not be written.
+bool traceDump (const char * pFileName);
+
+// Return the name of an event, e.g. "TX".
+const char * traceEventName (uint32_t id);
+
+// Return true if an event carries text rather than values.
+bool traceEventIsText (uint32_t id);
+
+#endif
+
+// End Of File
@@ -0,0 +1,78 @@
+// Transport interface for NB-IoT example application
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The maximum number of segments that can be passed to transmitVector()
+#define TRANSPORT_MAX_SEGMENTS 8
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// A segment of data to be transmitted with transmitVector().
+typedef struct
+{
+    const char * pBuf;
+    uint32_t len;
+} TxSegment;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// The byte stream between Nbiot and the AT interface of a module,
+// whatever carries it: a serial port (SerialPort), a TCP connection
+// to a terminal server (TcpTransport) or memory (LoopbackTransport).
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    // Transmit the numSegments segments at pSegments, in order, as a
+    // single gathered write where the transport allows.  numSegments may
+    // be at most TRANSPORT_MAX_SEGMENTS.  Blocks until everything has been
+    // accepted.  Returns TRUE on success, otherwise FALSE.
+    virtual bool transmitVector(const TxSegment * pSegments, uint32_t numSegments) = 0;
+
+    // Transmit lenBuf characters from pBuf.
+    // Returns TRUE on success, otherwise FALSE.
+    virtual bool transmitBuffer(const char * pBuf, uint32_t lenBuf)
+    {
+        TxSegment segment = {pBuf, lenBuf};
+
+        return transmitVector(&segment, 1);
+    }
+
+    // Receive up to lenBuf of the characters that have already arrived
+    // into pBuf, without blocking.
+    // Returns the number of characters received.
+    virtual uint32_t receiveBuffer(char * pBuf, uint32_t lenBuf) = 0;
+
+    // Block for up to timeoutMs milliseconds waiting for received
+    // characters to become available, without consuming them.
+    // Returns TRUE if characters are waiting, otherwise FALSE.
+    virtual bool waitReadable(uint32_t timeoutMs) = 0;
+
+    // Return TRUE while the far end can be reached, FALSE once it has
+    // gone (e.g. a USB modem unplugged or a connection closed), after
+    // which nothing more will be received.  A transport that cannot be
+    // lost need not override this.
+    virtual bool isConnected()
+    {
+        return true;
+    }
+
+#ifndef _WIN32
+    // Return a file descriptor that is readable when characters have
+    // arrived, for adding to an event loop, or -1 if there is none.
+    virtual int getFd() = 0;
+#endif
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,155 @@
+// Uplink record aggregation for NB-IoT example application
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "utilities.h"
+#include "logging.h"
+#include "uplink_aggregator.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The space taken in a datagram by a record's length
+#define AGGREGATE_LENGTH_SIZE 1
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor.
+UplinkAggregator::UplinkAggregator (AggregateSendHandler pHandler, void * pContext,
+                                    uint32_t maxDatagramSize, uint32_t maxDelayMs)
+{
+    gpHandler = pHandler;
+    gpContext = pContext;
+    gMaxDatagramSize = maxDatagramSize;
+    gpDatagram = new char[maxDatagramSize];
+    gSize = 0;
+    gNumRecords = 0;
+    gMaxDelayMs = maxDelayMs;
+    gDueMs = 0;
+}
+
+// Destructor.
+UplinkAggregator::~UplinkAggregator ()
+{
+    delete[] gpDatagram;
+}
+
+// Add a record.
+bool UplinkAggregator::add (const char * pRecord, uint32_t size)
+{
+    bool success = false;
+
+    if (size <= getMaxRecordSize())
+    {
+        success = true;
+        if (gSize + AGGREGATE_LENGTH_SIZE + size > gMaxDatagramSize)
+        {
+            success = flush();
+        }
+
+        if (gNumRecords == 0)
+        {
+            gSize = 0;
+            gDueMs = getTimeMs() + gMaxDelayMs;
+        }
+        gpDatagram[gSize] = (char) size;
+        memcpy (gpDatagram + gSize + AGGREGATE_LENGTH_SIZE, pRecord, size);
+        gSize += AGGREGATE_LENGTH_SIZE + size;
+        gNumRecords++;
+
+        // Don't wait if there is no room for another record
+        if (gSize + AGGREGATE_LENGTH_SIZE + 1 > gMaxDatagramSize)
+        {
+            success = flush() && success;
+        }
+        else
+        {
+            success = poll() && success;
+        }
+    }
+    else
+    {
+        LOG_ERROR ("!!! Record is too long to aggregate (%d bytes when only %d fit).\r\n", size, getMaxRecordSize());
+    }
+
+    return success;
+}
+
+// Send the datagram being built if it is due.
+bool UplinkAggregator::poll ()
+{
+    bool success = true;
+
+    if ((gNumRecords > 0) && (gMaxDelayMs > 0) && (getTimeMs() >= gDueMs))
+    {
+        success = flush();
+    }
+
+    return success;
+}
+
+// Send the datagram being built.
+bool UplinkAggregator::flush ()
+{
+    bool success = true;
+
+    if (gNumRecords > 0)
+    {
+        success = gpHandler (gpContext, gpDatagram, gSize);
+        if (!success)
+        {
+            LOG_ERROR ("!!! Unable to send aggregate datagram, %d record(s) lost.\r\n", gNumRecords);
+        }
+        gSize = 0;
+        gNumRecords = 0;
+    }
+
+    return success;
+}
+
+// Return the time until the datagram being built is due.
+int64_t UplinkAggregator::getWaitMs ()
+{
+    int64_t waitMs = -1;
+
+    if ((gNumRecords > 0) && (gMaxDelayMs > 0))
+    {
+        waitMs = gDueMs - getTimeMs();
+        if (waitMs < 0)
+        {
+            waitMs = 0;
+        }
+    }
+
+    return waitMs;
+}
+
+// Return the number of records waiting.
+uint32_t UplinkAggregator::getRecordCount ()
+{
+    return gNumRecords;
+}
+
+// Return the longest record that fits.
+uint32_t UplinkAggregator::getMaxRecordSize ()
+{
+    uint32_t size = 0;
+
+    if (gMaxDatagramSize > AGGREGATE_LENGTH_SIZE)
+    {
+        size = gMaxDatagramSize - AGGREGATE_LENGTH_SIZE;
+    }
+    if (size > AGGREGATE_MAX_RECORD_SIZE)
+    {
+        size = AGGREGATE_MAX_RECORD_SIZE;
+    }
+
+    return size;
+}
+
+// End Of File
@@ -0,0 +1,107 @@
+// Uplink record aggregation for NB-IoT example application
+
+#ifndef _UPLINK_AGGREGATOR_H_
+#define _UPLINK_AGGREGATOR_H_
+
+// An aggregate is one or more records, each a length byte and then that
+// many bytes of record.  Nothing in it marks it as an aggregate: the send
+// handler is to encode it with payloadEncode() and aggregate true, which
+// gives it one of the aggregate headers of payload_codec.h (and
+// compresses it if asked), and the server side (server_side/Program.cs)
+// decodes it and, going by that header, splits it.
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The longest record, limited by its length byte
+#define AGGREGATE_MAX_RECORD_SIZE 255
+
+// The default longest time a record waits for others to join it
+#ifndef AGGREGATE_DEFAULT_MAX_DELAY_MS
+# define AGGREGATE_DEFAULT_MAX_DELAY_MS 5000
+#endif
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// Called with each aggregate to be encoded and sent, size bytes at
+// pDatagram, which is only valid for the duration of the call.  Returns
+// true if it was sent (or queued to be sent).
+typedef bool (*AggregateSendHandler) (void * pContext, const char * pDatagram, uint32_t size);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// Packs small application records into as few datagrams as possible,
+// since each datagram, however small, costs a whole AT+MGS to +SMI:SENT
+// exchange and its time on the air.  Records are added to a datagram
+// being built and it is handed to the send handler when the next record
+// would not fit, when the oldest record in it has waited maxDelayMs, or
+// on flush().  Nothing runs on its own: the delay is only acted on when
+// add(), poll() or flush() is called, and getWaitMs() says when poll()
+// should next be called.  Not thread safe.
+class UplinkAggregator
+{
+public:
+    // Constructor: aggregates go to pHandler, with pContext, and are to be
+    // at most maxDatagramSize bytes before they are encoded (e.g.
+    // Nbiot::getMaxDatagramSize() less the payload header); a record is
+    // to wait at most maxDelayMs to be sent (zero meaning until the
+    // datagram is full or flushed).
+    UplinkAggregator (AggregateSendHandler pHandler, void * pContext, uint32_t maxDatagramSize,
+                      uint32_t maxDelayMs = AGGREGATE_DEFAULT_MAX_DELAY_MS);
+
+    // Destructor: anything not yet sent is discarded, so flush() first.
+    ~UplinkAggregator ();
+
+    // Add the record at pRecord, size bytes long, sending the datagram
+    // being built first if the record will not fit in it, and afterwards
+    // if it is full or due.  Returns false if the record is longer than
+    // getMaxRecordSize(), when it is not added, or if a datagram could
+    // not be sent, when the records in that datagram are lost.
+    bool add (const char * pRecord, uint32_t size);
+
+    // Send the datagram being built now if it is due.  Returns false if
+    // it could not be sent.
+    bool poll ();
+
+    // Send the datagram being built now, if it holds any records.
+    // Returns false if it could not be sent.
+    bool flush ();
+
+    // Return the number of milliseconds until the datagram being built is
+    // due to be sent, or -1 if it is never due (it is empty, or there is
+    // no delay limit).
+    int64_t getWaitMs ();
+
+    // Return the number of records in the datagram being built.
+    uint32_t getRecordCount ();
+
+    // Return the longest record that fits in a datagram.
+    uint32_t getMaxRecordSize ();
+
+protected:
+    // Where datagrams go.
+    AggregateSendHandler gpHandler;
+    void * gpContext;
+
+    // The datagram being built, gSize bytes of gMaxDatagramSize.
+    char * gpDatagram;
+    uint32_t gSize;
+    uint32_t gMaxDatagramSize;
+
+    // The number of records in the datagram being built.
+    uint32_t gNumRecords;
+
+    // The longest a record waits, and when the datagram being built is
+    // due to be sent.
+    uint32_t gMaxDelayMs;
+    int64_t gDueMs;
+};
+
+#endif
+
+// End Of File
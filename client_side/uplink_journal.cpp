@@ -0,0 +1,634 @@
+// Store-and-forward uplink journal for NB-IoT example application
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "platform.h"
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+#include "utilities.h"
+#include "logging.h"
+#include "trace.h"
+#include "transport.h"
+#include "line_buffer.h"
+#include "spsc_queue.h"
+#include "at_dispatcher.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include "modem_driver.h"
+#include "uplink_journal.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The start of a journal file, "NBUJ"
+#define JOURNAL_MAGIC 0x4A55424E
+
+// The version of the journal file format
+#define JOURNAL_VERSION 1
+
+// The start of a record, "UREC"
+#define JOURNAL_RECORD_MAGIC 0x43455255
+
+// The states of a record
+#define JOURNAL_STATE_PENDING 0x444E4550
+#define JOURNAL_STATE_DONE    0x454E4F44
+
+// Records are padded to a multiple of this many bytes, so that each
+// header is aligned for the single stores that mark it
+#define JOURNAL_RECORD_ALIGNMENT 8
+
+// Added to the journal file name for the file being compacted into
+#define JOURNAL_TEMP_SUFFIX ".tmp"
+
+// The smallest journal that is of any use
+#define JOURNAL_MIN_CAPACITY 4096
+
+// ----------------------------------------------------------------
+// PROTECTED FUNCTIONS
+// ----------------------------------------------------------------
+
+// Return the space taken by a record.
+uint32_t UplinkJournal::getRecordSpace (uint32_t size)
+{
+    return sizeof (RecordHeader) + ((size + JOURNAL_RECORD_ALIGNMENT - 1) & ~(JOURNAL_RECORD_ALIGNMENT - 1));
+}
+
+// Return the checksum of a record: FNV-1a over the size and the data.
+uint32_t UplinkJournal::getChecksum (const char * pData, uint32_t size)
+{
+    uint32_t hash = 2166136261U;
+
+    for (uint32_t x = 0; x < sizeof (size); x++)
+    {
+        hash = (hash ^ ((size >> (x * 8)) & 0xFF)) * 16777619U;
+    }
+    for (uint32_t x = 0; x < size; x++)
+    {
+        hash = (hash ^ (uint8_t) pData[x]) * 16777619U;
+    }
+
+    return hash;
+}
+
+// Return the record at offset, if there is one.
+UplinkJournal::RecordHeader * UplinkJournal::getRecord (uint32_t offset)
+{
+    RecordHeader * pRecord = NULL;
+    RecordHeader * pCandidate;
+
+    if (offset + sizeof (RecordHeader) <= gCapacity)
+    {
+        pCandidate = (RecordHeader *) (gpMap + offset);
+        if ((pCandidate->magic == JOURNAL_RECORD_MAGIC) &&
+            ((pCandidate->state == JOURNAL_STATE_PENDING) || (pCandidate->state == JOURNAL_STATE_DONE)) &&
+            (pCandidate->size <= gCapacity) &&
+            (offset + getRecordSpace (pCandidate->size) <= gCapacity))
+        {
+            pRecord = pCandidate;
+        }
+    }
+
+    return pRecord;
+}
+
+// Mark a record complete.
+void UplinkJournal::complete (uint32_t offset)
+{
+    RecordHeader * pRecord = (RecordHeader *) (gpMap + offset);
+
+    if (pRecord->state == JOURNAL_STATE_PENDING)
+    {
+        // A single aligned store, so the state is either one or the other
+        pRecord->state = JOURNAL_STATE_DONE;
+        flush (offset, sizeof (RecordHeader));
+        gNumPending--;
+        advanceHead();
+    }
+}
+
+// Move the head over completed records.
+void UplinkJournal::advanceHead ()
+{
+    RecordHeader * pRecord;
+
+    while ((gHead < gTail) && ((pRecord = (RecordHeader *) (gpMap + gHead))->state == JOURNAL_STATE_DONE))
+    {
+        gHead += getRecordSpace (pRecord->size);
+    }
+}
+
+// Start again from the beginning.
+void UplinkJournal::reset ()
+{
+    gHead = sizeof (FileHeader);
+    gTail = gHead;
+    // Whatever follows is now stale
+    ((RecordHeader *) (gpMap + gTail))->magic = 0;
+    flush (gTail, sizeof (uint32_t));
+}
+
+// Find the records in the mapped file.
+void UplinkJournal::replay ()
+{
+    RecordHeader * pRecord;
+    uint32_t offset = sizeof (FileHeader);
+    bool gotHead = false;
+    bool done = false;
+
+    gHead = offset;
+    gNumPending = 0;
+    while (!done)
+    {
+        pRecord = getRecord (offset);
+        if ((pRecord != NULL) && (pRecord->checksum == getChecksum ((char *) (pRecord + 1), pRecord->size)))
+        {
+            if (pRecord->state == JOURNAL_STATE_PENDING)
+            {
+                gNumPending++;
+                if (!gotHead)
+                {
+                    gHead = offset;
+                    gotHead = true;
+                }
+            }
+            offset += getRecordSpace (pRecord->size);
+        }
+        else
+        {
+            // The end, or a record torn by a crash part way through
+            // appending it, which will be written over
+            done = true;
+        }
+    }
+    gTail = offset;
+    if (!gotHead)
+    {
+        gHead = gTail;
+    }
+}
+
+// Flush part of the journal to the storage device.
+bool UplinkJournal::flush (uint32_t offset, uint32_t len, bool force)
+{
+    bool success = true;
+
+    if ((gDurable || force) && (gpMap != NULL) && (len > 0))
+    {
+        if (offset + len > gCapacity)
+        {
+            len = gCapacity - offset;
+        }
+#ifdef _WIN32
+        success = FlushViewOfFile (gpMap + offset, len) && FlushFileBuffers (gFileHandle);
+#else
+        // msync() wants a page-aligned start
+        uint32_t start = offset & ~((uint32_t) sysconf (_SC_PAGESIZE) - 1);
+        success = (msync (gpMap + start, offset + len - start, MS_SYNC) == 0);
+#endif
+        if (!success)
+        {
+            LOG_ERROR ("!!! Unable to flush uplink journal %s to storage.\n", gpPath);
+        }
+    }
+
+    return success;
+}
+
+// Open and map a file.
+bool UplinkJournal::mapFile (const char * pPath, uint32_t capacity, bool create)
+{
+    bool success = false;
+
+#ifdef _WIN32
+    DWORD size;
+
+    gFileHandle = CreateFileA (pPath, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                               create ? CREATE_NEW : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (gFileHandle != INVALID_HANDLE_VALUE)
+    {
+        size = create ? capacity : GetFileSize (gFileHandle, NULL);
+        if ((size != INVALID_FILE_SIZE) && (size >= JOURNAL_MIN_CAPACITY))
+        {
+            // Mapping a new file capacity bytes long extends it to that
+            gMappingHandle = CreateFileMappingA (gFileHandle, NULL, PAGE_READWRITE, 0, size, NULL);
+            if (gMappingHandle != NULL)
+            {
+                gpMap = (char *) MapViewOfFile (gMappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+                if (gpMap != NULL)
+                {
+                    gCapacity = size;
+                    success = true;
+                }
+            }
+        }
+    }
+#else
+    struct stat status;
+
+    gFd = ::open (pPath, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (gFd >= 0)
+    {
+        if ((!create || (ftruncate (gFd, capacity) == 0)) &&
+            (fstat (gFd, &status) == 0) && (status.st_size >= JOURNAL_MIN_CAPACITY) &&
+            (status.st_size <= (off_t) UINT32_MAX))
+        {
+            gpMap = (char *) mmap (NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, gFd, 0);
+            if (gpMap != MAP_FAILED)
+            {
+                gCapacity = (uint32_t) status.st_size;
+                success = true;
+            }
+            else
+            {
+                gpMap = NULL;
+            }
+        }
+    }
+#endif
+
+    if (!success)
+    {
+        unmapFile();
+    }
+
+    return success;
+}
+
+// Unmap and close the file.
+void UplinkJournal::unmapFile ()
+{
+#ifdef _WIN32
+    if (gpMap != NULL)
+    {
+        UnmapViewOfFile (gpMap);
+    }
+    if (gMappingHandle != NULL)
+    {
+        CloseHandle (gMappingHandle);
+        gMappingHandle = NULL;
+    }
+    if (gFileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle (gFileHandle);
+        gFileHandle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (gpMap != NULL)
+    {
+        munmap (gpMap, gCapacity);
+    }
+    if (gFd >= 0)
+    {
+        ::close (gFd);
+        gFd = -1;
+    }
+#endif
+    gpMap = NULL;
+    gCapacity = 0;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor.
+UplinkJournal::UplinkJournal ()
+{
+    gpPath = NULL;
+    gpMap = NULL;
+    gCapacity = 0;
+    gDurable = false;
+#ifdef _WIN32
+    gFileHandle = INVALID_HANDLE_VALUE;
+    gMappingHandle = NULL;
+#else
+    gFd = -1;
+#endif
+    gHead = 0;
+    gTail = 0;
+    gNumPending = 0;
+}
+
+// Destructor.
+UplinkJournal::~UplinkJournal ()
+{
+    close();
+}
+
+// Open the journal.
+bool UplinkJournal::open (const char * pPath, uint32_t capacity, bool durable)
+{
+    bool success = false;
+    FileHeader * pHeader;
+
+    close();
+
+    gDurable = durable;
+    gpPath = new char[strlen (pPath) + 1];
+    strcpy (gpPath, pPath);
+
+    if (mapFile (pPath, capacity, false))
+    {
+        pHeader = (FileHeader *) gpMap;
+        if ((pHeader->magic == JOURNAL_MAGIC) && (pHeader->version == JOURNAL_VERSION) &&
+            (pHeader->capacity == gCapacity))
+        {
+            replay();
+            LOG_INFO ("Uplink journal %s opened, %d datagram(s) waiting to be sent.\n", pPath, gNumPending);
+            success = true;
+        }
+        else
+        {
+            LOG_ERROR ("!!! %s is not an uplink journal.\n", pPath);
+        }
+    }
+    else if (capacity < JOURNAL_MIN_CAPACITY)
+    {
+        LOG_ERROR ("!!! An uplink journal must be at least %d bytes.\n", JOURNAL_MIN_CAPACITY);
+    }
+    else if (mapFile (pPath, capacity, true))
+    {
+        // A new file reads as zeroes, so there are no records
+        pHeader = (FileHeader *) gpMap;
+        pHeader->version = JOURNAL_VERSION;
+        pHeader->capacity = gCapacity;
+        pHeader->reserved = 0;
+        std::atomic_thread_fence (std::memory_order_release);
+        pHeader->magic = JOURNAL_MAGIC;
+        reset();
+        gNumPending = 0;
+        success = flush (0, gCapacity, true);
+        if (success)
+        {
+            LOG_INFO ("Uplink journal %s created, %d bytes.\n", pPath, gCapacity);
+        }
+    }
+    else
+    {
+        LOG_ERROR ("!!! Unable to open or create uplink journal %s.\n", pPath);
+    }
+
+    if (!success)
+    {
+        close();
+    }
+
+    return success;
+}
+
+// Close the journal.
+void UplinkJournal::close ()
+{
+    if (gpMap != NULL)
+    {
+        flush (0, gCapacity, true);
+    }
+    unmapFile();
+    delete[] gpPath;
+    gpPath = NULL;
+    gHead = 0;
+    gTail = 0;
+    gNumPending = 0;
+}
+
+// Append a datagram.
+bool UplinkJournal::append (const char * pData, uint32_t size)
+{
+    bool success = false;
+    uint32_t space = getRecordSpace (size);
+    RecordHeader * pRecord;
+
+    if (gpMap != NULL)
+    {
+        if ((gTail + space > gCapacity) && (gNumPending > 0) && (gHead > sizeof (FileHeader)))
+        {
+            // Recover the space of what has been sent
+            compact();
+        }
+        if ((gpMap != NULL) && (gNumPending == 0) && (gTail > sizeof (FileHeader)))
+        {
+            reset();
+        }
+
+        if ((gpMap != NULL) && (gTail + space <= gCapacity))
+        {
+            pRecord = (RecordHeader *) (gpMap + gTail);
+
+            // Invalidate whatever is here (a torn record or one from before
+            // a reset()) and end the journal after this record, both before
+            // this record can be valid
+            pRecord->magic = 0;
+            if (gTail + space + sizeof (uint32_t) <= gCapacity)
+            {
+                *(uint32_t *) (gpMap + gTail + space) = 0;
+            }
+            std::atomic_thread_fence (std::memory_order_release);
+
+            pRecord->state = JOURNAL_STATE_PENDING;
+            pRecord->size = size;
+            pRecord->checksum = getChecksum (pData, size);
+            memcpy (pRecord + 1, pData, size);
+
+            // The record only exists once its magic is in place
+            std::atomic_thread_fence (std::memory_order_release);
+            pRecord->magic = JOURNAL_RECORD_MAGIC;
+            flush (gTail, space + sizeof (uint32_t));
+
+            gTail += space;
+            gNumPending++;
+            success = true;
+        }
+        else
+        {
+            LOG_ERROR ("!!! Uplink journal full, unable to add a datagram of %d bytes.\n", size);
+        }
+    }
+
+    return success;
+}
+
+// Send the datagrams not yet complete.
+uint32_t UplinkJournal::forward (Nbiot * pModem, uint32_t timeoutMs)
+{
+    uint32_t numSent = 0;
+    uint32_t offsets[JOURNAL_MAX_IN_FLIGHT];
+    uint32_t tickets[JOURNAL_MAX_IN_FLIGHT];
+    uint32_t first = 0;
+    uint32_t numInFlight = 0;
+    uint32_t offset = gHead;
+    uint32_t ticket;
+    uint32_t x;
+    RecordHeader * pRecord;
+    bool stop = (gpMap == NULL) || (pModem == NULL);
+
+    while (!stop && ((offset < gTail) || (numInFlight > 0)))
+    {
+        // Keep the modem's send pipeline full
+        ticket = 1;
+        while (!stop && (ticket != 0) && (offset < gTail) && (numInFlight < JOURNAL_MAX_IN_FLIGHT))
+        {
+            pRecord = (RecordHeader *) (gpMap + offset);
+            if (pRecord->state == JOURNAL_STATE_PENDING)
+            {
+                if (pRecord->size > pModem->getMaxDatagramSize())
+                {
+                    // Never going to go, don't let it hold up the rest
+                    LOG_ERROR ("!!! Journalled datagram of %d bytes is longer than the modem can send, dropping it.\n", pRecord->size);
+                    complete (offset);
+                }
+                else
+                {
+                    ticket = pModem->sendAsync ((char *) (pRecord + 1), pRecord->size, timeoutMs);
+                    if (ticket != 0)
+                    {
+                        x = (first + numInFlight) % JOURNAL_MAX_IN_FLIGHT;
+                        offsets[x] = offset;
+                        tickets[x] = ticket;
+                        numInFlight++;
+                    }
+                    else if (numInFlight == 0)
+                    {
+                        // The pipeline is full of someone else's datagrams
+                        stop = true;
+                    }
+                }
+            }
+            if (ticket != 0)
+            {
+                offset += getRecordSpace (pRecord->size);
+            }
+        }
+
+        // Collect the oldest result
+        if (numInFlight > 0)
+        {
+            if (pModem->waitSend (tickets[first], 0) == Nbiot::SEND_STATUS_SENT)
+            {
+                complete (offsets[first]);
+                numSent++;
+            }
+            else
+            {
+                // Probably out of coverage: try again next time
+                stop = true;
+            }
+            first = (first + 1) % JOURNAL_MAX_IN_FLIGHT;
+            numInFlight--;
+        }
+    }
+
+    // Having stopped, the datagrams already with the modem still count
+    while (numInFlight > 0)
+    {
+        if (pModem->waitSend (tickets[first], 0) == Nbiot::SEND_STATUS_SENT)
+        {
+            complete (offsets[first]);
+            numSent++;
+        }
+        first = (first + 1) % JOURNAL_MAX_IN_FLIGHT;
+        numInFlight--;
+    }
+
+    if ((gpMap != NULL) && (gNumPending == 0) && (gTail > sizeof (FileHeader)))
+    {
+        reset();
+    }
+
+    return numSent;
+}
+
+// Return the number of datagrams not yet complete.
+uint32_t UplinkJournal::getPendingCount ()
+{
+    return gNumPending;
+}
+
+// Recover the space taken by completed datagrams.
+bool UplinkJournal::compact ()
+{
+    bool success = false;
+    UplinkJournal compacted;
+    RecordHeader * pRecord;
+    char * pTempPath;
+    char * pPath;
+    uint32_t capacity = gCapacity;
+    bool durable = gDurable;
+
+    if (gpMap != NULL)
+    {
+        if (gNumPending == 0)
+        {
+            reset();
+            success = true;
+        }
+        else
+        {
+            // Write what is pending to a new file and then swap it in
+            // with a rename, which is atomic, so that a crash at any point
+            // leaves either the old journal or the new one
+            pTempPath = new char[strlen (gpPath) + strlen (JOURNAL_TEMP_SUFFIX) + 1];
+            strcpy (pTempPath, gpPath);
+            strcat (pTempPath, JOURNAL_TEMP_SUFFIX);
+            remove (pTempPath);
+            success = compacted.open (pTempPath, capacity, false);
+            for (uint32_t offset = gHead; success && (offset < gTail); offset += getRecordSpace (pRecord->size))
+            {
+                pRecord = (RecordHeader *) (gpMap + offset);
+                if (pRecord->state == JOURNAL_STATE_PENDING)
+                {
+                    success = compacted.append ((char *) (pRecord + 1), pRecord->size);
+                }
+            }
+            if (success)
+            {
+                success = compacted.sync();
+            }
+            compacted.close();
+
+            if (success)
+            {
+                pPath = gpPath;
+                gpPath = NULL;
+                close();
+#ifdef _WIN32
+                success = MoveFileExA (pTempPath, pPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+                success = (rename (pTempPath, pPath) == 0);
+#endif
+                if (!success)
+                {
+                    LOG_ERROR ("!!! Unable to replace uplink journal %s with its compacted copy.\n", pPath);
+                }
+                // Carry on with whichever is now in place
+                if (!open (pPath, capacity, durable))
+                {
+                    success = false;
+                }
+                delete[] pPath;
+            }
+            else
+            {
+                LOG_ERROR ("!!! Unable to compact uplink journal %s.\n", gpPath);
+                remove (pTempPath);
+            }
+            delete[] pTempPath;
+        }
+    }
+
+    return success;
+}
+
+// Flush the journal to the storage device.
+bool UplinkJournal::sync ()
+{
+    return flush (0, gCapacity, true);
+}
+
+// End Of File
@@ -0,0 +1,160 @@
+// Store-and-forward uplink journal for NB-IoT example application
+
+#ifndef _UPLINK_JOURNAL_H_
+#define _UPLINK_JOURNAL_H_
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The default size of a new journal file, in bytes
+#ifndef JOURNAL_DEFAULT_CAPACITY
+# define JOURNAL_DEFAULT_CAPACITY (1024 * 1024)
+#endif
+
+// The most datagrams that forward() has with the modem at once
+#define JOURNAL_MAX_IN_FLIGHT 16
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// An append-only journal of uplink datagrams in a memory-mapped file, so
+// that a datagram written to it is not lost if it cannot be sent, nor if
+// the process stops before it is.  Datagrams are appended before they are
+// sent and marked complete only when the modem reports them SENT;
+// forward() sends everything not yet complete, in order, through the
+// Nbiot send pipeline, stopping at the first failure (e.g. out of
+// coverage) and leaving the rest for the next call.  On open() the journal
+// is replayed: a record is only counted once its checksum and, last of
+// all, its marker are in place, so a record torn by a crash mid-append is
+// simply ignored.  Space is recovered as datagrams complete: when all have
+// the journal starts again from the beginning, otherwise, when it fills,
+// the records still pending are copied to a new file which then replaces
+// the old one.  Not thread safe.
+class UplinkJournal
+{
+public:
+    // Constructor.
+    UplinkJournal ();
+
+    // Destructor: closes the journal.
+    ~UplinkJournal ();
+
+    // Open the journal at pPath, replaying it if it exists or otherwise
+    // creating it capacity bytes long.  If durable is true every append
+    // and completion is flushed to the storage device before returning,
+    // so that it survives a loss of power as well as a crash of the
+    // process, at the cost of a write to the device each time.
+    // Returns true on success.
+    bool open (const char * pPath, uint32_t capacity = JOURNAL_DEFAULT_CAPACITY, bool durable = false);
+
+    // Close the journal, flushing it to the storage device.
+    void close ();
+
+    // Append the datagram at pData, size bytes long.  Returns false if
+    // the journal is not open or there is no room even after compaction.
+    bool append (const char * pData, uint32_t size);
+
+    // Send the datagrams not yet complete, oldest first, on pModem,
+    // keeping up to JOURNAL_MAX_IN_FLIGHT with the modem at once and
+    // marking each complete when it is SENT.  Each datagram is given
+    // timeoutMs to be SENT (zero meaning no limit).  Stops at the first
+    // datagram that is not SENT.  Returns the number SENT.
+    uint32_t forward (Nbiot * pModem, uint32_t timeoutMs = DEFAULT_SEND_TIMEOUT_MS);
+
+    // Return the number of datagrams not yet complete.
+    uint32_t getPendingCount ();
+
+    // Recover the space taken by completed datagrams now, rather than
+    // waiting for the journal to fill.  Returns true on success.
+    bool compact ();
+
+    // Flush the journal to the storage device.  Returns true on success.
+    bool sync ();
+
+protected:
+    // The start of the file.
+    typedef struct
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t reserved;
+    } FileHeader;
+
+    // The start of each record, followed by size bytes of datagram and
+    // padding to the next multiple of 8 bytes.  magic is written last,
+    // and a record without it ends the journal.
+    typedef struct
+    {
+        uint32_t magic;
+        uint32_t state;
+        uint32_t size;
+        uint32_t checksum;
+    } RecordHeader;
+
+    // The path of the journal file.
+    char * gpPath;
+
+    // The mapping of the journal file, gCapacity bytes long.
+    char * gpMap;
+    uint32_t gCapacity;
+
+    // Whether every change is flushed to the storage device.
+    bool gDurable;
+
+#ifdef _WIN32
+    // The journal file and its mapping.
+    HANDLE gFileHandle;
+    HANDLE gMappingHandle;
+#else
+    // The journal file.
+    int gFd;
+#endif
+
+    // The offsets of the oldest record that is not complete (or gTail if
+    // there is none) and of the end of the last record.
+    uint32_t gHead;
+    uint32_t gTail;
+
+    // The number of records not yet complete.
+    uint32_t gNumPending;
+
+    // Return the size taken in the journal by a datagram of size bytes.
+    static uint32_t getRecordSpace (uint32_t size);
+
+    // Return the checksum of a record.
+    static uint32_t getChecksum (const char * pData, uint32_t size);
+
+    // Return the record at offset, or NULL if there is no valid one there.
+    RecordHeader * getRecord (uint32_t offset);
+
+    // Mark the record at offset complete.
+    void complete (uint32_t offset);
+
+    // Move gHead over completed records.
+    void advanceHead ();
+
+    // Start again from the beginning of the journal; nothing must be
+    // pending.
+    void reset ();
+
+    // Find the records in the mapped file.
+    void replay ();
+
+    // Flush len bytes from offset to the storage device if gDurable, or
+    // always if force is true.
+    bool flush (uint32_t offset, uint32_t len, bool force = false);
+
+    // Open the file at pPath, creating it capacity bytes long if create
+    // is true, and map it; gCapacity is set to the size of the file.
+    bool mapFile (const char * pPath, uint32_t capacity, bool create);
+
+    // Unmap and close the file.
+    void unmapFile ();
+};
+
+#endif
+
+// End Of File
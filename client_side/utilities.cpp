@@ -1,79 +1,101 @@
 // Utilitiy functions NB-IoT example application
 
 #include "stdint.h"
+#include "time.h"
+#include <chrono>
+#include "platform.h"
 #include "utilities.h"
+#include "hex_codec.h"
 
 // ----------------------------------------------------------------
-// PRIVATE VARIABLES
+// TYPES
 // ----------------------------------------------------------------
 
-static const char hexTable[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+// The form of the hex codec functions in hex_codec.h.
+typedef uint32_t (*HexCodecFunction) (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf);
 
 // ----------------------------------------------------------------
-// PUBLIC FUNCTIONS
+// PRIVATE FUNCTIONS
 // ----------------------------------------------------------------
 
-// Convert a hex string of a given length into a sequence of bytes, returning the
-// number of bytes written.
-uint32_t hexStringToBytes (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf)
+// Choose the fastest hex decoder this processor supports.
+static HexCodecFunction selectHexStringToBytes (void)
 {
-    uint32_t x;
-    uint32_t y = 0;
-    int32_t z;
-    uint32_t a = 0;
+    HexCodecFunction pFunction = hexStringToBytesScalar;
 
-    for (x = 0; (x < lenInBuf) && (y < lenOutBuf); x++)
+    if (hexCodecAvx2Supported())
     {
-        z = *(pInBuf + x);
-        if ((z >= '0') && (z <= '9'))
-        {
-            z = z - '0';
-        }
-        else
-        {
-            z &= ~0x20;
-            if ((z >= 'A') && (z <= 'F'))
-            {
-                z = z - 'A' + 10;
-            }
-            else
-            {
-                z = -1;
-            }
-        }
+        pFunction = hexStringToBytesAvx2;
+    }
+    else if (hexCodecSse2Supported())
+    {
+        pFunction = hexStringToBytesSse2;
+    }
 
-        if (z >= 0)
-        {
-            if (a % 2 == 0)
-            {
-                *(pOutBuf + y) = (z << 4) & 0xF0;
-            }
-            else
-            {
-                *(pOutBuf + y) += z;
-                y++;
-            }
-            a++;
-        }
+    return pFunction;
+}
+
+// Choose the fastest hex encoder this processor supports.
+static HexCodecFunction selectBytesToHexString (void)
+{
+    HexCodecFunction pFunction = bytesToHexStringScalar;
+
+    if (hexCodecAvx2Supported())
+    {
+        pFunction = bytesToHexStringAvx2;
+    }
+    else if (hexCodecSse2Supported())
+    {
+        pFunction = bytesToHexStringSse2;
     }
 
-    return y;
+    return pFunction;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Convert a hex string of a given length into a sequence of bytes, returning the
+// number of bytes written.  Non-hex characters are skipped.
+uint32_t hexStringToBytes (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf)
+{
+    static const HexCodecFunction pFunction = selectHexStringToBytes();
+
+    return pFunction (pInBuf, lenInBuf, pOutBuf, lenOutBuf);
 }
 
 // Convert a sequence of bytes into a hex string, returning the number
 // of characters written. The hex string is NOT null terminated.
 uint32_t bytesToHexString (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf)
 {
+    static const HexCodecFunction pFunction = selectBytesToHexString();
+
+    return pFunction (pInBuf, size, pOutBuf, lenOutBuf);
+}
+
+// Convert an unsigned integer into a decimal string, returning the
+// number of characters written, or 0 if it would not fit.  The
+// decimal string is NOT null terminated.
+uint32_t uintToDecString (uint32_t value, char * pOutBuf, uint32_t lenOutBuf)
+{
+    char digits[10];
     uint32_t x = 0;
     uint32_t y = 0;
 
-    for (x = 0; (x < size) && (y < lenOutBuf); x++)
+    do
     {
-        pOutBuf[y] = hexTable[(pInBuf[x] >> 4) & 0x0f]; // upper nibble
-        y++;
-        if (y < lenOutBuf)
+        digits[x] = '0' + (value % 10);
+        value /= 10;
+        x++;
+    } while (value > 0);
+
+    if (x <= lenOutBuf)
+    {
+        while (x > 0)
         {
-            pOutBuf[y] = hexTable[pInBuf[x] & 0x0f]; // lower nibble
+            x--;
+            pOutBuf[y] = digits[x];
             y++;
         }
     }
@@ -81,4 +103,31 @@ uint32_t bytesToHexString (const char * pInBuf, uint32_t size, char * pOutBuf, u
     return y;
 }
 
+// Block the calling thread for the given number of milliseconds.
+void sleepMs (uint32_t milliseconds)
+{
+#ifdef _WIN32
+    Sleep(milliseconds);
+#else
+    struct timespec duration;
+
+    duration.tv_sec = milliseconds / 1000;
+    duration.tv_nsec = (milliseconds % 1000) * 1000000L;
+    nanosleep(&duration, NULL);
+#endif
+}
+
+// Return a count of milliseconds that only ever goes up, unaffected
+// by changes to the time of day; only differences are meaningful.
+int64_t getTimeMs (void)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// As getTimeMs() but in microseconds.
+int64_t getTimeUs (void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 // End Of File
@@ -13,6 +13,10 @@
 
 uint32_t bytesToHexString (const char * pInBuf, uint32_t size, char * pOutBuf, uint32_t lenOutBuf);
 uint32_t hexStringToBytes (const char * pInBuf, uint32_t lenInBuf, char * pOutBuf, uint32_t lenOutBuf);
+uint32_t uintToDecString (uint32_t value, char * pOutBuf, uint32_t lenOutBuf);
+void sleepMs (uint32_t milliseconds);
+int64_t getTimeMs (void);
+int64_t getTimeUs (void);
 
 #endif
 
@@ -29,6 +29,29 @@ namespace example
         static Connection gConnection;
         static System.Threading.Timer gReceiveTimer;
 
+        // The one-byte headers that every uplink datagram from the client
+        // side starts with (see client_side/payload_codec.h): stored as-is
+        // or compressed.  A datagram starting with anything else is corrupt.
+        const Byte PayloadHeaderStored = 0xC0;
+        const Byte PayloadHeaderLz = 0xC1;
+
+        // The same for a datagram from the client side with -a (see
+        // client_side/uplink_aggregator.h): once decoded it is records,
+        // each a length byte followed by that many bytes
+        const Byte PayloadHeaderAggregateStored = 0xF5;
+        const Byte PayloadHeaderAggregateLz = 0xF6;
+
+        // Compressed payloads are preceded by this dictionary; it must
+        // match the one in client_side/payload_codec.cpp byte for byte
+        static readonly Byte[] gPayloadDictionary = Encoding.ASCII.GetBytes(
+            "{\"id\":\"\",\"seq\":,\"time\":\"2026-01-01T00:00:00Z\",\"ts\":1700000000," +
+            "\"temperature\":2,\"temp\":-0.5,\"humidity\":5,\"pressure\":101," +
+            "\"battery\":3.,\"voltage\":,\"current\":,\"rssi\":-,\"snr\":," +
+            "\"lat\":51.,\"lon\":-0.,\"alt\":,\"value\":,\"values\":[,]," +
+            "\"count\":,\"level\":,\"state\":\"on\",\"status\":\"ok\"," +
+            "\"error\":,\"alarm\":true,false,null}\r\n" +
+            "Hello World! 0123456789.0,0.1,1.0,10.0,20.5,100");
+
         static void Main(string[] args)
         {
             // Fill these fields in with your Huawei server host name, the
@@ -100,7 +123,20 @@ namespace example
                         var rsp = jsonMsg as JsonMessages.AmqpResponse;
                         if (rsp != null)
                         {
-                            Console.WriteLine(String.Format("[Received datagram: {0}, \"{1}\"]", rsp.ToString(), Encoding.UTF8.GetString (rsp.Data)));
+                            Boolean aggregate;
+                            Byte[] payload = decodePayload(rsp.Data, out aggregate);
+                            var records = (payload != null) ? splitRecords(payload, aggregate) : null;
+                            if (records != null)
+                            {
+                                foreach (Byte[] record in records)
+                                {
+                                    Console.WriteLine(String.Format("[Received datagram: {0}, \"{1}\"]", rsp.ToString(), Encoding.UTF8.GetString (record)));
+                                }
+                            }
+                            else
+                            {
+                                Console.WriteLine(String.Format("[Received corrupt datagram: {0}]", rsp.ToString()));
+                            }
                             Console.Write("> ");
                         }
                     }
@@ -110,5 +146,117 @@ namespace example
             }
         }
 
+        // Undo the encoding of an uplink payload: strip the header and,
+        // if it was compressed, decompress it, setting aggregate to whether
+        // the header says it is an aggregate.  Returns null if it is
+        // corrupt, which includes having no header.
+        static Byte[] decodePayload(Byte[] data, out Boolean aggregate)
+        {
+            Byte[] payload = null;
+            Byte header = (data.Length > 0) ? data[0] : (Byte) 0;
+
+            aggregate = (header == PayloadHeaderAggregateStored) || (header == PayloadHeaderAggregateLz);
+            if ((data.Length > 0) && ((header == PayloadHeaderStored) || (header == PayloadHeaderAggregateStored)))
+            {
+                payload = new Byte[data.Length - 1];
+                Array.Copy(data, 1, payload, 0, payload.Length);
+            }
+            else if ((data.Length > 0) && ((header == PayloadHeaderLz) || (header == PayloadHeaderAggregateLz)))
+            {
+                // Each token is either 0LLLLLLL, followed by L + 1 literal
+                // bytes, or 1LLLLOOO OOOOOOOO, a copy of L + 3 bytes from
+                // O + 1 bytes back in the dictionary followed by the output
+                var output = new System.Collections.Generic.List<Byte>(data.Length * 4);
+                int x = 1;
+
+                payload = data;
+
+                while ((payload != null) && (x < data.Length))
+                {
+                    int token = data[x];
+                    if ((token & 0x80) == 0)
+                    {
+                        int length = token + 1;
+                        if (x + 1 + length <= data.Length)
+                        {
+                            for (int y = 0; y < length; y++)
+                            {
+                                output.Add(data[x + 1 + y]);
+                            }
+                            x += 1 + length;
+                        }
+                        else
+                        {
+                            payload = null;
+                        }
+                    }
+                    else if (x + 2 <= data.Length)
+                    {
+                        int length = ((token >> 3) & 0x0F) + 3;
+                        int offset = (((token & 0x07) << 8) | data[x + 1]) + 1;
+                        int from = gPayloadDictionary.Length + output.Count - offset;
+                        if (from >= 0)
+                        {
+                            // Byte by byte, as the copy may overlap what it produces
+                            for (int y = from; y < from + length; y++)
+                            {
+                                output.Add((y < gPayloadDictionary.Length) ? gPayloadDictionary[y] : output[y - gPayloadDictionary.Length]);
+                            }
+                            x += 2;
+                        }
+                        else
+                        {
+                            payload = null;
+                        }
+                    }
+                    else
+                    {
+                        payload = null;
+                    }
+                }
+
+                if (payload != null)
+                {
+                    payload = output.ToArray();
+                }
+            }
+
+            return payload;
+        }
+
+        // Split a decoded payload into the records that were aggregated
+        // into it, if aggregate is true; a payload that is not an
+        // aggregate is one record.  Returns null if it is corrupt.
+        static System.Collections.Generic.List<Byte[]> splitRecords(Byte[] payload, Boolean aggregate)
+        {
+            var records = new System.Collections.Generic.List<Byte[]>();
+
+            if (aggregate)
+            {
+                int x = 0;
+                while ((records != null) && (x < payload.Length))
+                {
+                    int length = payload[x];
+                    if (x + 1 + length <= payload.Length)
+                    {
+                        Byte[] record = new Byte[length];
+                        Array.Copy(payload, x + 1, record, 0, length);
+                        records.Add(record);
+                        x += 1 + length;
+                    }
+                    else
+                    {
+                        records = null;
+                    }
+                }
+            }
+            else
+            {
+                records.Add(payload);
+            }
+
+            return records;
+        }
+
     }
 }
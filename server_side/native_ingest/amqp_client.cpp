@@ -0,0 +1,919 @@
+// AMQP 0-9-1 client for NB-IoT native ingestion daemon
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "utilities.h"
+#include "logging.h"
+#include "transport.h"
+#include "amqp_client.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// What a client sends first
+#define AMQP_PROTOCOL_HEADER "AMQP\x00\x00\x09\x01"
+
+// Frame types
+#define AMQP_FRAME_METHOD    1
+#define AMQP_FRAME_HEADER    2
+#define AMQP_FRAME_BODY      3
+#define AMQP_FRAME_HEARTBEAT 8
+
+// The size of a frame's header (type, channel, size) and its end marker
+#define AMQP_FRAME_HEADER_SIZE 7
+#define AMQP_FRAME_END 0xCE
+
+// The channel used for consuming
+#define AMQP_CHANNEL 1
+
+// Classes and methods
+#define AMQP_CONNECTION        10
+#define AMQP_CONNECTION_START     10
+#define AMQP_CONNECTION_START_OK  11
+#define AMQP_CONNECTION_TUNE      30
+#define AMQP_CONNECTION_TUNE_OK   31
+#define AMQP_CONNECTION_OPEN      40
+#define AMQP_CONNECTION_OPEN_OK   41
+#define AMQP_CONNECTION_CLOSE     50
+#define AMQP_CONNECTION_CLOSE_OK  51
+#define AMQP_CHANNEL_CLASS     20
+#define AMQP_CHANNEL_OPEN         10
+#define AMQP_CHANNEL_OPEN_OK      11
+#define AMQP_CHANNEL_CLOSE        40
+#define AMQP_CHANNEL_CLOSE_OK     41
+#define AMQP_BASIC             60
+#define AMQP_BASIC_QOS            10
+#define AMQP_BASIC_QOS_OK         11
+#define AMQP_BASIC_CONSUME        20
+#define AMQP_BASIC_CONSUME_OK     21
+#define AMQP_BASIC_PUBLISH        40
+#define AMQP_BASIC_DELIVER        60
+#define AMQP_BASIC_ACK            80
+#define AMQP_BASIC_NACK          120
+#define AMQP_CONFIRM           85
+#define AMQP_CONFIRM_SELECT       10
+#define AMQP_CONFIRM_SELECT_OK    11
+
+// The content type of messages published, and the property flag that
+// says it is there
+#define AMQP_CONTENT_TYPE "application/json"
+#define AMQP_PROPERTY_CONTENT_TYPE 0x8000
+
+// The reply code of a normal close
+#define AMQP_REPLY_SUCCESS 200
+
+// The longest set of method arguments sent
+#define AMQP_MAX_ARGS_SIZE 1024
+
+// The size of the receive buffer: one whole frame of the largest size,
+// with room to read the start of the next behind it
+#define AMQP_RX_BUFFER_SIZE (AMQP_FRAME_MAX * 2)
+
+// The product name given to the broker
+#define AMQP_PRODUCT "nbiot_ingest"
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// Method arguments being written, len bytes of lenBuf so far; ok is
+// cleared if they do not fit.
+typedef struct
+{
+    char * pBuf;
+    uint32_t lenBuf;
+    uint32_t len;
+    bool ok;
+} ArgWriter;
+
+// Method arguments being read, pos bytes of size so far; ok is cleared
+// if they run out.
+typedef struct
+{
+    const char * pBuf;
+    uint32_t size;
+    uint32_t pos;
+    bool ok;
+} ArgReader;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Write len bytes from pData.
+static void putBytes (ArgWriter * pWriter, const void * pData, uint32_t len)
+{
+    if (pWriter->ok && (pWriter->len + len <= pWriter->lenBuf))
+    {
+        memcpy (pWriter->pBuf + pWriter->len, pData, len);
+        pWriter->len += len;
+    }
+    else
+    {
+        pWriter->ok = false;
+    }
+}
+
+// Write an integer of numBytes bytes, most significant first.
+static void putUint (ArgWriter * pWriter, uint64_t value, uint32_t numBytes)
+{
+    char bytes[8];
+
+    for (uint32_t x = 0; x < numBytes; x++)
+    {
+        bytes[x] = (char) (value >> ((numBytes - 1 - x) * 8));
+    }
+    putBytes (pWriter, bytes, numBytes);
+}
+
+// Write a short string (a length byte and up to 255 characters).
+static void putShortString (ArgWriter * pWriter, const char * pString)
+{
+    uint32_t len = strlen (pString);
+
+    if (len > 255)
+    {
+        pWriter->ok = false;
+    }
+    putUint (pWriter, len, 1);
+    putBytes (pWriter, pString, len);
+}
+
+// Write a long string (a four-byte length and the characters).
+static void putLongString (ArgWriter * pWriter, const char * pString, uint32_t len)
+{
+    putUint (pWriter, len, 4);
+    putBytes (pWriter, pString, len);
+}
+
+// Read an integer of numBytes bytes, most significant first.
+static uint64_t getUint (ArgReader * pReader, uint32_t numBytes)
+{
+    uint64_t value = 0;
+
+    if (pReader->ok && (pReader->pos + numBytes <= pReader->size))
+    {
+        for (uint32_t x = 0; x < numBytes; x++)
+        {
+            value = (value << 8) | (uint8_t) pReader->pBuf[pReader->pos + x];
+        }
+        pReader->pos += numBytes;
+    }
+    else
+    {
+        pReader->ok = false;
+    }
+
+    return value;
+}
+
+// Read a short string, returning a pointer to its characters and
+// putting its length in *pLen.
+static const char * getShortString (ArgReader * pReader, uint32_t * pLen)
+{
+    const char * pString = NULL;
+
+    *pLen = (uint32_t) getUint (pReader, 1);
+    if (pReader->ok && (pReader->pos + *pLen <= pReader->size))
+    {
+        pString = pReader->pBuf + pReader->pos;
+        pReader->pos += *pLen;
+    }
+    else
+    {
+        pReader->ok = false;
+        *pLen = 0;
+    }
+
+    return pString;
+}
+
+// Start reading the arguments of the method frame at pPayload, size
+// bytes long, putting its class and method in *pClassId and *pMethodId.
+static ArgReader startMethod (const char * pPayload, uint32_t size, uint16_t * pClassId, uint16_t * pMethodId)
+{
+    ArgReader reader = {pPayload, size, 0, true};
+
+    *pClassId = (uint16_t) getUint (&reader, 2);
+    *pMethodId = (uint16_t) getUint (&reader, 2);
+
+    return reader;
+}
+
+// ----------------------------------------------------------------
+// PROTECTED FUNCTIONS
+// ----------------------------------------------------------------
+
+// Send a method frame.
+bool AmqpClient::sendMethod (uint16_t channel, uint16_t classId, uint16_t methodId, const char * pArgs, uint32_t lenArgs)
+{
+    char header[AMQP_FRAME_HEADER_SIZE + 4];
+    char end = (char) AMQP_FRAME_END;
+    ArgWriter writer = {header, sizeof (header), 0, true};
+    TxSegment segments[3];
+
+    putUint (&writer, AMQP_FRAME_METHOD, 1);
+    putUint (&writer, channel, 2);
+    putUint (&writer, 4 + lenArgs, 4);
+    putUint (&writer, classId, 2);
+    putUint (&writer, methodId, 2);
+
+    // Header, arguments and end marker in one gathered write
+    segments[0].pBuf = header;
+    segments[0].len = writer.len;
+    segments[1].pBuf = pArgs;
+    segments[1].len = lenArgs;
+    segments[2].pBuf = &end;
+    segments[2].len = 1;
+
+    return flush() && gpTransport->transmitVector (segments, 3);
+}
+
+// Gather a frame to be written.
+bool AmqpClient::queueFrame (uint8_t type, uint16_t channel, const char * pPayload, uint32_t size)
+{
+    ArgWriter writer = {gpTxBuf, AMQP_TX_BUFFER_SIZE, 0, true};
+    bool success = true;
+
+    if (gTxLen + AMQP_FRAME_HEADER_SIZE + size + 1 > AMQP_TX_BUFFER_SIZE)
+    {
+        success = flush();
+    }
+    if (success)
+    {
+        writer.len = gTxLen;
+        putUint (&writer, type, 1);
+        putUint (&writer, channel, 2);
+        putUint (&writer, size, 4);
+        putBytes (&writer, pPayload, size);
+        putUint (&writer, AMQP_FRAME_END, 1);
+        success = writer.ok;
+        if (success)
+        {
+            gTxLen = writer.len;
+        }
+    }
+
+    return success;
+}
+
+// Read the next frame.
+bool AmqpClient::readFrame (Frame * pFrame, uint32_t timeoutMs)
+{
+    bool gotFrame = false;
+    bool stop = gFailed;
+    int64_t deadlineMs = getTimeMs() + timeoutMs;
+    int64_t waitMs;
+    uint32_t size;
+    uint32_t received;
+    const uint8_t * pHeader;
+
+    // The last frame returned is finished with
+    if (gRxStart == gRxEnd)
+    {
+        gRxStart = 0;
+        gRxEnd = 0;
+    }
+
+    while (!gotFrame && !stop)
+    {
+        if (gRxEnd - gRxStart >= AMQP_FRAME_HEADER_SIZE)
+        {
+            pHeader = (const uint8_t *) gpRxBuf + gRxStart;
+            size = ((uint32_t) pHeader[3] << 24) | ((uint32_t) pHeader[4] << 16) | ((uint32_t) pHeader[5] << 8) | pHeader[6];
+            if (size + AMQP_FRAME_HEADER_SIZE + 1 > AMQP_RX_BUFFER_SIZE / 2)
+            {
+                LOG_ERROR ("!!! AMQP frame of %u bytes is larger than agreed.\n", size);
+                gFailed = true;
+                stop = true;
+            }
+            else if (gRxEnd - gRxStart >= AMQP_FRAME_HEADER_SIZE + size + 1)
+            {
+                if ((uint8_t) gpRxBuf[gRxStart + AMQP_FRAME_HEADER_SIZE + size] == AMQP_FRAME_END)
+                {
+                    pFrame->type = pHeader[0];
+                    pFrame->channel = (uint16_t) ((pHeader[1] << 8) | pHeader[2]);
+                    pFrame->pPayload = gpRxBuf + gRxStart + AMQP_FRAME_HEADER_SIZE;
+                    pFrame->size = size;
+                    gRxStart += AMQP_FRAME_HEADER_SIZE + size + 1;
+                    gotFrame = true;
+                }
+                else
+                {
+                    LOG_ERROR ("!!! AMQP frame without an end marker.\n");
+                    gFailed = true;
+                    stop = true;
+                }
+            }
+        }
+
+        if (!gotFrame && !stop)
+        {
+            // Need more: make room behind what is here, then take
+            // whatever has arrived, in one go
+            if (gRxStart > 0)
+            {
+                memmove (gpRxBuf, gpRxBuf + gRxStart, gRxEnd - gRxStart);
+                gRxEnd -= gRxStart;
+                gRxStart = 0;
+            }
+            waitMs = deadlineMs - getTimeMs();
+            if (waitMs < 0)
+            {
+                waitMs = 0;
+            }
+            if (gpTransport->waitReadable ((uint32_t) waitMs))
+            {
+                received = gpTransport->receiveBuffer (gpRxBuf + gRxEnd, AMQP_RX_BUFFER_SIZE - gRxEnd);
+                if (received == 0)
+                {
+                    // Readable with nothing to read: the broker has gone
+                    LOG_ERROR ("!!! AMQP connection lost.\n");
+                    gFailed = true;
+                    stop = true;
+                }
+                gRxEnd += received;
+            }
+            else
+            {
+                stop = true;
+            }
+        }
+    }
+
+    if (gFailed)
+    {
+        gOpen = false;
+    }
+
+    return gotFrame;
+}
+
+// Wait for a method.
+bool AmqpClient::waitMethod (uint16_t channel, uint16_t classId, uint16_t methodId, Frame * pFrame, uint32_t timeoutMs)
+{
+    bool gotMethod = false;
+    bool stop = false;
+    int64_t deadlineMs = getTimeMs() + timeoutMs;
+    int64_t waitMs;
+    uint16_t frameClassId;
+    uint16_t frameMethodId;
+
+    while (!gotMethod && !stop)
+    {
+        waitMs = deadlineMs - getTimeMs();
+        if ((waitMs > 0) && readFrame (pFrame, (uint32_t) waitMs))
+        {
+            if (pFrame->type == AMQP_FRAME_METHOD)
+            {
+                startMethod (pFrame->pPayload, pFrame->size, &frameClassId, &frameMethodId);
+                if (handleClose (pFrame))
+                {
+                    stop = true;
+                }
+                else if ((pFrame->channel == channel) && (frameClassId == classId) && (frameMethodId == methodId))
+                {
+                    gotMethod = true;
+                }
+            }
+        }
+        else
+        {
+            if (!gFailed)
+            {
+                LOG_ERROR ("!!! No answer from the AMQP broker (waiting for %d.%d).\n", classId, methodId);
+            }
+            stop = true;
+        }
+    }
+
+    return gotMethod;
+}
+
+// Deal with a close from the broker.
+bool AmqpClient::handleClose (const Frame * pFrame)
+{
+    bool isClose = false;
+    uint16_t classId;
+    uint16_t methodId;
+    uint32_t replyCode;
+    const char * pReplyText;
+    uint32_t lenReplyText;
+    char args[AMQP_MAX_ARGS_SIZE];
+    ArgWriter writer = {args, sizeof (args), 0, true};
+    ArgReader reader = startMethod (pFrame->pPayload, pFrame->size, &classId, &methodId);
+
+    if (((classId == AMQP_CONNECTION) && (methodId == AMQP_CONNECTION_CLOSE)) ||
+        ((classId == AMQP_CHANNEL_CLASS) && (methodId == AMQP_CHANNEL_CLOSE)))
+    {
+        isClose = true;
+        replyCode = (uint32_t) getUint (&reader, 2);
+        pReplyText = getShortString (&reader, &lenReplyText);
+        if (replyCode != AMQP_REPLY_SUCCESS)
+        {
+            LOG_ERROR ("!!! AMQP broker closed the %s: %u %.*s.\n", (classId == AMQP_CONNECTION) ? "connection" : "channel",
+                       replyCode, (int) lenReplyText, (pReplyText != NULL) ? pReplyText : "");
+        }
+        if (classId == AMQP_CONNECTION)
+        {
+            sendMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_CLOSE_OK, NULL, 0);
+        }
+        else
+        {
+            // Without the channel there is nothing to do, so close the
+            // connection too
+            sendMethod (pFrame->channel, AMQP_CHANNEL_CLASS, AMQP_CHANNEL_CLOSE_OK, NULL, 0);
+            putUint (&writer, AMQP_REPLY_SUCCESS, 2);
+            putShortString (&writer, "");
+            putUint (&writer, 0, 2);
+            putUint (&writer, 0, 2);
+            sendMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_CLOSE, args, writer.len);
+        }
+        gOpen = false;
+        gFailed = true;
+    }
+
+    return isClose;
+}
+
+// Hand over the delivery in progress.
+void AmqpClient::completeDelivery (AmqpDelivery * pDelivery, char * pArena)
+{
+    pDelivery->deliveryTag = gDeliveryTag;
+    pDelivery->redelivered = gRedelivered;
+    if (gBodySize <= AMQP_MAX_BODY_SIZE)
+    {
+        memcpy (pArena, gpBody, (size_t) gBodySize);
+        pDelivery->pBody = pArena;
+        pDelivery->size = (uint32_t) gBodySize;
+    }
+    else
+    {
+        LOG_ERROR ("!!! AMQP message of %llu bytes is too long, only %d are allowed.\n",
+                   (unsigned long long) gBodySize, AMQP_MAX_BODY_SIZE);
+        pDelivery->pBody = NULL;
+        pDelivery->size = 0;
+    }
+    gInDelivery = false;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor.
+AmqpClient::AmqpClient (Transport * pTransport)
+{
+    gpTransport = pTransport;
+    gOpen = false;
+    gFailed = false;
+    gFrameMax = AMQP_FRAME_MAX;
+    gpRxBuf = new char[AMQP_RX_BUFFER_SIZE];
+    gRxStart = 0;
+    gRxEnd = 0;
+    gInDelivery = false;
+    gGotHeader = false;
+    gDeliveryTag = 0;
+    gRedelivered = false;
+    gpBody = new char[AMQP_MAX_BODY_SIZE];
+    gBodySize = 0;
+    gBodyReceived = 0;
+    gpTxBuf = new char[AMQP_TX_BUFFER_SIZE];
+    gTxLen = 0;
+    gPublishCount = 0;
+}
+
+// Destructor.
+AmqpClient::~AmqpClient ()
+{
+    delete[] gpRxBuf;
+    delete[] gpBody;
+    delete[] gpTxBuf;
+}
+
+// Open the connection and a channel.
+bool AmqpClient::open (const char * pUser, const char * pPassword, const char * pVhost, uint32_t timeoutMs)
+{
+    bool success;
+    Frame frame;
+    ArgReader reader;
+    uint16_t classId;
+    uint16_t methodId;
+    uint32_t versionMajor;
+    uint32_t versionMinor;
+    uint32_t channelMax;
+    uint32_t frameMax;
+    char args[AMQP_MAX_ARGS_SIZE];
+    char table[64];
+    char response[2 + 255 + 255];
+    ArgWriter writer = {args, sizeof (args), 0, true};
+    ArgWriter tableWriter = {table, sizeof (table), 0, true};
+    uint32_t lenUser = strlen (pUser);
+    uint32_t lenPassword = strlen (pPassword);
+
+    gFailed = false;
+    success = (lenUser <= 255) && (lenPassword <= 255) &&
+              gpTransport->transmitBuffer (AMQP_PROTOCOL_HEADER, sizeof (AMQP_PROTOCOL_HEADER) - 1) &&
+              waitMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_START, &frame, timeoutMs);
+    if (success)
+    {
+        reader = startMethod (frame.pPayload, frame.size, &classId, &methodId);
+        versionMajor = (uint32_t) getUint (&reader, 1);
+        versionMinor = (uint32_t) getUint (&reader, 1);
+        if ((versionMajor != 0) || (versionMinor != 9))
+        {
+            LOG_ERROR ("!!! AMQP broker speaks version %u-%u, not 0-9-1.\n", versionMajor, versionMinor);
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+        // Connection.StartOk: who we are and PLAIN credentials
+        putShortString (&tableWriter, "product");
+        putUint (&tableWriter, 'S', 1);
+        putLongString (&tableWriter, AMQP_PRODUCT, sizeof (AMQP_PRODUCT) - 1);
+        putLongString (&writer, table, tableWriter.len);
+        putShortString (&writer, "PLAIN");
+        response[0] = 0;
+        memcpy (response + 1, pUser, lenUser);
+        response[1 + lenUser] = 0;
+        memcpy (response + 2 + lenUser, pPassword, lenPassword);
+        putLongString (&writer, response, 2 + lenUser + lenPassword);
+        putShortString (&writer, "en_US");
+        success = writer.ok &&
+                  sendMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_START_OK, args, writer.len) &&
+                  waitMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_TUNE, &frame, timeoutMs);
+    }
+
+    if (success)
+    {
+        // Connection.TuneOk: the broker's channel limit, the smaller
+        // frame limit and no heartbeats
+        reader = startMethod (frame.pPayload, frame.size, &classId, &methodId);
+        channelMax = (uint32_t) getUint (&reader, 2);
+        frameMax = (uint32_t) getUint (&reader, 4);
+        gFrameMax = ((frameMax == 0) || (frameMax > AMQP_FRAME_MAX)) ? AMQP_FRAME_MAX : frameMax;
+        writer.len = 0;
+        putUint (&writer, channelMax, 2);
+        putUint (&writer, gFrameMax, 4);
+        putUint (&writer, 0, 2);
+        success = sendMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_TUNE_OK, args, writer.len);
+    }
+
+    if (success)
+    {
+        writer.len = 0;
+        putShortString (&writer, pVhost);
+        putShortString (&writer, "");
+        putUint (&writer, 0, 1);
+        success = writer.ok &&
+                  sendMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_OPEN, args, writer.len) &&
+                  waitMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_OPEN_OK, &frame, timeoutMs);
+    }
+
+    if (success)
+    {
+        writer.len = 0;
+        putShortString (&writer, "");
+        success = sendMethod (AMQP_CHANNEL, AMQP_CHANNEL_CLASS, AMQP_CHANNEL_OPEN, args, writer.len) &&
+                  waitMethod (AMQP_CHANNEL, AMQP_CHANNEL_CLASS, AMQP_CHANNEL_OPEN_OK, &frame, timeoutMs);
+    }
+
+    gOpen = success;
+    if (!success)
+    {
+        LOG_ERROR ("!!! Unable to open AMQP connection as %s to virtual host %s.\n", pUser, pVhost);
+    }
+
+    return success;
+}
+
+// Start consuming a queue.
+bool AmqpClient::consume (const char * pQueue, uint16_t prefetch, uint32_t timeoutMs)
+{
+    bool success = false;
+    Frame frame;
+    char args[AMQP_MAX_ARGS_SIZE];
+    ArgWriter writer = {args, sizeof (args), 0, true};
+
+    if (gOpen)
+    {
+        // Basic.Qos: the window of unacknowledged deliveries
+        putUint (&writer, 0, 4);
+        putUint (&writer, prefetch, 2);
+        putUint (&writer, 0, 1);
+        success = sendMethod (AMQP_CHANNEL, AMQP_BASIC, AMQP_BASIC_QOS, args, writer.len) &&
+                  waitMethod (AMQP_CHANNEL, AMQP_BASIC, AMQP_BASIC_QOS_OK, &frame, timeoutMs);
+        if (success)
+        {
+            // Basic.Consume: a tag chosen by the broker, with
+            // acknowledgements (no-ack clear) and no arguments
+            writer.len = 0;
+            putUint (&writer, 0, 2);
+            putShortString (&writer, pQueue);
+            putShortString (&writer, "");
+            putUint (&writer, 0, 1);
+            putUint (&writer, 0, 4);
+            success = writer.ok &&
+                      sendMethod (AMQP_CHANNEL, AMQP_BASIC, AMQP_BASIC_CONSUME, args, writer.len) &&
+                      waitMethod (AMQP_CHANNEL, AMQP_BASIC, AMQP_BASIC_CONSUME_OK, &frame, timeoutMs);
+        }
+        if (!success)
+        {
+            LOG_ERROR ("!!! Unable to consume AMQP queue %s.\n", pQueue);
+        }
+    }
+
+    return success;
+}
+
+// Take a batch of deliveries.
+uint32_t AmqpClient::receiveBatch (char * pArena, uint32_t lenArena, AmqpDelivery * pDeliveries,
+                                     uint32_t maxDeliveries, uint32_t timeoutMs)
+{
+    uint32_t numDeliveries = 0;
+    uint32_t used = 0;
+    uint32_t len;
+    uint16_t classId;
+    uint16_t methodId;
+    int64_t deadlineMs = getTimeMs() + timeoutMs;
+    int64_t waitMs;
+    bool done = false;
+    Frame frame;
+    ArgReader reader;
+
+    while (!done && gOpen)
+    {
+        // Only read on while a whole delivery would fit; once there is
+        // one, take only what has already arrived
+        waitMs = 0;
+        if (numDeliveries == 0)
+        {
+            waitMs = deadlineMs - getTimeMs();
+            if (waitMs < 0)
+            {
+                waitMs = 0;
+            }
+        }
+        if ((numDeliveries < maxDeliveries) && (lenArena - used >= AMQP_MAX_BODY_SIZE) &&
+            readFrame (&frame, (uint32_t) waitMs))
+        {
+            switch (frame.type)
+            {
+                case AMQP_FRAME_METHOD:
+                    reader = startMethod (frame.pPayload, frame.size, &classId, &methodId);
+                    if ((classId == AMQP_BASIC) && (methodId == AMQP_BASIC_DELIVER))
+                    {
+                        // Consumer tag, delivery tag, redelivered,
+                        // exchange, routing key
+                        getShortString (&reader, &len);
+                        gDeliveryTag = getUint (&reader, 8);
+                        gRedelivered = ((getUint (&reader, 1) & 0x01) != 0);
+                        gInDelivery = reader.ok;
+                        gGotHeader = false;
+                    }
+                    else
+                    {
+                        handleClose (&frame);
+                    }
+                break;
+                case AMQP_FRAME_HEADER:
+                    if (gInDelivery && !gGotHeader)
+                    {
+                        // Class, weight, body size; the properties
+                        // that follow are not needed
+                        reader = startMethod (frame.pPayload, frame.size, &classId, &methodId);
+                        gBodySize = getUint (&reader, 8);
+                        gBodyReceived = 0;
+                        gGotHeader = reader.ok;
+                        if (gGotHeader && (gBodySize == 0))
+                        {
+                            completeDelivery (&pDeliveries[numDeliveries], pArena + used);
+                            numDeliveries++;
+                        }
+                    }
+                break;
+                case AMQP_FRAME_BODY:
+                    if (gInDelivery && gGotHeader)
+                    {
+                        if (gBodyReceived + frame.size <= AMQP_MAX_BODY_SIZE)
+                        {
+                            memcpy (gpBody + gBodyReceived, frame.pPayload, frame.size);
+                        }
+                        gBodyReceived += frame.size;
+                        if (gBodyReceived >= gBodySize)
+                        {
+                            completeDelivery (&pDeliveries[numDeliveries], pArena + used);
+                            used += pDeliveries[numDeliveries].size;
+                            numDeliveries++;
+                        }
+                    }
+                break;
+                default:
+                    // Heartbeats are not asked for, but ignore them anyway
+                break;
+            }
+        }
+        else
+        {
+            done = true;
+        }
+    }
+
+    return numDeliveries;
+}
+
+// Put the channel in confirm mode.
+bool AmqpClient::confirmSelect (uint32_t timeoutMs)
+{
+    bool success = false;
+    Frame frame;
+    char noWait = 0;
+
+    if (gOpen)
+    {
+        gPublishCount = 0;
+        success = sendMethod (AMQP_CHANNEL, AMQP_CONFIRM, AMQP_CONFIRM_SELECT, &noWait, 1) &&
+                  waitMethod (AMQP_CHANNEL, AMQP_CONFIRM, AMQP_CONFIRM_SELECT_OK, &frame, timeoutMs);
+        if (!success)
+        {
+            LOG_ERROR ("!!! Unable to put AMQP channel in confirm mode.\n");
+        }
+    }
+
+    return success;
+}
+
+// Publish a message.
+uint64_t AmqpClient::publish (const char * pExchange, const char * pRoutingKey, const char * pBody, uint32_t size)
+{
+    bool success = gOpen;
+    char args[AMQP_MAX_ARGS_SIZE];
+    ArgWriter writer = {args, sizeof (args), 0, true};
+    uint32_t maxChunk = gFrameMax - AMQP_FRAME_HEADER_SIZE - 1;
+    uint32_t chunk;
+
+    if (maxChunk > AMQP_TX_BUFFER_SIZE - AMQP_FRAME_HEADER_SIZE - 1)
+    {
+        maxChunk = AMQP_TX_BUFFER_SIZE - AMQP_FRAME_HEADER_SIZE - 1;
+    }
+
+    // Basic.Publish: neither mandatory nor immediate
+    putUint (&writer, AMQP_BASIC, 2);
+    putUint (&writer, AMQP_BASIC_PUBLISH, 2);
+    putUint (&writer, 0, 2);
+    putShortString (&writer, pExchange);
+    putShortString (&writer, pRoutingKey);
+    putUint (&writer, 0, 1);
+    success = success && writer.ok && queueFrame (AMQP_FRAME_METHOD, AMQP_CHANNEL, args, writer.len);
+
+    // The content header: class, weight, body size and content type
+    writer.len = 0;
+    putUint (&writer, AMQP_BASIC, 2);
+    putUint (&writer, 0, 2);
+    putUint (&writer, size, 8);
+    putUint (&writer, AMQP_PROPERTY_CONTENT_TYPE, 2);
+    putShortString (&writer, AMQP_CONTENT_TYPE);
+    success = success && queueFrame (AMQP_FRAME_HEADER, AMQP_CHANNEL, args, writer.len);
+
+    // The body, in as many frames as it takes
+    while (success && (size > 0))
+    {
+        chunk = (size > maxChunk) ? maxChunk : size;
+        success = queueFrame (AMQP_FRAME_BODY, AMQP_CHANNEL, pBody, chunk);
+        pBody += chunk;
+        size -= chunk;
+    }
+
+    if (success)
+    {
+        gPublishCount++;
+    }
+    else
+    {
+        // Part of a message may have gone, so nothing more can
+        LOG_ERROR ("!!! Unable to publish AMQP message.\n");
+        gFailed = true;
+        gOpen = false;
+    }
+
+    return success ? gPublishCount : 0;
+}
+
+// Write what has been published.
+bool AmqpClient::flush ()
+{
+    bool success = !gFailed;
+
+    if (success && (gTxLen > 0))
+    {
+        success = gpTransport->transmitBuffer (gpTxBuf, gTxLen);
+        gTxLen = 0;
+        if (!success)
+        {
+            gFailed = true;
+            gOpen = false;
+        }
+    }
+
+    return success;
+}
+
+// Take a batch of publisher confirms.
+uint32_t AmqpClient::receiveConfirms (AmqpConfirm * pConfirms, uint32_t maxConfirms, uint32_t timeoutMs)
+{
+    uint32_t numConfirms = 0;
+    uint16_t classId;
+    uint16_t methodId;
+    int64_t deadlineMs = getTimeMs() + timeoutMs;
+    int64_t waitMs;
+    bool done = !flush();
+    Frame frame;
+    ArgReader reader;
+
+    while (!done && gOpen)
+    {
+        // Once there is one, take only what has already arrived
+        waitMs = 0;
+        if (numConfirms == 0)
+        {
+            waitMs = deadlineMs - getTimeMs();
+            if (waitMs < 0)
+            {
+                waitMs = 0;
+            }
+        }
+        if ((numConfirms < maxConfirms) && readFrame (&frame, (uint32_t) waitMs))
+        {
+            if (frame.type == AMQP_FRAME_METHOD)
+            {
+                reader = startMethod (frame.pPayload, frame.size, &classId, &methodId);
+                if ((classId == AMQP_BASIC) && ((methodId == AMQP_BASIC_ACK) || (methodId == AMQP_BASIC_NACK)))
+                {
+                    pConfirms[numConfirms].deliveryTag = getUint (&reader, 8);
+                    pConfirms[numConfirms].multiple = ((getUint (&reader, 1) & 0x01) != 0);
+                    pConfirms[numConfirms].ack = (methodId == AMQP_BASIC_ACK);
+                    if (reader.ok)
+                    {
+                        numConfirms++;
+                    }
+                }
+                else
+                {
+                    handleClose (&frame);
+                }
+            }
+        }
+        else
+        {
+            done = true;
+        }
+    }
+
+    return numConfirms;
+}
+
+// Acknowledge deliveries.
+bool AmqpClient::ack (uint64_t deliveryTag, bool multiple)
+{
+    char args[9];
+    ArgWriter writer = {args, sizeof (args), 0, true};
+
+    putUint (&writer, deliveryTag, 8);
+    putUint (&writer, multiple ? 1 : 0, 1);
+
+    return gOpen && sendMethod (AMQP_CHANNEL, AMQP_BASIC, AMQP_BASIC_ACK, args, writer.len);
+}
+
+// Close the connection.
+void AmqpClient::close ()
+{
+    Frame frame;
+    char args[AMQP_MAX_ARGS_SIZE];
+    ArgWriter writer = {args, sizeof (args), 0, true};
+
+    if (gOpen)
+    {
+        putUint (&writer, AMQP_REPLY_SUCCESS, 2);
+        putShortString (&writer, "");
+        putUint (&writer, 0, 2);
+        putUint (&writer, 0, 2);
+        if (sendMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_CLOSE, args, writer.len))
+        {
+            waitMethod (0, AMQP_CONNECTION, AMQP_CONNECTION_CLOSE_OK, &frame, AMQP_DEFAULT_TIMEOUT_MS);
+        }
+        gOpen = false;
+    }
+}
+
+// Return whether the connection is open.
+bool AmqpClient::isOpen ()
+{
+    return gOpen;
+}
+
+// End Of File
@@ -0,0 +1,200 @@
+// AMQP 0-9-1 client for NB-IoT native ingestion daemon
+
+#ifndef _AMQP_CLIENT_H_
+#define _AMQP_CLIENT_H_
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The largest frame asked for when tuning the connection
+#define AMQP_FRAME_MAX 131072
+
+// The longest message body kept; longer ones are returned empty
+#ifndef AMQP_MAX_BODY_SIZE
+# define AMQP_MAX_BODY_SIZE 16384
+#endif
+
+// The default time to wait for the broker to answer a command
+#define AMQP_DEFAULT_TIMEOUT_MS 5000
+
+// The size of the buffer in which published messages are gathered
+// before being written
+#ifndef AMQP_TX_BUFFER_SIZE
+# define AMQP_TX_BUFFER_SIZE 65536
+#endif
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// A message delivered by the broker.  pBody points into the arena
+// passed to AmqpClient::receiveBatch(); it is NULL, with size zero,
+// if the body was longer than AMQP_MAX_BODY_SIZE.
+typedef struct
+{
+    uint64_t deliveryTag;
+    const char * pBody;
+    uint32_t size;
+    bool redelivered;
+} AmqpDelivery;
+
+// A publisher confirm: the broker has taken responsibility for (ack
+// true) or has refused the message published with the sequence number
+// deliveryTag and, if multiple is true, every one before it not yet
+// confirmed.
+typedef struct
+{
+    uint64_t deliveryTag;
+    bool multiple;
+    bool ack;
+} AmqpConfirm;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// Just enough of an AMQP 0-9-1 client to consume one queue or to publish
+// with confirms: open a connection (PLAIN authentication, no heartbeats)
+// and a channel, then either set a prefetch window, start consuming with
+// explicit acknowledgement and take deliveries off the connection in
+// batches, acknowledging many at once with a single Basic.Ack, or put
+// the channel in confirm mode and publish many messages in one write,
+// collecting the broker's confirms as they come.  A connection is used
+// for one or the other, not both.  It runs over any Transport, so over a
+// TcpTransport for a broker or a LoopbackTransport for a model of one.
+// Not thread safe: one thread does everything.
+class AmqpClient
+{
+public:
+    // Constructor: pTransport, which must outlive this object, is already
+    // connected to the broker.
+    AmqpClient (Transport * pTransport);
+
+    // Destructor.
+    ~AmqpClient ();
+
+    // Open the connection, logging in as pUser with pPassword to virtual
+    // host pVhost, and then open a channel.  Returns true on success.
+    bool open (const char * pUser, const char * pPassword, const char * pVhost = "/",
+               uint32_t timeoutMs = AMQP_DEFAULT_TIMEOUT_MS);
+
+    // Start consuming pQueue, with up to prefetch deliveries not yet
+    // acknowledged (zero meaning no limit).  Returns true on success.
+    bool consume (const char * pQueue, uint16_t prefetch, uint32_t timeoutMs = AMQP_DEFAULT_TIMEOUT_MS);
+
+    // Wait up to timeoutMs for a delivery and then take as many more as
+    // have already arrived, up to maxDeliveries, writing them to
+    // pDeliveries and their bodies to pArena, which lenArena must be large
+    // enough to hold at least one of AMQP_MAX_BODY_SIZE.  Returns the
+    // number of deliveries.
+    uint32_t receiveBatch (char * pArena, uint32_t lenArena, AmqpDelivery * pDeliveries,
+                           uint32_t maxDeliveries, uint32_t timeoutMs);
+
+    // Acknowledge the delivery deliveryTag, and every one before it if
+    // multiple is true.  Returns true on success.
+    bool ack (uint64_t deliveryTag, bool multiple = true);
+
+    // Put the channel in confirm mode, so that every message published
+    // is confirmed by the broker.  Returns true on success.
+    bool confirmSelect (uint32_t timeoutMs = AMQP_DEFAULT_TIMEOUT_MS);
+
+    // Publish the message of size bytes at pBody, a JSON document, to the
+    // exchange pExchange with the routing key pRoutingKey.  It is only
+    // gathered with others to be written by flush() or
+    // receiveConfirms(), or when there is no room for more.  Returns the
+    // sequence number that its confirm will carry, counting from one, or
+    // zero on failure.
+    uint64_t publish (const char * pExchange, const char * pRoutingKey, const char * pBody, uint32_t size);
+
+    // Write the messages published but not yet written.  Returns true on
+    // success.
+    bool flush ();
+
+    // Write anything published, then wait up to timeoutMs for a confirm
+    // and take as many more as have already arrived, up to maxConfirms,
+    // writing them to pConfirms.  Returns the number of confirms.
+    uint32_t receiveConfirms (AmqpConfirm * pConfirms, uint32_t maxConfirms, uint32_t timeoutMs);
+
+    // Close the connection politely.
+    void close ();
+
+    // Return true if the connection is open, false once it has been
+    // closed by either end or has failed.
+    bool isOpen ();
+
+protected:
+    // A frame received; pPayload points into gpRxBuf and is valid until
+    // the next frame is read.
+    typedef struct
+    {
+        uint8_t type;
+        uint16_t channel;
+        const char * pPayload;
+        uint32_t size;
+    } Frame;
+
+    // The connection to the broker.
+    Transport * gpTransport;
+
+    // Whether the connection and channel are open, and whether the
+    // connection has failed (closed under us or broken the protocol).
+    bool gOpen;
+    bool gFailed;
+
+    // The largest frame agreed with the broker.
+    uint32_t gFrameMax;
+
+    // Received characters, from gRxStart to gRxEnd not yet made into
+    // frames.
+    char * gpRxBuf;
+    uint32_t gRxStart;
+    uint32_t gRxEnd;
+
+    // A delivery whose header or body has yet to arrive, which may span
+    // calls to receiveBatch(): its tag, its body so far, the size the
+    // header gave and how much has come.
+    bool gInDelivery;
+    bool gGotHeader;
+    uint64_t gDeliveryTag;
+    bool gRedelivered;
+    char * gpBody;
+    uint64_t gBodySize;
+    uint64_t gBodyReceived;
+
+    // Messages published and gathered to be written, gTxLen bytes of
+    // AMQP_TX_BUFFER_SIZE, and the number published.
+    char * gpTxBuf;
+    uint32_t gTxLen;
+    uint64_t gPublishCount;
+
+    // Add a frame of type on channel with the payload of size bytes at
+    // pPayload to those gathered in gpTxBuf.  Returns true on success.
+    bool queueFrame (uint8_t type, uint16_t channel, const char * pPayload, uint32_t size);
+
+    // Send a method frame on channel with classId and methodId and
+    // arguments pArgs, lenArgs bytes long, after anything published.
+    // Returns true on success.
+    bool sendMethod (uint16_t channel, uint16_t classId, uint16_t methodId, const char * pArgs, uint32_t lenArgs);
+
+    // Read the next frame into pFrame, waiting up to timeoutMs for it.
+    // Returns true if there is one.
+    bool readFrame (Frame * pFrame, uint32_t timeoutMs);
+
+    // Wait up to timeoutMs for the method classId/methodId on channel,
+    // putting its arguments in pFrame.  Returns false if something else
+    // is received that closes the connection, or on timeout.
+    bool waitMethod (uint16_t channel, uint16_t classId, uint16_t methodId, Frame * pFrame, uint32_t timeoutMs);
+
+    // Deal with a Connection.Close or Channel.Close from the broker in
+    // pFrame.  Returns true if that is what it was.
+    bool handleClose (const Frame * pFrame);
+
+    // Hand the delivery in progress to the batch at pDelivery, its body
+    // going to pArena.
+    void completeDelivery (AmqpDelivery * pDelivery, char * pArena);
+};
+
+#endif
+
+// End Of File
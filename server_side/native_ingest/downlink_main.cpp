@@ -0,0 +1,257 @@
+// This is a server-side downlink fan-out program for use with the u-blox
+// NB-IoT modules.  Where the C# example (server_side/Program.cs) sends
+// each line typed to one device and waits for it to go, this sends one
+// datagram, e.g. a configuration, to every device in a list through the
+// AMQP broker, at a paced rate and with many sends waiting for the
+// broker's confirms at once, and reports what became of each device's.
+// It should be used in conjunction with the client-side example code.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "platform.h"
+#include "utilities.h"
+#include "logging.h"
+#include "transport.h"
+#include "tcp_transport.h"
+#include "amqp_client.h"
+#include "downlink_scheduler.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The defaults for the command line
+#define DEFAULT_ADDRESS "127.0.0.1:5672"
+#define DEFAULT_USER "guest"
+#define DEFAULT_PASSWORD "guest"
+#define DEFAULT_VHOST "/"
+
+// The longest line in the file of devices
+#define MAX_LINE_LENGTH 256
+
+// How long service() waits each time round
+#define SERVICE_WAIT_MS 100
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+// Cleared by a signal to stop.
+static std::atomic<bool> gRunning(true);
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Print what became of a device's downlink.
+static void printStatus (void * pContext, const char * pUuid, DownlinkStatus status)
+{
+    (void) pContext;
+
+    printf ("%s %s\n", pUuid, (status == DOWNLINK_STATUS_CONFIRMED) ? "confirmed" : "failed");
+}
+
+// Stop on SIGINT or SIGTERM.
+static void signalHandler (int signal)
+{
+    (void) signal;
+    gRunning = false;
+}
+
+// Read the device UUIDs, one per line, from the file pFileName ("-"
+// meaning stdin) into pUuids.  Returns true on success.
+static bool readDevices (const char * pFileName, std::vector<std::string> * pUuids)
+{
+    char line[MAX_LINE_LENGTH];
+    uint32_t len;
+    FILE * pFile = (strcmp (pFileName, "-") == 0) ? stdin : fopen (pFileName, "r");
+
+    if (pFile != NULL)
+    {
+        while (fgets (line, sizeof (line), pFile) != NULL)
+        {
+            len = strlen (line);
+            while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r') || (line[len - 1] == ' ')))
+            {
+                len--;
+            }
+            if (len > 0)
+            {
+                pUuids->push_back (std::string (line, len));
+            }
+        }
+        if (pFile != stdin)
+        {
+            fclose (pFile);
+        }
+    }
+
+    return (pFile != NULL);
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+// Main accepts these command-line arguments, in any order:
+//
+// -a <host:port>: the AMQP broker (default DEFAULT_ADDRESS).
+// -u <user>, -p <password>: who to log in as (default guest/guest).
+// -V <vhost>: the virtual host (default DEFAULT_VHOST).
+// -f <file>: the devices, one UUID per line ("-" for stdin); required.
+// -d <string>: the datagram to send, as text, or
+// -x <hex>: the datagram to send, as hex; one of the two is required.
+// -r <n>: sends per second (default DOWNLINK_DEFAULT_RATE).
+// -w <n>: the most sends waiting for confirms (default
+// DOWNLINK_DEFAULT_MAX_IN_FLIGHT).
+// -v: print the outcome for each device.
+int main(int argc, char* argv[])
+{
+    bool success = true;
+    const char * pAddress = DEFAULT_ADDRESS;
+    const char * pUser = DEFAULT_USER;
+    const char * pPassword = DEFAULT_PASSWORD;
+    const char * pVhost = DEFAULT_VHOST;
+    const char * pFileName = NULL;
+    const char * pText = NULL;
+    const char * pHex = NULL;
+    uint32_t rate = DOWNLINK_DEFAULT_RATE;
+    uint32_t window = DOWNLINK_DEFAULT_MAX_IN_FLIGHT;
+    bool verbose = false;
+    char datagram[DOWNLINK_MAX_DATAGRAM_SIZE];
+    uint32_t size = 0;
+    std::vector<std::string> uuids;
+    std::vector<const char *> uuidPointers;
+    TcpTransport transport;
+    AmqpClient * pClient;
+    DownlinkScheduler * pScheduler;
+    uint32_t numQueued;
+    int64_t startMs;
+    int64_t elapsedMs;
+
+    // Check the command line parameters
+    for (int32_t x = 1; success && (x < argc); x++)
+    {
+        if (strcmp (argv[x], "-v") == 0)
+        {
+            verbose = true;
+        }
+        else if ((argv[x][0] == '-') && (argv[x][1] != 0) && (argv[x][2] == 0) && (x + 1 < argc) &&
+                 (strchr ("aupVfdxrw", argv[x][1]) != NULL))
+        {
+            x++;
+            switch (argv[x - 1][1])
+            {
+                case 'a':
+                    pAddress = argv[x];
+                break;
+                case 'u':
+                    pUser = argv[x];
+                break;
+                case 'p':
+                    pPassword = argv[x];
+                break;
+                case 'V':
+                    pVhost = argv[x];
+                break;
+                case 'f':
+                    pFileName = argv[x];
+                break;
+                case 'd':
+                    pText = argv[x];
+                break;
+                case 'x':
+                    pHex = argv[x];
+                break;
+                case 'r':
+                    rate = strtoul (argv[x], NULL, 0);
+                break;
+                case 'w':
+                    window = strtoul (argv[x], NULL, 0);
+                break;
+            }
+        }
+        else
+        {
+            printf ("!!! Unknown command-line parameter '%s'.\n", argv[x]);
+            success = false;
+        }
+    }
+
+    if (success && (pText != NULL) && (strlen (pText) <= sizeof (datagram)))
+    {
+        size = strlen (pText);
+        memcpy (datagram, pText, size);
+    }
+    else if (success && (pHex != NULL) && (strlen (pHex) / 2 <= sizeof (datagram)))
+    {
+        size = hexStringToBytes (pHex, strlen (pHex), datagram, sizeof (datagram));
+    }
+
+    if (!success || (pFileName == NULL) || (size == 0) || ((pText != NULL) && (pHex != NULL)) || (rate == 0) || (window == 0))
+    {
+        printf ("Usage:\n");
+        printf ("%s -f devices (-d text | -x hex) [-a host:port] [-u user] [-p password] [-V vhost] [-r rate] [-w window] [-v]\n", argv[0]);
+        printf ("...which sends the datagram given as text or hex (at most %d bytes) to each device\n", DOWNLINK_MAX_DATAGRAM_SIZE);
+        printf ("listed, one UUID per line, in the file devices (- for stdin) through the AMQP broker at\n");
+        printf ("host:port (default %s), rate a second (default %d) with up to window waiting\n", DEFAULT_ADDRESS, DOWNLINK_DEFAULT_RATE);
+        printf ("for the broker's confirms (default %d).  With -v it prints the outcome for each device.\n", DOWNLINK_DEFAULT_MAX_IN_FLIGHT);
+        return -1;
+    }
+
+    if (!readDevices (pFileName, &uuids))
+    {
+        printf ("!!! Unable to read devices from %s.\n", pFileName);
+        return -1;
+    }
+    for (uint32_t x = 0; x < uuids.size(); x++)
+    {
+        uuidPointers.push_back (uuids[x].c_str());
+    }
+
+    signal (SIGINT, signalHandler);
+    signal (SIGTERM, signalHandler);
+
+    if (!transport.connect (pAddress))
+    {
+        printf ("!!! Unable to connect to the AMQP broker at %s.\n", pAddress);
+        return -1;
+    }
+
+    pClient = new AmqpClient (&transport);
+    success = pClient->open (pUser, pPassword, pVhost) && pClient->confirmSelect();
+    if (success)
+    {
+        pScheduler = new DownlinkScheduler (pClient, rate, window, verbose ? printStatus : NULL, NULL);
+        numQueued = pScheduler->submit (uuidPointers.data(), uuidPointers.size(), datagram, size);
+        printf ("Sending %d byte(s) to %d device(s) (%d listed), %d a second.\n", size, numQueued,
+                (uint32_t) uuids.size(), rate);
+
+        startMs = getTimeMs();
+        while (gRunning && !pScheduler->isIdle() && pScheduler->service (SERVICE_WAIT_MS))
+        {
+        }
+        elapsedMs = getTimeMs() - startMs;
+
+        printf ("%d confirmed, %d failed, %d not sent, %d duplicate(s) left out, %d message(s) published in %d ms.\n",
+                pScheduler->getCount (DOWNLINK_STATUS_CONFIRMED), pScheduler->getCount (DOWNLINK_STATUS_FAILED),
+                pScheduler->getCount (DOWNLINK_STATUS_QUEUED) + pScheduler->getCount (DOWNLINK_STATUS_PUBLISHED),
+                pScheduler->getDuplicateCount(), pScheduler->getPublishCount(), (int32_t) elapsedMs);
+        success = (pScheduler->getCount (DOWNLINK_STATUS_CONFIRMED) == numQueued);
+        pClient->close();
+        delete pScheduler;
+    }
+
+    delete pClient;
+    transport.disconnect();
+
+    return success ? 0 : -1;
+}
+
+// End Of File
@@ -0,0 +1,442 @@
+// Downlink fan-out to many devices for NB-IoT native ingestion daemon
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "utilities.h"
+#include "logging.h"
+#include "transport.h"
+#include "amqp_client.h"
+#include "downlink_scheduler.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The length of a device UUID in its text form
+#define DOWNLINK_UUID_LENGTH 36
+
+// The most confirms dealt with in one go
+#define DOWNLINK_CONFIRM_BATCH 64
+
+// The most sends that the pacing lets build up while there is nothing
+// to send, as a number of milliseconds' worth
+#define DOWNLINK_MAX_BURST_MS 100
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Copy the UUID pUuid to pOut in lower case, NULL terminated.  Returns
+// true if it is a UUID.
+static bool normaliseUuid (const char * pUuid, char * pOut)
+{
+    bool valid = (strlen (pUuid) == DOWNLINK_UUID_LENGTH);
+    char c;
+
+    for (uint32_t x = 0; valid && (x < DOWNLINK_UUID_LENGTH); x++)
+    {
+        c = pUuid[x];
+        if ((c >= 'A') && (c <= 'F'))
+        {
+            c += 'a' - 'A';
+        }
+        if ((x == 8) || (x == 13) || (x == 18) || (x == 23))
+        {
+            valid = (c == '-');
+        }
+        else
+        {
+            valid = ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'f'));
+        }
+        pOut[x] = c;
+    }
+    pOut[valid ? DOWNLINK_UUID_LENGTH : 0] = 0;
+
+    return valid;
+}
+
+// ----------------------------------------------------------------
+// PROTECTED FUNCTIONS
+// ----------------------------------------------------------------
+
+// Move a device to a new status.
+void DownlinkScheduler::setStatus (const std::string * pUuid, Device * pDevice, DownlinkStatus status)
+{
+    gCounts[pDevice->status]--;
+    gCounts[status]++;
+    pDevice->status = status;
+    if ((gpHandler != NULL) && ((status == DOWNLINK_STATUS_CONFIRMED) || (status == DOWNLINK_STATUS_FAILED)))
+    {
+        gpHandler (gpContext, pUuid->c_str(), status);
+    }
+}
+
+// Let go of a payload.
+void DownlinkScheduler::releasePayload (Payload * pPayload)
+{
+    if (pPayload != NULL)
+    {
+        pPayload->references--;
+        if (pPayload->references == 0)
+        {
+            gPayloads.erase (*pPayload->pBytes);
+            delete pPayload;
+        }
+    }
+}
+
+// Queue a device to be sent a payload.
+void DownlinkScheduler::queueDevice (const std::string * pUuid, Device * pDevice, Payload * pPayload)
+{
+    if (pPayload != pDevice->pPayload)
+    {
+        pPayload->references++;
+        releasePayload (pDevice->pPayload);
+        pDevice->pPayload = pPayload;
+    }
+    pDevice->attempts = 0;
+    if (pDevice->status != DOWNLINK_STATUS_QUEUED)
+    {
+        setStatus (pUuid, pDevice, DOWNLINK_STATUS_QUEUED);
+        gQueue.push_back (std::make_pair (pUuid, pDevice));
+    }
+}
+
+// Deal with the outcome of a send.
+void DownlinkScheduler::settle (const InFlight * pInFlight, bool ack)
+{
+    Device * pDevice = pInFlight->pDevice;
+    Payload * pNextPayload = pDevice->pNextPayload;
+
+    if (!ack && (pDevice->attempts < DOWNLINK_MAX_ATTEMPTS))
+    {
+        // Try again, behind everything else
+        setStatus (pInFlight->pUuid, pDevice, DOWNLINK_STATUS_QUEUED);
+        gQueue.push_back (std::make_pair (pInFlight->pUuid, pDevice));
+    }
+    else
+    {
+        if (!ack)
+        {
+            LOG_WARNING ("WARNING: downlink to %s refused %d times, giving up.\n", pInFlight->pUuid->c_str(), pDevice->attempts);
+        }
+        setStatus (pInFlight->pUuid, pDevice, ack ? DOWNLINK_STATUS_CONFIRMED : DOWNLINK_STATUS_FAILED);
+        if (pNextPayload != NULL)
+        {
+            // Something else is due: it goes now
+            pDevice->pNextPayload = NULL;
+            queueDevice (pInFlight->pUuid, pDevice, pNextPayload);
+            releasePayload (pNextPayload);
+        }
+    }
+}
+
+// Mark everything queued or in flight as failed.
+void DownlinkScheduler::failAll ()
+{
+    while (!gInFlight.empty())
+    {
+        setStatus (gInFlight.front().pUuid, gInFlight.front().pDevice, DOWNLINK_STATUS_FAILED);
+        gInFlight.pop_front();
+    }
+    while (!gQueue.empty())
+    {
+        if (gQueue.front().second->status == DOWNLINK_STATUS_QUEUED)
+        {
+            setStatus (gQueue.front().first, gQueue.front().second, DOWNLINK_STATUS_FAILED);
+        }
+        gQueue.pop_front();
+    }
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor.
+DownlinkScheduler::DownlinkScheduler (AmqpClient * pClient, uint32_t ratePerSecond, uint32_t maxInFlight,
+                                      DownlinkStatusHandler pHandler, void * pContext)
+{
+    gpClient = pClient;
+    gRatePerSecond = (ratePerSecond > 0) ? ratePerSecond : 1;
+    gMaxInFlight = (maxInFlight > 0) ? maxInFlight : 1;
+    gpHandler = pHandler;
+    gpContext = pContext;
+    gCredit = 1000;
+    gCreditMs = getTimeMs();
+    memset (gCounts, 0, sizeof (gCounts));
+    gDuplicates = 0;
+    gPublished = 0;
+}
+
+// Destructor.
+DownlinkScheduler::~DownlinkScheduler ()
+{
+    for (std::unordered_map<std::string, Payload *>::iterator payload = gPayloads.begin();
+         payload != gPayloads.end(); payload++)
+    {
+        delete payload->second;
+    }
+}
+
+// Queue a payload for a set of devices.
+uint32_t DownlinkScheduler::submit (const char * const * ppUuids, uint32_t numDevices, const char * pPayload, uint32_t size)
+{
+    uint32_t numQueued = 0;
+    char uuid[DOWNLINK_UUID_LENGTH + 1];
+    char number[8];
+    Payload * pNew;
+    Device * pDevice;
+    std::unordered_map<std::string, Payload *>::iterator payload;
+    std::unordered_map<std::string, Device>::iterator device;
+
+    if (size > DOWNLINK_MAX_DATAGRAM_SIZE)
+    {
+        LOG_ERROR ("!!! Downlink datagram of %u bytes is too long, only %d are allowed.\n", size, DOWNLINK_MAX_DATAGRAM_SIZE);
+    }
+    else
+    {
+        // The payload is kept, and rendered, once
+        payload = gPayloads.find (std::string (pPayload, size));
+        if (payload == gPayloads.end())
+        {
+            pNew = new Payload;
+            payload = gPayloads.insert (std::make_pair (std::string (pPayload, size), pNew)).first;
+            pNew->pBytes = &payload->first;
+            pNew->references = 0;
+            snprintf (number, sizeof (number), "%d", DOWNLINK_ENDPOINT);
+            pNew->json = std::string ("\"endpoint\":") + number + ",\"payload\":[";
+            for (uint32_t x = 0; x < size; x++)
+            {
+                snprintf (number, sizeof (number), "%s%u", (x > 0) ? "," : "", (uint8_t) pPayload[x]);
+                pNew->json += number;
+            }
+            pNew->json += "]}";
+        }
+        // Held while the devices are gone through, so that it cannot be
+        // deleted by a device letting go of it
+        payload->second->references++;
+
+        for (uint32_t x = 0; x < numDevices; x++)
+        {
+            if (normaliseUuid (ppUuids[x], uuid))
+            {
+                device = gDevices.find (uuid);
+                if (device == gDevices.end())
+                {
+                    device = gDevices.insert (std::make_pair (std::string (uuid), Device())).first;
+                    device->second.status = DOWNLINK_STATUS_NONE;
+                    device->second.pPayload = NULL;
+                    device->second.pNextPayload = NULL;
+                    device->second.attempts = 0;
+                    gCounts[DOWNLINK_STATUS_NONE]++;
+                }
+                pDevice = &device->second;
+
+                if ((pDevice->pNextPayload == payload->second) ||
+                    ((pDevice->pNextPayload == NULL) && (pDevice->pPayload == payload->second) &&
+                     ((pDevice->status == DOWNLINK_STATUS_QUEUED) || (pDevice->status == DOWNLINK_STATUS_PUBLISHED))))
+                {
+                    // Already due this payload; once it is confirmed or
+                    // has failed it may be sent again
+                    gDuplicates++;
+                }
+                else
+                {
+                    if (pDevice->status == DOWNLINK_STATUS_PUBLISHED)
+                    {
+                        // Goes once the one on its way is done with
+                        payload->second->references++;
+                        releasePayload (pDevice->pNextPayload);
+                        pDevice->pNextPayload = payload->second;
+                    }
+                    else
+                    {
+                        queueDevice (&device->first, pDevice, payload->second);
+                    }
+                    numQueued++;
+                }
+            }
+            else
+            {
+                LOG_WARNING ("WARNING: \"%s\" is not a device UUID, left out.\n", ppUuids[x]);
+            }
+        }
+        releasePayload (payload->second);
+    }
+
+    return numQueued;
+}
+
+// Publish what is allowed and deal with confirms.
+bool DownlinkScheduler::service (uint32_t timeoutMs)
+{
+    AmqpConfirm confirms[DOWNLINK_CONFIRM_BATCH];
+    uint32_t numConfirms;
+    uint64_t sequence;
+    uint64_t maxCredit = (uint64_t) gRatePerSecond * DOWNLINK_MAX_BURST_MS;
+    int64_t nowMs = getTimeMs();
+    int64_t waitMs = timeoutMs;
+    const std::string * pUuid;
+    Device * pDevice;
+    int64_t creditWaitMs;
+    InFlight inFlight;
+    std::deque<InFlight>::iterator send;
+    bool done;
+
+    // Bring the pacing up to date; at least one send is always allowed
+    // to build up, however low the rate
+    gCredit += (uint64_t) (nowMs - gCreditMs) * gRatePerSecond;
+    gCreditMs = nowMs;
+    if (maxCredit < 1000)
+    {
+        maxCredit = 1000;
+    }
+    if (gCredit > maxCredit)
+    {
+        gCredit = maxCredit;
+    }
+
+    // Publish as many as are allowed, in one write
+    done = !gpClient->isOpen();
+    while (!done && !gQueue.empty() && (gInFlight.size() < gMaxInFlight) && (gCredit >= 1000))
+    {
+        pUuid = gQueue.front().first;
+        pDevice = gQueue.front().second;
+        gQueue.pop_front();
+        if (pDevice->status == DOWNLINK_STATUS_QUEUED)
+        {
+            gMessage.assign ("{\"command\":\"send\",\"device_uuid\":\"");
+            gMessage += *pUuid;
+            gMessage += "\",";
+            gMessage += pDevice->pPayload->json;
+            sequence = gpClient->publish (DOWNLINK_EXCHANGE, DOWNLINK_ROUTING_KEY, gMessage.data(), gMessage.size());
+            if (sequence > 0)
+            {
+                inFlight.sequence = sequence;
+                inFlight.pUuid = pUuid;
+                inFlight.pDevice = pDevice;
+                gInFlight.push_back (inFlight);
+                pDevice->attempts++;
+                setStatus (pUuid, pDevice, DOWNLINK_STATUS_PUBLISHED);
+                gCredit -= 1000;
+                gPublished++;
+            }
+            else
+            {
+                gQueue.push_front (std::make_pair (pUuid, pDevice));
+                done = true;
+            }
+        }
+    }
+
+    // Wait no longer than it takes for the next send to be allowed
+    if (!gQueue.empty() && (gInFlight.size() < gMaxInFlight) && (gCredit < 1000))
+    {
+        creditWaitMs = (int64_t) ((1000 - gCredit + gRatePerSecond - 1) / gRatePerSecond);
+        if (creditWaitMs < waitMs)
+        {
+            waitMs = creditWaitMs;
+        }
+    }
+
+    if (gInFlight.empty())
+    {
+        gpClient->flush();
+        if (!gQueue.empty())
+        {
+            sleepMs ((uint32_t) waitMs);
+        }
+    }
+    else
+    {
+        numConfirms = gpClient->receiveConfirms (confirms, DOWNLINK_CONFIRM_BATCH, (uint32_t) waitMs);
+        for (uint32_t x = 0; x < numConfirms; x++)
+        {
+            if (confirms[x].multiple)
+            {
+                // Everything up to it
+                while (!gInFlight.empty() && (gInFlight.front().sequence <= confirms[x].deliveryTag))
+                {
+                    inFlight = gInFlight.front();
+                    gInFlight.pop_front();
+                    settle (&inFlight, confirms[x].ack);
+                }
+            }
+            else
+            {
+                // Just it, which is usually the oldest
+                send = gInFlight.begin();
+                while ((send != gInFlight.end()) && (send->sequence != confirms[x].deliveryTag))
+                {
+                    send++;
+                }
+                if (send != gInFlight.end())
+                {
+                    inFlight = *send;
+                    gInFlight.erase (send);
+                    settle (&inFlight, confirms[x].ack);
+                }
+            }
+        }
+    }
+
+    if (!gpClient->isOpen())
+    {
+        failAll();
+    }
+
+    return gpClient->isOpen();
+}
+
+// Return true if there is nothing to do.
+bool DownlinkScheduler::isIdle ()
+{
+    return gQueue.empty() && gInFlight.empty();
+}
+
+// Return the status of a device's downlink.
+DownlinkStatus DownlinkScheduler::getStatus (const char * pUuid)
+{
+    DownlinkStatus status = DOWNLINK_STATUS_NONE;
+    char uuid[DOWNLINK_UUID_LENGTH + 1];
+    std::unordered_map<std::string, Device>::iterator device;
+
+    if (normaliseUuid (pUuid, uuid))
+    {
+        device = gDevices.find (uuid);
+        if (device != gDevices.end())
+        {
+            status = device->second.status;
+        }
+    }
+
+    return status;
+}
+
+// Return the number of devices in a status.
+uint32_t DownlinkScheduler::getCount (DownlinkStatus status)
+{
+    return gCounts[status];
+}
+
+// Return the number of sends left out as duplicates.
+uint32_t DownlinkScheduler::getDuplicateCount ()
+{
+    return gDuplicates;
+}
+
+// Return the number of messages published.
+uint32_t DownlinkScheduler::getPublishCount ()
+{
+    return gPublished;
+}
+
+// Return the number of distinct payloads held.
+uint32_t DownlinkScheduler::getPayloadCount ()
+{
+    return gPayloads.size();
+}
+
+// End Of File
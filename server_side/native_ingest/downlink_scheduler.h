@@ -0,0 +1,201 @@
+// Downlink fan-out to many devices for NB-IoT native ingestion daemon
+
+#ifndef _DOWNLINK_SCHEDULER_H_
+#define _DOWNLINK_SCHEDULER_H_
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// Where downlink messages are published and what they look like: the
+// "send" command of Neul.ServiceProvider.dll, a JSON object such as
+// {"command":"send","device_uuid":"2c2fb400-f1d5-11e5-8ed5-fdef214758f5",
+//  "endpoint":4,"payload":[72,101,108,108,111]}, 4 being the UART
+// endpoint of the module.
+#define DOWNLINK_EXCHANGE "nto"
+#define DOWNLINK_ROUTING_KEY "send"
+#define DOWNLINK_ENDPOINT 4
+
+// The largest downlink datagram
+#ifndef DOWNLINK_MAX_DATAGRAM_SIZE
+# define DOWNLINK_MAX_DATAGRAM_SIZE 512
+#endif
+
+// The number of times a send refused by the broker is tried before the
+// device is marked as failed
+#define DOWNLINK_MAX_ATTEMPTS 3
+
+// The defaults for the rate of sends per second, and for how many sends
+// may be waiting for the broker's confirm at once
+#define DOWNLINK_DEFAULT_RATE 1000
+#define DOWNLINK_DEFAULT_MAX_IN_FLIGHT 256
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// Where a device's downlink has got to.
+typedef enum
+{
+    DOWNLINK_STATUS_NONE,      // No downlink for this device
+    DOWNLINK_STATUS_QUEUED,    // Waiting its turn to be published
+    DOWNLINK_STATUS_PUBLISHED, // Published, waiting for the broker's confirm
+    DOWNLINK_STATUS_CONFIRMED, // The broker has taken it
+    DOWNLINK_STATUS_FAILED     // Refused DOWNLINK_MAX_ATTEMPTS times, or lost
+                               // with the connection
+} DownlinkStatus;
+
+// Called with pContext when the downlink to device pUuid reaches
+// DOWNLINK_STATUS_CONFIRMED or DOWNLINK_STATUS_FAILED.
+typedef void (*DownlinkStatusHandler) (void * pContext, const char * pUuid, DownlinkStatus status);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// Sends a downlink datagram to each of a set of devices, e.g. to push a
+// configuration to a fleet, through an AmqpClient in confirm mode.
+// Identical payloads are kept, and rendered as JSON, once however many
+// devices they go to, and a device that is already due the same payload
+// (queued, or published and not yet confirmed) is not sent it again.
+// Once that send is confirmed or has failed the payload may be sent
+// again, since a confirm from the broker does not mean the device has
+// it.  A different payload for a device whose last one is still on its
+// way is sent after it.  Sends are paced to a rate, so
+// as to stay within the limits of the network, and are pipelined:
+// many are published in one write, with up to a window of them waiting
+// for the broker's confirms, rather than each waiting for the one
+// before.  Nothing runs on its own: service() does the work.  Not thread
+// safe.
+class DownlinkScheduler
+{
+public:
+    // Constructor: sends go through pClient, which must be open and in
+    // confirm mode (AmqpClient::confirmSelect()) and must outlive this
+    // object, at up to ratePerSecond a second with at most maxInFlight
+    // waiting to be confirmed.  pHandler, with pContext, may be NULL.
+    DownlinkScheduler (AmqpClient * pClient, uint32_t ratePerSecond = DOWNLINK_DEFAULT_RATE,
+                       uint32_t maxInFlight = DOWNLINK_DEFAULT_MAX_IN_FLIGHT,
+                       DownlinkStatusHandler pHandler = NULL, void * pContext = NULL);
+
+    // Destructor.
+    ~DownlinkScheduler ();
+
+    // Queue the payload of size bytes at pPayload to be sent to each of
+    // the numDevices devices whose UUIDs are at ppUuids.  Returns the
+    // number of sends queued: a device already due this payload, or with
+    // a UUID that is not one, is left out.
+    uint32_t submit (const char * const * ppUuids, uint32_t numDevices, const char * pPayload, uint32_t size);
+
+    // Publish what the rate and the window allow, then wait up to
+    // timeoutMs for confirms and deal with them.  Returns false if the
+    // connection has failed, when everything not yet confirmed is
+    // marked as failed.
+    bool service (uint32_t timeoutMs);
+
+    // Return true if there is nothing queued or waiting to be confirmed.
+    bool isIdle ();
+
+    // Return the status of the latest downlink to device pUuid.
+    DownlinkStatus getStatus (const char * pUuid);
+
+    // Return the number of devices with a downlink in status.
+    uint32_t getCount (DownlinkStatus status);
+
+    // Return the number of sends left out as duplicates, of messages
+    // published (retries included) and of distinct payloads held.
+    uint32_t getDuplicateCount ();
+    uint32_t getPublishCount ();
+    uint32_t getPayloadCount ();
+
+protected:
+    // A distinct payload: its bytes (the key it is held under), the JSON
+    // rendering of it that ends every message carrying it and the number
+    // of devices that refer to it.
+    typedef struct
+    {
+        const std::string * pBytes;
+        std::string json;
+        uint32_t references;
+    } Payload;
+
+    // A device: the status of its latest downlink, the payload of that
+    // (NULL when there is none) and of the one to follow it, if any, and
+    // the number of times it has been tried.
+    typedef struct
+    {
+        DownlinkStatus status;
+        Payload * pPayload;
+        Payload * pNextPayload;
+        uint32_t attempts;
+    } Device;
+
+    // A send waiting for its confirm.
+    typedef struct
+    {
+        uint64_t sequence;
+        const std::string * pUuid;
+        Device * pDevice;
+    } InFlight;
+
+    // Where sends go.
+    AmqpClient * gpClient;
+
+    // What is told of each outcome.
+    DownlinkStatusHandler gpHandler;
+    void * gpContext;
+
+    // The payloads, by their bytes.
+    std::unordered_map<std::string, Payload *> gPayloads;
+
+    // The devices, by UUID.
+    std::unordered_map<std::string, Device> gDevices;
+
+    // Devices waiting to be published, oldest first.
+    std::deque<std::pair<const std::string *, Device *> > gQueue;
+
+    // Sends waiting for confirms, in the order published.
+    std::deque<InFlight> gInFlight;
+    uint32_t gMaxInFlight;
+
+    // The pacing: sends allowed per second, the sends that may be made
+    // now (in thousandths) and when that was last brought up to date.
+    uint32_t gRatePerSecond;
+    uint64_t gCredit;
+    int64_t gCreditMs;
+
+    // The number of devices in each status.
+    uint32_t gCounts[DOWNLINK_STATUS_FAILED + 1];
+
+    // Statistics.
+    uint32_t gDuplicates;
+    uint32_t gPublished;
+
+    // A message being built.
+    std::string gMessage;
+
+    // Move pDevice, pUuid, to status, keeping the counts, and tell the
+    // handler if it is an outcome.
+    void setStatus (const std::string * pUuid, Device * pDevice, DownlinkStatus status);
+
+    // Let go of pPayload, and delete it if no device refers to it.
+    void releasePayload (Payload * pPayload);
+
+    // Give pDevice, pUuid, pPayload to be sent next and queue it.
+    void queueDevice (const std::string * pUuid, Device * pDevice, Payload * pPayload);
+
+    // Deal with the outcome of the send in flight pInFlight: the broker
+    // took it if ack is true, otherwise it was refused.
+    void settle (const InFlight * pInFlight, bool ack);
+
+    // Mark everything queued or in flight as failed.
+    void failAll ();
+};
+
+#endif
+
+// End Of File
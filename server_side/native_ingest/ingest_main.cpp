@@ -0,0 +1,362 @@
+// This is a server-side ingestion daemon for use with the u-blox NB-IoT
+// modules.  Where the C# example (server_side/Program.cs) polls for one
+// message a second from one device, this consumes the whole uplink feed
+// from the AMQP broker, taking messages in batches and handing the
+// records in them to a handler per device on a pool of worker threads,
+// so that one process can take in a fleet of devices.  It decodes the
+// payload encodings and aggregates of the client side.  If the broker
+// cannot be reached, or the connection to it is lost, it tries again,
+// waiting longer each time.
+// It should be used in conjunction with the client-side example code.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <atomic>
+#include "platform.h"
+#include "utilities.h"
+#include "logging.h"
+#include "transport.h"
+#include "tcp_transport.h"
+#include "spsc_queue.h"
+#include "amqp_client.h"
+#include "ingest_router.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The defaults for the command line
+#define DEFAULT_ADDRESS "127.0.0.1:5672"
+#define DEFAULT_USER "guest"
+#define DEFAULT_PASSWORD "guest"
+#define DEFAULT_VHOST "/"
+#define DEFAULT_QUEUE "uplink"
+#define DEFAULT_NUM_WORKERS 4
+#define DEFAULT_BATCH 256
+
+// The most messages taken in one batch
+#define MAX_BATCH 4096
+
+// How long to wait for messages when all is quiet, and when there are
+// messages being handled whose acknowledgement the broker is waiting for
+#define IDLE_WAIT_MS 100
+#define ACK_WAIT_MS 1
+
+// How often to print statistics
+#define STATS_INTERVAL_MS 10000
+
+// How long to wait before trying the broker again after the first
+// failure, doubling with each failure after that up to the maximum
+#define RECONNECT_MIN_WAIT_MS 500
+#define RECONNECT_MAX_WAIT_MS 30000
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// The handler for one device: counts its records and bytes and, if
+// asked to, prints each record.
+class RecordPrinter : public DeviceHandler
+{
+public:
+    RecordPrinter (bool print)
+    {
+        gPrint = print;
+        gRecords = 0;
+        gBytes = 0;
+    }
+
+    ~RecordPrinter ()
+    {
+        if (gPrint)
+        {
+            printf ("[Device done: %llu record(s), %llu byte(s)]\n", (unsigned long long) gRecords, (unsigned long long) gBytes);
+        }
+    }
+
+    void handleRecord (const char * pUuid, const char * pRecord, uint32_t size)
+    {
+        gRecords++;
+        gBytes += size;
+        if (gPrint)
+        {
+            printf ("[Received datagram: %s, \"%.*s\"]\n", pUuid, (int) size, pRecord);
+        }
+    }
+
+protected:
+    bool gPrint;
+    uint64_t gRecords;
+    uint64_t gBytes;
+};
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+// Cleared by a signal to stop.
+static std::atomic<bool> gRunning(true);
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Make a handler for a device.
+static DeviceHandler * newHandler (void * pContext, const char * pUuid)
+{
+    (void) pUuid;
+
+    return new RecordPrinter (*((bool *) pContext));
+}
+
+// Stop on SIGINT or SIGTERM.
+static void signalHandler (int signal)
+{
+    (void) signal;
+    gRunning = false;
+}
+
+// Connect pTransport to the broker at pAddress, log in as pUser with
+// pPassword to pVhost and start consuming pQueue with prefetch.  Returns
+// the consumer, or NULL on failure.
+static AmqpClient * openConsumer (TcpTransport * pTransport, const char * pAddress,
+                                  const char * pUser, const char * pPassword, const char * pVhost,
+                                  const char * pQueue, uint16_t prefetch)
+{
+    AmqpClient * pConsumer = NULL;
+
+    if (pTransport->connect (pAddress))
+    {
+        pConsumer = new AmqpClient (pTransport);
+        if (!pConsumer->open (pUser, pPassword, pVhost) || !pConsumer->consume (pQueue, prefetch))
+        {
+            delete pConsumer;
+            pConsumer = NULL;
+            pTransport->disconnect();
+        }
+    }
+    else
+    {
+        printf ("!!! Unable to connect to the AMQP broker at %s.\n", pAddress);
+    }
+
+    return pConsumer;
+}
+
+// Print the statistics of pRouter, with the rate since startMs.
+static void printStats (IngestRouter * pRouter, int64_t startMs)
+{
+    int64_t elapsedMs = getTimeMs() - startMs;
+
+    printf ("%llu message(s), %llu record(s) from %u device(s), %llu malformed, %llu corrupt, %.0f message(s)/s.\n",
+            (unsigned long long) pRouter->getMessageCount(), (unsigned long long) pRouter->getRecordCount(),
+            pRouter->getDeviceCount(), (unsigned long long) pRouter->getMalformedCount(),
+            (unsigned long long) pRouter->getCorruptCount(),
+            (elapsedMs > 0) ? (double) pRouter->getMessageCount() * 1000 / elapsedMs : 0.0);
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+// Main accepts these command-line arguments, in any order:
+//
+// -a <host:port>: the AMQP broker (default DEFAULT_ADDRESS).
+// -u <user>, -p <password>: who to log in as (default guest/guest).
+// -V <vhost>: the virtual host (default DEFAULT_VHOST).
+// -q <queue>: the queue of uplink messages (default DEFAULT_QUEUE).
+// -w <n>: the number of worker threads (default DEFAULT_NUM_WORKERS).
+// -b <n>: the most messages taken in one batch (default DEFAULT_BATCH);
+// the broker is allowed twice this many unacknowledged.
+// -n <n>: exit after n messages (default 0, run until interrupted).
+// -v: print every record.
+//
+// It runs until it is interrupted or has taken n messages, connecting
+// to the broker again whenever the connection is lost.
+int main(int argc, char* argv[])
+{
+    bool success = true;
+    const char * pAddress = DEFAULT_ADDRESS;
+    const char * pUser = DEFAULT_USER;
+    const char * pPassword = DEFAULT_PASSWORD;
+    const char * pVhost = DEFAULT_VHOST;
+    const char * pQueue = DEFAULT_QUEUE;
+    uint32_t numWorkers = DEFAULT_NUM_WORKERS;
+    uint32_t batch = DEFAULT_BATCH;
+    uint64_t limit = 0;
+    bool verbose = false;
+    TcpTransport transport;
+    AmqpClient * pConsumer = NULL;
+    IngestRouter * pRouter;
+    AmqpDelivery * pDeliveries;
+    char * pArena;
+    uint32_t lenArena;
+    uint32_t numDeliveries;
+    uint64_t routedTag = 0;
+    uint64_t ackedTag = 0;
+    uint64_t completedTag;
+    uint64_t tagBase;
+    uint32_t reconnectWaitMs = RECONNECT_MIN_WAIT_MS;
+    int64_t startMs;
+    int64_t statsMs;
+
+    // Check the command line parameters
+    for (int32_t x = 1; success && (x < argc); x++)
+    {
+        if (strcmp (argv[x], "-v") == 0)
+        {
+            verbose = true;
+        }
+        else if ((argv[x][0] == '-') && (argv[x][1] != 0) && (argv[x][2] == 0) && (x + 1 < argc) &&
+                 (strchr ("aupVqwbn", argv[x][1]) != NULL))
+        {
+            x++;
+            switch (argv[x - 1][1])
+            {
+                case 'a':
+                    pAddress = argv[x];
+                break;
+                case 'u':
+                    pUser = argv[x];
+                break;
+                case 'p':
+                    pPassword = argv[x];
+                break;
+                case 'V':
+                    pVhost = argv[x];
+                break;
+                case 'q':
+                    pQueue = argv[x];
+                break;
+                case 'w':
+                    numWorkers = strtoul (argv[x], NULL, 0);
+                break;
+                case 'b':
+                    batch = strtoul (argv[x], NULL, 0);
+                break;
+                case 'n':
+                    limit = strtoull (argv[x], NULL, 0);
+                break;
+            }
+        }
+        else
+        {
+            printf ("!!! Unknown command-line parameter '%s'.\n", argv[x]);
+            success = false;
+        }
+    }
+
+    if (!success || (numWorkers == 0) || (batch == 0) || (batch > MAX_BATCH))
+    {
+        printf ("Usage:\n");
+        printf ("%s [-a host:port] [-u user] [-p password] [-V vhost] [-q queue] [-w workers] [-b batch] [-n messages] [-v]\n", argv[0]);
+        printf ("...which consumes uplink messages from queue (default %s) on the AMQP broker at\n", DEFAULT_QUEUE);
+        printf ("host:port (default %s) and hands them to a handler per device on a pool of\n", DEFAULT_ADDRESS);
+        printf ("worker threads (default %d), batch messages at a time (default %d, at most %d).\n", DEFAULT_NUM_WORKERS, DEFAULT_BATCH, MAX_BATCH);
+        printf ("With -n it exits after that many messages, with -v it prints every record.\n");
+        return -1;
+    }
+
+    signal (SIGINT, signalHandler);
+    signal (SIGTERM, signalHandler);
+
+    // Room for a whole batch of the longest messages
+    lenArena = batch * AMQP_MAX_BODY_SIZE;
+    pArena = new char[lenArena];
+    pDeliveries = new AmqpDelivery[batch];
+    pRouter = new IngestRouter (numWorkers, newHandler, &verbose);
+    startMs = getTimeMs();
+    statsMs = startMs + STATS_INTERVAL_MS;
+
+    while (gRunning && ((limit == 0) || (pRouter->getMessageCount() < limit)))
+    {
+        // Qos and Consume go again with each connection
+        pConsumer = openConsumer (&transport, pAddress, pUser, pPassword, pVhost, pQueue, (uint16_t) (batch * 2));
+        if (pConsumer != NULL)
+        {
+            printf ("Consuming %s on %s with %d worker(s), %d message(s) at a time.\n", pQueue, pAddress, numWorkers, batch);
+            reconnectWaitMs = RECONNECT_MIN_WAIT_MS;
+
+            // Delivery tags start again from one on each connection, while
+            // the router needs them to keep on rising: carry on from the
+            // last tag routed
+            tagBase = routedTag;
+
+            while (gRunning && pConsumer->isOpen() && ((limit == 0) || (pRouter->getMessageCount() < limit)))
+            {
+                // Look again soon if the broker is waiting to hear that
+                // messages have been handled before it sends more
+                numDeliveries = pConsumer->receiveBatch (pArena, lenArena, pDeliveries, batch,
+                                                         (routedTag > ackedTag) ? ACK_WAIT_MS : IDLE_WAIT_MS);
+                for (uint32_t x = 0; x < numDeliveries; x++)
+                {
+                    if (pDeliveries[x].pBody != NULL)
+                    {
+                        pRouter->route (tagBase + pDeliveries[x].deliveryTag, pDeliveries[x].pBody, pDeliveries[x].size);
+                    }
+                    else
+                    {
+                        // Too long to be an uplink message: drop it
+                        pRouter->route (tagBase + pDeliveries[x].deliveryTag, "", 0);
+                    }
+                    routedTag = tagBase + pDeliveries[x].deliveryTag;
+                }
+
+                // One acknowledgement for everything finished since last time
+                completedTag = pRouter->getCompletedTag();
+                if (completedTag > ackedTag)
+                {
+                    pConsumer->ack (completedTag - tagBase);
+                    ackedTag = completedTag;
+                }
+
+                if (getTimeMs() >= statsMs)
+                {
+                    printStats (pRouter, startMs);
+                    statsMs += STATS_INTERVAL_MS;
+                }
+            }
+
+            // Finish off what has been taken and acknowledge it; if the
+            // connection has been lost the broker delivers whatever was
+            // not acknowledged again, so those messages are handled twice
+            pRouter->drain();
+            completedTag = pRouter->getCompletedTag();
+            if ((completedTag > ackedTag) && pConsumer->isOpen())
+            {
+                pConsumer->ack (completedTag - tagBase);
+            }
+            ackedTag = completedTag;
+            pConsumer->close();
+            delete pConsumer;
+            transport.disconnect();
+        }
+
+        if (gRunning && ((limit == 0) || (pRouter->getMessageCount() < limit)))
+        {
+            printf ("WARNING: no connection to the AMQP broker at %s, trying again in %d ms.\n", pAddress, reconnectWaitMs);
+            for (uint32_t waitedMs = 0; gRunning && (waitedMs < reconnectWaitMs); waitedMs += IDLE_WAIT_MS)
+            {
+                sleepMs (IDLE_WAIT_MS);
+            }
+            reconnectWaitMs *= 2;
+            if (reconnectWaitMs > RECONNECT_MAX_WAIT_MS)
+            {
+                reconnectWaitMs = RECONNECT_MAX_WAIT_MS;
+            }
+        }
+    }
+
+    printStats (pRouter, startMs);
+
+    delete pRouter;
+    delete[] pDeliveries;
+    delete[] pArena;
+
+    return success ? 0 : -1;
+}
+
+// End Of File
@@ -0,0 +1,451 @@
+// Routing of uplink messages to device handlers for NB-IoT native ingestion daemon
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "utilities.h"
+#include "logging.h"
+#include "spsc_queue.h"
+#include "payload_codec.h"
+#include "ingest_router.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The most a compressed datagram can grow by when decoded: a two-byte
+// copy token becomes up to 18 bytes
+#define INGEST_MAX_EXPANSION 9
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Return the FNV-1a hash of the len characters at pData.
+static uint32_t getHash (const char * pData, uint32_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (uint32_t x = 0; x < len; x++)
+    {
+        hash ^= (uint8_t) pData[x];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Skip white space in the JSON at pJson, before pEnd.
+static const char * skipSpace (const char * pJson, const char * pEnd)
+{
+    while ((pJson < pEnd) && ((*pJson == ' ') || (*pJson == '\t') || (*pJson == '\r') || (*pJson == '\n')))
+    {
+        pJson++;
+    }
+
+    return pJson;
+}
+
+// Find the field pName in the JSON object of size bytes at pJson, a flat
+// one, as uplink messages are.  Returns a pointer to the first character
+// of its value, or NULL if it is not there.
+static const char * findField (const char * pJson, uint32_t size, const char * pName)
+{
+    const char * pValue = NULL;
+    const char * pEnd = pJson + size;
+    const char * pPosition = pJson;
+    uint32_t lenName = strlen (pName);
+
+    while ((pValue == NULL) && (pPosition + lenName + 2 < pEnd))
+    {
+        if ((pPosition[0] == '"') && (memcmp (pPosition + 1, pName, lenName) == 0) && (pPosition[lenName + 1] == '"'))
+        {
+            pPosition = skipSpace (pPosition + lenName + 2, pEnd);
+            if ((pPosition < pEnd) && (*pPosition == ':'))
+            {
+                pValue = skipSpace (pPosition + 1, pEnd);
+                if (pValue == pEnd)
+                {
+                    pValue = NULL;
+                }
+            }
+        }
+        else
+        {
+            pPosition++;
+        }
+    }
+
+    return pValue;
+}
+
+// Read the UUID, a JSON string, at pValue, before pEnd, into pUuid in
+// lower case.  Returns true if it is a UUID.
+static bool readUuid (const char * pValue, const char * pEnd, char * pUuid)
+{
+    bool valid = (pValue + INGEST_UUID_LENGTH + 2 <= pEnd) && (pValue[0] == '"') && (pValue[INGEST_UUID_LENGTH + 1] == '"');
+    char c;
+
+    for (uint32_t x = 0; valid && (x < INGEST_UUID_LENGTH); x++)
+    {
+        c = pValue[x + 1];
+        if ((c >= 'A') && (c <= 'F'))
+        {
+            c += 'a' - 'A';
+        }
+        if ((x == 8) || (x == 13) || (x == 18) || (x == 23))
+        {
+            valid = (c == '-');
+        }
+        else
+        {
+            valid = ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'f'));
+        }
+        pUuid[x] = c;
+    }
+    pUuid[INGEST_UUID_LENGTH] = 0;
+
+    return valid;
+}
+
+// Read the payload at pValue, before pEnd, either a JSON array of byte
+// values or a JSON string of hex digits, into pDatagram, of lenDatagram
+// bytes.  Returns the number of bytes read, or -1 if it is not a payload.
+static int32_t readPayload (const char * pValue, const char * pEnd, char * pDatagram, uint32_t lenDatagram)
+{
+    int32_t size = -1;
+    const char * pClose;
+    uint32_t value;
+    uint32_t digits;
+    uint32_t len = 0;
+    bool valid = true;
+    bool done = false;
+
+    if (*pValue == '"')
+    {
+        pClose = (const char *) memchr (pValue + 1, '"', pEnd - pValue - 1);
+        if ((pClose != NULL) && ((pClose - pValue - 1) / 2 <= (int32_t) lenDatagram))
+        {
+            size = (int32_t) hexStringToBytes (pValue + 1, pClose - pValue - 1, pDatagram, lenDatagram);
+        }
+    }
+    else if (*pValue == '[')
+    {
+        pValue = skipSpace (pValue + 1, pEnd);
+        if ((pValue < pEnd) && (*pValue == ']'))
+        {
+            done = true;
+        }
+        while (valid && !done)
+        {
+            value = 0;
+            digits = 0;
+            while ((pValue < pEnd) && (*pValue >= '0') && (*pValue <= '9') && (digits < 4))
+            {
+                value = value * 10 + (*pValue - '0');
+                digits++;
+                pValue++;
+            }
+            pValue = skipSpace (pValue, pEnd);
+            valid = (digits > 0) && (value <= 0xFF) && (len < lenDatagram) && (pValue < pEnd) &&
+                    ((*pValue == ',') || (*pValue == ']'));
+            if (valid)
+            {
+                pDatagram[len] = (char) value;
+                len++;
+                done = (*pValue == ']');
+                pValue = skipSpace (pValue + 1, pEnd);
+            }
+        }
+        if (valid)
+        {
+            size = (int32_t) len;
+        }
+    }
+
+    return size;
+}
+
+// ----------------------------------------------------------------
+// PROTECTED FUNCTIONS
+// ----------------------------------------------------------------
+
+// The body of a worker thread.
+void IngestRouter::workerThread (Worker * pWorker)
+{
+    const Message * pMessage;
+
+    while (gRunning.load() || (pWorker->pQueue->getCount() > 0))
+    {
+        pMessage = (const Message *) pWorker->pQueue->getReadRecord();
+        if (pMessage != NULL)
+        {
+            handleMessage (pWorker, pMessage);
+            pWorker->pQueue->pop();
+            pWorker->finished.fetch_add (1, std::memory_order_release);
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(pWorker->mutex);
+            pWorker->signal.wait_for(lock, std::chrono::milliseconds(INGEST_IDLE_WAIT_MS),
+                                     [this, pWorker] {return (pWorker->pQueue->getCount() > 0) || !gRunning.load();});
+        }
+    }
+}
+
+// Hand the records in a message to the device's handler.
+void IngestRouter::handleMessage (Worker * pWorker, const Message * pMessage)
+{
+    char decoded[INGEST_MAX_DATAGRAM_SIZE * INGEST_MAX_EXPANSION];
+    const char * pData = pMessage->datagram;
+    uint32_t size = pMessage->size;
+    uint32_t x;
+    uint32_t numRecords = 0;
+    bool valid = true;
+    bool aggregate = false;
+    DeviceHandler * pHandler;
+    std::unordered_map<std::string, DeviceHandler *>::iterator handler;
+
+    // Undo the encoding, which every datagram has, going by its header,
+    // which also says whether it is an aggregate
+    size = payloadDecode (pData, size, decoded, sizeof (decoded), &aggregate);
+    pData = decoded;
+    valid = (size > 0);
+
+    // Check that an aggregate splits into whole records before any of
+    // them are handled
+    if (valid && aggregate)
+    {
+        for (x = 0; x < size; x += 1 + (uint8_t) pData[x])
+        {
+            numRecords++;
+        }
+        valid = (x == size) && (numRecords > 0);
+    }
+
+    if (valid)
+    {
+        pWorker->key.assign (pMessage->uuid, INGEST_UUID_LENGTH);
+        handler = pWorker->handlers.find (pWorker->key);
+        if (handler == pWorker->handlers.end())
+        {
+            handler = pWorker->handlers.insert (std::make_pair (pWorker->key, gpFactory (gpContext, pMessage->uuid))).first;
+            pWorker->devices++;
+        }
+        pHandler = handler->second;
+
+        if (numRecords == 0)
+        {
+            numRecords = 1;
+            if (pHandler != NULL)
+            {
+                pHandler->handleRecord (pMessage->uuid, pData, size);
+            }
+        }
+        else if (pHandler != NULL)
+        {
+            for (x = 0; x < size; x += 1 + (uint8_t) pData[x])
+            {
+                pHandler->handleRecord (pMessage->uuid, pData + x + 1, (uint8_t) pData[x]);
+            }
+        }
+        pWorker->records += numRecords;
+    }
+    else
+    {
+        LOG_WARNING ("WARNING: corrupt datagram of %u bytes from %s dropped.\n", pMessage->size, pMessage->uuid);
+        pWorker->corrupt++;
+    }
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+// Constructor.
+IngestRouter::IngestRouter (uint32_t numWorkers, DeviceHandlerFactory pFactory, void * pContext)
+{
+    Worker * pWorker;
+
+    gNumWorkers = (numWorkers > 0) ? numWorkers : 1;
+    gpFactory = pFactory;
+    gpContext = pContext;
+    gRunning = true;
+    gCompletedTag = 0;
+    gMessages = 0;
+    gMalformed = 0;
+
+    gpWorkers = new Worker[gNumWorkers];
+    for (uint32_t x = 0; x < gNumWorkers; x++)
+    {
+        pWorker = &gpWorkers[x];
+        pWorker->pStorage = new Message[INGEST_QUEUE_LENGTH];
+        pWorker->pQueue = new SpscQueue (pWorker->pStorage, sizeof (Message), INGEST_QUEUE_LENGTH);
+        pWorker->queued = 0;
+        pWorker->finished = 0;
+        pWorker->records = 0;
+        pWorker->corrupt = 0;
+        pWorker->devices = 0;
+        pWorker->thread = std::thread(&IngestRouter::workerThread, this, pWorker);
+    }
+}
+
+// Destructor.
+IngestRouter::~IngestRouter ()
+{
+    Worker * pWorker;
+
+    drain();
+    gRunning = false;
+    for (uint32_t x = 0; x < gNumWorkers; x++)
+    {
+        pWorker = &gpWorkers[x];
+        {
+            std::lock_guard<std::mutex> lock(pWorker->mutex);
+        }
+        pWorker->signal.notify_one();
+        pWorker->thread.join();
+        for (std::unordered_map<std::string, DeviceHandler *>::iterator handler = pWorker->handlers.begin();
+             handler != pWorker->handlers.end(); handler++)
+        {
+            delete handler->second;
+        }
+        delete pWorker->pQueue;
+        delete[] pWorker->pStorage;
+    }
+    delete[] gpWorkers;
+}
+
+// Route a message.
+bool IngestRouter::route (uint64_t tag, const char * pBody, uint32_t size)
+{
+    bool routed = false;
+    const char * pEnd = pBody + size;
+    const char * pUuid = findField (pBody, size, INGEST_FIELD_UUID);
+    const char * pPayload = findField (pBody, size, INGEST_FIELD_PAYLOAD);
+    char uuid[INGEST_UUID_LENGTH + 1];
+    int32_t lenDatagram = -1;
+    Worker * pWorker = NULL;
+    Message * pMessage = NULL;
+    Pending pending;
+
+    if ((pUuid != NULL) && (pPayload != NULL) && readUuid (pUuid, pEnd, uuid))
+    {
+        pWorker = &gpWorkers[getHash (uuid, INGEST_UUID_LENGTH) % gNumWorkers];
+
+        // Wait for room, the worker being behind
+        while ((pMessage = (Message *) pWorker->pQueue->getWriteRecord()) == NULL)
+        {
+            std::this_thread::yield();
+        }
+        lenDatagram = readPayload (pPayload, pEnd, pMessage->datagram, sizeof (pMessage->datagram));
+    }
+
+    pending.tag = tag;
+    pending.pWorker = NULL;
+    pending.sequence = 0;
+    if (lenDatagram >= 0)
+    {
+        memcpy (pMessage->uuid, uuid, sizeof (pMessage->uuid));
+        pMessage->size = (uint32_t) lenDatagram;
+        pWorker->pQueue->push();
+        {
+            std::lock_guard<std::mutex> lock(pWorker->mutex);
+        }
+        pWorker->signal.notify_one();
+        pWorker->queued++;
+        pending.pWorker = pWorker;
+        pending.sequence = pWorker->queued;
+        routed = true;
+    }
+    else
+    {
+        LOG_WARNING ("WARNING: message %llu not understood, dropped: \"%.*s\".\n", (unsigned long long) tag,
+                     (int) ((size > 80) ? 80 : size), pBody);
+        gMalformed++;
+    }
+    gPending.push_back (pending);
+    gMessages++;
+
+    return routed;
+}
+
+// Return the tag up to which every message is done.
+uint64_t IngestRouter::getCompletedTag ()
+{
+    while (!gPending.empty() &&
+           ((gPending.front().pWorker == NULL) ||
+            (gPending.front().pWorker->finished.load (std::memory_order_acquire) >= gPending.front().sequence)))
+    {
+        gCompletedTag = gPending.front().tag;
+        gPending.pop_front();
+    }
+
+    return gCompletedTag;
+}
+
+// Wait until every message routed has been handled.
+void IngestRouter::drain ()
+{
+    for (uint32_t x = 0; x < gNumWorkers; x++)
+    {
+        while (gpWorkers[x].finished.load (std::memory_order_acquire) < gpWorkers[x].queued)
+        {
+            sleepMs (1);
+        }
+    }
+    getCompletedTag();
+}
+
+// Return the number of messages routed.
+uint64_t IngestRouter::getMessageCount ()
+{
+    return gMessages;
+}
+
+// Return the number of messages dropped as not understood.
+uint64_t IngestRouter::getMalformedCount ()
+{
+    return gMalformed;
+}
+
+// Return the number of datagrams dropped as corrupt.
+uint64_t IngestRouter::getCorruptCount ()
+{
+    uint64_t count = 0;
+
+    for (uint32_t x = 0; x < gNumWorkers; x++)
+    {
+        count += gpWorkers[x].corrupt.load();
+    }
+
+    return count;
+}
+
+// Return the number of records handled.
+uint64_t IngestRouter::getRecordCount ()
+{
+    uint64_t count = 0;
+
+    for (uint32_t x = 0; x < gNumWorkers; x++)
+    {
+        count += gpWorkers[x].records.load();
+    }
+
+    return count;
+}
+
+// Return the number of devices seen.
+uint32_t IngestRouter::getDeviceCount ()
+{
+    uint32_t count = 0;
+
+    for (uint32_t x = 0; x < gNumWorkers; x++)
+    {
+        count += gpWorkers[x].devices.load();
+    }
+
+    return count;
+}
+
+// End Of File
@@ -0,0 +1,188 @@
+// Routing of uplink messages to device handlers for NB-IoT native ingestion daemon
+
+#ifndef _INGEST_ROUTER_H_
+#define _INGEST_ROUTER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The names of the fields of an uplink message, a JSON object such as
+// {"device_uuid":"2c2fb400-f1d5-11e5-8ed5-fdef214758f5",
+//  "endpoint_uuid":"...","payload":[72,101,108,108,111]}; these are the
+// data members of the AmqpMessage that Neul.ServiceProvider.dll
+// deserialises, the payload being its byte array (or, as an alternative,
+// a string of hex digits).
+#define INGEST_FIELD_UUID "device_uuid"
+#define INGEST_FIELD_PAYLOAD "payload"
+
+// The length of a device UUID in its text form
+#define INGEST_UUID_LENGTH 36
+
+// The largest uplink datagram carried
+#ifndef INGEST_MAX_DATAGRAM_SIZE
+# define INGEST_MAX_DATAGRAM_SIZE 1024
+#endif
+
+// The number of messages that can wait for each worker; a power of two
+#ifndef INGEST_QUEUE_LENGTH
+# define INGEST_QUEUE_LENGTH 256
+#endif
+
+// The longest a worker with nothing to do sleeps before looking again
+#define INGEST_IDLE_WAIT_MS 10
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+// What is done with the records from one device.  Each device has its
+// own handler, which is only ever called from one worker thread, so
+// needs no locking of its own.
+class DeviceHandler
+{
+public:
+    virtual ~DeviceHandler () {}
+
+    // Handle the record of size bytes at pRecord, which came from the
+    // device pUuid; pRecord is only valid for the duration of the call.
+    virtual void handleRecord (const char * pUuid, const char * pRecord, uint32_t size) = 0;
+};
+
+// Called, on a worker thread, with pContext the first time a message
+// from device pUuid is seen.  Returns a handler for it, which the
+// IngestRouter deletes when it is destroyed, or NULL to ignore the
+// device.
+typedef DeviceHandler * (*DeviceHandlerFactory) (void * pContext, const char * pUuid);
+
+// Takes uplink messages from the consuming thread and hands the records
+// in them to per-device handlers on a pool of worker threads.  Devices
+// are shared out between workers by a hash of their UUID, so a device's
+// records are always handled by the same worker and in the order they
+// arrived.  The consuming thread finds the message, the device and the
+// datagram; the workers do the rest: undo the encoding from
+// payload_codec.h, split aggregates from uplink_aggregator.h and call
+// the handlers.  Because messages finish out of order across workers,
+// getCompletedTag() says up to where every message is done, for
+// acknowledging them all at once.  route(), getCompletedTag() and
+// drain() must all be called from the one consuming thread.
+class IngestRouter
+{
+public:
+    // Constructor: start numWorkers worker threads, with handlers made
+    // by pFactory with pContext.
+    IngestRouter (uint32_t numWorkers, DeviceHandlerFactory pFactory, void * pContext);
+
+    // Destructor: finish the messages already routed, stop the workers
+    // and delete the handlers.
+    ~IngestRouter ();
+
+    // Route the message of size bytes at pBody, identified by tag (which
+    // must be larger than that of any message routed before), to the
+    // worker for its device, waiting for room if that worker is behind.
+    // A message that cannot be understood is dropped, and is complete at
+    // once.  Returns true if the message was routed.
+    bool route (uint64_t tag, const char * pBody, uint32_t size);
+
+    // Return the largest tag such that it, and every message routed
+    // before it, is completely handled; zero if there is none.
+    uint64_t getCompletedTag ();
+
+    // Wait until every message routed has been handled.
+    void drain ();
+
+    // Return the number of messages routed, of messages dropped because
+    // they were not understood, of datagrams dropped because they were
+    // corrupt, of records handled and of devices seen.
+    uint64_t getMessageCount ();
+    uint64_t getMalformedCount ();
+    uint64_t getCorruptCount ();
+    uint64_t getRecordCount ();
+    uint32_t getDeviceCount ();
+
+protected:
+    // A message on its way to a worker.
+    typedef struct
+    {
+        char uuid[INGEST_UUID_LENGTH + 1];
+        uint32_t size;
+        char datagram[INGEST_MAX_DATAGRAM_SIZE];
+    } Message;
+
+    // A worker thread and what it owns.
+    typedef struct
+    {
+        // Messages for the worker, written by the consuming thread.
+        Message * pStorage;
+        SpscQueue * pQueue;
+
+        // Used to wake the worker when a message is queued.
+        std::mutex mutex;
+        std::condition_variable signal;
+
+        // The number of messages queued, only used by the consuming
+        // thread, and the number the worker has finished with.
+        uint64_t queued;
+        std::atomic<uint64_t> finished;
+
+        // The handlers of the worker's devices, by UUID, and a key kept
+        // for looking them up without allocating each time.
+        std::unordered_map<std::string, DeviceHandler *> handlers;
+        std::string key;
+
+        // What the worker has done, for the statistics.
+        std::atomic<uint64_t> records;
+        std::atomic<uint64_t> corrupt;
+        std::atomic<uint32_t> devices;
+
+        std::thread thread;
+    } Worker;
+
+    // A message routed but perhaps not yet finished: its tag, its worker
+    // (NULL if it was dropped) and the value the worker's finished count
+    // reaches once it is done.
+    typedef struct
+    {
+        uint64_t tag;
+        Worker * pWorker;
+        uint64_t sequence;
+    } Pending;
+
+    // The workers.
+    Worker * gpWorkers;
+    uint32_t gNumWorkers;
+
+    // Where handlers come from.
+    DeviceHandlerFactory gpFactory;
+    void * gpContext;
+
+    // Set to false to ask the workers to exit.
+    std::atomic<bool> gRunning;
+
+    // Messages routed, oldest first, and the newest tag known complete.
+    std::deque<Pending> gPending;
+    uint64_t gCompletedTag;
+
+    // Counts kept by the consuming thread.
+    uint64_t gMessages;
+    uint64_t gMalformed;
+
+    // The body of a worker thread.
+    void workerThread (Worker * pWorker);
+
+    // Hand the records in the datagram of message pMessage to the
+    // worker pWorker's handler for its device.
+    void handleMessage (Worker * pWorker, const Message * pMessage);
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,731 @@
+// AMQP broker stand-in for NB-IoT native ingestion daemon
+//
+// Listens on a TCP port and, to the first client that connects, behaves
+// like an AMQP 0-9-1 broker with one queue full of uplink messages, so
+// that nbiot_ingest can be run and load tested without a broker or the
+// network behind it, and that takes downlink messages from
+// nbiot_downlink, confirming them.  It speaks the server side of just
+// what AmqpClient uses:
+//
+// Connection.Start/StartOk/Tune/TuneOk/Open/OpenOk/Close/CloseOk
+// Channel.Open/OpenOk
+// Basic.Qos/QosOk, Basic.Consume/ConsumeOk, Basic.Deliver, Basic.Ack
+// Confirm.Select/SelectOk, Basic.Publish, Basic.Ack/Nack
+//
+// Messages are JSON like those of the real service, for devices with
+// made-up UUIDs; their payloads are a mix of the client side's stored,
+// compressed (payload_codec.h) and aggregated (uplink_aggregator.h)
+// datagrams, as byte arrays or hex strings.  No more are outstanding than
+// the client's prefetch allows and they go as fast as it acknowledges
+// them.  Messages published are confirmed with one Basic.Ack for all
+// those in each read from the client, less any chosen at random to be
+// refused with a Basic.Nack.  The address listened on is printed on
+// stdout, on a line of its own; the number of messages, records and
+// devices that went out, which the client should account for, and of
+// messages published, goes to stderr on exit.
+// Linux only.
+//
+// Usage: amqp_standin [options], where options are:
+//   -p <port>  the port to listen on, on 127.0.0.1 (default 5673)
+//   -n <n>     the number of messages in the queue (default 10000)
+//   -d <n>     the number of devices they come from (default 1000)
+//   -m <pct>   the percentage of messages that are not uplink messages
+//              at all, to be dropped (default 0)
+//   -k <pct>   the percentage of messages published that are refused
+//              (default 0)
+//   -S <n>     random number seed, for repeatable runs (default 1)
+//   -v         print every frame received and sent on stderr
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <string>
+#include <unordered_set>
+#include "utilities.h"
+#include "payload_codec.h"
+
+// ----------------------------------------------------------------
+// COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+// The largest frame allowed either way
+#define STANDIN_FRAME_MAX 131072
+
+// The size of the buffers either way
+#define STANDIN_RX_BUFFER_SIZE (STANDIN_FRAME_MAX * 2)
+#define STANDIN_TX_BUFFER_SIZE (1024 * 1024)
+
+// The longest message and the room it needs, in frames, to go out
+#define STANDIN_MAX_MESSAGE 4096
+#define STANDIN_MAX_DELIVERY (STANDIN_MAX_MESSAGE + 256)
+
+// The longest datagram and record made up, the most records in an
+// aggregate being as many as are sure to fit
+#define STANDIN_MAX_DATAGRAM 256
+#define STANDIN_MAX_RECORD 48
+#define STANDIN_MAX_AGGREGATE ((STANDIN_MAX_DATAGRAM - 1) / (STANDIN_MAX_RECORD + 1))
+
+// The frame end marker
+#define STANDIN_FRAME_END 0xCE
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// The configuration, from the command line.
+typedef struct
+{
+    uint32_t port;
+    uint32_t numMessages;
+    uint32_t numDevices;
+    uint32_t malformedPercent;
+    uint32_t nackPercent;
+    uint32_t seed;
+    bool verbose;
+} Config;
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+static Config gConfig = {5673, 10000, 1000, 0, 0, 1, false};
+static int gFd = -1;
+static char gRxBuf[STANDIN_RX_BUFFER_SIZE];
+static uint32_t gRxLen = 0;
+static char gTxBuf[STANDIN_TX_BUFFER_SIZE];
+static uint32_t gTxStart = 0;
+static uint32_t gTxEnd = 0;
+static uint32_t gRandom = 1;
+static volatile sig_atomic_t gStop = 0;
+
+// The protocol state
+static bool gStarted = false;
+static bool gConsuming = false;
+static bool gClosed = false;
+static uint32_t gPrefetch = 0;
+static uint64_t gAckedTag = 0;
+
+// The message being published and the state of publisher confirms
+static bool gConfirming = false;
+static bool gPublishing = false;
+static char gPublishBuf[STANDIN_MAX_MESSAGE];
+static uint64_t gPublishSize = 0;
+static uint32_t gPublishLen = 0;
+static uint64_t gPublishTag = 0;
+static uint64_t gConfirmTag = 0;
+
+// Statistics
+static uint32_t gMessages = 0;
+static uint32_t gRecords = 0;
+static uint32_t gMalformed = 0;
+static uint32_t gAcks = 0;
+static bool * gpDeviceSeen = NULL;
+static uint32_t gDevices = 0;
+static uint32_t gNacks = 0;
+static uint32_t gBadPublishes = 0;
+static std::unordered_set<std::string> gPublishDevices;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+static void signalHandler(int signal)
+{
+    (void) signal;
+    gStop = 1;
+}
+
+// A small repeatable random number generator (xorshift32).
+static uint32_t nextRandom(void)
+{
+    gRandom ^= gRandom << 13;
+    gRandom ^= gRandom >> 17;
+    gRandom ^= gRandom << 5;
+
+    return gRandom;
+}
+
+// Write an integer of numBytes bytes, most significant first, to pBuf,
+// returning the number of bytes written.
+static uint32_t putUint(char * pBuf, uint64_t value, uint32_t numBytes)
+{
+    for (uint32_t x = 0; x < numBytes; x++)
+    {
+        pBuf[x] = (char) (value >> ((numBytes - 1 - x) * 8));
+    }
+
+    return numBytes;
+}
+
+// Write a short string to pBuf, returning the number of bytes written.
+static uint32_t putShortString(char * pBuf, const char * pString)
+{
+    uint32_t len = strlen(pString);
+
+    pBuf[0] = (char) len;
+    memcpy(pBuf + 1, pString, len);
+
+    return 1 + len;
+}
+
+// Read an integer of numBytes bytes, most significant first.
+static uint64_t getUint(const char * pBuf, uint32_t numBytes)
+{
+    uint64_t value = 0;
+
+    for (uint32_t x = 0; x < numBytes; x++)
+    {
+        value = (value << 8) | (uint8_t) pBuf[x];
+    }
+
+    return value;
+}
+
+// Queue a frame of the given type on channel with the payload of size
+// bytes at pPayload.
+static void queueFrame(uint8_t type, uint16_t channel, const char * pPayload, uint32_t size)
+{
+    char * pFrame = gTxBuf + gTxEnd;
+
+    if (gTxEnd + size + 8 > sizeof (gTxBuf))
+    {
+        // Make room behind what is still to be written
+        memmove(gTxBuf, gTxBuf + gTxStart, gTxEnd - gTxStart);
+        gTxEnd -= gTxStart;
+        gTxStart = 0;
+        pFrame = gTxBuf + gTxEnd;
+    }
+    if (gTxEnd + size + 8 <= sizeof (gTxBuf))
+    {
+        pFrame[0] = (char) type;
+        putUint(pFrame + 1, channel, 2);
+        putUint(pFrame + 3, size, 4);
+        memcpy(pFrame + 7, pPayload, size);
+        pFrame[7 + size] = (char) STANDIN_FRAME_END;
+        gTxEnd += size + 8;
+        if (gConfig.verbose)
+        {
+            fprintf(stderr, "-> type %d, channel %d, %d byte(s)\n", type, channel, size);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "WARNING: stand-in output buffer full, frame lost.\n");
+    }
+}
+
+// Queue a method on channel with the arguments of lenArgs bytes at pArgs.
+static void queueMethod(uint16_t channel, uint16_t classId, uint16_t methodId, const char * pArgs, uint32_t lenArgs)
+{
+    char payload[1024];
+
+    putUint(payload, classId, 2);
+    putUint(payload + 2, methodId, 2);
+    if (lenArgs > 0)
+    {
+        memcpy(payload + 4, pArgs, lenArgs);
+    }
+    queueFrame(1, channel, payload, 4 + lenArgs);
+}
+
+// Make up a record, returning its length.
+static uint32_t newRecord(char * pRecord, uint32_t sequence)
+{
+    int32_t temperature = (int32_t) (nextRandom() % 400) - 100;
+
+    return (uint32_t) snprintf(pRecord, STANDIN_MAX_RECORD, "{\"seq\":%u,\"temp\":%d.%d,\"battery\":3.%u}",
+                               sequence, temperature / 10, abs(temperature % 10), nextRandom() % 10);
+}
+
+// Make up an uplink message from a random device, returning its length.
+static uint32_t newMessage(char * pMessage)
+{
+    char records[STANDIN_MAX_DATAGRAM];
+    char datagram[STANDIN_MAX_DATAGRAM + 1];
+    uint32_t device = nextRandom() % gConfig.numDevices;
+    uint32_t kind = nextRandom() % 4;
+    uint32_t numRecords = 1;
+    uint32_t size = 0;
+    uint32_t len;
+    uint32_t recordLen;
+
+    if ((gConfig.malformedPercent > 0) && ((nextRandom() % 100) < gConfig.malformedPercent))
+    {
+        gMalformed++;
+        return (uint32_t) snprintf(pMessage, STANDIN_MAX_MESSAGE, "{\"command\":\"status\",\"seq\":%u}", gMessages);
+    }
+
+    if (kind == 3)
+    {
+        // An aggregate of several records, compressed or not
+        numRecords = 2 + nextRandom() % (STANDIN_MAX_AGGREGATE - 1);
+        for (uint32_t x = 0; x < numRecords; x++)
+        {
+            recordLen = newRecord(records + size + 1, gRecords + x);
+            records[size] = (char) recordLen;
+            size += 1 + recordLen;
+        }
+        size = payloadEncode(records, size, datagram, sizeof (datagram), (nextRandom() % 2) != 0, true);
+    }
+    else
+    {
+        // One record, stored or, where that helps, compressed
+        size = newRecord(records, gRecords);
+        size = payloadEncode(records, size, datagram, sizeof (datagram), kind == 2);
+    }
+    gRecords += numRecords;
+    if (!gpDeviceSeen[device])
+    {
+        gpDeviceSeen[device] = true;
+        gDevices++;
+    }
+
+    len = (uint32_t) snprintf(pMessage, STANDIN_MAX_MESSAGE,
+                              "{\"device_uuid\":\"%08x-0000-4000-8000-%012x\",\"endpoint_uuid\":\"%08x-0000-4000-8000-000000000004\","
+                              "\"device_name\":\"device %u\",\"payload\":", device, device, device, device);
+    if (gMessages % 2)
+    {
+        // As hex
+        pMessage[len] = '"';
+        len++;
+        len += bytesToHexString(datagram, size, pMessage + len, STANDIN_MAX_MESSAGE - len);
+        pMessage[len] = '"';
+        len++;
+    }
+    else
+    {
+        // As a byte array, the way a .NET data contract has it
+        for (uint32_t x = 0; x < size; x++)
+        {
+            len += snprintf(pMessage + len, STANDIN_MAX_MESSAGE - len, "%c%u", (x == 0) ? '[' : ',', (uint8_t) datagram[x]);
+        }
+        len += snprintf(pMessage + len, STANDIN_MAX_MESSAGE - len, "%s", (size == 0) ? "[]" : "]");
+    }
+    len += snprintf(pMessage + len, STANDIN_MAX_MESSAGE - len, "}");
+
+    return len;
+}
+
+// Queue the next message as a Basic.Deliver, a content header and a body.
+static void queueDelivery(void)
+{
+    char message[STANDIN_MAX_MESSAGE];
+    char args[64];
+    uint32_t len = 0;
+    uint32_t size = newMessage(message);
+
+    gMessages++;
+
+    // Consumer tag, delivery tag, redelivered, exchange, routing key
+    len += putShortString(args + len, "ctag-1");
+    len += putUint(args + len, gMessages, 8);
+    len += putUint(args + len, 0, 1);
+    len += putShortString(args + len, "");
+    len += putShortString(args + len, "uplink");
+    queueMethod(1, 60, 60, args, len);
+
+    // Class, weight, body size and a content type property
+    len = 0;
+    len += putUint(args + len, 60, 2);
+    len += putUint(args + len, 0, 2);
+    len += putUint(args + len, size, 8);
+    len += putUint(args + len, 0x8000, 2);
+    len += putShortString(args + len, "application/json");
+    queueFrame(2, 1, args, len);
+
+    queueFrame(3, 1, message, size);
+}
+
+// Deal with a message published, now that all of it is in gPublishBuf:
+// refuse it now or confirm it along with the rest of this read.
+static void publishDone(void)
+{
+    const char * pUuid = NULL;
+    char args[16];
+    uint32_t len = 0;
+
+    gPublishing = false;
+    gPublishTag++;
+    if (gPublishLen < sizeof (gPublishBuf))
+    {
+        gPublishBuf[gPublishLen] = 0;
+        pUuid = strstr(gPublishBuf, "\"device_uuid\":\"");
+    }
+    if (pUuid != NULL)
+    {
+        pUuid += 15;
+        gPublishDevices.insert(std::string(pUuid, strcspn(pUuid, "\"")));
+    }
+    else
+    {
+        gBadPublishes++;
+    }
+
+    if (gConfirming)
+    {
+        if ((gConfig.nackPercent > 0) && ((nextRandom() % 100) < gConfig.nackPercent))
+        {
+            // Delivery tag, neither multiple nor requeue
+            len += putUint(args + len, gPublishTag, 8);
+            len += putUint(args + len, 0, 1);
+            queueMethod(1, 60, 120, args, len);
+            gNacks++;
+        }
+        else
+        {
+            gConfirmTag = gPublishTag;
+        }
+    }
+}
+
+// Handle a content header or body frame of a message being published.
+static void handleContent(uint8_t type, const char * pPayload, uint32_t size)
+{
+    uint32_t len;
+
+    if (gPublishing && (type == 2) && (size >= 12))
+    {
+        gPublishSize = getUint(pPayload + 4, 8);
+        gPublishLen = 0;
+    }
+    else if (gPublishing && (type == 3))
+    {
+        len = size;
+        if (gPublishLen + len > sizeof (gPublishBuf))
+        {
+            len = sizeof (gPublishBuf) - gPublishLen;
+        }
+        memcpy(gPublishBuf + gPublishLen, pPayload, len);
+        gPublishLen += len;
+        gPublishSize = (gPublishSize > size) ? gPublishSize - size : 0;
+    }
+    if (gPublishing && ((type == 2) || (type == 3)) && (gPublishSize == 0))
+    {
+        publishDone();
+    }
+}
+
+// Handle a method from the client.
+static void handleMethod(uint16_t channel, const char * pPayload, uint32_t size)
+{
+    uint16_t classId = (uint16_t) getUint(pPayload, 2);
+    uint16_t methodId = (uint16_t) getUint(pPayload + 2, 2);
+    char args[64];
+    uint32_t len = 0;
+    uint64_t tag;
+
+    if (size < 4)
+    {
+        return;
+    }
+    if (gConfig.verbose)
+    {
+        fprintf(stderr, "<- method %d.%d, channel %d\n", classId, methodId, channel);
+    }
+
+    if ((classId == 10) && (methodId == 11))
+    {
+        // StartOk: tune to our frame size, no heartbeats
+        len += putUint(args + len, 2047, 2);
+        len += putUint(args + len, STANDIN_FRAME_MAX, 4);
+        len += putUint(args + len, 0, 2);
+        queueMethod(0, 10, 30, args, len);
+    }
+    else if ((classId == 10) && (methodId == 40))
+    {
+        len += putShortString(args + len, "");
+        queueMethod(0, 10, 41, args, len);
+    }
+    else if ((classId == 10) && (methodId == 50))
+    {
+        queueMethod(0, 10, 51, NULL, 0);
+        gClosed = true;
+    }
+    else if ((classId == 20) && (methodId == 10))
+    {
+        len += putUint(args + len, 0, 4);
+        queueMethod(channel, 20, 11, args, len);
+    }
+    else if ((classId == 60) && (methodId == 10) && (size >= 11))
+    {
+        gPrefetch = (uint32_t) getUint(pPayload + 8, 2);
+        queueMethod(channel, 60, 11, NULL, 0);
+    }
+    else if ((classId == 60) && (methodId == 20))
+    {
+        len += putShortString(args + len, "ctag-1");
+        queueMethod(channel, 60, 21, args, len);
+        gConsuming = true;
+    }
+    else if ((classId == 60) && (methodId == 80) && (size >= 13))
+    {
+        tag = getUint(pPayload + 4, 8);
+        if ((pPayload[12] & 0x01) || (tag == gAckedTag + 1))
+        {
+            if (tag > gAckedTag)
+            {
+                gAckedTag = tag;
+            }
+        }
+        gAcks++;
+    }
+    else if ((classId == 60) && (methodId == 40))
+    {
+        gPublishing = true;
+        gPublishSize = 0;
+        gPublishLen = 0;
+    }
+    else if ((classId == 85) && (methodId == 10))
+    {
+        queueMethod(channel, 85, 11, NULL, 0);
+        gConfirming = true;
+    }
+    else if (!((classId == 10) && (methodId == 31)))
+    {
+        fprintf(stderr, "WARNING: unexpected method %d.%d.\n", classId, methodId);
+    }
+}
+
+// Handle whatever whole frames have been received.
+static void handleFrames(void)
+{
+    uint32_t start = 0;
+    uint32_t size;
+    bool done = false;
+
+    if (!gStarted && (gRxLen >= 8) && (memcmp(gRxBuf, "AMQP", 4) == 0))
+    {
+        // The protocol header: Connection.Start for version 0-9, no
+        // properties, PLAIN authentication
+        char args[64];
+        uint32_t len = 0;
+        len += putUint(args + len, 0, 1);
+        len += putUint(args + len, 9, 1);
+        len += putUint(args + len, 0, 4);
+        len += putUint(args + len, 5, 4);
+        memcpy(args + len, "PLAIN", 5);
+        len += 5;
+        len += putUint(args + len, 5, 4);
+        memcpy(args + len, "en_US", 5);
+        len += 5;
+        queueMethod(0, 10, 10, args, len);
+        start = 8;
+        gStarted = true;
+    }
+
+    while (!done && gStarted && (gRxLen - start >= 8))
+    {
+        size = (uint32_t) getUint(gRxBuf + start + 3, 4);
+        if (size + 8 > STANDIN_FRAME_MAX)
+        {
+            fprintf(stderr, "!!! Frame of %u bytes received.\n", size);
+            gClosed = true;
+            done = true;
+        }
+        else if (gRxLen - start >= size + 8)
+        {
+            if (gRxBuf[start] == 1)
+            {
+                handleMethod((uint16_t) getUint(gRxBuf + start + 1, 2), gRxBuf + start + 7, size);
+            }
+            else
+            {
+                handleContent((uint8_t) gRxBuf[start], gRxBuf + start + 7, size);
+            }
+            start += size + 8;
+        }
+        else
+        {
+            done = true;
+        }
+    }
+
+    memmove(gRxBuf, gRxBuf + start, gRxLen - start);
+    gRxLen -= start;
+
+    if (gConfirmTag > 0)
+    {
+        // One confirm for all taken: delivery tag, multiple
+        char args[16];
+        uint32_t len = 0;
+        len += putUint(args + len, gConfirmTag, 8);
+        len += putUint(args + len, 1, 1);
+        queueMethod(1, 60, 80, args, len);
+        gConfirmTag = 0;
+        gAcks++;
+    }
+}
+
+static bool parseArgs(int argc, char * argv[])
+{
+    bool success = true;
+    int c;
+
+    while (success && ((c = getopt(argc, argv, "p:n:d:m:k:S:v")) != -1))
+    {
+        switch (c)
+        {
+            case 'p':
+                gConfig.port = strtoul(optarg, NULL, 0);
+            break;
+            case 'n':
+                gConfig.numMessages = strtoul(optarg, NULL, 0);
+            break;
+            case 'd':
+                gConfig.numDevices = strtoul(optarg, NULL, 0);
+            break;
+            case 'm':
+                gConfig.malformedPercent = strtoul(optarg, NULL, 0);
+            break;
+            case 'k':
+                gConfig.nackPercent = strtoul(optarg, NULL, 0);
+            break;
+            case 'S':
+                gConfig.seed = strtoul(optarg, NULL, 0);
+            break;
+            case 'v':
+                gConfig.verbose = true;
+            break;
+            default:
+                success = false;
+            break;
+        }
+    }
+
+    if ((gConfig.port > 0xFFFF) || (gConfig.numDevices == 0) || (gConfig.malformedPercent > 100) || (gConfig.nackPercent > 100))
+    {
+        success = false;
+    }
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+    int listenFd;
+    int option = 1;
+    struct sockaddr_in address;
+    struct pollfd pollFd;
+    ssize_t len;
+    int64_t startMs;
+    int64_t elapsedMs;
+
+    if (!parseArgs(argc, argv))
+    {
+        fprintf(stderr, "Usage: %s [-p port] [-n messages] [-d devices] [-m malformed_percent] [-k nack_percent] [-S seed] [-v]\n", argv[0]);
+        return -1;
+    }
+
+    gRandom = (gConfig.seed != 0) ? gConfig.seed : 1;
+    gpDeviceSeen = (bool *) calloc(gConfig.numDevices, sizeof (bool));
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&address, 0, sizeof (address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t) gConfig.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((gpDeviceSeen == NULL) || (listenFd < 0) ||
+        (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof (option)) != 0) ||
+        (bind(listenFd, (struct sockaddr *) &address, sizeof (address)) != 0) || (listen(listenFd, 1) != 0))
+    {
+        fprintf(stderr, "!!! Unable to listen on port %u (%s).\n", gConfig.port, strerror(errno));
+        return -1;
+    }
+
+    printf("127.0.0.1:%u\n", gConfig.port);
+    fflush(stdout);
+
+    gFd = accept(listenFd, NULL, NULL);
+    close(listenFd);
+    if (gFd < 0)
+    {
+        fprintf(stderr, "!!! Unable to accept a connection (%s).\n", strerror(errno));
+        return -1;
+    }
+    setsockopt(gFd, IPPROTO_TCP, TCP_NODELAY, &option, sizeof (option));
+    startMs = getTimeMs();
+
+    while (!gStop && !gClosed)
+    {
+        // Deliver as many as the prefetch window allows
+        while (gConsuming && (gMessages < gConfig.numMessages) &&
+               ((gPrefetch == 0) || (gMessages - gAckedTag < gPrefetch)) &&
+               (sizeof (gTxBuf) - (gTxEnd - gTxStart) >= STANDIN_MAX_DELIVERY))
+        {
+            queueDelivery();
+        }
+
+        pollFd.fd = gFd;
+        pollFd.events = POLLIN | ((gTxEnd > gTxStart) ? POLLOUT : 0);
+        pollFd.revents = 0;
+        if (poll(&pollFd, 1, 100) > 0)
+        {
+            if ((pollFd.revents & POLLOUT) != 0)
+            {
+                len = send(gFd, gTxBuf + gTxStart, gTxEnd - gTxStart, MSG_DONTWAIT);
+                if (len > 0)
+                {
+                    gTxStart += len;
+                    if (gTxStart == gTxEnd)
+                    {
+                        gTxStart = 0;
+                        gTxEnd = 0;
+                    }
+                }
+            }
+            if ((pollFd.revents & (POLLIN | POLLHUP | POLLERR)) != 0)
+            {
+                len = recv(gFd, gRxBuf + gRxLen, sizeof (gRxBuf) - gRxLen, MSG_DONTWAIT);
+                if (len > 0)
+                {
+                    gRxLen += len;
+                    handleFrames();
+                }
+                else if ((len == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+                {
+                    gClosed = true;
+                }
+            }
+        }
+    }
+
+    // Let the last of the output, the CloseOk, go
+    while (gTxEnd > gTxStart)
+    {
+        len = send(gFd, gTxBuf + gTxStart, gTxEnd - gTxStart, 0);
+        gTxStart = (len > 0) ? gTxStart + len : gTxEnd;
+    }
+    close(gFd);
+
+    elapsedMs = getTimeMs() - startMs;
+    fprintf(stderr, "%u message(s), %u record(s) from %u device(s) and %u malformed message(s) delivered, "
+                    "%llu acknowledged in %u Basic.Ack(s), %.0f message(s)/s.\n",
+            gMessages, gRecords, gDevices, gMalformed, (unsigned long long) gAckedTag, gAcks,
+            (elapsedMs > 0) ? (double) gAckedTag * 1000 / elapsedMs : 0.0);
+    if (gPublishTag > 0)
+    {
+        fprintf(stderr, "%llu message(s) published to %u device(s), %u without a device, %u refused.\n",
+                (unsigned long long) gPublishTag, (uint32_t) gPublishDevices.size(), gBadPublishes, gNacks);
+    }
+    free(gpDeviceSeen);
+
+    return ((gAckedTag == gConfig.numMessages) && (gBadPublishes == 0)) ? 0 : -1;
+}
+
+// End Of File